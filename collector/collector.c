@@ -0,0 +1,605 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file collector.c
+ * @brief Daemon collecting the counts of multiple units
+ *
+ * All links are served by a single epoll loop, along with a timer driving
+ * periodic polls, reconnects and write-backs, and a signalfd for shutting
+ * down. Reading a link processes everything available at once, so a busy
+ * link never keeps the others waiting for long.
+ *
+ * Besides running the daemon, this provides querying the collected time
+ * series and a benchmark of ingestion and queries. For details refer to
+ * `doc/COLLECTOR.md`.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "link.h"
+#include "store.h"
+
+/**
+ * @brief Maximum number of events handled per call of epoll_wait()
+ */
+#define COLLECTOR_EVENTS 64
+
+/**
+ * @brief Default data directory
+ */
+#define COLLECTOR_DIR_DEFAULT "s0-data"
+
+/**
+ * @brief Default interval of polls in seconds
+ */
+#define COLLECTOR_INTERVAL_DEFAULT 10
+
+/**
+ * @brief Default baud rate of the links
+ */
+#define COLLECTOR_BAUD_DEFAULT 38400
+
+/**
+ * @brief Markers distinguishing the timer and signals from links within epoll
+ */
+static int collector_timer_marker;
+static int collector_signal_marker;
+
+static void collector_fail(const char* msg, const char* arg)
+{
+
+    fprintf(stderr, "collector: %s%s%s\n", msg, arg ? ": " : "", arg ? arg : "");
+    exit(EXIT_FAILURE);
+
+}
+
+/**
+ * @brief Returns the current time in milliseconds since the epoch
+ */
+static int64_t collector_now()
+{
+
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+
+}
+
+/**
+ * @brief Returns a monotonic time in nanoseconds, used for measurements
+ */
+static uint64_t collector_ns()
+{
+
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+
+}
+
+static void collector_watch(int epoll, int fd, void* ptr)
+{
+
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = ptr };
+
+    if (epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event) != 0) {
+
+        collector_fail("unable to watch descriptor", strerror(errno));
+
+    }
+
+}
+
+static void collector_connect(int epoll, link_t* link)
+{
+
+    if (link_connect(link)) {
+
+        fprintf(stderr, "collector: %s connected via %s\n", link->name, link->device);
+        collector_watch(epoll, link->fd, link);
+
+    }
+
+}
+
+/**
+ * @brief Parses a link given as `NAME=DEVICE[@BAUD]`
+ */
+static void collector_link_add(link_t* link, const char* dir, char* arg)
+{
+
+    char* device = strchr(arg, '=');
+    unsigned long baud = COLLECTOR_BAUD_DEFAULT;
+
+    if (!device) {
+
+        collector_fail("invalid link", arg);
+
+    }
+
+    *device++ = '\0';
+
+    char* at = strrchr(device, '@');
+
+    if (at) {
+
+        *at = '\0';
+        baud = strtoul(at + 1, NULL, 10);
+
+    }
+
+    if (!link_init(link, dir, arg, device, baud)) {
+
+        collector_fail("unable to open time series", arg);
+
+    }
+
+}
+
+static void collector_report(link_t* links, size_t count, double elapsed)
+{
+
+    link_t total = { 0 };
+
+    printf("| %-16s | %10s | %10s | %8s | %8s |\n", "Unit", "Events", "Samples", "Missed", "Errors");
+    printf("|------------------|------------|------------|----------|----------|\n");
+
+    for (size_t i = 0; i < count; i++) {
+
+        link_t* link = &links[i];
+
+        printf("| %-16s | %10lu | %10lu | %8lu | %8lu |\n", link->name,
+            (unsigned long)link->events, (unsigned long)link->samples, (unsigned long)link->missed, (unsigned long)link->errors);
+
+        total.events += link->events;
+        total.samples += link->samples;
+        total.missed += link->missed;
+        total.errors += link->errors;
+
+    }
+
+    printf("| %-16s | %10lu | %10lu | %8lu | %8lu |\n", "Total",
+        (unsigned long)total.events, (unsigned long)total.samples, (unsigned long)total.missed, (unsigned long)total.errors);
+
+    printf("\ningested %.1f events/s over %.1f s\n", total.events / elapsed, elapsed);
+
+}
+
+/**
+ * @brief Runs the daemon until being interrupted
+ */
+static int collector_run(const char* dir, unsigned interval, int argc, char* argv[])
+{
+
+    size_t count = argc;
+    link_t* links = calloc(count, sizeof(link_t));
+
+    if (!links || count == 0) {
+
+        collector_fail("no links given", NULL);
+
+    }
+
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+
+        collector_fail("unable to create data directory", dir);
+
+    }
+
+    int epoll = epoll_create1(0);
+
+    sigset_t signals;
+
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &signals, NULL);
+
+    int sfd = signalfd(-1, &signals, SFD_NONBLOCK);
+    int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    struct itimerspec period = { { interval, 0 }, { interval, 0 } };
+
+    if (epoll < 0 || sfd < 0 || tfd < 0 || timerfd_settime(tfd, 0, &period, NULL) != 0) {
+
+        collector_fail("unable to set up event loop", strerror(errno));
+
+    }
+
+    collector_watch(epoll, sfd, &collector_signal_marker);
+    collector_watch(epoll, tfd, &collector_timer_marker);
+
+    for (size_t i = 0; i < count; i++) {
+
+        collector_link_add(&links[i], dir, argv[i]);
+        collector_connect(epoll, &links[i]);
+
+    }
+
+    uint64_t start = collector_ns();
+    bool running = true;
+
+    while (running) {
+
+        struct epoll_event events[COLLECTOR_EVENTS];
+        int n = epoll_wait(epoll, events, COLLECTOR_EVENTS, -1);
+
+        if (n < 0 && errno != EINTR) {
+
+            collector_fail("unable to wait for events", strerror(errno));
+
+        }
+
+        int64_t now = collector_now();
+
+        for (int i = 0; i < n; i++) {
+
+            void* ptr = events[i].data.ptr;
+
+            if (ptr == &collector_signal_marker) {
+
+                running = false;
+
+            } else if (ptr == &collector_timer_marker) {
+
+                uint64_t expirations;
+
+                if (read(tfd, &expirations, sizeof(expirations)) < 0) {
+
+                    continue;
+
+                }
+
+                for (size_t j = 0; j < count; j++) {
+
+                    if (links[j].fd < 0) {
+
+                        collector_connect(epoll, &links[j]);
+
+                    } else {
+
+                        link_poll(&links[j]);
+
+                    }
+
+                    link_sync(&links[j]);
+
+                }
+
+            } else {
+
+                link_t* link = ptr;
+
+                if (!link_read(link, now) || (events[i].events & (EPOLLHUP | EPOLLERR))) {
+
+                    fprintf(stderr, "collector: %s disconnected\n", link->name);
+
+                    // Closing the descriptor removes it from epoll as well
+                    link_disconnect(link);
+
+                }
+
+            }
+
+        }
+
+    }
+
+    double elapsed = (collector_ns() - start) / 1e9;
+
+    for (size_t i = 0; i < count; i++) {
+
+        link_free(&links[i]);
+
+    }
+
+    collector_report(links, count, elapsed);
+
+    free(links);
+
+    return EXIT_SUCCESS;
+
+}
+
+static void collector_print(int64_t time, uint32_t value, void* arg)
+{
+
+    printf("%lld %u\n", (long long)time, value);
+
+}
+
+/**
+ * @brief Outputs the samples of a channel within the given range
+ */
+static int collector_query(const char* dir, int argc, char* argv[])
+{
+
+    if (argc < 2 || argc > 4) {
+
+        collector_fail("expected UNIT CHANNEL [FROM [TO]]", NULL);
+
+    }
+
+    char path[PATH_MAX];
+    store_t store;
+
+    snprintf(path, sizeof(path), "%s/%s/ch%s", dir, argv[0], argv[1]);
+
+    if (access(path, F_OK) != 0 || !store_open(&store, path)) {
+
+        collector_fail("unable to open time series", path);
+
+    }
+
+    int64_t from = argc > 2 ? strtoll(argv[2], NULL, 10) : INT64_MIN;
+    int64_t to = argc > 3 ? strtoll(argv[3], NULL, 10) : INT64_MAX;
+
+    store_query(&store, from, to, collector_print, NULL);
+    store_close(&store);
+
+    return EXIT_SUCCESS;
+
+}
+
+static int collector_compare(const void* a, const void* b)
+{
+
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+
+    return (x > y) - (x < y);
+
+}
+
+/**
+ * @brief Benchmarks ingestion and queries with synthetic events
+ *
+ * Events of all channels are written into a pipe and read by a link, just
+ * like they would be read from a serial device, so this covers reading,
+ * parsing and appending. Queries then cover ranges of random position and
+ * length within the ingested time series.
+ */
+static int collector_bench(const char* dir, unsigned long events, unsigned long queries)
+{
+
+    link_t link;
+    int fds[2];
+
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+
+        collector_fail("unable to create data directory", dir);
+
+    }
+
+    if (!link_init(&link, dir, "bench", "-", COLLECTOR_BAUD_DEFAULT) || pipe2(fds, O_NONBLOCK) != 0) {
+
+        collector_fail("unable to set up benchmark", dir);
+
+    }
+
+    link.fd = fds[0];
+
+    uint32_t counts[LINK_CHANNELS];
+
+    for (uint8_t ch = 0; ch < LINK_CHANNELS; ch++) {
+
+        counts[ch] = (link.known & (1 << ch)) ? link.counts[ch] : 0;
+
+    }
+
+    // Times advance by a millisecond per event, starting after existing data
+    int64_t base = collector_now();
+    int64_t last;
+
+    for (uint8_t ch = 0; ch < LINK_CHANNELS; ch++) {
+
+        uint32_t value;
+
+        if (store_last(&link.stores[ch], &last, &value) && last >= base) {
+
+            base = last + 1;
+
+        }
+
+    }
+
+    char buffer[65536];
+    size_t len = 0;
+    uint64_t start = collector_ns();
+
+    for (unsigned long i = 0; i < events; i++) {
+
+        uint8_t ch = i % LINK_CHANNELS;
+
+        len += snprintf(buffer + len, sizeof(buffer) - len, "LOG: S0: channel: %u, count: %u\r\n", ch, ++counts[ch]);
+
+        if (len > sizeof(buffer) - 64 || i == events - 1) {
+
+            // Written in chunks fitting into the pipe, read as they arrive
+            for (size_t written = 0; written < len; ) {
+
+                ssize_t result = write(fds[1], buffer + written, len - written);
+
+                if (result > 0) {
+
+                    written += result;
+
+                }
+
+                link_read(&link, base + i);
+
+            }
+
+            len = 0;
+
+        }
+
+    }
+
+    double ingest = (collector_ns() - start) / 1e9;
+
+    printf("ingested %lu events in %.3f s, %.0f events/s\n", (unsigned long)link.events, ingest, link.events / ingest);
+
+    // Ranges cover up to a tenth of the time series of channel 0
+    store_t* store = &link.stores[0];
+    uint64_t* latencies = malloc(queries * sizeof(uint64_t));
+    uint64_t visited = 0;
+    int64_t first = store->index[0];
+
+    store_last(store, &last, &counts[0]);
+
+    for (unsigned long i = 0; i < queries; i++) {
+
+        int64_t span = last - first + 1;
+        int64_t from = first + rand() % span;
+        int64_t to = from + rand() % (span / 10 + 1);
+        uint64_t t = collector_ns();
+
+        visited += store_query(store, from, to, NULL, NULL);
+        latencies[i] = collector_ns() - t;
+
+    }
+
+    qsort(latencies, queries, sizeof(uint64_t), collector_compare);
+
+    printf("queried %lu ranges, %.0f samples each, p50 %.1f us, p99 %.1f us, max %.1f us\n",
+        queries, (double)visited / queries, latencies[queries / 2] / 1e3,
+        latencies[queries * 99 / 100] / 1e3, latencies[queries - 1] / 1e3);
+
+    free(latencies);
+    close(fds[1]);
+    link_free(&link);
+
+    return EXIT_SUCCESS;
+
+}
+
+static void collector_usage()
+{
+
+    fprintf(stderr,
+        "Usage: collector run [-D DIR] [-i S] NAME=DEVICE[@BAUD]...\n"
+        "       collector query [-D DIR] UNIT CHANNEL [FROM [TO]]\n"
+        "       collector bench [-D DIR] [-n EVENTS] [-q QUERIES]\n"
+        "\n"
+        "  -D DIR      data directory (default: %s)\n"
+        "  -i S        interval of polls and reconnects (default: %u)\n"
+        "  -n EVENTS   number of events ingested (default: 1000000)\n"
+        "  -q QUERIES  number of queries (default: 10000)\n",
+        COLLECTOR_DIR_DEFAULT, COLLECTOR_INTERVAL_DEFAULT);
+
+    exit(EXIT_FAILURE);
+
+}
+
+int main(int argc, char* argv[])
+{
+
+    const char* dir = COLLECTOR_DIR_DEFAULT;
+    unsigned interval = COLLECTOR_INTERVAL_DEFAULT;
+    unsigned long events = 1000000;
+    unsigned long queries = 10000;
+    int opt;
+
+    if (argc < 2) {
+
+        collector_usage();
+
+    }
+
+    const char* mode = argv[1];
+
+    optind = 2;
+
+    while ((opt = getopt(argc, argv, "D:i:n:q:")) != -1) {
+
+        switch (opt) {
+
+            case 'D':
+                dir = optarg;
+                break;
+
+            case 'i':
+                interval = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'n':
+                events = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'q':
+                queries = strtoul(optarg, NULL, 10);
+                break;
+
+            default:
+                collector_usage();
+
+        }
+
+    }
+
+    if (interval == 0 || events == 0 || queries == 0) {
+
+        collector_usage();
+
+    }
+
+    if (strcmp(mode, "run") == 0) {
+
+        return collector_run(dir, interval, argc - optind, argv + optind);
+
+    }
+
+    if (strcmp(mode, "query") == 0) {
+
+        return collector_query(dir, argc - optind, argv + optind);
+
+    }
+
+    if (strcmp(mode, "bench") == 0 && optind == argc) {
+
+        return collector_bench(dir, events, queries);
+
+    }
+
+    collector_usage();
+
+}
@@ -0,0 +1,467 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file link.c
+ * @brief Implementation of the header declared in link.h
+ *
+ * @see link.h
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "link.h"
+#include "proto.h"
+#include "store.h"
+
+/**
+ * @brief Prefix of log messages reporting an impulse
+ */
+#define LINK_EVENT_PREFIX "LOG: S0: channel: "
+
+/**
+ * @brief Prefix of responses to the `changes` command, including the tag
+ */
+#define LINK_CHANGES_PREFIX PROTO_OUTPUT_PREFIX "#c "
+
+/**
+ * @brief Parses an unsigned decimal number, advancing the pointer past it
+ */
+static bool link_parse_uint(const char** p, uint32_t* value)
+{
+
+    const char* s = *p;
+    uint64_t v = 0;
+
+    if (*s < '0' || *s > '9') {
+
+        return false;
+
+    }
+
+    while (*s >= '0' && *s <= '9') {
+
+        v = v * 10 + (*s++ - '0');
+
+        if (v > UINT32_MAX) {
+
+            return false;
+
+        }
+
+    }
+
+    *value = v;
+    *p = s;
+
+    return true;
+
+}
+
+/**
+ * @brief Skips the given literal, returning false if it doesn't match
+ */
+static bool link_parse_literal(const char** p, const char* literal)
+{
+
+    size_t len = strlen(literal);
+
+    if (strncmp(*p, literal, len) != 0) {
+
+        return false;
+
+    }
+
+    *p += len;
+
+    return true;
+
+}
+
+/**
+ * @brief Records a count of a channel, unless it is unchanged
+ *
+ * Counts increasing by more than one indicate that log messages have been
+ * lost, which is accounted for, but otherwise harmless.
+ */
+static void link_record(link_t* link, uint32_t channel, uint32_t count, int64_t now)
+{
+
+    if (channel >= LINK_CHANNELS) {
+
+        return;
+
+    }
+
+    if (link->known & (1 << channel)) {
+
+        uint32_t last = link->counts[channel];
+
+        if (count == last) {
+
+            return;
+
+        }
+
+        if (count > last + 1) {
+
+            link->missed += count - last - 1;
+
+        }
+
+    }
+
+    if (!store_append(&link->stores[channel], now, count)) {
+
+        link->errors++;
+
+        return;
+
+    }
+
+    link->counts[channel] = count;
+    link->known |= 1 << channel;
+    link->samples++;
+
+}
+
+/**
+ * @brief Sets up a link and opens the time series of its channels
+ *
+ * Time series are stored within `DIR/NAME/chN`.
+ */
+bool link_init(link_t* link, const char* dir, const char* name, const char* device, unsigned long baud)
+{
+
+    memset(link, 0, sizeof(link_t));
+
+    link->name = name;
+    link->device = device;
+    link->baud = baud;
+    link->fd = -1;
+
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+
+        return false;
+
+    }
+
+    for (uint8_t ch = 0; ch < LINK_CHANNELS; ch++) {
+
+        int64_t time;
+
+        snprintf(path, sizeof(path), "%s/%s/ch%u", dir, name, ch);
+
+        if (!store_open(&link->stores[ch], path)) {
+
+            while (ch-- > 0) {
+
+                store_close(&link->stores[ch]);
+
+            }
+
+            return false;
+
+        }
+
+        if (store_last(&link->stores[ch], &time, &link->counts[ch])) {
+
+            link->known |= 1 << ch;
+
+        }
+
+    }
+
+    return true;
+
+}
+
+void link_free(link_t* link)
+{
+
+    link_disconnect(link);
+
+    for (uint8_t ch = 0; ch < LINK_CHANNELS; ch++) {
+
+        store_close(&link->stores[ch]);
+
+    }
+
+}
+
+/**
+ * @brief Opens the device and asks the unit for the counts of all channels
+ *
+ * Serial devices are configured as raw lines with the baud rate of the link.
+ */
+bool link_connect(link_t* link)
+{
+
+    link->fd = open(link->device, O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+    if (link->fd < 0) {
+
+        return false;
+
+    }
+
+    struct termios tio;
+
+    if (tcgetattr(link->fd, &tio) == 0) {
+
+        cfmakeraw(&tio);
+        cfsetspeed(&tio, link->baud);
+        tcsetattr(link->fd, TCSANOW, &tio);
+        tcflush(link->fd, TCIFLUSH);
+
+    }
+
+    link->len = 0;
+    link->overflow = false;
+
+    // The unit might have been replaced meanwhile, so start over
+    link->epoch = 0;
+    link->sequence = 0;
+    link_poll(link);
+
+    return true;
+
+}
+
+void link_disconnect(link_t* link)
+{
+
+    if (link->fd >= 0) {
+
+        close(link->fd);
+        link->fd = -1;
+
+    }
+
+}
+
+/**
+ * @brief Parses a single line of output received from the unit
+ *
+ * The line is expected to be terminated by a null character.
+ */
+void link_line(link_t* link, const char* line, int64_t now)
+{
+
+    const char* p = line;
+    uint32_t channel;
+    uint32_t count;
+
+    if (link_parse_literal(&p, LINK_EVENT_PREFIX)) {
+
+        if (link_parse_uint(&p, &channel) && link_parse_literal(&p, ", count: ") && link_parse_uint(&p, &count)) {
+
+            link->events++;
+            link_record(link, channel, count, now);
+
+        }
+
+        return;
+
+    }
+
+    if (link_parse_literal(&p, LINK_CHANGES_PREFIX)) {
+
+        uint32_t epoch;
+        uint32_t sequence;
+
+        if (!link_parse_uint(&p, &epoch) || !link_parse_literal(&p, " ") || !link_parse_uint(&p, &sequence)) {
+
+            link->errors++;
+
+            return;
+
+        }
+
+        // Each changed channel is given as ;CHANNEL ENABLED MIN MAX COUNT
+        while (*p == ';') {
+
+            uint32_t ignored;
+
+            p++;
+
+            if (!link_parse_uint(&p, &channel)
+                || !link_parse_literal(&p, " ") || !link_parse_uint(&p, &ignored)
+                || !link_parse_literal(&p, " ") || !link_parse_uint(&p, &ignored)
+                || !link_parse_literal(&p, " ") || !link_parse_uint(&p, &ignored)
+                || !link_parse_literal(&p, " ") || !link_parse_uint(&p, &count)) {
+
+                link->errors++;
+
+                return;
+
+            }
+
+            link_record(link, channel, count, now);
+
+        }
+
+        link->epoch = epoch;
+        link->sequence = sequence;
+
+        return;
+
+    }
+
+    if (link_parse_literal(&p, PROTO_OUTPUT_PREFIX)) {
+
+        // Skip the tag, if any
+        if (*p == PROTO_INPUT_TAG_PREFIX) {
+
+            p = strchr(p, ' ');
+
+            if (p == NULL) {
+
+                return;
+
+            }
+
+            p++;
+
+        }
+
+        if (strcmp(p, PROTO_OUTPUT_ERROR) == 0) {
+
+            link->errors++;
+
+        }
+
+    }
+
+}
+
+/**
+ * @brief Reads all of the data available and processes complete lines
+ *
+ * @return False if the device has been closed or an error occurred
+ */
+bool link_read(link_t* link, int64_t now)
+{
+
+    char buffer[4096];
+
+    while (true) {
+
+        ssize_t len = read(link->fd, buffer, sizeof(buffer));
+
+        if (len == 0) {
+
+            return false;
+
+        }
+
+        if (len < 0) {
+
+            return errno == EAGAIN || errno == EINTR;
+
+        }
+
+        for (ssize_t i = 0; i < len; i++) {
+
+            char c = buffer[i];
+
+            if (c == '\r' || c == '\n') {
+
+                if (link->len > 0 && !link->overflow) {
+
+                    link->line[link->len] = '\0';
+                    link_line(link, link->line, now);
+
+                }
+
+                link->len = 0;
+                link->overflow = false;
+
+            } else if (link->len < LINK_LINE_MAX - 1) {
+
+                link->line[link->len++] = c;
+
+            } else {
+
+                link->overflow = true;
+
+            }
+
+        }
+
+    }
+
+}
+
+/**
+ * @brief Asks the unit for all channels changed since the last response
+ *
+ * This is not waiting for the response, which is processed by link_line()
+ * whenever it arrives. If the unit has been reset since the last response,
+ * the epoch doesn't match and all of the channels are returned.
+ */
+void link_poll(link_t* link)
+{
+
+    if (link->fd < 0) {
+
+        return;
+
+    }
+
+    char command[40];
+    int len = snprintf(command, sizeof(command), "#c changes %u %u\r", link->epoch, link->sequence);
+
+    if (write(link->fd, command, len) != len) {
+
+        link->errors++;
+
+    }
+
+}
+
+/**
+ * @brief Schedules the time series of all channels to be written back
+ */
+void link_sync(link_t* link)
+{
+
+    for (uint8_t ch = 0; ch < LINK_CHANNELS; ch++) {
+
+        store_sync(&link->stores[ch]);
+
+    }
+
+}
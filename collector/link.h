@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file link.h
+ * @brief Serial link to a single unit speaking the text protocol
+ *
+ * Each link reads the output of a unit and records the counts of its
+ * channels, each into a time series of its own (see store.h). Counts are
+ * taken from two sources:
+ *
+ * - Log messages of the S0 module (`LOG: S0: channel: N, count: N`), which
+ *   are output for each impulse as it happens.
+ * - Responses to the `changes` command, which is sent periodically and right
+ *   after connecting. These catch up on impulses whose log messages have been
+ *   lost, e.g. while the link was down.
+ *
+ * Commands are tagged and sent without waiting for previous responses, so
+ * polling never stalls the processing of log messages. Lines are parsed in
+ * place within a fixed buffer, nothing is allocated per line.
+ *
+ * @see link.c
+ */
+
+#ifndef _LINK_H_
+#define _LINK_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "store.h"
+
+/**
+ * @brief Maximum number of channels of a unit
+ */
+#define LINK_CHANNELS 8
+
+/**
+ * @brief Maximum length of a line, longer lines are discarded
+ */
+#define LINK_LINE_MAX 256
+
+/**
+ * @brief State of a link to a single unit
+ */
+typedef struct {
+
+    // Name of the unit, used as directory within the data directory
+    const char* name;
+
+    const char* device;
+    unsigned long baud;
+
+    // File descriptor of the device, negative while disconnected
+    int fd;
+
+    // Partial line received so far
+    char line[LINK_LINE_MAX];
+    size_t len;
+    bool overflow;
+
+    // Time series of each channel
+    store_t stores[LINK_CHANNELS];
+
+    // Last count recorded for each channel, valid if the bit is set in known
+    uint32_t counts[LINK_CHANNELS];
+    uint8_t known;
+
+    // Epoch and sequence number of the last response to `changes`
+    uint32_t epoch;
+    uint32_t sequence;
+
+    // Statistics
+    uint64_t events;
+    uint64_t samples;
+    uint64_t missed;
+    uint64_t errors;
+
+} link_t;
+
+bool link_init(link_t* link, const char* dir, const char* name, const char* device, unsigned long baud);
+void link_free(link_t* link);
+bool link_connect(link_t* link);
+void link_disconnect(link_t* link);
+bool link_read(link_t* link, int64_t now);
+void link_line(link_t* link, const char* line, int64_t now);
+void link_poll(link_t* link);
+void link_sync(link_t* link);
+
+#endif /* _LINK_H_ */
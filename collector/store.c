@@ -0,0 +1,371 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file store.c
+ * @brief Implementation of the header declared in store.h
+ *
+ * @see store.h
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "store.h"
+
+/**
+ * @brief Ensures that the index can hold at least the given number of blocks
+ */
+static bool store_index_reserve(store_t* store, size_t blocks)
+{
+
+    if (blocks <= store->index_size) {
+
+        return true;
+
+    }
+
+    size_t size = store->index_size ? store->index_size : 16;
+
+    while (size < blocks) {
+
+        size *= 2;
+
+    }
+
+    int64_t* index = realloc(store->index, size * sizeof(int64_t));
+
+    if (!index) {
+
+        return false;
+
+    }
+
+    store->index = index;
+    store->index_size = size;
+
+    return true;
+
+}
+
+/**
+ * @brief Maps the given number of blocks, growing the file if necessary
+ */
+static bool store_map(store_t* store, size_t blocks)
+{
+
+    size_t size = blocks * sizeof(store_block_t);
+    void* map;
+
+    if (ftruncate(store->fd, size) != 0) {
+
+        return false;
+
+    }
+
+    if (store->blocks) {
+
+        map = mremap(store->blocks, store->block_count * sizeof(store_block_t), size, MREMAP_MAYMOVE);
+
+    } else {
+
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, store->fd, 0);
+
+    }
+
+    if (map == MAP_FAILED) {
+
+        return false;
+
+    }
+
+    store->blocks = map;
+    store->block_count = blocks;
+
+    return true;
+
+}
+
+/**
+ * @brief Opens (and creates if necessary) the time series within a file
+ *
+ * Blocks not carrying the magic number end the time series, anything behind
+ * them is discarded.
+ */
+bool store_open(store_t* store, const char* path)
+{
+
+    memset(store, 0, sizeof(store_t));
+
+    store->fd = open(path, O_RDWR | O_CREAT, 0644);
+
+    if (store->fd < 0) {
+
+        return false;
+
+    }
+
+    struct stat st;
+
+    if (fstat(store->fd, &st) != 0) {
+
+        store_close(store);
+
+        return false;
+
+    }
+
+    size_t blocks = st.st_size / sizeof(store_block_t);
+
+    if (blocks == 0) {
+
+        return true;
+
+    }
+
+    if (!store_map(store, blocks) || !store_index_reserve(store, blocks)) {
+
+        store_close(store);
+
+        return false;
+
+    }
+
+    for (size_t i = 0; i < blocks; i++) {
+
+        store_block_t* block = &store->blocks[i];
+
+        if (block->magic != STORE_MAGIC || block->count == 0 || block->count > STORE_BLOCK_SAMPLES) {
+
+            blocks = i;
+
+            break;
+
+        }
+
+        store->index[i] = block->time[0];
+        store->samples += block->count;
+
+    }
+
+    if (blocks != store->block_count && !store_map(store, blocks)) {
+
+        store_close(store);
+
+        return false;
+
+    }
+
+    return true;
+
+}
+
+void store_close(store_t* store)
+{
+
+    if (store->blocks) {
+
+        munmap(store->blocks, store->block_count * sizeof(store_block_t));
+
+    }
+
+    if (store->fd >= 0) {
+
+        close(store->fd);
+
+    }
+
+    free(store->index);
+
+    memset(store, 0, sizeof(store_t));
+    store->fd = -1;
+
+}
+
+/**
+ * @brief Appends a sample, growing the file by a block if necessary
+ *
+ * Times earlier than the last sample, e.g. due to the clock being set back,
+ * are replaced by the time of the last sample, so times never decrease.
+ */
+bool store_append(store_t* store, int64_t time, uint32_t value)
+{
+
+    store_block_t* block = store->block_count ? &store->blocks[store->block_count - 1] : NULL;
+
+    if (block && time < block->time[block->count - 1]) {
+
+        time = block->time[block->count - 1];
+
+    }
+
+    if (!block || block->count == STORE_BLOCK_SAMPLES) {
+
+        if (!store_index_reserve(store, store->block_count + 1) || !store_map(store, store->block_count + 1)) {
+
+            return false;
+
+        }
+
+        block = &store->blocks[store->block_count - 1];
+        block->magic = STORE_MAGIC;
+        store->index[store->block_count - 1] = time;
+
+    }
+
+    block->time[block->count] = time;
+    block->value[block->count] = value;
+
+    // Published last, so the sample is either stored completely or not at all
+    __atomic_store_n(&block->count, block->count + 1, __ATOMIC_RELEASE);
+
+    store->samples++;
+
+    return true;
+
+}
+
+/**
+ * @brief Retrieves the last sample, if any
+ */
+bool store_last(const store_t* store, int64_t* time, uint32_t* value)
+{
+
+    if (store->block_count == 0) {
+
+        return false;
+
+    }
+
+    const store_block_t* block = &store->blocks[store->block_count - 1];
+
+    *time = block->time[block->count - 1];
+    *value = block->value[block->count - 1];
+
+    return true;
+
+}
+
+/**
+ * @brief Visits all samples with a time within [from, to]
+ *
+ * @return Number of samples visited
+ */
+uint64_t store_query(const store_t* store, int64_t from, int64_t to, store_visit_t visit, void* arg)
+{
+
+    if (store->block_count == 0 || from > to) {
+
+        return 0;
+
+    }
+
+    // Last block starting at or before from, samples at from may precede it
+    size_t low = 0;
+    size_t high = store->block_count;
+
+    while (high - low > 1) {
+
+        size_t mid = (low + high) / 2;
+
+        if (store->index[mid] < from) {
+
+            low = mid;
+
+        } else {
+
+            high = mid;
+
+        }
+
+    }
+
+    // First sample of the block at or after from
+    const store_block_t* block = &store->blocks[low];
+    uint32_t first = 0;
+    uint32_t last = block->count;
+
+    while (first < last) {
+
+        uint32_t mid = (first + last) / 2;
+
+        if (block->time[mid] < from) {
+
+            first = mid + 1;
+
+        } else {
+
+            last = mid;
+
+        }
+
+    }
+
+    uint64_t visited = 0;
+
+    for (size_t b = low; b < store->block_count; b++) {
+
+        block = &store->blocks[b];
+
+        for (uint32_t i = (b == low) ? first : 0; i < block->count; i++) {
+
+            if (block->time[i] > to) {
+
+                return visited;
+
+            }
+
+            if (visit) {
+
+                visit(block->time[i], block->value[i], arg);
+
+            }
+
+            visited++;
+
+        }
+
+    }
+
+    return visited;
+
+}
+
+/**
+ * @brief Schedules all changes to be written back to the file
+ */
+void store_sync(store_t* store)
+{
+
+    if (store->blocks) {
+
+        msync(store->blocks, store->block_count * sizeof(store_block_t), MS_ASYNC);
+
+    }
+
+}
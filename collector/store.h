@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file store.h
+ * @brief Append-only time series of a single channel, memory-mapped
+ *
+ * Samples, i.e. pairs of time and count, are stored within a file of blocks.
+ * Each block holds up to STORE_BLOCK_SAMPLES samples in two columns, one for
+ * the times and one for the counts, so scanning either of them touches
+ * contiguous memory only. Blocks are appended to the file as needed and the
+ * whole file is mapped into memory, so appending a sample is nothing more
+ * than two stores into memory.
+ *
+ * Times are never decreasing within a file, which allows ranges to be looked
+ * up by bisection: First within an in-memory index holding the time of the
+ * first sample of each block, then within the time column of the block.
+ *
+ * The number of samples of a block is updated after the sample itself has
+ * been written, so a sample is either stored completely or not at all. Files
+ * truncated in the middle of a block, e.g. due to a crash while growing, are
+ * cut back to whole blocks when being opened.
+ *
+ * @see store.c
+ */
+
+#ifndef _STORE_H_
+#define _STORE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Magic number identifying a block, "S0TS" in little endian
+ */
+#define STORE_MAGIC 0x53543053
+
+/**
+ * @brief Number of samples within a single block
+ */
+#define STORE_BLOCK_SAMPLES 4096
+
+/**
+ * @brief Layout of a single block within the file
+ *
+ * All values are in host byte order, files are not meant to be moved between
+ * machines of different endianness.
+ */
+typedef struct {
+
+    uint32_t magic;
+
+    // Number of valid samples within this block
+    uint32_t count;
+
+    // Time of each sample in milliseconds since the epoch
+    int64_t time[STORE_BLOCK_SAMPLES];
+
+    // Count of the channel at the time of each sample
+    uint32_t value[STORE_BLOCK_SAMPLES];
+
+} store_block_t;
+
+/**
+ * @brief State of an open time series
+ */
+typedef struct {
+
+    int fd;
+
+    // Mapping of the whole file
+    store_block_t* blocks;
+    size_t block_count;
+
+    // Time of the first sample of each block, i.e. the index
+    int64_t* index;
+    size_t index_size;
+
+    // Number of samples within all blocks
+    uint64_t samples;
+
+} store_t;
+
+/**
+ * @brief Callback invoked for each sample within a queried range
+ */
+typedef void (*store_visit_t)(int64_t time, uint32_t value, void* arg);
+
+bool store_open(store_t* store, const char* path);
+void store_close(store_t* store);
+bool store_append(store_t* store, int64_t time, uint32_t value);
+bool store_last(const store_t* store, int64_t* time, uint32_t* value);
+uint64_t store_query(const store_t* store, int64_t from, int64_t to, store_visit_t visit, void* arg);
+void store_sync(store_t* store);
+
+#endif /* _STORE_H_ */
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file fram.c
+ * @brief Implementation of fram.h for host builds, backed by a file
+ *
+ * Variables placed into FRAM are located within a section of their own on
+ * the host, too. The offset of a variable relative to the start of this
+ * section serves as its address within the file, just like the address
+ * within the `.fram` section serves as address within the FRAM chip.
+ *
+ * Bytes beyond the end of the file read as zero, which is what an erased
+ * FRAM is assumed to contain.
+ *
+ * @note The layout of the preferences differs between the host and the AVR,
+ * e.g. `size_t` is wider on the host, so files are not interchangeable with
+ * dumps of an actual FRAM chip.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "fram.h"
+#include "i2c.h"
+#include "sim.h"
+
+/**
+ * @brief Start of the section holding FRAM variables, provided by the linker
+ */
+extern uint8_t __start_fram[];
+
+/**
+ * @brief File descriptor of the file backing the FRAM
+ */
+static int fram_fd = -1;
+
+/**
+ * @brief Opens (and creates if necessary) the file backing the FRAM
+ *
+ * @return True on success, false otherwise
+ */
+bool sim_fram_open(const char* path)
+{
+
+    fram_fd = open(path, O_RDWR | O_CREAT, 0644);
+
+    return fram_fd >= 0;
+
+}
+
+/**
+ * @brief There is no I2C bus on the host, so there is nothing to initialize
+ */
+bool i2c_init()
+{
+
+    return true;
+
+}
+
+uint8_t fram_read_byte(const uint8_t* src)
+{
+
+    uint8_t data;
+
+    fram_read_block(src, &data, 1);
+
+    return data;
+
+}
+
+void fram_read_block(const void* src, void* dst, size_t len)
+{
+
+    off_t offset = (const uint8_t*)src - __start_fram;
+    ssize_t result = pread(fram_fd, dst, len, offset);
+
+    if (result < 0) {
+
+        result = 0;
+
+    }
+
+    memset((uint8_t*)dst + result, 0, len - result);
+
+}
+
+void fram_write_byte(uint8_t* dst, uint8_t val)
+{
+
+    fram_write_block(dst, &val, 1);
+
+}
+
+void fram_write_block(void* dst, const void* src, size_t len)
+{
+
+    off_t offset = (uint8_t*)dst - __start_fram;
+
+    if (pwrite(fram_fd, src, len, offset) != (ssize_t)len) {
+
+        perror("fram");
+
+    }
+
+}
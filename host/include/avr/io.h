@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file avr/io.h
+ * @brief Register file of the ATmega328P for host builds
+ *
+ * This replaces the header of the same name provided by avr-libc. Registers
+ * are mapped onto the simulated data memory {@link #sim_io}, at the very same
+ * addresses as on the actual MCU. This keeps register access within the
+ * firmware unchanged, including the address arithmetic of `src/io.h` and
+ * static initializers taking the address of a register.
+ *
+ * Only the registers needed by the modules compiled for the host are
+ * provided. The simulation (`host/sim.c`) reads and writes them to model
+ * the hardware, e.g. it drives the `PINx` registers.
+ *
+ * @see sim.h
+ */
+
+#ifndef _HOST_AVR_IO_H_
+#define _HOST_AVR_IO_H_
+
+#include <inttypes.h>
+#include <stdint.h>
+
+/**
+ * @brief Size of the simulated I/O and extended I/O space
+ */
+#define SIM_IO_SIZE 0x100
+
+/**
+ * @brief Simulated I/O and extended I/O space, defined within sim.c
+ */
+extern volatile uint8_t sim_io[SIM_IO_SIZE];
+
+#define _MMIO_BYTE(mem_addr) (sim_io[(mem_addr)])
+#define _MMIO_WORD(mem_addr) (*(volatile uint16_t*)&sim_io[(mem_addr)])
+
+#define _SFR_MEM8(mem_addr) _MMIO_BYTE(mem_addr)
+#define _SFR_MEM16(mem_addr) _MMIO_WORD(mem_addr)
+#define _SFR_IO8(io_addr) _MMIO_BYTE((io_addr) + 0x20)
+#define _SFR_IO16(io_addr) _MMIO_WORD((io_addr) + 0x20)
+
+#define _BV(bit) (1 << (bit))
+
+#define bit_is_set(sfr, bit) ((sfr) & _BV(bit))
+#define bit_is_clear(sfr, bit) (!((sfr) & _BV(bit)))
+
+#define RAMEND 0x8FF
+
+// Ports
+#define PINB _SFR_IO8(0x03)
+#define DDRB _SFR_IO8(0x04)
+#define PORTB _SFR_IO8(0x05)
+#define PINC _SFR_IO8(0x06)
+#define DDRC _SFR_IO8(0x07)
+#define PORTC _SFR_IO8(0x08)
+#define PIND _SFR_IO8(0x09)
+#define DDRD _SFR_IO8(0x0A)
+#define PORTD _SFR_IO8(0x0B)
+
+// Interrupt flags
+#define TIFR0 _SFR_IO8(0x15)
+#define OCF0A 1
+
+#define TIFR1 _SFR_IO8(0x16)
+#define TOV1 0
+
+#define PCIFR _SFR_IO8(0x1B)
+#define PCIF1 1
+#define PCIF2 2
+
+// Timer0
+#define TCCR0A _SFR_IO8(0x24)
+#define WGM01 1
+
+#define TCCR0B _SFR_IO8(0x25)
+#define CS00 0
+#define CS01 1
+#define CS02 2
+
+#define TCNT0 _SFR_IO8(0x26)
+#define OCR0A _SFR_IO8(0x27)
+
+// SPI
+#define SPCR _SFR_IO8(0x2C)
+#define SPIE 7
+#define SPE 6
+
+#define SPSR _SFR_IO8(0x2D)
+#define SPDR _SFR_IO8(0x2E)
+
+// Analog comparator
+#define ACSR _SFR_IO8(0x30)
+#define ACD 7
+
+// Status register and stack pointer
+#define SP _SFR_IO16(0x3D)
+#define SREG _SFR_IO8(0x3F)
+#define SREG_I 7
+
+// Power reduction
+#define PRR _SFR_MEM8(0x64)
+#define PRADC 0
+#define PRSPI 2
+#define PRTIM1 3
+#define PRTIM2 6
+
+// Pin change interrupts
+#define PCICR _SFR_MEM8(0x68)
+#define PCIE0 0
+#define PCIE1 1
+#define PCIE2 2
+
+#define PCMSK0 _SFR_MEM8(0x6B)
+#define PCINT2 2
+
+#define PCMSK1 _SFR_MEM8(0x6C)
+#define PCMSK2 _SFR_MEM8(0x6D)
+
+// Timer interrupt masks
+#define TIMSK0 _SFR_MEM8(0x6E)
+#define OCIE0A 1
+
+#define TIMSK1 _SFR_MEM8(0x6F)
+#define TOIE1 0
+
+// Timer1
+#define TCCR1A _SFR_MEM8(0x80)
+#define TCCR1B _SFR_MEM8(0x81)
+#define CS10 0
+
+#define TCNT1 _SFR_MEM16(0x84)
+
+#endif /* _HOST_AVR_IO_H_ */
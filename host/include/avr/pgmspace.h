@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file avr/pgmspace.h
+ * @brief Program space access for host builds
+ *
+ * The host has a single address space, so data in program space is accessed
+ * directly. Reading words is type generic, as pointers are wider than 16 bit
+ * on the host, while tables of pointers are read by pgm_read_word() within
+ * the firmware.
+ *
+ * The formatting functions translate the format string from avr-libc to the
+ * host C library before formatting, see pgmspace.c.
+ */
+
+#ifndef _HOST_AVR_PGMSPACE_H_
+#define _HOST_AVR_PGMSPACE_H_
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define PGM_P const char*
+
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#define pgm_read_word(addr) (*(addr))
+#define pgm_read_dword(addr) (*(addr))
+#define pgm_read_ptr(addr) (*(addr))
+
+#define memcpy_P memcpy
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strncpy_P strncpy
+#define strlen_P strlen
+
+int vsnprintf_P(char* str, size_t size, const char* fmt, va_list ap);
+int snprintf_P(char* str, size_t size, const char* fmt, ...);
+
+#endif /* _HOST_AVR_PGMSPACE_H_ */
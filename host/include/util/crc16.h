@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file util/crc16.h
+ * @brief CRC calculations for host builds
+ *
+ * These are the C equivalents of the optimized inline assembly of avr-libc.
+ */
+
+#ifndef _HOST_UTIL_CRC16_H_
+#define _HOST_UTIL_CRC16_H_
+
+#include <stdint.h>
+
+static inline uint16_t _crc16_update(uint16_t crc, uint8_t a)
+{
+
+    crc ^= a;
+
+    for (uint8_t i = 0; i < 8; i++) {
+
+        crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : (crc >> 1);
+
+    }
+
+    return crc;
+
+}
+
+static inline uint16_t _crc_xmodem_update(uint16_t crc, uint8_t data)
+{
+
+    crc ^= (uint16_t)data << 8;
+
+    for (uint8_t i = 0; i < 8; i++) {
+
+        crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+
+    }
+
+    return crc;
+
+}
+
+#endif /* _HOST_UTIL_CRC16_H_ */
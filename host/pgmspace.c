@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file pgmspace.c
+ * @brief Formatting functions declared in avr/pgmspace.h for host builds
+ *
+ * Format strings of the firmware are written for the printf implementation
+ * of avr-libc, which differs from the one of the host in two aspects:
+ *
+ * - `%S` denotes a string within program space instead of a wide string
+ * - `long` is 32 bit wide, i.e. `%lu` is used for `uint32_t`
+ *
+ * The format string is therefore translated before being passed on to the
+ * host C library.
+ */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <avr/pgmspace.h>
+
+/**
+ * @brief Maximum length of a translated format string
+ */
+#define PGMSPACE_FMT_MAX_LEN 128
+
+/**
+ * @brief Translates a format string of avr-libc to the host C library
+ */
+static void pgmspace_translate(char* dst, const char* fmt)
+{
+
+    char* end = dst + PGMSPACE_FMT_MAX_LEN - 1;
+    bool conversion = false;
+
+    while (*fmt && dst < end) {
+
+        char c = *fmt++;
+
+        if (!conversion) {
+
+            conversion = (c == '%');
+            *dst++ = c;
+
+            continue;
+
+        }
+
+        if (c == 'l') {
+
+            // long is as wide as int on the AVR
+            continue;
+
+        }
+
+        if (c == 'S') {
+
+            c = 's';
+
+        }
+
+        *dst++ = c;
+
+        // Flags, width, precision and length modifiers continue a conversion
+        if (c == '%' || (c != '-' && c != '+' && c != ' ' && c != '#' && c != '.' && (c < '0' || c > '9') && c != 'h')) {
+
+            conversion = false;
+
+        }
+
+    }
+
+    *dst = '\0';
+
+}
+
+int vsnprintf_P(char* str, size_t size, const char* fmt, va_list ap)
+{
+
+    char translated[PGMSPACE_FMT_MAX_LEN];
+
+    pgmspace_translate(translated, fmt);
+
+    return vsnprintf(str, size, translated, ap);
+
+}
+
+int snprintf_P(char* str, size_t size, const char* fmt, ...)
+{
+
+    va_list ap;
+    va_start(ap, fmt);
+    int result = vsnprintf_P(str, size, fmt, ap);
+    va_end(ap);
+
+    return result;
+
+}
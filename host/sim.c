@@ -0,0 +1,664 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file sim.c
+ * @brief Implementation of the header declared in sim.h
+ *
+ * This provides main() of the host build, which sets up the simulated
+ * environment and then hands over to main() of the firmware, which has been
+ * renamed to firmware_main() while being compiled for the host.
+ *
+ * Changes of the input pins are read from a script line by line, so that
+ * scripts covering long periods of time don't need to fit into memory. Each
+ * line consists of the time in milliseconds, the pin and its new level, e.g.
+ * `1500 C0 0`. Times need to be ascending. Lines starting with `#` are
+ * ignored. All pins are high initially, just like with the pull-ups enabled.
+ *
+ * @see sim.h
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "sim.h"
+
+/**
+ * @brief Maximum number of steps taken at once when bound to the wall clock
+ *
+ * This gives the main loop of the firmware a chance to keep up, once the
+ * simulation has fallen behind.
+ */
+#define SIM_STEPS_MAX 10
+
+/**
+ * @brief Number of steps between polls for input when running unbound
+ */
+#define SIM_POLL_STEPS 16
+
+/**
+ * @brief Default file backing the FRAM
+ */
+#define SIM_FRAM_DEFAULT "s0-counter.fram"
+
+/**
+ * @brief A single change of an input pin
+ */
+typedef struct {
+
+    uint32_t time;
+    uint8_t reg;
+    uint8_t bit;
+    bool level;
+
+} sim_event_t;
+
+volatile uint8_t sim_io[SIM_IO_SIZE];
+
+int firmware_main();
+void TIMER0_COMPA_vect(void);
+
+// Pin change ISRs are only provided by some configurations
+void PCINT0_vect(void) __attribute__((weak));
+void PCINT1_vect(void) __attribute__((weak));
+void PCINT2_vect(void) __attribute__((weak));
+
+/**
+ * @brief Simulated time in milliseconds, i.e. the number of steps taken
+ */
+static uint32_t sim_time;
+
+/**
+ * @brief Simulated time to stop at, zero to run forever
+ */
+static uint32_t sim_duration;
+
+/**
+ * @brief Speed relative to the wall clock, zero to run unbound
+ */
+static uint32_t sim_speed = 1;
+
+/**
+ * @brief Wall clock time the simulation has been started at
+ */
+static struct timespec sim_start;
+
+/**
+ * @brief File descriptor input is read from, negative once exhausted
+ */
+static int sim_fd_in = -1;
+
+/**
+ * @brief Whether to wait for input while unbound, see sim_idle()
+ */
+static bool sim_wait_input;
+
+/**
+ * @brief Script containing changes of the input pins, if any
+ */
+static FILE* sim_script;
+
+/**
+ * @brief Line number within sim_script, used for error messages
+ */
+static unsigned long sim_script_line;
+
+/**
+ * @brief Next change of the input pins, valid if sim_event_pending is set
+ */
+static sim_event_t sim_event;
+static bool sim_event_pending;
+
+/**
+ * @brief Milliseconds elapsed since the last compare match of Timer0
+ */
+static uint32_t sim_timer_elapsed;
+
+/**
+ * @brief Value of TCNT0 as last set by the simulation
+ *
+ * A differing value means the firmware has written to TCNT0.
+ */
+static uint8_t sim_timer_count;
+
+/**
+ * @brief Number of interrupts that have occurred, used by sim_sleep()
+ */
+static uint32_t sim_interrupts;
+
+/**
+ * @brief Flag indicating that the firmware is sleeping, see sim_sleep()
+ */
+static bool sim_sleeping;
+
+/**
+ * @brief Flag set by signals asking the simulation to stop
+ */
+static volatile sig_atomic_t sim_stop;
+
+static uint64_t sim_wall_us()
+{
+
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)(now.tv_sec - sim_start.tv_sec) * 1000000 + (now.tv_nsec - sim_start.tv_nsec) / 1000;
+
+}
+
+/**
+ * @brief Reads the next change of the input pins from the script
+ */
+static void sim_script_next()
+{
+
+    char line[128];
+
+    sim_event_pending = false;
+
+    while (sim_script && fgets(line, sizeof(line), sim_script)) {
+
+        sim_script_line++;
+
+        unsigned long time;
+        char port;
+        unsigned bit;
+        unsigned level;
+
+        if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0') {
+
+            continue;
+
+        }
+
+        if (sscanf(line, "%lu %c%u %u", &time, &port, &bit, &level) != 4 || port < 'B' || port > 'D' || bit > 7 || level > 1 || time < sim_event.time) {
+
+            fprintf(stderr, "sim: invalid script line %lu: %s", sim_script_line, line);
+            exit(EXIT_FAILURE);
+
+        }
+
+        sim_event.time = time;
+        sim_event.reg = (&PINB - sim_io) + 3 * (port - 'B');
+        sim_event.bit = bit;
+        sim_event.level = level;
+        sim_event_pending = true;
+
+        return;
+
+    }
+
+}
+
+/**
+ * @brief Reads as much input as the UART can take without blocking
+ *
+ * @param timeout Time to wait for input in milliseconds
+ */
+static void sim_input(int timeout)
+{
+
+    if (sim_fd_in < 0) {
+
+        if (timeout > 0) {
+
+            usleep(timeout * 1000);
+
+        }
+
+        return;
+
+    }
+
+    struct pollfd pfd = { sim_fd_in, POLLIN, 0 };
+
+    if (poll(&pfd, 1, timeout) <= 0) {
+
+        return;
+
+    }
+
+    uint8_t buffer[UINT8_MAX];
+    uint8_t space = sim_uart_space();
+
+    if (space == 0) {
+
+        return;
+
+    }
+
+    ssize_t len = read(sim_fd_in, buffer, space);
+
+    if (len == 0 || (len < 0 && errno != EAGAIN && errno != EINTR)) {
+
+        // End of input, e.g. when stdin is a file
+        sim_fd_in = -1;
+
+        return;
+
+    }
+
+    for (ssize_t i = 0; i < len; i++) {
+
+        sim_uart_receive(buffer[i]);
+
+    }
+
+    if (len > 0) {
+
+        sim_interrupts++;
+
+    }
+
+}
+
+/**
+ * @brief Invokes the pin change ISR of a port, if enabled
+ *
+ * @param reg Address of the PINx register whose pins have changed
+ * @param changed Bitmap of the pins that have changed
+ */
+static void sim_pin_change(uint8_t reg, uint8_t changed)
+{
+
+    uint8_t group = (reg - (&PINB - sim_io)) / 3;
+    void (*vectors[])(void) = { PCINT0_vect, PCINT1_vect, PCINT2_vect };
+    volatile uint8_t* masks[] = { &PCMSK0, &PCMSK1, &PCMSK2 };
+
+    if (!(SREG & _BV(SREG_I)) || !(PCICR & _BV(group)) || !(*masks[group] & changed) || !vectors[group]) {
+
+        return;
+
+    }
+
+    sim_interrupts++;
+    vectors[group]();
+
+}
+
+/**
+ * @brief Advances Timer0 by a millisecond and invokes its ISR on compare match
+ *
+ * Only CTC mode is modeled. The period is rounded to full milliseconds, so
+ * with a prescaler of 64 the ISR is invoked on each step, just like before
+ * sleep modes have been modeled.
+ */
+static void sim_timer()
+{
+
+    static const uint16_t prescalers[] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+
+    uint16_t prescaler = prescalers[TCCR0B & 0x07];
+
+    if (prescaler == 0) {
+
+        return;
+
+    }
+
+    if (TCNT0 != sim_timer_count) {
+
+        sim_timer_elapsed = 0;
+
+    }
+
+    uint32_t period = ((OCR0A + 1UL) * prescaler + F_CPU / 2000) / (F_CPU / 1000);
+
+    sim_timer_elapsed++;
+
+    if (sim_timer_elapsed >= period) {
+
+        sim_timer_elapsed = 0;
+
+        if ((SREG & _BV(SREG_I)) && (TIMSK0 & _BV(OCIE0A))) {
+
+            sim_interrupts++;
+            TIMER0_COMPA_vect();
+
+        }
+
+    }
+
+    TCNT0 = sim_timer_elapsed * (F_CPU / 1000) / prescaler;
+    sim_timer_count = TCNT0;
+
+}
+
+/**
+ * @brief Advances the simulated time by a single timer tick
+ */
+static void sim_step()
+{
+
+    sim_time++;
+
+    while (sim_event_pending && sim_event.time <= sim_time) {
+
+        uint8_t reg = sim_event.reg;
+        uint8_t previous = sim_io[reg];
+
+        if (sim_event.level) {
+
+            sim_io[reg] |= _BV(sim_event.bit);
+
+        } else {
+
+            sim_io[reg] &= ~_BV(sim_event.bit);
+
+        }
+
+        sim_script_next();
+        sim_pin_change(reg, previous ^ sim_io[reg]);
+
+    }
+
+    sim_timer();
+
+}
+
+/**
+ * @brief Returns the simulated time in milliseconds
+ */
+uint32_t sim_get_time()
+{
+
+    return sim_time;
+
+}
+
+/**
+ * @brief Advances the simulation while the firmware has nothing to do
+ *
+ * This is invoked by the UART whenever the firmware polls for input without
+ * finding any, i.e. once per iteration of the main loop. When bound to the
+ * wall clock, this waits for input until the next step is due. Unbound with
+ * stdin as input, this waits for input until stdin has been exhausted.
+ */
+void sim_idle()
+{
+
+    if (sim_stop || (sim_duration && sim_time >= sim_duration)) {
+
+        exit(EXIT_SUCCESS);
+
+    }
+
+    if (sim_speed == 0) {
+
+        // Piped input would otherwise be raced by the simulation, so time
+        // only advances once it has been exhausted
+        if (sim_wait_input && sim_fd_in >= 0) {
+
+            sim_input(-1);
+
+            return;
+
+        }
+
+        if (sim_time % SIM_POLL_STEPS == 0) {
+
+            sim_input(0);
+
+        }
+
+        sim_step();
+
+        return;
+
+    }
+
+    uint64_t target = sim_wall_us() * sim_speed / 1000;
+
+    if (target <= sim_time) {
+
+        sim_input(1);
+
+        return;
+
+    }
+
+    sim_input(0);
+
+    uint32_t interrupts = sim_interrupts;
+
+    for (uint8_t i = 0; i < SIM_STEPS_MAX && sim_time < target; i++) {
+
+        // A sleeping firmware is woken up by each interrupt
+        if (sim_sleeping && sim_interrupts != interrupts) {
+
+            break;
+
+        }
+
+        sim_step();
+
+    }
+
+}
+
+/**
+ * @brief Advances the simulation until an interrupt occurs
+ *
+ * This is invoked by the firmware instead of entering sleep mode.
+ */
+void sim_sleep()
+{
+
+    uint32_t interrupts = sim_interrupts;
+
+    sim_sleeping = true;
+
+    while (sim_interrupts == interrupts) {
+
+        sim_idle();
+
+    }
+
+    sim_sleeping = false;
+
+}
+
+static void sim_signal(int signal)
+{
+
+    sim_stop = true;
+
+}
+
+static void sim_summary()
+{
+
+    double wall = sim_wall_us() / 1e6;
+
+    fprintf(stderr, "sim: %u ms simulated in %.3f s\n", sim_time, wall);
+
+}
+
+/**
+ * @brief Creates a pty the UART is attached to
+ *
+ * The slave side is kept open, so that clients may come and go without the
+ * master side reporting errors.
+ *
+ * @return File descriptor of the master side, negative on error
+ */
+static int sim_open_pty()
+{
+
+    int fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+    if (fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0) {
+
+        return -1;
+
+    }
+
+    int slave = open(ptsname(fd), O_RDWR | O_NOCTTY);
+
+    if (slave < 0) {
+
+        return -1;
+
+    }
+
+    struct termios tio;
+
+    tcgetattr(slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+
+    fprintf(stderr, "sim: uart on %s\n", ptsname(fd));
+
+    return fd;
+
+}
+
+static void sim_usage(const char* name)
+{
+
+    fprintf(stderr,
+        "Usage: %s [-i] [-T] [-f FRAM] [-p SCRIPT] [-s SPEED] [-t MS]\n"
+        "\n"
+        "  -i         use stdin/stdout instead of a pty for the UART\n"
+        "  -T         prefix each line of output with the simulated time\n"
+        "  -f FRAM    file backing the FRAM (default: %s)\n"
+        "  -p SCRIPT  script of changes of the input pins\n"
+        "  -s SPEED   speed relative to real time, 0 for unbound (default: 1),\n"
+        "             waiting for stdin to be exhausted with -i\n"
+        "  -t MS      stop after the given simulated time\n",
+        name, SIM_FRAM_DEFAULT);
+
+}
+
+int main(int argc, char* argv[])
+{
+
+    const char* fram = SIM_FRAM_DEFAULT;
+    bool stdio = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "iTf:p:s:t:")) != -1) {
+
+        switch (opt) {
+
+            case 'i':
+                stdio = true;
+                break;
+
+            case 'T':
+                sim_uart_timestamps(true);
+                break;
+
+            case 'f':
+                fram = optarg;
+                break;
+
+            case 'p':
+                sim_script = fopen(optarg, "r");
+
+                if (!sim_script) {
+
+                    perror(optarg);
+
+                    return EXIT_FAILURE;
+
+                }
+
+                break;
+
+            case 's':
+                sim_speed = strtoul(optarg, NULL, 10);
+                break;
+
+            case 't':
+                sim_duration = strtoul(optarg, NULL, 10);
+                break;
+
+            default:
+                sim_usage(argv[0]);
+
+                return EXIT_FAILURE;
+
+        }
+
+    }
+
+    if (!sim_fram_open(fram)) {
+
+        perror(fram);
+
+        return EXIT_FAILURE;
+
+    }
+
+    if (stdio) {
+
+        sim_fd_in = STDIN_FILENO;
+        sim_wait_input = true;
+        sim_uart_attach(STDOUT_FILENO);
+
+    } else {
+
+        sim_fd_in = sim_open_pty();
+
+        if (sim_fd_in < 0) {
+
+            perror("pty");
+
+            return EXIT_FAILURE;
+
+        }
+
+        sim_uart_attach(sim_fd_in);
+
+    }
+
+    // Inputs are pulled up
+    PINB = 0xFF;
+    PINC = 0xFF;
+    PIND = 0xFF;
+
+    sim_script_next();
+
+    signal(SIGINT, sim_signal);
+    signal(SIGTERM, sim_signal);
+
+    clock_gettime(CLOCK_MONOTONIC, &sim_start);
+    atexit(sim_summary);
+
+    return firmware_main();
+
+}
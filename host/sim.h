@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file sim.h
+ * @brief Simulation environment running the firmware on a Linux host
+ *
+ * The firmware is compiled for the host with the headers of `host/include`
+ * replacing those of avr-libc. Modules talking to peripherals that can't be
+ * modeled by registers alone are replaced: The UART is backed by a pty (or
+ * stdin/stdout) and the FRAM by a file. Everything else, including main(),
+ * is compiled unchanged from `src/`.
+ *
+ * Simulated time advances in steps of one timer tick (1 ms). Steps are taken
+ * whenever the firmware polls for input without finding any, i.e. once per
+ * iteration of the main loop, see sim_idle(), or while the firmware sleeps,
+ * see sim_sleep(). Each step applies scripted changes of the input pins,
+ * invoking the pin change ISRs if enabled, and advances Timer0, invoking its
+ * ISR on compare match, just like the hardware would. The pace is either bound to the wall clock (multiplied by
+ * a speed factor) or unbound, in which case the simulation runs as fast as
+ * the host permits.
+ *
+ * For details on how to use the simulation refer to `doc/HOST.md`.
+ *
+ * @see sim.c
+ */
+
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+uint32_t sim_get_time();
+void sim_idle();
+void sim_sleep();
+
+void sim_uart_attach(int fd);
+uint8_t sim_uart_space();
+void sim_uart_receive(uint8_t c);
+void sim_uart_timestamps(bool enabled);
+
+bool sim_fram_open(const char* path);
+
+#endif /* _SIM_H_ */
@@ -0,0 +1,415 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file uart.c
+ * @brief Implementation of uart.h for host builds
+ *
+ * Received data is handed over by the simulation via sim_uart_receive() and
+ * buffered until retrieved by the firmware. Data to be transmitted is written
+ * to the attached file descriptor right away, so transmissions complete
+ * instantly and never keep the firmware waiting.
+ *
+ * If the descriptor is non-blocking, e.g. a pty without anybody reading from
+ * it, bytes that can't be written are dropped and accounted for in the
+ * statistics, just like bytes lost due to a full transmission buffer on the
+ * AVR.
+ *
+ * Only a single port is provided. Flow control and baud rates are accepted
+ * and reported back, but don't have any effect.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <unistd.h>
+
+#include "config.h"
+#include "event.h"
+#include "sim.h"
+#include "uart.h"
+
+/**
+ * @brief Size of the receive buffer, the indices wrap around naturally
+ */
+#define UART_HOST_BUFFER_SIZE 256
+
+/**
+ * @brief Buffer holding received data not yet retrieved by the firmware
+ */
+static uint8_t uart_buffer[UART_HOST_BUFFER_SIZE];
+
+/**
+ * @brief Index of the next byte to be retrieved from uart_buffer
+ */
+static uint8_t uart_read;
+
+/**
+ * @brief Number of bytes within uart_buffer
+ */
+static uint16_t uart_count;
+
+/**
+ * @brief File descriptor output is written to
+ */
+static int uart_fd = -1;
+
+/**
+ * @brief Flag indicating that lines of output are prefixed with the time
+ */
+static bool uart_timestamps;
+
+/**
+ * @brief Flag indicating that the next byte of output starts a new line
+ */
+static bool uart_line_start = true;
+
+static bool uart_flow_control;
+static uint32_t uart_baud = UART_BAUD;
+static uint8_t uart_rx_idle;
+
+#if ENABLE_STATS
+    static uart_stats_t uart_stats;
+#endif
+
+static uint8_t uart_routes[UART_STREAM_COUNT] = {
+
+    UART_PORT_DEFAULT,
+    UART_PORT_STREAMING,
+    UART_PORT_STREAMING,
+
+};
+
+/**
+ * @brief Attaches the port to the given file descriptor for output
+ *
+ * Output is dropped instead of blocking if the descriptor is non-blocking.
+ */
+void sim_uart_attach(int fd)
+{
+
+    uart_fd = fd;
+
+}
+
+/**
+ * @brief Returns the number of bytes that can be received right now
+ */
+uint8_t sim_uart_space()
+{
+
+    uint16_t space = UART_HOST_BUFFER_SIZE - uart_count;
+
+    return space > UINT8_MAX ? UINT8_MAX : space;
+
+}
+
+/**
+ * @brief Hands over a received byte, which needs to fit into the buffer
+ *
+ * @see sim_uart_space()
+ */
+void sim_uart_receive(uint8_t c)
+{
+
+    uart_buffer[(uint8_t)(uart_read + uart_count)] = c;
+    uart_count++;
+    uart_rx_idle = 0;
+
+    event_post();
+
+    #if ENABLE_STATS
+        uart_stats.rx++;
+    #endif
+
+}
+
+/**
+ * @brief Enables prefixing each line of output with the simulated time
+ *
+ * This allows output to be related to the input pins, e.g. by tools replaying
+ * pulse trains.
+ */
+void sim_uart_timestamps(bool enabled)
+{
+
+    uart_timestamps = enabled;
+
+}
+
+void uart_init()
+{
+
+}
+
+bool uart_putc(uint8_t port, char c)
+{
+
+    ssize_t result;
+
+    // Output is discarded while nothing is attached, e.g. by benchmarks
+    if (uart_fd < 0) {
+
+        return true;
+
+    }
+
+    if (uart_timestamps && uart_line_start) {
+
+        dprintf(uart_fd, "%u ", sim_get_time());
+
+    }
+
+    uart_line_start = (c == '\n');
+
+    do {
+
+        result = write(uart_fd, &c, 1);
+
+    } while (result < 0 && errno == EINTR);
+
+    if (result != 1) {
+
+        #if ENABLE_STATS
+            uart_stats.tx_dropped++;
+        #endif
+
+        return false;
+
+    }
+
+    #if ENABLE_STATS
+        uart_stats.tx++;
+    #endif
+
+    return true;
+
+}
+
+/**
+ * @brief Retrieves the next byte received, if any
+ *
+ * Finding no data hands control over to the simulation, which advances the
+ * simulated time, see sim_idle().
+ */
+bool uart_getc_nowait(uint8_t port, char* c)
+{
+
+    if (uart_count == 0) {
+
+        sim_idle();
+
+        return false;
+
+    }
+
+    *c = uart_buffer[uart_read++];
+    uart_count--;
+
+    return true;
+
+}
+
+char uart_getc_wait(uint8_t port)
+{
+
+    char c;
+
+    while (!uart_getc_nowait(port, &c));
+
+    return c;
+
+}
+
+void uart_puts(uint8_t port, const char* str)
+{
+
+    while (*str) {
+
+        uart_putc(port, *str++);
+
+    }
+
+}
+
+void uart_puts_p(uint8_t port, PGM_P str)
+{
+
+    uart_puts(port, str);
+
+}
+
+void uart_flush_output(uint8_t port)
+{
+
+}
+
+bool uart_output_busy(uint8_t port)
+{
+
+    return false;
+
+}
+
+void uart_set_flow_control(uint8_t port, bool enabled)
+{
+
+    uart_flow_control = enabled;
+
+}
+
+bool uart_get_flow_control(uint8_t port)
+{
+
+    return uart_flow_control;
+
+}
+
+#if ENABLE_RS485
+
+/**
+ * @brief Nothing to do, as input is never lost within the simulation
+ */
+void uart_set_bus(bool enabled)
+{
+
+}
+
+#endif
+
+#if ENABLE_STATS
+
+void uart_get_stats(uint8_t port, uart_stats_t* stats)
+{
+
+    *stats = uart_stats;
+    stats->rx_high = uart_count > UINT8_MAX ? UINT8_MAX : uart_count;
+
+}
+
+#endif
+
+void uart_tick()
+{
+
+    if (uart_rx_idle < UINT8_MAX) {
+
+        uart_rx_idle++;
+
+        event_post();
+
+    }
+
+}
+
+/**
+ * @brief Checks whether the rate could be generated on the AVR
+ *
+ * This mirrors the calculation of the firmware, so that the host accepts the
+ * same rates.
+ */
+bool uart_baud_valid(uint32_t baud)
+{
+
+    if (baud == 0 || baud > F_CPU / 8) {
+
+        return false;
+
+    }
+
+    uint32_t value = (F_CPU + 4 * baud) / (8 * baud) - 1;
+
+    if (value > 0xFFF) {
+
+        return false;
+
+    }
+
+    uint32_t actual = F_CPU / (8 * (value + 1));
+    uint32_t deviation = actual > baud ? actual - baud : baud - actual;
+
+    return deviation * 100 <= baud * UART_BAUD_TOLERANCE;
+
+}
+
+bool uart_set_baud(uint8_t port, uint32_t baud)
+{
+
+    if (!uart_baud_valid(baud)) {
+
+        return false;
+
+    }
+
+    uart_baud = baud;
+
+    // Discard everything received at the previous rate
+    uart_count = 0;
+
+    return true;
+
+}
+
+uint32_t uart_get_baud(uint8_t port)
+{
+
+    return uart_baud;
+
+}
+
+uint8_t uart_get_rx_idle(uint8_t port)
+{
+
+    return uart_rx_idle;
+
+}
+
+bool uart_input_available(uint8_t port)
+{
+
+    return uart_count != 0;
+
+}
+
+uint32_t uart_get_rx_time(uint8_t port)
+{
+
+    return 0;
+
+}
+
+void uart_set_route(uart_stream_t stream, uint8_t port)
+{
+
+    if (port < UART_PORTS) {
+
+        uart_routes[stream] = port;
+
+    }
+
+}
+
+uint8_t uart_get_route(uart_stream_t stream)
+{
+
+    return uart_routes[stream];
+
+}
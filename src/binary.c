@@ -0,0 +1,575 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file binary.c
+ * @brief Implementation of the header declared in binary.h
+ *
+ * Incoming data is decoded on the fly, byte by byte, so only the decoded
+ * frame needs to be buffered. Responses are assembled in a buffer of their
+ * own and encoded while being put into the UART transmission buffer.
+ *
+ * @see binary.h
+ */
+
+#include <util/crc16.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "binary.h"
+#include "config.h"
+#include "log.h"
+#include "prefs.h"
+#include "push.h"
+#include "str.h"
+#include "uart.h"
+#include "version.h"
+
+#if ENABLE_BINARY_PROTOCOL
+
+/**
+ * @brief Port frames are exchanged on, which is the one of the text protocol
+ *
+ * @see uart_set_route()
+ */
+#define BINARY_PORT uart_get_route(UART_STREAM_PROTO)
+
+/**
+ * @brief Size of the header of a response (command, id and status)
+ */
+#define BINARY_RESPONSE_HEADER_SIZE 3
+
+/**
+ * @brief Size of the CRC attached to each frame
+ */
+#define BINARY_CRC_SIZE 2
+
+/**
+ * @brief Flag indicating whether the binary protocol is currently active
+ *
+ * @see binary_enable()
+ * @see binary_is_enabled()
+ */
+static bool binary_enabled = false;
+
+/**
+ * @brief State of logging and flow control before the binary protocol
+ *
+ * Both are disabled while the binary protocol is active and restored once
+ * switching back to the text protocol.
+ *
+ * @see binary_enable()
+ */
+static bool binary_log_enabled;
+static bool binary_flow_control;
+
+/**
+ * @brief Buffer holding the frame that is currently being decoded
+ */
+static uint8_t binary_rx_buffer[BINARY_FRAME_MAX_SIZE];
+
+/**
+ * @brief Number of bytes decoded into binary_rx_buffer so far
+ */
+static uint8_t binary_rx_index;
+
+/**
+ * @brief COBS code of the block that is currently being decoded
+ *
+ * This is zero at the beginning of each frame, as the first block does not
+ * imply a zero byte in front of it.
+ */
+static uint8_t binary_rx_code;
+
+/**
+ * @brief Number of bytes left in the block that is currently being decoded
+ */
+static uint8_t binary_rx_remaining;
+
+/**
+ * @brief Flag indicating that the current frame is invalid
+ *
+ * Once set, everything up to the next delimiter will be discarded.
+ */
+static bool binary_rx_invalid;
+
+/**
+ * @brief Buffer the response is assembled in
+ */
+static uint8_t binary_tx_buffer[BINARY_FRAME_MAX_SIZE];
+
+/**
+ * @brief Continues the calculation of a CRC with the given data
+ *
+ * @param crc CRC so far, 0xFFFF initially
+ */
+static uint16_t binary_crc(uint16_t crc, const uint8_t* data, uint8_t len)
+{
+
+    while (len--) {
+
+        crc = _crc_xmodem_update(crc, *data++);
+
+    }
+
+    return crc;
+
+}
+
+/**
+ * @brief Encodes the given data using COBS and transmits it as a frame
+ *
+ * Each block starts with a code byte, which contains the offset to the next
+ * zero byte (or the end of the block), followed by the non-zero bytes in
+ * between. The frame is terminated by {@link #BINARY_FRAME_DELIMITER}.
+ */
+static void binary_output_frame(const uint8_t* data, uint8_t len)
+{
+
+    uint8_t start = 0;
+
+    while (true) {
+
+        uint8_t end = start;
+
+        // Find next zero byte, but at most 254 bytes ahead
+        while (end < len && data[end] != 0 && end - start < 254) {
+
+            end++;
+
+        }
+
+        uart_putc(BINARY_PORT, end - start + 1);
+
+        for (uint8_t i = start; i < end; i++) {
+
+            uart_putc(BINARY_PORT, data[i]);
+
+        }
+
+        if (end == len) {
+
+            break;
+
+        }
+
+        // Blocks of maximum length are not followed by an implicit zero
+        start = (end - start == 254) ? end : end + 1;
+
+    }
+
+    uart_putc(BINARY_PORT, BINARY_FRAME_DELIMITER);
+
+}
+
+/**
+ * @brief Sends a response with the given status and payload
+ *
+ * The command and id are taken from the request in binary_rx_buffer.
+ */
+static void binary_respond(binary_status_t status, const void* payload, uint8_t len)
+{
+
+    binary_tx_buffer[0] = binary_rx_buffer[0];
+    binary_tx_buffer[1] = binary_rx_buffer[1];
+    binary_tx_buffer[2] = status;
+
+    memcpy(&binary_tx_buffer[BINARY_RESPONSE_HEADER_SIZE], payload, len);
+    len += BINARY_RESPONSE_HEADER_SIZE;
+
+    uint16_t crc = binary_crc(0xFFFF, binary_tx_buffer, len);
+    binary_tx_buffer[len++] = crc & 0xFF;
+    binary_tx_buffer[len++] = crc >> 8;
+
+    uart_flush_output(BINARY_PORT);
+    binary_output_frame(binary_tx_buffer, len);
+
+}
+
+static void binary_status(binary_status_t status)
+{
+
+    binary_respond(status, NULL, 0);
+
+}
+
+/**
+ * @brief Verifies the given range of the staged FRAM image and loads it
+ *
+ * The CRC is calculated over the image as staged in FRAM, so anything that
+ * went wrong while writing it is detected. Counts saved in the meantime go
+ * to the preferences in use, which are only replaced once the image has been
+ * verified and are left alone otherwise.
+ *
+ * @return True if the CRC matches and the image has been loaded
+ */
+static bool binary_fram_commit(uint16_t length, uint16_t expected)
+{
+
+    uint8_t chunk[BINARY_FRAM_CHUNK_SIZE];
+    uint16_t crc = 0xFFFF;
+
+    for (uint16_t offset = 0; offset < length; offset += sizeof(chunk)) {
+
+        uint8_t size = (length - offset < sizeof(chunk)) ? length - offset : sizeof(chunk);
+
+        prefs_read_staged(offset, chunk, size);
+        crc = binary_crc(crc, chunk, size);
+
+    }
+
+    if (crc != expected) {
+
+        log_output_S(LOG_MODULE_BINARY, LOG_LEVEL_DEBUG, str_crc_mismatch);
+
+        return false;
+
+    }
+
+    if (!prefs_commit_image(length)) {
+
+        return false;
+
+    }
+
+    #if ENABLE_PUSH
+        push_rebase(0, CHANNELS - 1);
+    #endif
+
+    return true;
+
+}
+
+/**
+ * @brief Processes a single, already decoded and verified frame
+ *
+ * @param payload Pointer to payload of request
+ * @param len Length of payload
+ */
+static void binary_process(const uint8_t* payload, uint8_t len)
+{
+
+    channel_prefs_t* channel;
+
+    // All of the FRAM commands expect an offset or length as first value
+    uint16_t offset = (len >= 2) ? payload[0] | (payload[1] << 8) : 0;
+
+    // All of the commands addressing a channel expect it as first byte
+    if (len > 0 && payload[0] < CHANNELS) {
+
+        channel = &(prefs_get()->channels[payload[0]]);
+
+    } else {
+
+        channel = NULL;
+
+    }
+
+    switch (binary_rx_buffer[0]) {
+
+        case BINARY_CMD_PING:
+
+            binary_status(BINARY_STATUS_OK);
+
+            break;
+
+        case BINARY_CMD_INFO: {
+
+            uint8_t info[] = { VERSION, CHANNELS };
+            binary_respond(BINARY_STATUS_OK, info, sizeof(info));
+
+            break;
+
+        }
+
+        case BINARY_CMD_CHANNEL_GET: {
+
+            if (len != 1 || channel == NULL) {
+
+                binary_status(BINARY_STATUS_INVALID_ARGUMENT);
+
+                break;
+
+            }
+
+            uint8_t info[7] = { channel->enabled, channel->min, channel->max };
+            memcpy(&info[3], &(channel->count), sizeof(uint32_t));
+
+            binary_respond(BINARY_STATUS_OK, info, sizeof(info));
+
+            break;
+
+        }
+
+        case BINARY_CMD_CHANNEL_SET:
+
+            if (len != 4 || channel == NULL || payload[1] > 1) {
+
+                binary_status(BINARY_STATUS_INVALID_ARGUMENT);
+
+                break;
+
+            }
+
+            // enabled, min and max are stored consecutively
+            channel->enabled = payload[1];
+            channel->min = payload[2];
+            channel->max = payload[3];
+            prefs_save_block(&(channel->enabled), 3);
+
+            binary_status(BINARY_STATUS_OK);
+
+            break;
+
+        case BINARY_CMD_COUNT_SET:
+
+            if (len != 5 || channel == NULL) {
+
+                binary_status(BINARY_STATUS_INVALID_ARGUMENT);
+
+                break;
+
+            }
+
+            memcpy(&(channel->count), &payload[1], sizeof(uint32_t));
+            prefs_save_block(&(channel->count), sizeof(uint32_t));
+
+            #if ENABLE_PUSH
+                push_rebase(payload[0], payload[0]);
+            #endif
+
+            binary_status(BINARY_STATUS_OK);
+
+            break;
+
+        case BINARY_CMD_FRAM_READ: {
+
+            if (len != 3 || payload[2] > BINARY_FRAM_CHUNK_SIZE || offset > sizeof(prefs_t)) {
+
+                binary_status(BINARY_STATUS_INVALID_ARGUMENT);
+
+                break;
+
+            }
+
+            // The FRAM is read while the previous response is still being sent
+            uint8_t chunk[BINARY_FRAM_CHUNK_SIZE];
+            uint8_t size = (sizeof(prefs_t) - offset < payload[2]) ? sizeof(prefs_t) - offset : payload[2];
+
+            if (size != 0) {
+
+                prefs_read_image(offset, chunk, size);
+
+            }
+
+            binary_respond(BINARY_STATUS_OK, chunk, size);
+
+            break;
+
+        }
+
+        case BINARY_CMD_FRAM_WRITE:
+
+            if (len < 3 || offset + (len - 2) > sizeof(prefs_t)) {
+
+                binary_status(BINARY_STATUS_INVALID_ARGUMENT);
+
+                break;
+
+            }
+
+            prefs_write_image(offset, &payload[2], len - 2);
+
+            binary_status(BINARY_STATUS_OK);
+
+            break;
+
+        case BINARY_CMD_FRAM_COMMIT:
+
+            if (len != 4 || offset > sizeof(prefs_t) || !binary_fram_commit(offset, payload[2] | (payload[3] << 8))) {
+
+                binary_status(BINARY_STATUS_INVALID_ARGUMENT);
+
+                break;
+
+            }
+
+            binary_status(BINARY_STATUS_OK);
+
+            break;
+
+        case BINARY_CMD_TEXT:
+
+            binary_status(BINARY_STATUS_OK);
+            uart_flush_output(BINARY_PORT);
+
+            binary_enabled = false;
+
+            uart_set_flow_control(BINARY_PORT, binary_flow_control);
+
+            if (binary_log_enabled) {
+
+                log_enable();
+
+            }
+
+            break;
+
+        default:
+
+            binary_status(BINARY_STATUS_UNKNOWN_COMMAND);
+
+    }
+
+}
+
+/**
+ * @brief Verifies the frame decoded into binary_rx_buffer and processes it
+ */
+static void binary_frame_complete()
+{
+
+    // Command, id and CRC are mandatory
+    if (binary_rx_index < 2 + BINARY_CRC_SIZE) {
+
+        return;
+
+    }
+
+    uint8_t len = binary_rx_index - BINARY_CRC_SIZE;
+    uint16_t crc = binary_rx_buffer[len] | (binary_rx_buffer[len + 1] << 8);
+
+    if (crc != binary_crc(0xFFFF, binary_rx_buffer, len)) {
+
+        log_output_S(LOG_MODULE_BINARY, LOG_LEVEL_DEBUG, str_crc_mismatch);
+
+        return;
+
+    }
+
+    binary_process(&binary_rx_buffer[2], len - 2);
+
+}
+
+static void binary_rx_append(uint8_t data)
+{
+
+    if (binary_rx_index < BINARY_FRAME_MAX_SIZE) {
+
+        binary_rx_buffer[binary_rx_index++] = data;
+
+    } else {
+
+        binary_rx_invalid = true;
+
+    }
+
+}
+
+/**
+ * @brief Switches from the text protocol to the binary protocol
+ *
+ * Logging is disabled while the binary protocol is active, as log messages
+ * would otherwise be interleaved with the frames. Its state is restored along
+ * with the one of flow control when switching back.
+ */
+void binary_enable()
+{
+
+    binary_rx_index = 0;
+    binary_rx_code = 0;
+    binary_rx_remaining = 0;
+    binary_rx_invalid = false;
+
+    binary_flow_control = uart_get_flow_control(BINARY_PORT);
+    binary_log_enabled = log_is_enabled();
+
+    // XON/XOFF can't be told apart from payload within frames
+    uart_set_flow_control(BINARY_PORT, false);
+
+    log_disable();
+    binary_enabled = true;
+
+}
+
+bool binary_is_enabled()
+{
+
+    return binary_enabled;
+
+}
+
+/**
+ * @brief Decodes incoming data and processes complete frames
+ *
+ * This is expected to be called from proto_handle() whenever the binary
+ * protocol is active, i.e. it consumes all of the data received via UART.
+ */
+void binary_handle()
+{
+
+    char c;
+
+    while (binary_enabled && uart_getc_nowait(BINARY_PORT, &c)) {
+
+        uint8_t data = c;
+
+        if (data == BINARY_FRAME_DELIMITER) {
+
+            if (!binary_rx_invalid && binary_rx_remaining == 0) {
+
+                binary_frame_complete();
+
+            }
+
+            binary_rx_index = 0;
+            binary_rx_code = 0;
+            binary_rx_remaining = 0;
+            binary_rx_invalid = false;
+
+            continue;
+
+        }
+
+        if (binary_rx_remaining == 0) {
+
+            // Blocks shorter than 254 bytes imply a zero byte in between
+            if (binary_rx_code != 0 && binary_rx_code != 0xFF) {
+
+                binary_rx_append(0);
+
+            }
+
+            binary_rx_code = data;
+            binary_rx_remaining = data - 1;
+
+        } else {
+
+            binary_rx_append(data);
+            binary_rx_remaining--;
+
+        }
+
+    }
+
+}
+
+#endif /* ENABLE_BINARY_PROTOCOL */
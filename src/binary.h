@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file binary.h
+ * @brief Binary framed protocol as an alternative to the text protocol
+ *
+ * This module implements a compact binary protocol on the same UART the text
+ * protocol (proto.h) is using. It is entered explicitly with the `binary`
+ * command of the text protocol and left again with
+ * {@link BINARY_CMD_TEXT}.
+ *
+ * Each request and response is a single frame, which is encoded using
+ * [COBS][1] and terminated by a `0x00` byte. Before encoding a frame looks
+ * like this (multi-byte values are little endian):
+ *
+ * \code
+ *  request:  | command | id | payload ... | crc16 |
+ *  response: | command | id | status | payload ... | crc16 |
+ * \endcode
+ *
+ * The id of the request is echoed back in the response, so responses can be
+ * matched to requests by the host. The CRC is CRC-16/CCITT-FALSE (polynomial
+ * 0x1021, initial value 0xFFFF) over all of the preceding bytes of the frame.
+ * Frames with an invalid CRC are dropped silently.
+ *
+ * For details refer to `doc/BINARY_PROTOCOL.md`.
+ *
+ * [1]: https://en.wikipedia.org/wiki/Consistent_Overhead_Byte_Stuffing
+ *
+ * @see binary.c
+ */
+
+#ifndef _BINARY_H_
+#define _BINARY_H_
+
+#include <stdbool.h>
+
+/**
+ * @brief Maximum size of a decoded frame including id and CRC
+ */
+#define BINARY_FRAME_MAX_SIZE 24
+
+/**
+ * @brief Maximum number of bytes of the FRAM image within a single frame
+ *
+ * This is limited by {@link #BINARY_FRAME_MAX_SIZE}, which needs to hold a
+ * request of {@link BINARY_CMD_FRAM_WRITE} with a chunk of this size.
+ */
+#define BINARY_FRAM_CHUNK_SIZE 16
+
+/**
+ * @brief Delimiter terminating each encoded frame
+ */
+#define BINARY_FRAME_DELIMITER 0x00
+
+/**
+ * @brief Enumeration of commands supported by the binary protocol
+ */
+typedef enum {
+
+    // Keeps the connection alive, no payload
+    BINARY_CMD_PING = 0x01,
+
+    // Returns version (uint8_t) and number of channels (uint8_t)
+    BINARY_CMD_INFO = 0x02,
+
+    // Expects channel (uint8_t), returns enabled, min, max (uint8_t each)
+    // and count (uint32_t)
+    BINARY_CMD_CHANNEL_GET = 0x03,
+
+    // Expects channel, enabled, min and max (uint8_t each)
+    BINARY_CMD_CHANNEL_SET = 0x04,
+
+    // Expects channel (uint8_t) and count (uint32_t)
+    BINARY_CMD_COUNT_SET = 0x05,
+
+    // Switches back to the text protocol after responding
+    BINARY_CMD_TEXT = 0x06,
+
+    // Expects offset (uint16_t) and length (uint8_t), returns up to length
+    // bytes of the FRAM image, less than requested at its end
+    BINARY_CMD_FRAM_READ = 0x07,
+
+    // Expects offset (uint16_t) followed by the bytes to be staged
+    BINARY_CMD_FRAM_WRITE = 0x08,
+
+    // Expects length and CRC (uint16_t each) of the image staged before,
+    // which is verified, copied over the image in use and loaded
+    BINARY_CMD_FRAM_COMMIT = 0x09,
+
+} binary_cmd_t;
+
+/**
+ * @brief Enumeration of status codes contained in each response
+ */
+typedef enum {
+
+    BINARY_STATUS_OK = 0,
+    BINARY_STATUS_UNKNOWN_COMMAND,
+    BINARY_STATUS_INVALID_ARGUMENT,
+
+} binary_status_t;
+
+void binary_enable();
+bool binary_is_enabled();
+void binary_handle();
+
+#endif /* _BINARY_H_ */
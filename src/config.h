@@ -21,14 +21,112 @@
  * @file config.h
  *
  * Configuration file for the whole project
+ *
+ * Each of the switches can be overridden from the command line of the
+ * compiler, e.g. `make FEATURES=-DENABLE_LOGGING=0`, which is used by the
+ * `matrix` target of the Makefile to build various combinations.
  */
 
 #ifndef _CONFIG_H_
 #define _CONFIG_H_
 
+/**
+ * @brief Enables monitoring of the memory usage
+ *
+ * This paints the SRAM during initialization and scans it incrementally
+ * afterwards, see mem.h. It also provides the `memory` command.
+ */
+#ifndef ENABLE_MEMCHECK
 #define ENABLE_MEMCHECK 1
+#endif
 
+/**
+ * @brief Enables the output of log messages
+ *
+ * When disabled, all log calls are compiled out along with their format
+ * strings and the `log` command is not available, see log.h.
+ */
+#ifndef ENABLE_LOGGING
 #define ENABLE_LOGGING 1
+#endif
+
+/**
+ * @brief Enables counters of data loss and buffer usage
+ *
+ * These are maintained by the UART and the FIFOs and output by the `stats`
+ * command. Impulses lost by the S0 module are counted regardless.
+ */
+#ifndef ENABLE_STATS
+#define ENABLE_STATS 1
+#endif
+
+/**
+ * @brief Enables the binary framed protocol
+ *
+ * When enabled, the `binary` command of the text protocol switches over to
+ * the binary protocol implemented in binary.c.
+ */
+#ifndef ENABLE_BINARY_PROTOCOL
+#define ENABLE_BINARY_PROTOCOL 1
+#endif
+
+/**
+ * @brief Enables periodic output of the counts of subscribed channels
+ *
+ * @see push.h
+ */
+#ifndef ENABLE_PUSH
+#define ENABLE_PUSH 1
+#endif
+
+/**
+ * @brief Enables operation on a shared RS-485 bus
+ *
+ * This controls the driver enable pin of a half-duplex transceiver and allows
+ * a unit address to be set, see the `address` command.
+ */
+#ifndef ENABLE_RS485
+#define ENABLE_RS485 0
+#endif
+
+/**
+ * @brief Enables the Modbus RTU slave personality
+ *
+ * When enabled, the `modbus` command of the text protocol switches over to
+ * Modbus RTU persistently, see modbus.h.
+ */
+#ifndef ENABLE_MODBUS
+#define ENABLE_MODBUS 0
+#endif
+
+/**
+ * @brief Enables the SPI slave interface for readout by a host on the board
+ *
+ * This occupies the SPI pins along with PD4 as data ready output, see spi.h.
+ */
+#ifndef ENABLE_SPI
+#define ENABLE_SPI 0
+#endif
+
+/**
+ * @brief Enables sleeping between events along with a tickless timer
+ *
+ * The main loop only runs once ISRs have posted events and puts the MCU into
+ * idle mode otherwise. The timer slows down while no impulse is in progress,
+ * see event.h.
+ */
+#ifndef ENABLE_SLEEP
+#define ENABLE_SLEEP 1
+#endif
+
+/**
+ * @brief Enables profiling of ISR execution times and the CPU load
+ *
+ * This occupies Timer1 as free-running counter, see prof.h.
+ */
+#ifndef ENABLE_PROFILING
+#define ENABLE_PROFILING 0
+#endif
 
 #endif /* _CONFIG_H_ */
 
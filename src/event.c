@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file event.c
+ * @brief Implementation of the header declared in event.h
+ *
+ * A single flag is sufficient to keep track of posted events, as the main
+ * loop runs all of its handlers once woken up anyway. Handlers without
+ * anything to do return right away.
+ *
+ * @see event.h
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "event.h"
+#include "prof.h"
+
+#if ENABLE_SLEEP
+
+/**
+ * @brief Flag indicating that an event has been posted since the last pass
+ *
+ * @see event_post()
+ */
+static volatile bool event_pending;
+
+/**
+ * @brief Number of wake-ups within the current second
+ */
+static volatile uint16_t event_wakeups_current;
+
+/**
+ * @brief Number of wake-ups within the last second
+ *
+ * @see event_get_wakeups()
+ */
+static volatile uint16_t event_wakeups;
+
+/**
+ * @brief Selects idle mode and powers down unused peripherals
+ *
+ * Neither the ADC nor the analog comparator nor Timer2 are used at all,
+ * Timer1 and SPI only when enabled.
+ */
+void event_init()
+{
+
+    ACSR |= _BV(ACD);
+
+    PRR |= _BV(PRADC) | _BV(PRTIM2);
+
+    #if !ENABLE_PROFILING
+        PRR |= _BV(PRTIM1);
+    #endif
+
+    #if !ENABLE_SPI
+        PRR |= _BV(PRSPI);
+    #endif
+
+    set_sleep_mode(SLEEP_MODE_IDLE);
+
+}
+
+/**
+ * @brief Lets the main loop run its handlers once more
+ *
+ * @note This is expected to be called from ISRs leaving work for the main
+ * loop, but may also be called by handlers that haven't finished yet.
+ */
+void event_post()
+{
+
+    event_pending = true;
+
+}
+
+/**
+ * @brief Sleeps until an event has been posted
+ *
+ * Interrupts not posting an event, e.g. for each byte being transmitted,
+ * send the MCU back to sleep right away. Interrupts are enabled right before
+ * entering sleep mode, so an interrupt pending at this point wakes the MCU
+ * up again immediately.
+ *
+ * @note This is expected to be called once per iteration of the main loop.
+ */
+void event_wait()
+{
+
+    #if ENABLE_PROFILING
+        uint32_t since = prof_cycles();
+    #endif
+
+    while (true) {
+
+        cli();
+
+        if (event_pending) {
+
+            event_pending = false;
+            sei();
+
+            break;
+
+        }
+
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+
+        event_wakeups_current++;
+
+    }
+
+    #if ENABLE_PROFILING
+        prof_sleep(since);
+    #endif
+
+}
+
+/**
+ * @brief Latches the number of wake-ups within the last second
+ *
+ * @note This is expected to be called from the timer ISR at 1 Hz.
+ */
+void event_tick()
+{
+
+    event_wakeups = event_wakeups_current;
+    event_wakeups_current = 0;
+
+}
+
+/**
+ * @brief Returns the number of wake-ups within the last second
+ */
+uint16_t event_get_wakeups()
+{
+
+    uint8_t sreg = SREG;
+    cli();
+
+    uint16_t wakeups = event_wakeups;
+
+    SREG = sreg;
+
+    return wakeups;
+
+}
+
+/**
+ * @brief Estimates the average supply current of the MCU in microamperes
+ *
+ * The MCU is assumed to draw {@link #EVENT_CURRENT_ACTIVE} while awake and
+ * {@link #EVENT_CURRENT_IDLE} while sleeping.
+ */
+uint16_t event_get_current()
+{
+
+    // Cycles spent awake per second
+    #if ENABLE_PROFILING
+        uint32_t busy = (uint32_t)prof_get_load() * (F_CPU / 100);
+    #else
+        uint32_t busy = (uint32_t)event_get_wakeups() * EVENT_WAKE_CYCLES;
+    #endif
+
+    if (busy > F_CPU) {
+
+        busy = F_CPU;
+
+    }
+
+    return EVENT_CURRENT_IDLE + (uint32_t)(EVENT_CURRENT_ACTIVE - EVENT_CURRENT_IDLE) * (busy / 1000) / (F_CPU / 1000);
+
+}
+
+#endif /* ENABLE_SLEEP */
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file event.h
+ * @brief Event-driven main loop putting the MCU to sleep between events
+ *
+ * ISRs leaving work for the main loop post an event by calling event_post(),
+ * e.g. when data has been received or an impulse has been detected. Once the
+ * main loop has run all of its handlers, event_wait() puts the MCU into idle
+ * mode until an event is posted. Checking for posted events and going to
+ * sleep is atomic, so events posted in between are never missed.
+ *
+ * Idle mode keeps the timers, the UART and the TWI running, so every
+ * interrupt wakes the MCU up again. Deeper modes (power-save, power-down)
+ * would stop the clock of Timer0 and the UART, as Timer2 is not clocked by an
+ * external crystal on this board, so received data would be lost.
+ *
+ * The number of wake-ups per second and the resulting average current are
+ * estimated for the `power` command. The current is derived from the time the
+ * MCU is awake, which is measured by the profiler if `ENABLE_PROFILING` is
+ * set and estimated from the number of wake-ups otherwise.
+ *
+ * Unless `ENABLE_SLEEP` is set, event_post() expands to nothing and the main
+ * loop keeps spinning.
+ *
+ * @see event.c
+ */
+
+#ifndef _EVENT_H_
+#define _EVENT_H_
+
+#include <stdint.h>
+
+#include "config.h"
+
+/**
+ * @brief Typical supply current of the MCU while active in microamperes
+ *
+ * This is the typical value for the ATmega328P at 8 MHz and 5 V according
+ * to its datasheet.
+ */
+#define EVENT_CURRENT_ACTIVE 5200
+
+/**
+ * @brief Typical supply current of the MCU in idle mode in microamperes
+ *
+ * @see EVENT_CURRENT_ACTIVE
+ */
+#define EVENT_CURRENT_IDLE 1200
+
+/**
+ * @brief Estimated number of cycles the MCU is awake for per wake-up
+ *
+ * This covers the ISR waking the MCU up along with a pass of the main loop.
+ * The actual number of cycles spent within the timer ISR is measured by
+ * `make bench`.
+ */
+#define EVENT_WAKE_CYCLES 500
+
+#if ENABLE_SLEEP
+
+    void event_post();
+
+#else
+
+    #define event_post()
+
+#endif
+
+void event_init();
+void event_wait();
+void event_tick();
+uint16_t event_get_wakeups();
+uint16_t event_get_current();
+
+#endif /* _EVENT_H_ */
@@ -49,6 +49,11 @@ void fifo_init(fifo_t* fifo, uint8_t* buffer, uint8_t size)
 {
 
     fifo->count = 0;
+
+    #if ENABLE_STATS
+        fifo->high = 0;
+    #endif
+
     fifo->pread = buffer;
     fifo->pwrite = buffer;
     fifo->read2end = size;
@@ -103,10 +108,20 @@ bool fifo_put(fifo_t* fifo, uint8_t data)
     fifo->write2end = write2end;
     fifo->pwrite = pwrite;
 
-    // Increment count atomically
+    // Increment count and keep track of high-water mark atomically
     uint8_t sreg = SREG;
     cli();
+
     fifo->count++;
+
+    #if ENABLE_STATS
+        if (fifo->count > fifo->high) {
+
+            fifo->high = fifo->count;
+
+        }
+    #endif
+
     SREG = sreg;
 
     return true;
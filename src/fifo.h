@@ -39,6 +39,8 @@
 
 #include <stdbool.h>
 
+#include "config.h"
+
 /**
  * @brief Typedef for variables holding the organizational data of a FIFO
  *
@@ -58,6 +60,15 @@ typedef struct
      */
     uint8_t size;
 
+    #if ENABLE_STATS
+        /**
+         * @brief Highest number of elements stored at once since initialization
+         *
+         * This can be used to size the buffer based on actual usage.
+         */
+        uint8_t volatile high;
+    #endif
+
     /**
      * @brief Pointer to location where to read from
      */
@@ -17,6 +17,7 @@
  * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <avr/pgmspace.h>
 #include <util/twi.h>
 
 #include "fram.h"
@@ -28,6 +29,8 @@
 #define LOW(w) ((w) & 0xFF)
 #define HIGH(w) ((w) >> 8)
 
+static const char str_fmt_fram[] PROGMEM = "src: %p, dst: %p: %x";
+
 uint8_t fram_read_byte(const uint8_t* src) {
 
     uint8_t data;
@@ -53,7 +56,7 @@ void fram_read_block(const void* src, void* dst, size_t len) {
 
         uint8_t data = i2c_read(i < (len - 1));
 
-        log_output_P(LOG_MODULE_FRAM, LOG_LEVEL_DEBUG, "src: %p, dst: %p: %x", src, dst, data);
+        log_output_S(LOG_MODULE_FRAM, LOG_LEVEL_DEBUG, str_fmt_fram, src, dst, data);
 
         *(uint8_t*)dst = data;
         dst++;
@@ -83,7 +86,7 @@ void fram_write_block(void* dst, const void* src, size_t len) {
 
         uint8_t data = *(uint8_t*)src;
 
-        log_output_P(LOG_MODULE_FRAM, LOG_LEVEL_DEBUG, "src: %p, dst: %p: %x", src, dst, data);
+        log_output_S(LOG_MODULE_FRAM, LOG_LEVEL_DEBUG, str_fmt_fram, src, dst, data);
 
         i2c_write(data);
         src++;
@@ -23,7 +23,12 @@
 #include <inttypes.h>
 #include <stddef.h>
 
+#if defined(__AVR__)
 #define FRAM __attribute__ ((section (".fram")))
+#else
+// Host builds address FRAM relative to the start of the section, see host/fram.c
+#define FRAM __attribute__ ((section ("fram")))
+#endif
 
 uint8_t fram_read_byte(const uint8_t* src);
 void fram_read_block(const void* src, void* dst, size_t len);
@@ -18,6 +18,7 @@
  */
 
 #include <avr/io.h>
+#include <avr/pgmspace.h>
 
 #include <util/twi.h>
 #include <util/delay.h>
@@ -41,6 +42,10 @@
 #define SDA_IS_HIGH     (PIN(SDA) & _BV(BIT(SDA)))
 #define SDA_IS_LOW      (!SDA_IS_HIGH)
 
+static const char str_ack[] PROGMEM = "ack";
+static const char str_nack[] PROGMEM = "nack";
+static const char str_fmt_hex[] PROGMEM = "%02x";
+
 // Waits for operation to be completed on bus
 static void i2c_wait() {
 
@@ -153,13 +158,13 @@ bool i2c_start(uint8_t addr) {
     // Check if slave acknowledged transfer
     if ((TW_STATUS != TW_MT_SLA_ACK) && (TW_STATUS != TW_MR_SLA_ACK)) {
 
-        log_output_P(LOG_MODULE_I2C, LOG_LEVEL_INFO, "nack");
+        log_output_S(LOG_MODULE_I2C, LOG_LEVEL_INFO, str_nack);
 
         return false;
 
     }
 
-    log_output_P(LOG_MODULE_I2C, LOG_LEVEL_INFO, "ack");
+    log_output_S(LOG_MODULE_I2C, LOG_LEVEL_INFO, str_ack);
 
     return true;
 
@@ -184,13 +189,13 @@ bool i2c_write(uint8_t data) {
 
     if (TW_STATUS != TW_MT_DATA_ACK) {
 
-        log_output_P(LOG_MODULE_I2C, LOG_LEVEL_DEBUG, "nack", data);
+        log_output_S(LOG_MODULE_I2C, LOG_LEVEL_DEBUG, str_nack);
 
         return false;
 
     }
 
-    log_output_P(LOG_MODULE_I2C, LOG_LEVEL_INFO, "ack");
+    log_output_S(LOG_MODULE_I2C, LOG_LEVEL_INFO, str_ack);
 
     return true;
 
@@ -204,7 +209,7 @@ uint8_t i2c_read_ack() {
     i2c_wait();
     uint8_t data = TWDR;
 
-    log_output_P(LOG_MODULE_I2C, LOG_LEVEL_DEBUG, "%02x", data);
+    log_output_S(LOG_MODULE_I2C, LOG_LEVEL_DEBUG, str_fmt_hex, data);
 
     return data;
 
@@ -218,7 +223,7 @@ uint8_t i2c_read_nack() {
     i2c_wait();
     uint8_t data = TWDR;
 
-    log_output_P(LOG_MODULE_I2C, LOG_LEVEL_DEBUG, "%02x", data);
+    log_output_S(LOG_MODULE_I2C, LOG_LEVEL_DEBUG, str_fmt_hex, data);
 
     return data;
 
@@ -40,9 +40,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "config.h"
 #include "log.h"
+#include "mem.h"
+#include "scratch.h"
 #include "uart.h"
 
+#if ENABLE_LOGGING
+
+/**
+ * @brief Port log messages are output on
+ *
+ * @see uart_set_route()
+ */
+#define LOG_PORT uart_get_route(UART_STREAM_LOG)
+
 /**
  * @brief Names of modules able to output logging information
  *
@@ -63,6 +75,10 @@ static char const str5[] PROGMEM = "PROTO";
 static char const str6[] PROGMEM = "I2C";
 static char const str7[] PROGMEM = "PREFS";
 static char const str8[] PROGMEM = "FRAM";
+static char const str9[] PROGMEM = "BINARY";
+static char const str10[] PROGMEM = "MODBUS";
+static char const str11[] PROGMEM = "SPI";
+static char const str12[] PROGMEM = "MEM";
 
 static PGM_P const log_module_names[] PROGMEM = {
 
@@ -74,6 +90,10 @@ static PGM_P const log_module_names[] PROGMEM = {
     str6,
     str7,
     str8,
+    str9,
+    str10,
+    str11,
+    str12,
 
 };
 
@@ -138,6 +158,21 @@ void log_disable()
 
 }
 
+/**
+ * @brief Returns whether the logging functionality is enabled globally
+ *
+ * This allows modes that need to disable logging temporarily to restore the
+ * previous state afterwards.
+ *
+ * @see log_enabled
+ */
+bool log_is_enabled()
+{
+
+    return log_enabled;
+
+}
+
 /**
  * @brief Sets log level for a particular module
  *
@@ -186,6 +221,9 @@ log_level_t log_get_level(log_module_t module)
  *
  * Invalid specifiers are simply ignored.
  *
+ * The format string is read from program space if `progmem` is set. The
+ * message is formatted into a buffer allocated from the scratch arena.
+ *
  * The messages is prefixed with {@link #LOG_OUTPUT_PREFIX}. After the message
  * has been output, {@link #LOG_OUTPUT_EOL} is appended, representing the end
  * of each message.
@@ -198,7 +236,7 @@ log_level_t log_get_level(log_module_t module)
  * @see uint8ToStr()
  * @see uint8ToHexStr()
  */
-static void log_output_va(log_module_t module, log_level_t level, const char* fmt, va_list ap)
+static void log_output_va(log_module_t module, log_level_t level, const char* fmt, bool progmem, va_list ap)
 {
 
     // Check log level (globally and for specific module)
@@ -208,22 +246,47 @@ static void log_output_va(log_module_t module, log_level_t level, const char* fm
 
     }
 
+    #if ENABLE_MEMCHECK
+        mem_enter(MEM_CONTEXT_LOG);
+    #endif
+
     // Make sure output buffer is empty
-    uart_flush_output();
+    uart_flush_output(LOG_PORT);
 
     // Output prefix, including module name and separator
-    uart_puts_P(LOG_OUTPUT_PREFIX);
-    uart_puts_p((PGM_P)pgm_read_word(&log_module_names[module]));
-    uart_puts_P(LOG_OUTPUT_SEPARATOR);
+    uart_puts_P(LOG_PORT, LOG_OUTPUT_PREFIX);
+    uart_puts_p(LOG_PORT, (PGM_P)pgm_read_word(&log_module_names[module]));
+    uart_puts_P(LOG_PORT, LOG_OUTPUT_SEPARATOR);
 
     // Output formatted string
-    char str[LOG_FMT_MAX_STR_LEN];
+    scratch_mark_t mark = scratch_mark();
+    char* str = scratch_alloc(LOG_FMT_MAX_STR_LEN);
+
+    if (str != NULL) {
+
+        if (progmem) {
+
+            vsnprintf_P(str, LOG_FMT_MAX_STR_LEN, fmt, ap);
+
+        } else {
 
-    vsnprintf(str, LOG_FMT_MAX_STR_LEN, fmt, ap);
-    uart_puts(str);
+            vsnprintf(str, LOG_FMT_MAX_STR_LEN, fmt, ap);
+
+        }
+
+        uart_puts(LOG_PORT, str);
+
+    }
+
+    scratch_release(mark);
 
     // Output EOL
-    uart_puts_P(LOG_OUTPUT_EOL);
+    uart_puts_P(LOG_PORT, LOG_OUTPUT_EOL);
+
+    #if ENABLE_MEMCHECK
+        mem_sample(false);
+        mem_leave(MEM_CONTEXT_LOG);
+    #endif
 
 }
 
@@ -241,7 +304,7 @@ void log_output(log_module_t module, log_level_t level, const char* fmt, ...)
 
     va_list va;
     va_start(va, fmt);
-    log_output_va(module, level, fmt, va);
+    log_output_va(module, level, fmt, false, va);
     va_end(va);
 
 }
@@ -250,23 +313,19 @@ void log_output(log_module_t module, log_level_t level, const char* fmt, ...)
  * @brief Outputs a log message stored in program space
  *
  * This is essentially a wrapper around {@link #log_output_va()} for format
- * strings stored in program space. After copying over the log format string
- * from program space into a buffer, is uses functionality from `<stdarg.h>` to
- * retrieve a `va_list` and passes everything over to generate the actual
- * output.
+ * strings stored in program space. The format string is processed directly
+ * from program space, so it doesn't need to be copied into a buffer first.
  *
  * @see log_output_va()
  */
 void log_output_p(log_module_t module, log_level_t level, const char* fmt, ...)
 {
 
-    char buffer[LOG_FMT_MAX_STR_LEN];
-    strncpy_P(buffer, fmt, LOG_FMT_MAX_STR_LEN);
-
     va_list va;
     va_start(va, fmt);
-    log_output_va(module, level, buffer, va);
+    log_output_va(module, level, fmt, true, va);
     va_end(va);
 
 }
 
+#endif /* ENABLE_LOGGING */
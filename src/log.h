@@ -34,6 +34,11 @@
  * actually being processed, everything else is silently dropped without
  * wasting too much cycles.
  *
+ * Unless `ENABLE_LOGGING` is set, all of the functions provided by this module
+ * are replaced by empty stubs. The helper macros then expand to dead code, so
+ * arguments are still checked by the compiler, but no format string ends up
+ * in program space.
+ *
  * @see log.c
  */
 
@@ -42,6 +47,10 @@
 
 #include <avr/pgmspace.h>
 
+#include <stdbool.h>
+
+#include "config.h"
+
 /**
  * @brief Enumeration of modules able to output logging information
  *
@@ -60,6 +69,10 @@ typedef enum {
     LOG_MODULE_I2C,
     LOG_MODULE_PREFS,
     LOG_MODULE_FRAM,
+    LOG_MODULE_BINARY,
+    LOG_MODULE_MODBUS,
+    LOG_MODULE_SPI,
+    LOG_MODULE_MEM,
 
     LOG_MODULE_COUNT
 
@@ -105,8 +118,11 @@ typedef enum {
  */
 #define LOG_OUTPUT_EOL "\r\n"
 
+#if ENABLE_LOGGING
+
 void log_enable();
 void log_disable();
+bool log_is_enabled();
 
 void log_set_level(log_module_t module, log_level_t level);
 log_level_t log_get_level(log_module_t module);
@@ -126,5 +142,32 @@ void log_output_p(log_module_t module, log_level_t level, const char* fmt, ...);
  */
 #define log_output_P(module, level, fmt, ...) log_output_p(module, level, PSTR(fmt), ##__VA_ARGS__)
 
+/**
+ * @brief Helper macro to output a format string referenced by its symbol
+ *
+ * This is meant for strings in program space that are used more than once,
+ * e.g. the shared log messages (see str.h).
+ *
+ * @see log_output_p
+ */
+#define log_output_S(module, level, str, ...) log_output_p(module, level, str, ##__VA_ARGS__)
+
+#else
+
+static inline void log_enable() {}
+static inline void log_disable() {}
+static inline bool log_is_enabled() { return false; }
+
+static inline void log_set_level(log_module_t module, log_level_t level) {}
+static inline log_level_t log_get_level(log_module_t module) { return LOG_LEVEL_NONE; }
+
+static inline void log_output(log_module_t module, log_level_t level, const char* fmt, ...) {}
+static inline void log_output_p(log_module_t module, log_level_t level, const char* fmt, ...) {}
+
+#define log_output_P(module, level, fmt, ...) do { if (0) log_output_p(module, level, PSTR(fmt), ##__VA_ARGS__); } while (0)
+#define log_output_S(module, level, str, ...) do { if (0) log_output_p(module, level, str, ##__VA_ARGS__); } while (0)
+
+#endif
+
 #endif /* _LOG_H_ */
 
@@ -53,13 +53,21 @@
 #include <util/delay.h>
 #include <util/twi.h>
 
+#include "config.h"
+#include "event.h"
 #include "i2c.h"
 #include "log.h"
+#include "mem.h"
+#include "modbus.h"
 #include "s0.h"
 #include "timer.h"
 #include "uart.h"
 #include "prefs.h"
 #include "proto.h"
+#include "prof.h"
+#include "push.h"
+#include "spi.h"
+#include "str.h"
 
 /**
  * @brief Main entry point
@@ -88,21 +96,74 @@ __attribute__((OS_main)) int main()
     sei();
 
     // Initialize modules
+    #if ENABLE_PROFILING
+        prof_init();
+    #endif
+
     uart_init();
     s0_init();
     timer_init();
     i2c_init();
     prefs_init();
 
-    log_output_P(LOG_MODULE_MAIN, LOG_LEVEL_DEBUG, "initialized");
-    uart_flush_output();
+    // Invalid rates are rejected, so the default rate is kept in this case
+    if (prefs_get()->baud != UART_BAUD) {
+
+        uart_set_baud(UART_PORT_DEFAULT, prefs_get()->baud);
+
+    }
+
+    #if ENABLE_SPI
+        spi_init();
+    #endif
+
+    #if ENABLE_SLEEP
+        event_init();
+    #endif
+
+    #if ENABLE_RS485
+        // Unsolicited output would collide with other units on the bus
+        if (prefs_get()->address != 0) {
+
+            log_disable();
+            uart_set_bus(true);
+
+        }
+    #endif
+
+    #if ENABLE_MODBUS
+        modbus_init();
+    #endif
+
+    log_output_S(LOG_MODULE_MAIN, LOG_LEVEL_DEBUG, str_initialized);
+    uart_flush_output(uart_get_route(UART_STREAM_LOG));
 
     // Loop forever
     while(1) {
 
+        #if ENABLE_PROFILING
+            prof_loop();
+        #endif
+
         proto_handle();
         s0_handle();
 
+        #if ENABLE_MEMCHECK
+            mem_handle();
+        #endif
+
+        #if ENABLE_PUSH
+            push_handle();
+        #endif
+
+        #if ENABLE_SPI
+            spi_handle();
+        #endif
+
+        #if ENABLE_SLEEP
+            event_wait();
+        #endif
+
     }
 
 }
@@ -29,15 +29,34 @@
  * memory can be determined. This implementation is based on [1], which
  * outlines the concept for the AVR GCC toolchain.
  *
+ * Instead of scanning all of the memory at once, the scan is spread over
+ * multiple calls of mem_handle(), each of which only scans
+ * {@link #MEM_SCAN_CHUNK_SIZE} bytes. As the stack only ever grows deeper,
+ * the scan starts over from the heap start once it has found a modified byte
+ * or has reached the lowest modified byte known so far (mem_low). The minimum
+ * amount of unused memory is then available at any time without delay.
+ *
+ * The lowest {@link #MEM_CANARY_SIZE} bytes above the heap start serve as
+ * canary: Once any of them has been modified, the stack has come close to the
+ * data segment. This is logged and counted as incident, after which the
+ * canary is restored, so further incidents are detected, too.
+ *
  * [1]: http://rn-wissen.de/wiki/index.php/Speicherverbrauch_bestimmen_mit_avr-gcc
  *
  * @see mem.h
  */
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include <stdbool.h>
 
+#include "config.h"
+#include "log.h"
 #include "mem.h"
 
+#if ENABLE_MEMCHECK
+
 /**
  * Bit mask used to distinguish used from unused memory bytes
  *
@@ -50,38 +69,66 @@
  */
 #define MEM_MASK 0xAA
 
+/**
+ * Number of bytes scanned with each call of mem_handle()
+ */
+#define MEM_SCAN_CHUNK_SIZE 32
+
 extern unsigned char __heap_start;
 
+/**
+ * Lowest address known to have been modified by the stack
+ *
+ * @see mem_handle()
+ */
+static unsigned char* mem_low = (unsigned char*)RAMEND + 1;
+
+/**
+ * Address the incremental scan continues at
+ */
+static unsigned char* mem_scan = &__heap_start;
+
+/**
+ * Number of times the canary has been found to be modified
+ */
+static uint16_t mem_incidents;
+
+/**
+ * Bitmask of contexts (mem_context_t) the main loop is currently within
+ *
+ * @see mem_enter()
+ */
+static volatile uint8_t mem_context;
+
+/**
+ * Maximum stack depth observed for each combination of contexts
+ *
+ * @see mem_sample()
+ */
+static uint16_t mem_depth[MEM_PATHS];
+
+/**
+ * Flag indicating that the next chunk is due to be scanned
+ *
+ * @see mem_tick()
+ */
+static volatile bool mem_scan_due;
+
 /**
  * Returns minimum amount of unused bytes
  *
- * This scans over the SRAM and looks for a {@link MEM_MASK specific} bit
- * pattern. It returns the number of bytes that are currently set to this bit
- * pattern, which are all of the bytes that were not yet modified by the stack.
+ * This returns the number of bytes between the heap start and the lowest
+ * byte modified by the stack, as determined by the incremental scan so far.
  *
  * @return Minimum number of unused bytes
  *
  * @see MEM_MASK
+ * @see mem_handle()
  */
 size_t mem_free_min()
 {
 
-   size_t free = 0;
-   unsigned char *p = &__heap_start;
-
-   do {
-
-       if (*p++ != MEM_MASK) {
-
-           break;
-
-       }
-
-      free++;
-
-   } while (p <= (unsigned char*)RAMEND);
-
-   return free;
+   return mem_low - &__heap_start;
 
 }
 
@@ -103,6 +150,173 @@ size_t mem_free_cur()
 
 }
 
+/**
+ * Returns the number of times the stack has come close to the data segment
+ *
+ * @see MEM_CANARY_SIZE
+ */
+uint16_t mem_get_incidents()
+{
+
+    return mem_incidents;
+
+}
+
+/**
+ * Marks the next chunk of memory as due to be scanned
+ *
+ * @note This is expected to be called from the timer ISR at 100 Hz.
+ */
+void mem_tick()
+{
+
+    mem_scan_due = true;
+
+}
+
+/**
+ * Checks the canary and scans the next chunk of memory
+ *
+ * @note This is expected to be called from within the main loop, where the
+ * stack is shallow, so the canary can be restored safely.
+ */
+void mem_handle()
+{
+
+    if (!mem_scan_due) {
+
+        return;
+
+    }
+
+    mem_scan_due = false;
+
+    // Check canary
+    bool intact = true;
+
+    for (unsigned char* p = &__heap_start; p < &__heap_start + MEM_CANARY_SIZE; p++) {
+
+        if (*p != MEM_MASK) {
+
+            if (p < mem_low) {
+
+                mem_low = p;
+
+            }
+
+            *p = MEM_MASK;
+            intact = false;
+
+        }
+
+    }
+
+    if (!intact) {
+
+        mem_incidents++;
+
+        log_output_P(LOG_MODULE_MEM, LOG_LEVEL_WARN, "canary modified, incidents: %u", mem_incidents);
+
+    }
+
+    // Scan next chunk
+    for (uint8_t i = 0; i < MEM_SCAN_CHUNK_SIZE; i++) {
+
+        if (mem_scan >= mem_low) {
+
+            mem_scan = &__heap_start;
+
+            break;
+
+        }
+
+        if (*mem_scan != MEM_MASK) {
+
+            mem_low = mem_scan;
+            mem_scan = &__heap_start;
+
+            break;
+
+        }
+
+        mem_scan++;
+
+    }
+
+}
+
+/**
+ * Marks the given context as entered by the main loop
+ *
+ * Contexts can be nested, e.g. a log message can be output while processing
+ * a command. Samples of the stack depth are accounted for each combination
+ * of contexts individually.
+ *
+ * @see mem_leave()
+ */
+void mem_enter(mem_context_t context)
+{
+
+    mem_context |= context;
+
+}
+
+void mem_leave(mem_context_t context)
+{
+
+    mem_context &= ~context;
+
+}
+
+/**
+ * Samples the current stack depth for the current combination of contexts
+ *
+ * This is called at points where the stack is expected to be deep. As it is
+ * also called from the timer ISR, samples are taken at arbitrary points of
+ * the main loop, too.
+ *
+ * @param isr True if called from within an ISR
+ */
+void mem_sample(bool isr)
+{
+
+    uint8_t sreg = SREG;
+    cli();
+
+    uint8_t path = mem_context | (isr ? MEM_CONTEXT_ISR : 0);
+    uint16_t depth = RAMEND - SP;
+
+    if (depth > mem_depth[path]) {
+
+        mem_depth[path] = depth;
+
+    }
+
+    SREG = sreg;
+
+}
+
+/**
+ * Returns the maximum stack depth observed for a combination of contexts
+ *
+ * @param path Bitmask of contexts, see mem_context_t
+ *
+ * @return Stack depth in bytes, zero if never sampled
+ */
+uint16_t mem_get_depth(uint8_t path)
+{
+
+    uint8_t sreg = SREG;
+    cli();
+
+    uint16_t depth = mem_depth[path];
+
+    SREG = sreg;
+
+    return depth;
+
+}
+
 void __attribute__ ((naked, used, section(".init3"))) mem_init();
 
 /**
@@ -127,3 +341,4 @@ void mem_init()
 
 }
 
+#endif /* ENABLE_MEMCHECK */
@@ -22,16 +22,58 @@
  * 
  * Provides means to check the memory usage during runtime.
  *
+ * Besides the minimum amount of unused memory, the maximum stack depth is
+ * tracked for each combination of contexts (mem_context_t), e.g. an ISR
+ * interrupting the output of a log message while a command is processed.
+ *
  * @see mem.c
  */
 
 #ifndef _MEM_H_
 #define _MEM_H_
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
+/**
+ * Number of bytes above the heap start serving as canary
+ *
+ * Once the stack reaches into this area, it has come close to colliding with
+ * the data segment.
+ *
+ * @see mem_get_incidents()
+ */
+#define MEM_CANARY_SIZE 16
+
+/**
+ * Enumeration of contexts, which stack depth samples are accounted for
+ *
+ * These are bits, which are combined to describe nested contexts.
+ *
+ * @see mem_enter()
+ */
+typedef enum {
+
+    MEM_CONTEXT_PROTO = (1 << 0),
+    MEM_CONTEXT_LOG = (1 << 1),
+    MEM_CONTEXT_ISR = (1 << 2),
+
+} mem_context_t;
+
+/**
+ * Number of possible combinations of contexts
+ */
+#define MEM_PATHS 8
+
 size_t mem_free_min();
 size_t mem_free_cur();
+uint16_t mem_get_incidents();
+void mem_tick();
+void mem_handle();
+void mem_enter(mem_context_t context);
+void mem_leave(mem_context_t context);
+void mem_sample(bool isr);
+uint16_t mem_get_depth(uint8_t path);
 
 #endif  /* _MEM_H_ */
-
@@ -0,0 +1,632 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file modbus.c
+ * @brief Implementation of the header declared in modbus.h
+ *
+ * Frames are delimited by silence on the line as detected by the UART module
+ * (uart_get_rx_idle()), so incoming data can be collected from the UART
+ * buffer at any time. Responses are built directly from the values kept in
+ * RAM by the prefs module, without any formatting being involved.
+ *
+ * @see modbus.h
+ */
+
+#include <avr/pgmspace.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "log.h"
+#include "modbus.h"
+#include "prefs.h"
+#include "str.h"
+#include "uart.h"
+
+#if ENABLE_MODBUS
+
+/**
+ * @brief Port frames are exchanged on, which is the one of the text protocol
+ *
+ * @see uart_set_route()
+ */
+#define MODBUS_PORT uart_get_route(UART_STREAM_PROTO)
+
+/**
+ * @brief Size of the buffer for incoming frames
+ *
+ * This is large enough for all read requests and for writing the holding
+ * registers of a few channels at once.
+ */
+#define MODBUS_FRAME_MAX_SIZE 32
+
+/**
+ * @brief Maximum number of registers that can be read with a single request
+ *
+ * The complete response needs to fit into the transmission buffer of the
+ * UART, as there must not be any gaps within a frame.
+ */
+#define MODBUS_READ_MAX ((UART_BUFFER_SIZE_OUT - 5) / 2)
+
+#define MODBUS_FC_READ_HOLDING 0x03
+#define MODBUS_FC_READ_INPUT 0x04
+#define MODBUS_FC_WRITE_SINGLE 0x06
+#define MODBUS_FC_WRITE_MULTIPLE 0x10
+
+#define MODBUS_EX_ILLEGAL_FUNCTION 0x01
+#define MODBUS_EX_ILLEGAL_ADDRESS 0x02
+#define MODBUS_EX_ILLEGAL_VALUE 0x03
+
+/**
+ * @brief Lookup table for the Modbus CRC (polynomial 0xA001, reflected)
+ */
+static const uint16_t modbus_crc_table[256] PROGMEM = {
+
+    0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
+    0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
+    0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+    0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
+    0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
+    0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+    0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
+    0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
+    0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+    0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
+    0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
+    0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+    0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
+    0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
+    0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+    0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
+    0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
+    0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+    0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
+    0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
+    0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+    0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
+    0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
+    0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+    0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
+    0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
+    0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+    0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
+    0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
+    0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+    0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
+    0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040,
+
+};
+
+/**
+ * @brief Buffer holding the frame that is currently being received
+ */
+static uint8_t modbus_frame[MODBUS_FRAME_MAX_SIZE];
+
+/**
+ * @brief Number of bytes within modbus_frame, or more if it has overflowed
+ */
+static uint8_t modbus_frame_len;
+
+/**
+ * @brief CRC of the response currently being output
+ */
+static uint16_t modbus_tx_crc;
+
+/**
+ * @brief Flag indicating that the current request has been broadcast
+ *
+ * Broadcast requests are processed, but never responded to.
+ */
+static bool modbus_broadcast;
+
+/**
+ * @brief Whether logging was enabled before switching to Modbus
+ *
+ * This is restored when switching back to the text protocol.
+ */
+static bool modbus_log_enabled;
+
+static uint16_t modbus_crc_update(uint16_t crc, uint8_t data)
+{
+
+    return (crc >> 8) ^ pgm_read_word(&modbus_crc_table[(crc ^ data) & 0xFF]);
+
+}
+
+static uint16_t modbus_word(const uint8_t* data)
+{
+
+    return (data[0] << 8) | data[1];
+
+}
+
+static void modbus_putc(uint8_t data)
+{
+
+    modbus_tx_crc = modbus_crc_update(modbus_tx_crc, data);
+    uart_putc(MODBUS_PORT, data);
+
+}
+
+static void modbus_put_word(uint16_t data)
+{
+
+    modbus_putc(data >> 8);
+    modbus_putc(data & 0xFF);
+
+}
+
+static void modbus_response_begin(uint8_t function)
+{
+
+    uart_flush_output(MODBUS_PORT);
+
+    modbus_tx_crc = 0xFFFF;
+    modbus_putc(modbus_frame[0]);
+    modbus_putc(function);
+
+}
+
+static void modbus_response_end()
+{
+
+    // CRC is transmitted low byte first
+    uint16_t crc = modbus_tx_crc;
+
+    uart_putc(MODBUS_PORT, crc & 0xFF);
+    uart_putc(MODBUS_PORT, crc >> 8);
+
+}
+
+static void modbus_exception(uint8_t code)
+{
+
+    if (modbus_broadcast) {
+
+        return;
+
+    }
+
+    modbus_response_begin(modbus_frame[1] | 0x80);
+    modbus_putc(code);
+    modbus_response_end();
+
+}
+
+/**
+ * @brief Returns the value of an input register
+ *
+ * Input registers contain the counts of the channels, with two consecutive
+ * registers for each channel, high word first.
+ */
+static uint16_t modbus_input_register(uint16_t reg)
+{
+
+    uint32_t count = prefs_get()->channels[reg / 2].count;
+
+    return (reg % 2) ? (count & 0xFFFF) : (count >> 16);
+
+}
+
+/**
+ * @brief Returns the value of a holding register
+ *
+ * Holding registers contain enabled, min and max of each channel.
+ */
+static uint16_t modbus_holding_register(uint16_t reg)
+{
+
+    if (reg == MODBUS_REG_MODE) {
+
+        return 1;
+
+    }
+
+    channel_prefs_t* channel = &(prefs_get()->channels[reg / MODBUS_HOLDING_PER_CHANNEL]);
+
+    switch (reg % MODBUS_HOLDING_PER_CHANNEL) {
+
+        case 0:
+            return channel->enabled;
+
+        case 1:
+            return channel->min;
+
+        default:
+            return channel->max;
+
+    }
+
+}
+
+/**
+ * @brief Checks whether a holding register can be set to the given value
+ *
+ * @return Exception code, or zero if the register can be set
+ */
+static uint8_t modbus_holding_check(uint16_t reg, uint16_t value)
+{
+
+    if (reg == MODBUS_REG_MODE) {
+
+        return (value == 0) ? 0 : MODBUS_EX_ILLEGAL_VALUE;
+
+    }
+
+    if (reg >= CHANNELS * MODBUS_HOLDING_PER_CHANNEL) {
+
+        return MODBUS_EX_ILLEGAL_ADDRESS;
+
+    }
+
+    if (value > ((reg % MODBUS_HOLDING_PER_CHANNEL == 0) ? 1 : UINT8_MAX)) {
+
+        return MODBUS_EX_ILLEGAL_VALUE;
+
+    }
+
+    return 0;
+
+}
+
+/**
+ * @brief Sets a holding register, which needs to be checked beforehand
+ *
+ * @see modbus_holding_check()
+ */
+static void modbus_set_holding_register(uint16_t reg, uint16_t value)
+{
+
+    if (reg == MODBUS_REG_MODE) {
+
+        // Switch back to text protocol after the response has been sent
+        prefs_get()->modbus = false;
+
+        return;
+
+    }
+
+    channel_prefs_t* channel = &(prefs_get()->channels[reg / MODBUS_HOLDING_PER_CHANNEL]);
+
+    switch (reg % MODBUS_HOLDING_PER_CHANNEL) {
+
+        case 0:
+            channel->enabled = value;
+            break;
+
+        case 1:
+            channel->min = value;
+            break;
+
+        default:
+            channel->max = value;
+
+    }
+
+}
+
+/**
+ * @brief Processes a complete frame with a valid CRC addressed to this unit
+ *
+ * @param len Length of the frame without its CRC
+ */
+static void modbus_process(uint8_t len)
+{
+
+    uint8_t function = modbus_frame[1];
+    uint16_t start = modbus_word(&modbus_frame[2]);
+    uint16_t quantity = modbus_word(&modbus_frame[4]);
+
+    // Number of registers written, a single one unless writing multiple
+    uint16_t written = 1;
+
+    switch (function) {
+
+        case MODBUS_FC_READ_HOLDING:
+        case MODBUS_FC_READ_INPUT: {
+
+            if (modbus_broadcast) {
+
+                return;
+
+            }
+
+            if (len != 6 || quantity == 0 || quantity > MODBUS_READ_MAX) {
+
+                modbus_exception(MODBUS_EX_ILLEGAL_VALUE);
+
+                return;
+
+            }
+
+            bool input = (function == MODBUS_FC_READ_INPUT);
+            uint16_t end = input ? CHANNELS * 2 : CHANNELS * MODBUS_HOLDING_PER_CHANNEL;
+
+            if (!input && start == MODBUS_REG_MODE && quantity == 1) {
+
+                end = MODBUS_REG_MODE + 1;
+
+            }
+
+            if (start >= end || quantity > end - start) {
+
+                modbus_exception(MODBUS_EX_ILLEGAL_ADDRESS);
+
+                return;
+
+            }
+
+            modbus_response_begin(function);
+            modbus_putc(quantity * 2);
+
+            for (uint16_t reg = start; reg < start + quantity; reg++) {
+
+                modbus_put_word(input ? modbus_input_register(reg) : modbus_holding_register(reg));
+
+            }
+
+            modbus_response_end();
+
+            return;
+
+        }
+
+        case MODBUS_FC_WRITE_SINGLE: {
+
+            // The value is located where the quantity is for other functions
+            uint8_t exception = (len != 6) ? MODBUS_EX_ILLEGAL_VALUE : modbus_holding_check(start, quantity);
+
+            if (exception) {
+
+                modbus_exception(exception);
+
+                return;
+
+            }
+
+            modbus_set_holding_register(start, quantity);
+
+            break;
+
+        }
+
+        case MODBUS_FC_WRITE_MULTIPLE: {
+
+            if (len != 7 + quantity * 2 || modbus_frame[6] != quantity * 2) {
+
+                modbus_exception(MODBUS_EX_ILLEGAL_VALUE);
+
+                return;
+
+            }
+
+            // Validate everything before applying anything
+            for (uint16_t i = 0; i < quantity; i++) {
+
+                uint8_t exception = modbus_holding_check(start + i, modbus_word(&modbus_frame[7 + i * 2]));
+
+                if (exception) {
+
+                    modbus_exception(exception);
+
+                    return;
+
+                }
+
+            }
+
+            for (uint16_t i = 0; i < quantity; i++) {
+
+                modbus_set_holding_register(start + i, modbus_word(&modbus_frame[7 + i * 2]));
+
+            }
+
+            written = quantity;
+
+            break;
+
+        }
+
+        default:
+
+            modbus_exception(MODBUS_EX_ILLEGAL_FUNCTION);
+
+            return;
+
+    }
+
+    // Only the preferences actually written are persisted
+    if (start == MODBUS_REG_MODE) {
+
+        prefs_save_block(&(prefs_get()->modbus), sizeof(bool));
+
+    } else {
+
+        uint8_t first = start / MODBUS_HOLDING_PER_CHANNEL;
+        uint8_t last = (start + written - 1) / MODBUS_HOLDING_PER_CHANNEL;
+
+        prefs_save_block(&(prefs_get()->channels[first]), (last - first + 1) * sizeof(channel_prefs_t));
+
+    }
+
+    if (!modbus_broadcast) {
+
+        // Response to writes echoes address, function, start and quantity/value
+        modbus_response_begin(function);
+        modbus_put_word(start);
+        modbus_put_word(quantity);
+        modbus_response_end();
+
+    }
+
+    if (!prefs_get()->modbus) {
+
+        uart_flush_output(MODBUS_PORT);
+
+        if (modbus_log_enabled) {
+
+            log_enable();
+
+        }
+
+    }
+
+}
+
+/**
+ * @brief Checks address and CRC of a received frame and processes it
+ */
+static void modbus_frame_complete()
+{
+
+    uint8_t len = modbus_frame_len;
+
+    // Address, function and CRC are mandatory, longer frames are unsupported
+    if (len < 4 || len > MODBUS_FRAME_MAX_SIZE) {
+
+        return;
+
+    }
+
+    uint8_t address = prefs_get()->address ? prefs_get()->address : MODBUS_DEFAULT_ADDRESS;
+
+    if (modbus_frame[0] != address && modbus_frame[0] != 0) {
+
+        return;
+
+    }
+
+    uint16_t crc = 0xFFFF;
+
+    for (uint8_t i = 0; i < len; i++) {
+
+        crc = modbus_crc_update(crc, modbus_frame[i]);
+
+    }
+
+    // The CRC over the whole frame including its CRC is zero for valid frames
+    if (crc != 0) {
+
+        log_output_S(LOG_MODULE_MODBUS, LOG_LEVEL_DEBUG, str_crc_mismatch);
+
+        return;
+
+    }
+
+    modbus_broadcast = (modbus_frame[0] == 0);
+    modbus_process(len - 2);
+
+}
+
+bool modbus_is_enabled()
+{
+
+    return prefs_get()->modbus;
+
+}
+
+/**
+ * @brief Disables logging, remembering whether it was enabled before
+ *
+ * Log messages would corrupt the frames.
+ */
+static void modbus_suspend_log()
+{
+
+    modbus_log_enabled = log_is_enabled();
+
+    log_disable();
+
+}
+
+/**
+ * @brief Takes over the UART if Modbus has been enabled persistently
+ *
+ * This is expected to be called once during startup, after anything else
+ * deciding upon logging, e.g. the RS-485 address.
+ */
+void modbus_init()
+{
+
+    if (prefs_get()->modbus) {
+
+        modbus_suspend_log();
+
+    }
+
+}
+
+/**
+ * @brief Switches from the text protocol to Modbus RTU persistently
+ */
+void modbus_enable()
+{
+
+    modbus_frame_len = 0;
+
+    prefs_get()->modbus = true;
+    prefs_save_block(&(prefs_get()->modbus), sizeof(bool));
+
+    modbus_suspend_log();
+
+}
+
+/**
+ * @brief Collects incoming data and processes complete frames
+ *
+ * This is expected to be called from proto_handle() whenever Modbus is
+ * enabled. A frame is considered to be complete once there has been silence
+ * for at least {@link #MODBUS_T35_TICKS} after the last byte.
+ */
+void modbus_handle()
+{
+
+    char c;
+
+    while (uart_getc_nowait(MODBUS_PORT, &c)) {
+
+        // Keep counting on overflow, so the frame is discarded as a whole
+        if (modbus_frame_len < MODBUS_FRAME_MAX_SIZE) {
+
+            modbus_frame[modbus_frame_len] = c;
+
+        }
+
+        if (modbus_frame_len < UINT8_MAX) {
+
+            modbus_frame_len++;
+
+        }
+
+    }
+
+    if (modbus_frame_len == 0 || uart_get_rx_idle(MODBUS_PORT) < MODBUS_T35_TICKS) {
+
+        return;
+
+    }
+
+    modbus_frame_complete();
+    modbus_frame_len = 0;
+
+}
+
+#endif /* ENABLE_MODBUS */
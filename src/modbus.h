@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file modbus.h
+ * @brief Modbus RTU slave as an alternative personality of the UART
+ *
+ * Once enabled with the `modbus` command of the text protocol, the UART
+ * speaks Modbus RTU instead of the text protocol. This setting is persisted,
+ * so the unit keeps being a Modbus slave across power cycles, until
+ * {@link #MODBUS_REG_MODE} is set to zero.
+ *
+ * The slave address is the address set with the `address` command, or
+ * {@link #MODBUS_DEFAULT_ADDRESS} if none has been set.
+ *
+ * The following function codes are supported:
+ *
+ * - 0x03: Read holding registers
+ * - 0x04: Read input registers
+ * - 0x06: Write single register
+ * - 0x10: Write multiple registers
+ *
+ * For the register map refer to `doc/MODBUS.md`.
+ *
+ * @see modbus.c
+ */
+
+#ifndef _MODBUS_H_
+#define _MODBUS_H_
+
+#include <stdbool.h>
+
+/**
+ * @brief Slave address used when no address has been set
+ */
+#define MODBUS_DEFAULT_ADDRESS 1
+
+/**
+ * @brief Number of timer ticks (1 ms each) of silence terminating a frame
+ *
+ * For baud rates above 19200 the specification recommends a fixed value of
+ * 1.75 ms for the 3.5 character times. With a resolution of 1 ms, two ticks
+ * make sure that at least one full millisecond has passed.
+ */
+#define MODBUS_T35_TICKS 2
+
+/**
+ * @brief Number of holding registers per channel (enabled, min, max)
+ */
+#define MODBUS_HOLDING_PER_CHANNEL 3
+
+/**
+ * @brief Holding register switching back to the text protocol if set to zero
+ */
+#define MODBUS_REG_MODE 0x0100
+
+bool modbus_is_enabled();
+void modbus_init();
+void modbus_enable();
+void modbus_handle();
+
+#endif /* _MODBUS_H_ */
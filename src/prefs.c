@@ -17,19 +17,69 @@
  * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stddef.h>
 #include <string.h>
 #include <stdbool.h>
 
 #include "fram.h"
 #include "log.h"
 #include "prefs.h"
+#include "uart.h"
 #include "version.h"
 
 #define membersize(type, member) sizeof(((type *)0)->member)
 
+/**
+ * @brief Number of bytes copied at once by prefs_commit_image()
+ */
+#define PREFS_COPY_CHUNK_SIZE 8
+
 static prefs_t prefs_fram FRAM;
 static prefs_t prefs;
 
+/**
+ * @brief Area images being restored are written to, see prefs_write_image()
+ *
+ * Counts keep being saved to prefs_fram while an image is being written, so
+ * it is staged separately and only copied over once it has been verified.
+ */
+static prefs_t prefs_staging FRAM;
+
+/**
+ * @brief Global change sequence number
+ *
+ * This is incremented whenever any of the channels is changed, i.e. its
+ * count or its configuration. It is not persisted, but starts at one after
+ * each reset with all of the channels considered changed. Hosts tell these
+ * apart by the epoch, see prefs_get_epoch().
+ *
+ * @see prefs_get_sequence()
+ */
+static uint32_t prefs_sequence = 1;
+
+/**
+ * @brief Sequence number of the last change of each channel
+ *
+ * @see prefs_get_channel_sequence()
+ */
+static uint32_t prefs_sequences[CHANNELS];
+
+/**
+ * @brief Records a change of the given range of channels
+ */
+static void prefs_changed(uint8_t first, uint8_t last)
+{
+
+    prefs_sequence++;
+
+    for (uint8_t i = first; i <= last; i++) {
+
+        prefs_sequences[i] = prefs_sequence;
+
+    }
+
+}
+
 static const prefs_t prefs_defaults PROGMEM = {
 
     VERSION,
@@ -46,36 +96,84 @@ static const prefs_t prefs_defaults PROGMEM = {
         { true, 25, 35, 0 },
     },
 
-};
+    0,
+    false,
+    UART_BAUD,
+    0,
 
-void prefs_init() {
+};
 
-    fram_read_block(&prefs_fram, &prefs, sizeof(prefs_t));
+/**
+ * @brief Checks whether the header of preferences found in FRAM is usable
+ *
+ * @return True if the preferences can be loaded, false if they need to be
+ * reset to their defaults
+ */
+static bool prefs_check(version_t version, size_t length)
+{
 
-    bool mismatch = false;
+    bool valid = true;
 
-    if (prefs.version != VERSION) {
+    if (version != VERSION) {
 
-        log_output_P(LOG_MODULE_PREFS, LOG_LEVEL_DEBUG, "version mismatch: %d != %d", prefs.version, VERSION);
+        log_output_P(LOG_MODULE_PREFS, LOG_LEVEL_DEBUG, "version mismatch: %d != %d", version, VERSION);
 
-        mismatch = true;
+        valid = false;
 
     }
 
-    if (prefs.length != sizeof(prefs_t)) {
+    if (length > sizeof(prefs_t) || length < offsetof(prefs_t, channels) + sizeof(prefs.channels)) {
 
-        log_output_P(LOG_MODULE_PREFS, LOG_LEVEL_DEBUG, "length mismatch: %d != %d", prefs.length, sizeof(prefs_t));
+        log_output_P(LOG_MODULE_PREFS, LOG_LEVEL_DEBUG, "length mismatch: %d != %d", length, sizeof(prefs_t));
 
-        mismatch = true;
+        valid = false;
 
     }
 
-    if (mismatch) {
+    return valid;
+
+}
+
+/**
+ * @brief Loads the preferences from FRAM, upgrading or resetting them
+ */
+static void prefs_load()
+{
+
+    fram_read_block(&prefs_fram, &prefs, sizeof(prefs_t));
+
+    if (!prefs_check(prefs.version, prefs.length)) {
 
         prefs_reset();
 
+    } else if (prefs.length < sizeof(prefs_t)) {
+
+        // Members appended since the preferences were saved get their defaults
+        log_output_P(LOG_MODULE_PREFS, LOG_LEVEL_DEBUG, "upgrading: %d -> %d", prefs.length, sizeof(prefs_t));
+
+        memcpy_P((uint8_t*)&prefs + prefs.length, (const uint8_t*)&prefs_defaults + prefs.length, sizeof(prefs_t) - prefs.length);
+        prefs.length = sizeof(prefs_t);
+
+        prefs_save();
+
+    }
+
+    // Sequence numbers start over, so they need to be told apart from before
+    prefs.epoch++;
+    prefs_save_block(&prefs.epoch, sizeof(prefs.epoch));
+
+}
+
+void prefs_init() {
+
+    for (uint8_t i = 0; i < CHANNELS; i++) {
+
+        prefs_sequences[i] = prefs_sequence;
+
     }
 
+    prefs_load();
+
 }
 
 prefs_t* prefs_get() {
@@ -90,6 +188,8 @@ void prefs_save() {
 
     fram_write_block(&prefs_fram, &prefs, sizeof(prefs_t));
 
+    prefs_changed(0, CHANNELS - 1);
+
 }
 
 void prefs_save_block(const void* src, size_t len) {
@@ -100,14 +200,160 @@ void prefs_save_block(const void* src, size_t len) {
 
     fram_write_block((void*)((size_t)&prefs_fram + (size_t)offset), (const void*)((size_t)&prefs + (size_t)offset), len);
 
+    // Determine the affected channels, if any
+    size_t begin = offsetof(prefs_t, channels);
+    size_t end = begin + sizeof(prefs.channels);
+
+    if (offset + len > begin && offset < end) {
+
+        uint8_t first = (offset < begin) ? 0 : (offset - begin) / sizeof(channel_prefs_t);
+        uint8_t last = (offset + len >= end) ? CHANNELS - 1 : (offset + len - 1 - begin) / sizeof(channel_prefs_t);
+
+        prefs_changed(first, last);
+
+    }
+
+}
+
+/**
+ * @brief Returns the current epoch of the change sequence numbers
+ *
+ * The epoch is persisted and incremented each time the preferences are
+ * loaded, i.e. after each reset and after an image has been restored. Change
+ * sequence numbers are only comparable within the same epoch.
+ *
+ * @see prefs_get_sequence()
+ */
+uint32_t prefs_get_epoch() {
+
+    return prefs.epoch;
+
+}
+
+/**
+ * @brief Returns the current change sequence number
+ *
+ * @see prefs_sequence
+ */
+uint32_t prefs_get_sequence() {
+
+    return prefs_sequence;
+
+}
+
+/**
+ * @brief Returns the sequence number of the last change of a channel
+ *
+ * @see prefs_sequences
+ */
+uint32_t prefs_get_channel_sequence(uint8_t channel) {
+
+    return prefs_sequences[channel];
+
 }
 
 void prefs_reset() {
 
     log_output_P(LOG_MODULE_PREFS, LOG_LEVEL_DEBUG, "resetting");
 
+    // Keep the epoch, so it doesn't repeat one a host might have seen before
+    uint32_t epoch = prefs.epoch;
+
     memcpy_P(&prefs, &prefs_defaults, sizeof(prefs_t));
+    prefs.epoch = epoch;
+
     prefs_save();
 
 }
 
+/**
+ * @brief Reads a range of the image of the preferences in use within FRAM
+ *
+ * Offsets are relative to the start of the preferences. The range is
+ * expected to be within the image, i.e. within prefs_t.
+ */
+void prefs_read_image(uint16_t offset, void* dst, uint8_t len) {
+
+    fram_read_block((const uint8_t*)&prefs_fram + offset, dst, len);
+
+}
+
+/**
+ * @brief Writes a range of an image to be restored into the staging area
+ *
+ * Neither the preferences in use nor their image within FRAM are affected
+ * until the image is committed, see prefs_commit_image().
+ *
+ * @see prefs_read_image()
+ */
+void prefs_write_image(uint16_t offset, const void* src, uint8_t len) {
+
+    fram_write_block((uint8_t*)&prefs_staging + offset, src, len);
+
+}
+
+/**
+ * @brief Reads a range of the image within the staging area
+ *
+ * This allows the image to be verified as written before committing it.
+ *
+ * @see prefs_write_image()
+ */
+void prefs_read_staged(uint16_t offset, void* dst, uint8_t len) {
+
+    fram_read_block((const uint8_t*)&prefs_staging + offset, dst, len);
+
+}
+
+/**
+ * @brief Copies the staged image over the preferences in use and loads it
+ *
+ * The image is only copied if its header is valid and its length matches the
+ * one given, otherwise the preferences in use are left alone. Sequence numbers carry on, so the epoch in use is
+ * kept rather than the one of the image. All of the channels are considered
+ * changed.
+ *
+ * @param length Number of bytes of the image as staged
+ *
+ * @return True if the image has been loaded, false otherwise
+ *
+ * @see prefs_write_image()
+ */
+bool prefs_commit_image(uint16_t length) {
+
+    version_t version;
+    size_t size;
+
+    fram_read_block(&prefs_staging.version, &version, sizeof(version));
+    fram_read_block(&prefs_staging.length, &size, sizeof(size));
+
+    // Anything else would mix the image with stale bytes of the staging area
+    if (length != size || !prefs_check(version, size)) {
+
+        return false;
+
+    }
+
+    uint8_t chunk[PREFS_COPY_CHUNK_SIZE];
+
+    for (uint16_t offset = 0; offset < length; offset += sizeof(chunk)) {
+
+        uint8_t len = (length - offset < sizeof(chunk)) ? length - offset : sizeof(chunk);
+
+        fram_read_block((const uint8_t*)&prefs_staging + offset, chunk, len);
+        fram_write_block((uint8_t*)&prefs_fram + offset, chunk, len);
+
+    }
+
+    uint32_t epoch = prefs.epoch;
+
+    prefs_load();
+
+    prefs.epoch = epoch;
+    prefs_save_block(&prefs.epoch, sizeof(prefs.epoch));
+
+    prefs_changed(0, CHANNELS - 1);
+
+    return true;
+
+}
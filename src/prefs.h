@@ -46,6 +46,13 @@ typedef struct {
 
 } channel_prefs_t;
 
+/**
+ * @brief Layout of the preferences stored in FRAM
+ *
+ * @note New members must only be appended at the end. Preferences saved by
+ * a previous firmware are upgraded by prefs_init() without losing the counts
+ * in this case.
+ */
 typedef struct {
 
     version_t version;
@@ -54,6 +61,18 @@ typedef struct {
 
     channel_prefs_t channels[CHANNELS];
 
+    // Address on a shared bus, zero if not operated on a bus
+    uint8_t address;
+
+    // Whether the UART speaks Modbus RTU instead of the text protocol
+    bool modbus;
+
+    // Baud rate negotiated with the host, see `baud` command
+    uint32_t baud;
+
+    // Incremented whenever the preferences are loaded, see prefs_get_epoch()
+    uint32_t epoch;
+
 } prefs_t;
 
 void prefs_init();
@@ -61,6 +80,13 @@ prefs_t* prefs_get();
 void prefs_save();
 void prefs_save_block(const void* src, size_t len);
 void prefs_reset();
+uint32_t prefs_get_epoch();
+uint32_t prefs_get_sequence();
+uint32_t prefs_get_channel_sequence(uint8_t channel);
+void prefs_read_image(uint16_t offset, void* dst, uint8_t len);
+void prefs_write_image(uint16_t offset, const void* src, uint8_t len);
+void prefs_read_staged(uint16_t offset, void* dst, uint8_t len);
+bool prefs_commit_image(uint16_t length);
 
 #endif /* _PREFS_H_ */
 
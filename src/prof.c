@@ -0,0 +1,435 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file prof.c
+ * @brief Implementation of the header declared in prof.h
+ *
+ * The CPU load is determined by measuring the duration of each iteration of
+ * the main loop. Iterations shorter than {@link #PROF_IDLE_CYCLES} did not
+ * have anything to do, so their duration is accumulated as idle time. With
+ * `ENABLE_SLEEP` the time spent sleeping is accumulated instead. Once per
+ * second the load is derived from the idle time within that second.
+ *
+ * The maximum of each prof_stats_t is held until prof_reset() is called, so
+ * rare outliers don't get lost between two queries.
+ *
+ * @see prof.h
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "prof.h"
+
+#if ENABLE_PROFILING
+
+/**
+ * @brief Resolution of the histograms of ISR execution times
+ *
+ * The first bucket holds ISRs that took less than 32 cycles, the last bucket
+ * those that took 2048 cycles or more.
+ *
+ * @see prof_stats_t
+ */
+#define PROF_ISR_SHIFT 5
+
+/**
+ * @brief Resolution of the histograms of each latency
+ *
+ * @see prof_stats_t
+ */
+static const uint8_t prof_latency_shifts[PROF_LATENCY_COUNT] PROGMEM = {
+
+    // 16 µs up to 1 ms and more
+    4,
+
+    // 64 µs up to 4 ms and more
+    6,
+
+    // 64 µs up to 4 ms and more
+    6,
+
+};
+
+/**
+ * @brief Statistics about the execution time of each instrumented ISR
+ */
+static prof_stats_t prof_isr_stats[PROF_ISR_COUNT];
+
+/**
+ * @brief Statistics about each of the latencies
+ */
+static prof_stats_t prof_latency_stats[PROF_LATENCY_COUNT];
+
+/**
+ * @brief Number of Timer1 overflows, i.e. the upper half of prof_cycles()
+ */
+static volatile uint16_t prof_overflows;
+
+/**
+ * @brief Timestamp of the last call to prof_loop()
+ */
+static uint32_t prof_loop_last;
+
+/**
+ * @brief Flag indicating that prof_loop_last is valid
+ *
+ * This prevents the time needed for initialization from being recorded as
+ * the duration of the first iteration.
+ */
+static bool prof_loop_started;
+
+/**
+ * @brief Idle cycles accumulated within the current second
+ */
+static volatile uint32_t prof_idle;
+
+/**
+ * @brief CPU load in percent during the last second
+ */
+static volatile uint8_t prof_load;
+
+/**
+ * @brief Starts Timer1 as free-running counter at the CPU clock
+ */
+void prof_init()
+{
+
+    TCCR1A = 0;
+    TCCR1B = _BV(CS10);
+    TIMSK1 = _BV(TOIE1);
+
+    for (uint8_t i = 0; i < PROF_ISR_COUNT; i++) {
+
+        prof_isr_stats[i].shift = PROF_ISR_SHIFT;
+
+    }
+
+    for (uint8_t i = 0; i < PROF_LATENCY_COUNT; i++) {
+
+        prof_latency_stats[i].shift = pgm_read_byte(&prof_latency_shifts[i]);
+
+    }
+
+    prof_reset();
+
+}
+
+void prof_stats_reset(prof_stats_t* stats)
+{
+
+    stats->min = UINT16_MAX;
+    stats->max = 0;
+    stats->sum = 0;
+    stats->count = 0;
+
+    for (uint8_t i = 0; i < PROF_HISTOGRAM_BUCKETS; i++) {
+
+        stats->histogram[i] = 0;
+
+    }
+
+}
+
+/**
+ * @brief Accounts for a single value within the given statistics
+ *
+ * Buckets of the histogram saturate, whereas the sum and number of values are
+ * halved before overflowing, so the mean keeps being accurate.
+ */
+void prof_stats_record(prof_stats_t* stats, uint16_t value)
+{
+
+    if (value < stats->min) {
+
+        stats->min = value;
+
+    }
+
+    if (value > stats->max) {
+
+        stats->max = value;
+
+    }
+
+    if (stats->count == UINT16_MAX || stats->sum > UINT32_MAX - value) {
+
+        stats->sum /= 2;
+        stats->count /= 2;
+
+    }
+
+    stats->sum += value;
+    stats->count++;
+
+    uint16_t v = value >> stats->shift;
+    uint8_t bucket = 0;
+
+    while (v != 0 && bucket < PROF_HISTOGRAM_BUCKETS - 1) {
+
+        v >>= 1;
+        bucket++;
+
+    }
+
+    if (stats->histogram[bucket] < UINT16_MAX) {
+
+        stats->histogram[bucket]++;
+
+    }
+
+}
+
+uint16_t prof_stats_mean(const prof_stats_t* stats)
+{
+
+    return stats->count ? stats->sum / stats->count : 0;
+
+}
+
+/**
+ * @brief Records the execution time of an ISR
+ *
+ * @note This is expected to be called via PROF_EXIT() only.
+ */
+void prof_record_isr(prof_isr_t isr, uint16_t cycles)
+{
+
+    prof_stats_record(&prof_isr_stats[isr], cycles);
+
+}
+
+/**
+ * @brief Retrieves a consistent copy of the statistics of an ISR
+ */
+void prof_get_isr(prof_isr_t isr, prof_stats_t* stats)
+{
+
+    uint8_t sreg = SREG;
+    cli();
+
+    *stats = prof_isr_stats[isr];
+
+    SREG = sreg;
+
+}
+
+ISR(TIMER1_OVF_vect)
+{
+
+    prof_overflows++;
+
+}
+
+/**
+ * @brief Returns the number of cycles since Timer1 has been started
+ *
+ * This wraps around after 2^32 cycles, i.e. about 9 minutes at 8 MHz, which
+ * is of no concern for the differences between two timestamps.
+ */
+uint32_t prof_cycles()
+{
+
+    uint8_t sreg = SREG;
+    cli();
+
+    uint16_t overflows = prof_overflows;
+    uint16_t cycles = TCNT1;
+
+    // Account for an overflow that has not been handled yet
+    if ((TIFR1 & _BV(TOV1)) && cycles < 0x8000) {
+
+        overflows++;
+
+    }
+
+    SREG = sreg;
+
+    return ((uint32_t)overflows << 16) | cycles;
+
+}
+
+/**
+ * @brief Records the time elapsed since the given timestamp
+ *
+ * @param latency Measured latency, see prof_latency_t
+ * @param since Timestamp as returned by prof_cycles()
+ */
+void prof_record_latency(prof_latency_t latency, uint32_t since)
+{
+
+    uint32_t us = (prof_cycles() - since) / (F_CPU / 1000000UL);
+
+    uint8_t sreg = SREG;
+    cli();
+
+    prof_stats_record(&prof_latency_stats[latency], us > UINT16_MAX ? UINT16_MAX : us);
+
+    SREG = sreg;
+
+}
+
+/**
+ * @brief Retrieves a consistent copy of the statistics of a latency
+ */
+void prof_get_latency(prof_latency_t latency, prof_stats_t* stats)
+{
+
+    uint8_t sreg = SREG;
+    cli();
+
+    *stats = prof_latency_stats[latency];
+
+    SREG = sreg;
+
+}
+
+void prof_reset()
+{
+
+    uint8_t sreg = SREG;
+    cli();
+
+    for (uint8_t i = 0; i < PROF_ISR_COUNT; i++) {
+
+        prof_stats_reset(&prof_isr_stats[i]);
+
+    }
+
+    for (uint8_t i = 0; i < PROF_LATENCY_COUNT; i++) {
+
+        prof_stats_reset(&prof_latency_stats[i]);
+
+    }
+
+    SREG = sreg;
+
+}
+
+/**
+ * @brief Accounts for an iteration of the main loop
+ *
+ * Besides the idle time, this records the duration of each iteration as
+ * {@link #PROF_LATENCY_LOOP}.
+ *
+ * @note This is expected to be called once per iteration of the main loop.
+ */
+void prof_loop()
+{
+
+    uint32_t now = prof_cycles();
+
+    #if !ENABLE_SLEEP
+        uint32_t cycles = now - prof_loop_last;
+    #endif
+
+    if (prof_loop_started) {
+
+        prof_record_latency(PROF_LATENCY_LOOP, prof_loop_last);
+
+    }
+
+    prof_loop_last = now;
+    prof_loop_started = true;
+
+    // Idle time is accounted for by prof_sleep() when sleeping instead
+    #if !ENABLE_SLEEP
+        if (cycles < PROF_IDLE_CYCLES) {
+
+            uint8_t sreg = SREG;
+            cli();
+
+            prof_idle += cycles;
+
+            SREG = sreg;
+
+        }
+    #endif
+
+}
+
+#if ENABLE_SLEEP
+
+/**
+ * @brief Accounts for the time spent sleeping since the given timestamp
+ *
+ * The time is accounted for as idle time and excluded from the duration of
+ * the current iteration of the main loop, so {@link #PROF_LATENCY_LOOP} only
+ * covers the time the MCU has actually been awake. ISRs executed while
+ * sleeping are accounted for as idle time, too.
+ *
+ * @note This is expected to be called by event_wait() once woken up.
+ */
+void prof_sleep(uint32_t since)
+{
+
+    uint32_t cycles = prof_cycles() - since;
+
+    uint8_t sreg = SREG;
+    cli();
+
+    prof_idle += cycles;
+
+    SREG = sreg;
+
+    prof_loop_last += cycles;
+
+}
+
+#endif
+
+/**
+ * @brief Derives the CPU load from the idle time within the last second
+ *
+ * @note This is expected to be called from the timer ISR at 1 Hz.
+ */
+void prof_tick()
+{
+
+    uint32_t idle = prof_idle;
+
+    prof_idle = 0;
+
+    if (idle > F_CPU) {
+
+        idle = F_CPU;
+
+    }
+
+    prof_load = 100 - (idle * 100) / F_CPU;
+
+}
+
+/**
+ * @brief Returns the CPU load in percent during the last second
+ */
+uint8_t prof_get_load()
+{
+
+    return prof_load;
+
+}
+
+#endif /* ENABLE_PROFILING */
@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file prof.h
+ * @brief Profiling of ISR execution times and CPU load
+ *
+ * Timer1 is run freely at the CPU clock, so that timestamps taken at the
+ * entry and exit of an ISR yield its execution time in cycles. Instrumented
+ * ISRs make use of PROF_ENTER() and PROF_EXIT(), which expand to nothing
+ * unless `ENABLE_PROFILING` is set.
+ *
+ * The cycles needed to enter and leave the ISR itself, i.e. saving and
+ * restoring the registers, are not accounted for.
+ *
+ * The CPU load is derived from the time spent in idle iterations of the main
+ * loop or sleeping, see prof_loop() and prof_sleep().
+ *
+ * Timer1 overflows are counted, so that prof_cycles() provides a timestamp
+ * with a range well beyond a single overflow. This is used to measure
+ * latencies within the main loop (prof_latency_t), which are recorded in
+ * microseconds, saturating at 65535 µs.
+ *
+ * @see prof.c
+ */
+
+#ifndef _PROF_H_
+#define _PROF_H_
+
+#include <avr/io.h>
+
+#include <stdint.h>
+
+#include "config.h"
+#include "uart.h"
+
+/**
+ * @brief Number of buckets of each histogram
+ */
+#define PROF_HISTOGRAM_BUCKETS 8
+
+/**
+ * @brief Iterations of the main loop shorter than this are considered idle
+ *
+ * This needs to be above the number of cycles an iteration takes with nothing
+ * to do, including interruptions by the timer ISR.
+ */
+#define PROF_IDLE_CYCLES 1024
+
+/**
+ * @brief Statistics about a single quantity, e.g. the execution time of an ISR
+ *
+ * The histogram is logarithmic: Bucket N holds values with N significant bits
+ * once shifted right by `shift`, so bucket 0 only holds values below
+ * `1 << shift`. The last bucket holds everything else.
+ *
+ * @see prof_stats_record()
+ */
+typedef struct {
+
+    uint16_t min;
+    uint16_t max;
+
+    // Sum and number of values, both are halved before overflowing
+    uint32_t sum;
+    uint16_t count;
+
+    // Resolution of the histogram, see above
+    uint8_t shift;
+
+    uint16_t histogram[PROF_HISTOGRAM_BUCKETS];
+
+} prof_stats_t;
+
+/**
+ * @brief Enumeration of instrumented ISRs
+ */
+typedef enum {
+
+    PROF_ISR_TIMER = 0,
+    PROF_ISR_UART_RX,
+    PROF_ISR_UART_UDRE,
+
+    #if UART_PORTS > 1
+        PROF_ISR_UART1_RX,
+        PROF_ISR_UART1_UDRE,
+    #endif
+
+    PROF_ISR_COUNT
+
+} prof_isr_t;
+
+/**
+ * @brief Enumeration of measured latencies
+ */
+typedef enum {
+
+    // Duration of a single iteration of the main loop
+    PROF_LATENCY_LOOP = 0,
+
+    // Age of an impulse from its detection until its count has been saved
+    PROF_LATENCY_PULSE,
+
+    // Time from the reception of a command until the start of its response
+    PROF_LATENCY_COMMAND,
+
+    PROF_LATENCY_COUNT
+
+} prof_latency_t;
+
+#if ENABLE_PROFILING
+
+    /**
+     * @brief Takes the timestamp at the entry of an ISR
+     */
+    #define PROF_ENTER() uint16_t prof_entry = TCNT1
+
+    /**
+     * @brief Records the execution time of an ISR
+     *
+     * @param isr Instrumented ISR, see prof_isr_t
+     */
+    #define PROF_EXIT(isr) prof_record_isr(isr, TCNT1 - prof_entry)
+
+#else
+
+    #define PROF_ENTER()
+    #define PROF_EXIT(isr)
+
+#endif
+
+void prof_init();
+void prof_stats_reset(prof_stats_t* stats);
+void prof_stats_record(prof_stats_t* stats, uint16_t value);
+uint16_t prof_stats_mean(const prof_stats_t* stats);
+void prof_record_isr(prof_isr_t isr, uint16_t cycles);
+void prof_get_isr(prof_isr_t isr, prof_stats_t* stats);
+uint32_t prof_cycles();
+void prof_record_latency(prof_latency_t latency, uint32_t since);
+void prof_get_latency(prof_latency_t latency, prof_stats_t* stats);
+void prof_reset();
+void prof_loop();
+void prof_sleep(uint32_t since);
+void prof_tick();
+uint8_t prof_get_load();
+
+#endif /* _PROF_H_ */
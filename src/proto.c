@@ -20,223 +20,1501 @@
 #include <avr/pgmspace.h>
 
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 
+#include "binary.h"
+#include "config.h"
+#include "event.h"
 #include "log.h"
 #include "mem.h"
+#include "modbus.h"
 #include "uart.h"
 #include "prefs.h"
+#include "prof.h"
 #include "proto.h"
+#include "push.h"
+#include "s0.h"
+#include "scratch.h"
+#include "str.h"
 #include "version.h"
 
 // TODO Put this somewhere more central?
 #define membersize(type, member) sizeof(((type *)0)->member)
 
+/**
+ * @brief Port commands are read from and responses are output on
+ *
+ * @see uart_set_route()
+ */
+#define PROTO_PORT uart_get_route(UART_STREAM_PROTO)
+
 #define PROTO_COMMAND_BUFFER_SIZE 64
 #define PROTO_OUTPUT_MAX_SIZE 64
 
-static void proto_output_va(const char* message, va_list ap)
-{
+/**
+ * @brief Maximum size of a single chunk of a streamed response
+ *
+ * @see proto_output_chunk_P()
+ */
+#define PROTO_OUTPUT_CHUNK_SIZE 28
+
+/**
+ * @brief Tag of the command currently being processed, NULL if none
+ *
+ * This points into proto_command_buffer and is output in front of the
+ * response, so that responses can be matched to commands by the host.
+ */
+static const char* proto_tag;
+
+/**
+ * @brief Flag indicating that no response should be output
+ *
+ * This is the case for commands broadcast to all units on a bus, as their
+ * responses would collide.
+ */
+static bool proto_silent;
+
+#if ENABLE_STATS
+
+/**
+ * @brief Number of command lines that exceeded PROTO_COMMAND_BUFFER_SIZE
+ *
+ * Such lines are rejected as a whole instead of being processed truncated.
+ */
+static uint16_t proto_truncated;
+
+#endif
+
+/**
+ * @brief Baud rate to fall back to if the new one is not confirmed in time
+ *
+ * @see _baud()
+ */
+static uint32_t proto_baud_previous;
+
+/**
+ * @brief Ticks left for the new baud rate to be confirmed, zero if none
+ *
+ * @see proto_tick()
+ */
+static volatile uint8_t proto_baud_countdown;
+
+/**
+ * @brief Flag indicating that the new baud rate has not been confirmed
+ */
+static volatile bool proto_baud_expired;
+
+#if ENABLE_PROFILING
+
+/**
+ * @brief Timestamp of the EOL of the command currently being processed
+ *
+ * @see PROF_LATENCY_COMMAND
+ */
+static uint32_t proto_command_received;
+
+/**
+ * @brief Flag indicating that the latency of the command is yet to be recorded
+ *
+ * This is recorded by proto_output_begin() for the first response only.
+ */
+static bool proto_command_pending;
+
+#endif
+
+static void proto_output_begin()
+{
+
+    if (proto_silent) {
+
+        return;
+
+    }
+
+    #if ENABLE_PROFILING
+        if (proto_command_pending) {
+
+            prof_record_latency(PROF_LATENCY_COMMAND, proto_command_received);
+            proto_command_pending = false;
+
+        }
+    #endif
+
+    uart_flush_output(PROTO_PORT);
+    uart_puts_P(PROTO_PORT, PROTO_OUTPUT_PREFIX);
+
+    if (proto_tag != NULL) {
+
+        uart_puts(PROTO_PORT, proto_tag);
+        uart_putc(PROTO_PORT, ' ');
+
+    }
+
+}
+
+static void proto_output_end()
+{
+
+    if (proto_silent) {
+
+        return;
+
+    }
+
+    uart_puts_P(PROTO_PORT, PROTO_OUTPUT_EOL);
+
+}
+
+/**
+ * @brief Outputs a chunk of a response that is streamed
+ *
+ * Responses that don't fit into PROTO_OUTPUT_MAX_SIZE can be output in
+ * chunks between proto_output_begin() and proto_output_end(). The
+ * transmission buffer is flushed before each chunk, so that no data is lost
+ * regardless of the length of the complete response.
+ */
+static void proto_output_chunk_P(PGM_P message, ...)
+{
+
+    if (proto_silent) {
+
+        return;
+
+    }
+
+    scratch_mark_t mark = scratch_mark();
+    char* str = scratch_alloc(PROTO_OUTPUT_CHUNK_SIZE);
+
+    if (str != NULL) {
+
+        va_list va;
+        va_start(va, message);
+        vsnprintf_P(str, PROTO_OUTPUT_CHUNK_SIZE, message, va);
+        va_end(va);
+
+        uart_flush_output(PROTO_PORT);
+        uart_puts(PROTO_PORT, str);
+
+    }
+
+    scratch_release(mark);
+
+}
+
+/**
+ * @brief Formats and outputs a complete response
+ *
+ * The response is formatted into a buffer allocated from the scratch arena.
+ * The format string is read from program space if `progmem` is set.
+ */
+static void proto_output_va(const char* message, bool progmem, va_list ap)
+{
+
+    if (proto_silent) {
+
+        return;
+
+    }
+
+    scratch_mark_t mark = scratch_mark();
+    char* str = scratch_alloc(PROTO_OUTPUT_MAX_SIZE);
+
+    if (str == NULL) {
+
+        scratch_release(mark);
+
+        return;
+
+    }
+
+    if (progmem) {
+
+        vsnprintf_P(str, PROTO_OUTPUT_MAX_SIZE, message, ap);
+
+    } else {
+
+        vsnprintf(str, PROTO_OUTPUT_MAX_SIZE, message, ap);
+
+    }
+
+    #if ENABLE_MEMCHECK
+        mem_sample(false);
+    #endif
+
+    proto_output_begin();
+    uart_puts(PROTO_PORT, str);
+    proto_output_end();
+
+    scratch_release(mark);
+
+}
+
+static void proto_output(const char* message, ...)
+{
+
+    va_list va;
+    va_start(va, message);
+    proto_output_va(message, false, va);
+    va_end(va);
+
+}
+
+static void proto_output_P(PGM_P message, ...)
+{
+
+    va_list va;
+    va_start(va, message);
+    proto_output_va(message, true, va);
+    va_end(va);
+
+}
+
+static void proto_ok()
+{
+
+    proto_output_P(PSTR(PROTO_OUTPUT_OK));
+
+}
+
+static void proto_error()
+{
+
+    proto_output_P(PSTR(PROTO_OUTPUT_ERROR));
+
+}
+
+
+/**
+ * @brief Maximum number of tokens a single command line can consist of
+ *
+ * This includes the command itself. Lines consisting of more tokens are
+ * rejected as a whole, so this directly limits the size of the argument
+ * vector that needs to be kept on the stack.
+ */
+#define PROTO_ARGS_MAX 7
+
+static char proto_command_buffer[PROTO_COMMAND_BUFFER_SIZE];
+
+typedef void (*proto_command_callback_t)(uint8_t argc, char* argv[]);
+
+/**
+ * @brief Entry of a command table
+ *
+ * Commands (and sub-commands) are described by tables of this type, which
+ * live in program space. Apart from the name and the callback each entry
+ * declares the number of arguments it accepts, so that callbacks don't need
+ * to check the arity themselves. Tables need to be sorted by name (in the
+ * order of strcmp()), as they are bisected.
+ *
+ * @see proto_dispatch()
+ */
+typedef struct
+{
+
+    const char* command;
+
+    // Minimum number of arguments following the (sub-)command
+    uint8_t args_min;
+
+    // Maximum number of arguments following the (sub-)command
+    uint8_t args_max;
+
+    proto_command_callback_t callback;
+
+} proto_command_t;
+
+/**
+ * @brief Looks up a (sub-)command in a table and invokes its callback
+ *
+ * The name of the command is expected to be `argv[depth]`, whereas everything
+ * after it is considered to be arguments. The table is bisected, so a lookup
+ * takes at most five steps for the 20 or so commands. Steps are decided by
+ * the first character, unless it matches, so a full comparison is only done
+ * for actual candidates. The callback itself receives the complete argument
+ * vector.
+ *
+ * @return True if a matching entry has been found and invoked
+ */
+static bool proto_dispatch(const proto_command_t* table, uint8_t size, uint8_t depth, uint8_t argc, char* argv[])
+{
+
+    const char* name = argv[depth];
+    uint8_t args = argc - depth - 1;
+    uint8_t low = 0;
+    uint8_t high = size;
+
+    while (low < high) {
+
+        uint8_t i = (low + high) / 2;
+        PGM_P command = (PGM_P)pgm_read_word(&(table[i].command));
+
+        // Most steps are decided by the first character already
+        int cmp = (uint8_t)name[0] - pgm_read_byte(command);
+
+        if (cmp == 0) {
+
+            cmp = strcmp_P(name, command);
+
+        }
+
+        if (cmp < 0) {
+
+            high = i;
+
+        } else if (cmp > 0) {
+
+            low = i + 1;
+
+        } else {
+
+            if (args < pgm_read_byte(&(table[i].args_min)) || args > pgm_read_byte(&(table[i].args_max))) {
+
+                return false;
+
+            }
+
+            proto_command_callback_t callback = (proto_command_callback_t)pgm_read_word(&(table[i].callback));
+            callback(argc, argv);
+
+            return true;
+
+        }
+
+    }
+
+    return false;
+
+}
+
+/**
+ * @brief Parses an unsigned decimal integer
+ *
+ * This is a small replacement for `sscanf()`, which only deals with plain
+ * decimal numbers. The whole string needs to consist of digits and the value
+ * must not exceed the given maximum.
+ *
+ * @return True if the string could be parsed, false otherwise
+ */
+static bool proto_parse_uint(const char* str, uint32_t max, uint32_t* value)
+{
+
+    uint32_t result = 0;
+
+    if (*str == '\0') {
+
+        return false;
+
+    }
+
+    do {
+
+        if (*str < '0' || *str > '9') {
+
+            return false;
+
+        }
+
+        uint8_t digit = *str - '0';
+
+        // Make sure result * 10 + digit does not exceed max
+        if (digit > max || result > (max - digit) / 10) {
+
+            return false;
+
+        }
+
+        result = result * 10 + digit;
+
+    } while (*++str);
+
+    *value = result;
+
+    return true;
+
+}
+
+/**
+ * @brief Keywords used by more than one command
+ */
+static const char str_true[] PROGMEM = "true";
+static const char str_false[] PROGMEM = "false";
+static const char str_on[] PROGMEM = "on";
+static const char str_off[] PROGMEM = "off";
+static const char str_reset[] PROGMEM = "reset";
+static const char str_proto[] PROGMEM = "proto";
+static const char str_log[] PROGMEM = "log";
+static const char str_push[] PROGMEM = "push";
+
+/**
+ * @brief Parses a boolean value, i.e. either "true" or "false"
+ *
+ * @return True if the string could be parsed, false otherwise
+ */
+static bool proto_parse_bool(const char* str, bool* value)
+{
+
+    if (strcmp_P(str, str_true) == 0) {
+
+        *value = true;
+
+    } else if (strcmp_P(str, str_false) == 0) {
+
+        *value = false;
+
+    } else {
+
+        return false;
+
+    }
+
+    return true;
+
+}
+
+static void _ping(uint8_t argc, char* argv[])
+{
+
+    proto_ok();
+
+}
+
+static void _info(uint8_t argc, char* argv[])
+{
+
+    proto_output_P(PSTR("version: %u, channels: %u"), VERSION, CHANNELS);
+
+}
+
+#if ENABLE_MEMCHECK
+
+/**
+ * @brief Names of the contexts as output by `memory paths`
+ *
+ * The order needs to match the bits of mem_context_t.
+ */
+static const char str_context_isr[] PROGMEM = "isr";
+
+static PGM_P const proto_context_names[] PROGMEM = {
+
+    str_proto,
+    str_log,
+    str_context_isr,
+
+};
+
+/**
+ * @brief Outputs the maximum stack depth of each combination of contexts
+ *
+ * Combinations are named by their contexts joined by `+`, e.g. `proto+isr`,
+ * with `main` being the main loop outside of any context. Combinations that
+ * have never been sampled are omitted.
+ */
+static void proto_output_paths() {
+
+    bool first = true;
+
+    proto_output_begin();
+
+    for (uint8_t path = 0; path < MEM_PATHS; path++) {
+
+        uint16_t depth = mem_get_depth(path);
+
+        if (depth == 0) {
+
+            continue;
+
+        }
+
+        if (!first) {
+
+            proto_output_chunk_P(PSTR(";"));
+
+        }
+
+        first = false;
+
+        if (path == 0) {
+
+            proto_output_chunk_P(PSTR("main"));
+
+        }
+
+        for (uint8_t i = 0; i < sizeof(proto_context_names) / sizeof(proto_context_names[0]); i++) {
+
+            if (path & _BV(i)) {
+
+                proto_output_chunk_P((path & (_BV(i) - 1)) ? PSTR("+%S") : PSTR("%S"), (PGM_P)pgm_read_word(&proto_context_names[i]));
+
+            }
+
+        }
+
+        proto_output_chunk_P(PSTR(" %u"), depth);
+
+    }
+
+    proto_output_end();
+
+}
+
+static const char str_memory[] PROGMEM = "memory";
+
+static void _memory(uint8_t argc, char* argv[]) {
+
+    if (argc == 1) {
+
+        proto_output_begin();
+        proto_output_chunk_P(PSTR("cur: %d, min: %d, "), mem_free_cur(), mem_free_min());
+        proto_output_chunk_P(PSTR("incidents: %u, "), mem_get_incidents());
+        proto_output_chunk_P(PSTR("scratch: %u/%u"), scratch_get_high(), SCRATCH_SIZE);
+        proto_output_chunk_P(PSTR(", overuse: %u"), scratch_get_overuse());
+        proto_output_end();
+
+    } else if (strcmp_P(argv[1], PSTR("paths")) == 0) {
+
+        proto_output_paths();
+
+    } else {
+
+        proto_error();
+
+    }
+
+}
+
+#endif
+
+/**
+ * @brief Channel range the currently processed `channel` sub-command refers to
+ *
+ * This is set up by _channel() before dispatching to any of the sub-commands,
+ * so they don't need to parse and validate it again. For a single channel
+ * both the first and the last channel are the same.
+ */
+static uint8_t proto_channel_first;
+static uint8_t proto_channel_last;
+
+static void _channel_info(uint8_t argc, char* argv[])
+{
+
+    if (proto_channel_first != proto_channel_last) {
+
+        proto_error();
+
+        return;
+
+    }
+
+    channel_prefs_t* channel = &(prefs_get()->channels[proto_channel_first]);
+
+    proto_output_P(PSTR("enabled: %S, min: %u, max: %u, count: %lu"),
+        channel->enabled ? str_true : str_false,
+        channel->min,
+        channel->max,
+        channel->count);
+
+}
+
+/**
+ * @brief Describes a setting of a channel that can be set by `channel N set`
+ *
+ * The value is written to the appropriate member of channel_prefs_t, which is
+ * determined by its offset and size. Settings with a maximum of zero are
+ * considered to be boolean values.
+ */
+typedef struct
+{
+
+    const char* name;
+
+    uint8_t offset;
+
+    uint8_t size;
+
+    uint32_t max;
+
+} proto_channel_setting_t;
+
+static const char str_enabled[] PROGMEM = "enabled";
+static const char str_min[] PROGMEM = "min";
+static const char str_max[] PROGMEM = "max";
+static const char str_count[] PROGMEM = "count";
+
+static const proto_channel_setting_t proto_channel_settings[] PROGMEM = {
+
+    {str_enabled, offsetof(channel_prefs_t, enabled), membersize(channel_prefs_t, enabled), 0},
+    {str_min, offsetof(channel_prefs_t, min), membersize(channel_prefs_t, min), UINT8_MAX},
+    {str_max, offsetof(channel_prefs_t, max), membersize(channel_prefs_t, max), UINT8_MAX},
+    {str_count, offsetof(channel_prefs_t, count), membersize(channel_prefs_t, count), UINT32_MAX},
+
+};
+
+static void _channel_set(uint8_t argc, char* argv[])
+{
+
+    uint8_t j = sizeof(proto_channel_settings) / sizeof(proto_channel_setting_t);
+
+    for (uint8_t i = 0; i < j; i++) {
+
+        const proto_channel_setting_t* setting = &proto_channel_settings[i];
+
+        if (strcmp_P(argv[3], (PGM_P)pgm_read_word(&(setting->name))) != 0) {
+
+            continue;
+
+        }
+
+        uint32_t max = pgm_read_dword(&(setting->max));
+        uint32_t value;
+
+        if (max == 0) {
+
+            bool enabled;
+
+            if (!proto_parse_bool(argv[4], &enabled)) {
+
+                break;
+
+            }
+
+            value = enabled;
+
+        } else if (!proto_parse_uint(argv[4], max, &value)) {
+
+            break;
+
+        }
+
+        uint8_t offset = pgm_read_byte(&(setting->offset));
+        uint8_t size = pgm_read_byte(&(setting->size));
+
+        for (uint8_t channel = proto_channel_first; channel <= proto_channel_last; channel++) {
+
+            // Members are stored in little endian, so the lower bytes suffice
+            memcpy((uint8_t*)&(prefs_get()->channels[channel]) + offset, &value, size);
+
+        }
+
+        #if ENABLE_PUSH
+            if (offset == offsetof(channel_prefs_t, count)) {
+
+                push_rebase(proto_channel_first, proto_channel_last);
+
+            }
+        #endif
+
+        // Save all of the affected channels within a single transaction
+        uint8_t* member = (uint8_t*)&(prefs_get()->channels[proto_channel_first]) + offset;
+        prefs_save_block(member, (proto_channel_last - proto_channel_first) * sizeof(channel_prefs_t) + size);
+
+        proto_ok();
+
+        return;
+
+    }
+
+    proto_error();
+
+}
+
+static const char str_info[] PROGMEM = "info";
+static const char str_set[] PROGMEM = "set";
+
+// Sorted by name, see proto_command_t
+static const proto_command_t proto_channel_commands[] PROGMEM = {
+
+    {str_info, 0, 0, _channel_info},
+    {str_set, 2, 2, _channel_set},
+
+};
+
+/**
+ * @brief Parses a channel, or a range of channels in the form of `N-M`
+ *
+ * @return True if the channel (range) is valid, false otherwise
+ *
+ * @see proto_channel_first
+ * @see proto_channel_last
+ */
+static bool proto_parse_channels(char* str)
+{
+
+    uint32_t first;
+    uint32_t last;
+
+    char* separator = strchr(str, '-');
+
+    if (separator != NULL) {
+
+        *separator = '\0';
+
+        if (!proto_parse_uint(separator + 1, CHANNELS - 1, &last)) {
+
+            return false;
+
+        }
+
+    }
+
+    if (!proto_parse_uint(str, CHANNELS - 1, &first)) {
+
+        return false;
+
+    }
+
+    if (separator == NULL) {
+
+        last = first;
+
+    }
+
+    if (first > last) {
+
+        return false;
+
+    }
+
+    proto_channel_first = first;
+    proto_channel_last = last;
+
+    return true;
+
+}
+
+static void _channel(uint8_t argc, char* argv[]) {
+
+    if (!proto_parse_channels(argv[1])) {
+
+        proto_error();
+
+        return;
+
+    }
+
+    if (!proto_dispatch(proto_channel_commands, sizeof(proto_channel_commands) / sizeof(proto_command_t), 2, argc, argv)) {
+
+        proto_error();
+
+    }
+
+}
+
+#if ENABLE_RS485
+
+/**
+ * @brief Counts of all channels captured by the `latch` command
+ *
+ * When broadcast to all units on a bus, the counts of all of the units are
+ * captured at virtually the same point in time, and can then be retrieved
+ * one after another with `snapshot latched`.
+ */
+static uint32_t proto_latch[CHANNELS];
+
+static void _latch(uint8_t argc, char* argv[]) {
+
+    for (uint8_t i = 0; i < CHANNELS; i++) {
+
+        proto_latch[i] = prefs_get()->channels[i].count;
+
+    }
+
+    proto_ok();
+
+}
+
+static void _address(uint8_t argc, char* argv[]) {
+
+    if (argc == 1) {
+
+        proto_output_P(PSTR("address: %u"), prefs_get()->address);
+
+        return;
+
+    }
+
+    uint32_t address;
+
+    if (!proto_parse_uint(argv[1], PROTO_ADDRESS_MAX, &address)) {
+
+        proto_error();
+
+        return;
+
+    }
+
+    // Respond before the new address takes effect
+    proto_ok();
+
+    prefs_get()->address = address;
+    prefs_save_block(&(prefs_get()->address), membersize(prefs_t, address));
+
+    // Unsolicited output would collide with other units on the bus
+    if (address != 0) {
+
+        log_disable();
+
+    } else {
+
+        log_enable();
+
+    }
+
+    uart_set_bus(address != 0);
+
+}
+
+#endif
+
+/**
+ * @brief Outputs the configuration and count of all channels in one response
+ *
+ * The response is streamed in chunks, one for each channel, separated by
+ * `;`. Counts are only ever modified by s0_handle(), which is not executed
+ * while the response is being generated, so all of the values reflect the
+ * same point in time. Impulses detected in the meantime are queued and only
+ * accounted for afterwards.
+ */
+static void _snapshot(uint8_t argc, char* argv[]) {
+
+    const uint32_t* counts = NULL;
+
+    #if ENABLE_RS485
+        if (argc == 2) {
+
+            if (strcmp_P(argv[1], PSTR("latched")) != 0) {
+
+                proto_error();
+
+                return;
+
+            }
+
+            counts = proto_latch;
+
+        }
+    #endif
+
+    proto_output_begin();
+
+    for (uint8_t i = 0; i < CHANNELS; i++) {
+
+        channel_prefs_t* channel = &(prefs_get()->channels[i]);
+
+        proto_output_chunk_P(i == 0 ? PSTR("%u %u %u %lu") : PSTR(";%u %u %u %lu"),
+            channel->enabled,
+            channel->min,
+            channel->max,
+            counts ? counts[i] : channel->count);
+
+    }
+
+    proto_output_end();
+
+}
+
+/**
+ * @brief Outputs the channels changed since the given epoch and sequence number
+ *
+ * The response starts with the current epoch and sequence number, followed by
+ * the configuration and count of each channel that has been changed after the
+ * given sequence number. Sequence numbers restart after each reset of the
+ * S0-counter, which increments the epoch. If the given epoch isn't the current
+ * one, or the sequence number is greater than the current one, all of the
+ * channels are output.
+ *
+ * @see prefs_get_epoch()
+ */
+static void _changes(uint8_t argc, char* argv[]) {
+
+    uint32_t epoch;
+    uint32_t since;
+
+    if (!proto_parse_uint(argv[1], UINT32_MAX, &epoch) || !proto_parse_uint(argv[2], UINT32_MAX, &since)) {
+
+        proto_error();
+
+        return;
+
+    }
+
+    uint32_t sequence = prefs_get_sequence();
+
+    if (epoch != prefs_get_epoch() || since > sequence) {
+
+        since = 0;
+
+    }
+
+    proto_output_begin();
+    proto_output_chunk_P(PSTR("%lu %lu"), prefs_get_epoch(), sequence);
+
+    for (uint8_t i = 0; i < CHANNELS; i++) {
+
+        if (prefs_get_channel_sequence(i) <= since) {
+
+            continue;
+
+        }
+
+        channel_prefs_t* channel = &(prefs_get()->channels[i]);
+
+        proto_output_chunk_P(PSTR(";%u %u %u %u %lu"),
+            i,
+            channel->enabled,
+            channel->min,
+            channel->max,
+            channel->count);
+
+    }
+
+    proto_output_end();
+
+}
+
+#if ENABLE_LOGGING
+
+static void _log(uint8_t argc, char* argv[]) {
+
+    // TODO Implement
+    proto_error();
+
+}
+
+#endif
+
+#if ENABLE_BINARY_PROTOCOL
+
+static const char str_binary[] PROGMEM = "binary";
+
+static void _binary(uint8_t argc, char* argv[]) {
+
+    proto_ok();
+    uart_flush_output(PROTO_PORT);
+
+    binary_enable();
+
+}
+
+#endif
+
+#if ENABLE_PUSH
+
+static const char str_interval[] PROGMEM = "interval";
+static const char str_subscribe[] PROGMEM = "subscribe";
+static const char str_unsubscribe[] PROGMEM = "unsubscribe";
+
+static void _push_interval(uint8_t argc, char* argv[]) {
+
+    if (argc == 2) {
+
+        proto_output_P(PSTR("interval: %u"), push_get_interval());
+
+        return;
+
+    }
+
+    uint32_t interval;
+
+    if (!proto_parse_uint(argv[2], UINT16_MAX, &interval)) {
+
+        proto_error();
+
+        return;
+
+    }
+
+    push_set_interval(interval);
+    proto_ok();
+
+}
+
+static void _push_subscribe(uint8_t argc, char* argv[]) {
+
+    if (!proto_parse_channels(argv[2])) {
+
+        proto_error();
+
+        return;
+
+    }
+
+    // Compare first character to tell "subscribe" and "unsubscribe" apart
+    bool subscribed = (argv[1][0] == 's');
+
+    for (uint8_t channel = proto_channel_first; channel <= proto_channel_last; channel++) {
+
+        push_subscribe(channel, subscribed);
+
+    }
+
+    proto_ok();
+
+}
+
+// Sorted by name, see proto_command_t
+static const proto_command_t proto_push_commands[] PROGMEM = {
+
+    {str_interval, 0, 1, _push_interval},
+    {str_subscribe, 1, 1, _push_subscribe},
+    {str_unsubscribe, 1, 1, _push_subscribe},
+
+};
+
+static void _push(uint8_t argc, char* argv[]) {
+
+    if (!proto_dispatch(proto_push_commands, sizeof(proto_push_commands) / sizeof(proto_command_t), 1, argc, argv)) {
+
+        proto_error();
+
+    }
+
+}
+
+#endif
+
+static void _flow(uint8_t argc, char* argv[]) {
+
+    if (argc == 1) {
+
+        proto_output_P(PSTR("flow: %S"), uart_get_flow_control(PROTO_PORT) ? str_on : str_off);
+
+        return;
+
+    }
+
+    if (strcmp_P(argv[1], str_on) == 0) {
+
+        uart_set_flow_control(PROTO_PORT, true);
+
+    } else if (strcmp_P(argv[1], str_off) == 0) {
+
+        uart_set_flow_control(PROTO_PORT, false);
+
+    } else {
+
+        proto_error();
+
+        return;
+
+    }
+
+    proto_ok();
+
+}
+
+#if ENABLE_STATS
+
+static const char str_stats[] PROGMEM = "stats";
+
+static void _stats(uint8_t argc, char* argv[]) {
+
+    uint32_t port = PROTO_PORT;
+
+    if (argc == 2 && !proto_parse_uint(argv[1], UART_PORTS - 1, &port)) {
+
+        proto_error();
+
+        return;
+
+    }
+
+    uart_stats_t stats;
+    uart_get_stats(port, &stats);
+
+    proto_output_begin();
+    proto_output_chunk_P(PSTR("rx: %lu, tx: %lu, "), stats.rx, stats.tx);
+    proto_output_chunk_P(PSTR("rx overrun: %u, "), stats.rx_overrun);
+    proto_output_chunk_P(PSTR("rx dropped: %u, "), stats.rx_dropped);
+    proto_output_chunk_P(PSTR("tx dropped: %u, "), stats.tx_dropped);
+    proto_output_chunk_P(PSTR("xoff: %u, "), stats.xoff);
+    proto_output_chunk_P(PSTR("rx high: %u, "), stats.rx_high);
+    proto_output_chunk_P(PSTR("tx high: %u, "), stats.tx_high);
+    proto_output_chunk_P(PSTR("s0 dropped: %u, "), s0_get_dropped());
+    proto_output_chunk_P(PSTR("s0 high: %u, "), s0_get_fifo_high());
+    proto_output_chunk_P(PSTR("truncated: %u"), proto_truncated);
+    proto_output_end();
+
+}
+
+#endif
+
+/**
+ * @brief Names of the streams as used by the `route` command
+ *
+ * The order needs to match uart_stream_t.
+ */
+static PGM_P const proto_stream_names[UART_STREAM_COUNT] PROGMEM = {
+
+    str_proto,
+    str_log,
+    str_push,
+
+};
+
+static void _route(uint8_t argc, char* argv[]) {
+
+    uart_stream_t stream;
+
+    for (stream = 0; stream < UART_STREAM_COUNT; stream++) {
+
+        if (strcmp_P(argv[1], (PGM_P)pgm_read_word(&proto_stream_names[stream])) == 0) {
+
+            break;
+
+        }
+
+    }
+
+    if (stream == UART_STREAM_COUNT) {
+
+        proto_error();
+
+        return;
+
+    }
+
+    if (argc == 2) {
+
+        proto_output_P(PSTR("route %s: %u"), argv[1], uart_get_route(stream));
+
+        return;
+
+    }
+
+    uint32_t port;
+
+    if (!proto_parse_uint(argv[2], UART_PORTS - 1, &port)) {
+
+        proto_error();
+
+        return;
+
+    }
+
+    // Acknowledge on the new port, in case the protocol itself is moved
+    uart_set_route(stream, port);
+    proto_ok();
+
+}
+
+#if ENABLE_RS485
+
+static const char str_latch[] PROGMEM = "latch";
+static const char str_address[] PROGMEM = "address";
+
+#endif
+
+#if ENABLE_MODBUS
 
-    char str[PROTO_OUTPUT_MAX_SIZE];
-    vsnprintf(str, PROTO_OUTPUT_MAX_SIZE, message, ap);
+static const char str_modbus[] PROGMEM = "modbus";
 
-    uart_flush_output();
+static void _modbus(uint8_t argc, char* argv[]) {
+
+    proto_ok();
+    uart_flush_output(PROTO_PORT);
 
-    uart_puts_P(PROTO_OUTPUT_PREFIX);
-    uart_puts(str);
-    uart_puts_P(PROTO_OUTPUT_EOL);
+    modbus_enable();
 
 }
 
-static void proto_output(const char* message, ...)
-{
+#endif
 
-    va_list va;
-    va_start(va, message);
-    proto_output_va(message, va);
-    va_end(va);
+/**
+ * @brief Negotiates a new baud rate with the host
+ *
+ * A new rate is acknowledged using the current rate and is switched to
+ * afterwards. The host is then expected to confirm the link by issuing
+ * `baud confirm` using the new rate within {@link #PROTO_BAUD_CONFIRM_TIMEOUT}.
+ * Only then the new rate is persisted, otherwise the previous rate is
+ * restored by proto_handle().
+ */
+static void _baud(uint8_t argc, char* argv[]) {
 
-}
+    if (argc == 1) {
 
-static void proto_output_P(PGM_P message, ...)
-{
+        proto_output_P(PSTR("baud: %lu"), uart_get_baud(PROTO_PORT));
 
-    char str[PROTO_OUTPUT_MAX_SIZE];
-    strncpy_P(str, message, PROTO_OUTPUT_MAX_SIZE);
+        return;
 
-    va_list va;
-    va_start(va, message);
-    proto_output_va(str, va);
-    va_end(va);
+    }
 
-}
+    if (strcmp_P(argv[1], PSTR("confirm")) == 0) {
 
-static void proto_ok()
-{
+        if (proto_baud_countdown == 0) {
 
-    proto_output_P(PSTR("OK"));
+            proto_error();
 
-}
+            return;
 
-static void proto_error()
-{
+        }
 
-    proto_output_P(PSTR("ERR"));
+        proto_baud_countdown = 0;
 
-}
+        // Routes aren't persisted, and startup only applies the rate to the
+        // default port, which must not come up at a rate negotiated elsewhere
+        if (PROTO_PORT == UART_PORT_DEFAULT) {
 
+            prefs_get()->baud = uart_get_baud(PROTO_PORT);
+            prefs_save_block(&(prefs_get()->baud), membersize(prefs_t, baud));
 
-static char proto_command_buffer[PROTO_COMMAND_BUFFER_SIZE];
+        }
 
-typedef void (*proto_command_callback_t)(uint8_t argc, char* argv[]);
+        proto_ok();
 
-static void _ping(uint8_t argc, char* argv[])
-{
+        return;
+
+    }
+
+    uint32_t baud;
+
+    if (!proto_parse_uint(argv[1], UINT32_MAX, &baud) || !uart_baud_valid(baud)) {
 
+        proto_error();
+
+        return;
+
+    }
+
+    // Respond before the new rate takes effect
     proto_ok();
 
-}
+    // Keep the original rate when switching again before confirmation
+    if (proto_baud_countdown == 0) {
 
-static void _info(uint8_t argc, char* argv[])
-{
+        proto_baud_previous = uart_get_baud(PROTO_PORT);
 
-    proto_output_P(PSTR("version: %u, channels: %u"), VERSION, CHANNELS);
+    }
+
+    uart_set_baud(PROTO_PORT, baud);
+
+    proto_baud_expired = false;
+    proto_baud_countdown = PROTO_BAUD_CONFIRM_TIMEOUT;
 
 }
 
-static void _memory(uint8_t argc, char* argv[]) {
+#if ENABLE_PROFILING
 
-    proto_output_P(PSTR("cur: %d, min: %d"), mem_free_cur(), mem_free_min());
+static const char str_profile[] PROGMEM = "profile";
+static const char str_latency[] PROGMEM = "latency";
 
-}
+/**
+ * @brief Name along with min, max and mean, with and without a separator
+ */
+static const char str_fmt_stats[] PROGMEM = "%S %u %u %u";
+static const char str_fmt_stats_sep[] PROGMEM = ";%S %u %u %u";
 
-static void _channel(uint8_t argc, char* argv[]) {
+/**
+ * @brief Names of the instrumented ISRs as used by the `profile` command
+ *
+ * The order needs to match prof_isr_t.
+ */
+static const char str_isr_timer[] PROGMEM = "timer";
+static const char str_isr_rx[] PROGMEM = "rx";
+static const char str_isr_udre[] PROGMEM = "udre";
 
-    if (argc < 3) {
+#if UART_PORTS > 1
+    static const char str_isr_rx1[] PROGMEM = "rx1";
+    static const char str_isr_udre1[] PROGMEM = "udre1";
+#endif
 
-        goto error;
+static PGM_P const proto_isr_names[PROF_ISR_COUNT] PROGMEM = {
 
-    }
+    str_isr_timer,
+    str_isr_rx,
+    str_isr_udre,
 
-    uint8_t channel;
+    #if UART_PORTS > 1
+        str_isr_rx1,
+        str_isr_udre1,
+    #endif
 
-    if (sscanf_P(argv[1], PSTR("%hhu"), &channel) != 1) {
+};
 
-        goto error;
+/**
+ * @brief Outputs the histogram of the given statistics as a single response
+ *
+ * The buckets are separated by spaces.
+ */
+static void proto_output_histogram(const prof_stats_t* stats)
+{
 
-    }
+    proto_output_begin();
 
-    if (channel >= CHANNELS) {
+    for (uint8_t i = 0; i < PROF_HISTOGRAM_BUCKETS; i++) {
 
-        goto error;
+        proto_output_chunk_P(i ? PSTR(" %u") : PSTR("%u"), stats->histogram[i]);
 
     }
 
-    if (argc == 3 && strncmp_P(argv[2], PSTR("info"), sizeof("info")) == 0) {
+    proto_output_end();
 
-        proto_output_P(PSTR("enabled: %S, min: %u, max: %u, count: %lu"),
-            prefs_get()->channels[channel].enabled ? PSTR("true") : PSTR("false"),
-            prefs_get()->channels[channel].min,
-            prefs_get()->channels[channel].max,
-            prefs_get()->channels[channel].count);
+}
 
-        return;
+/**
+ * @brief Outputs the CPU load and the execution times of all ISRs
+ *
+ * Without arguments min, max and mean cycles of each ISR are output. Given
+ * the name of an ISR its histogram is output instead.
+ */
+static void _profile(uint8_t argc, char* argv[]) {
 
-    } else if (argc == 5 && strncmp_P(argv[2], PSTR("set"), sizeof("set")) == 0) {
+    prof_stats_t stats;
 
-        if (strncmp_P(argv[3], PSTR("enabled"), sizeof("enabled")) == 0) {
+    if (argc == 1) {
 
-            bool enabled;
+        proto_output_begin();
+        proto_output_chunk_P(PSTR("load %u"), prof_get_load());
+
+        for (prof_isr_t isr = 0; isr < PROF_ISR_COUNT; isr++) {
+
+            prof_get_isr(isr, &stats);
 
-            if (strncmp_P(argv[4], PSTR("true"), sizeof("true")) == 0) {
+            proto_output_chunk_P(str_fmt_stats_sep, (PGM_P)pgm_read_word(&proto_isr_names[isr]),
+                stats.count ? stats.min : 0, stats.max, prof_stats_mean(&stats));
 
-                enabled = true;
+        }
 
-            } else if (strncmp_P(argv[4], PSTR("false"), sizeof("false")) == 0) {
+        proto_output_end();
 
-                enabled = false;
+        return;
 
-            } else {
+    }
 
-                goto error;
+    if (strcmp_P(argv[1], str_reset) == 0) {
 
-            }
+        prof_reset();
+        proto_ok();
 
-            prefs_get()->channels[channel].enabled = enabled;
-            prefs_save_block(&(prefs_get()->channels[channel].enabled), membersize(channel_prefs_t, enabled));
+        return;
 
-        } else if (strncmp_P(argv[3], PSTR("min"), sizeof("min")) == 0) {
+    }
 
-            uint8_t min;
+    for (prof_isr_t isr = 0; isr < PROF_ISR_COUNT; isr++) {
 
-            if (sscanf_P(argv[4], PSTR("%hhu"), &min) != 1) {
+        if (strcmp_P(argv[1], (PGM_P)pgm_read_word(&proto_isr_names[isr])) == 0) {
 
-                goto error;
+            prof_get_isr(isr, &stats);
+            proto_output_histogram(&stats);
 
-            }
+            return;
 
-            prefs_get()->channels[channel].min = min;
-            prefs_save_block(&(prefs_get()->channels[channel].min), membersize(channel_prefs_t, min));
+        }
 
-        } else if (strncmp_P(argv[3], PSTR("max"), sizeof("max")) == 0) {
+    }
 
-            uint8_t max;
+    proto_error();
 
-            if (sscanf_P(argv[4], PSTR("%hhu"), &max) != 1) {
+}
 
-                goto error;
+/**
+ * @brief Names of the latencies as used by the `latency` command
+ *
+ * The order needs to match prof_latency_t.
+ */
+static const char str_latency_loop[] PROGMEM = "loop";
+static const char str_latency_pulse[] PROGMEM = "pulse";
+static const char str_latency_command[] PROGMEM = "command";
 
-            }
+static PGM_P const proto_latency_names[PROF_LATENCY_COUNT] PROGMEM = {
 
-            prefs_get()->channels[channel].max = max;
-            prefs_save_block(&(prefs_get()->channels[channel].max), membersize(channel_prefs_t, max));
+    str_latency_loop,
+    str_latency_pulse,
+    str_latency_command,
 
-        }  else if (strncmp_P(argv[3], PSTR("count"), sizeof("count")) == 0) {
+};
 
-            uint64_t count;
+/**
+ * @brief Outputs the latencies measured within the main loop
+ *
+ * Without arguments min, max and mean of each latency in µs are output. The
+ * maximum is held until reset. Given the name of a latency its histogram is
+ * output instead.
+ */
+static void _latency(uint8_t argc, char* argv[]) {
 
-            if (sscanf_P(argv[4], PSTR("%lu"), &count) != 1) {
+    prof_stats_t stats;
 
-                goto error;
+    if (argc == 1) {
 
-            }
+        proto_output_begin();
 
-            prefs_get()->channels[channel].count = count;
-            prefs_save_block(&(prefs_get()->channels[channel].count), membersize(channel_prefs_t, count));
+        for (prof_latency_t latency = 0; latency < PROF_LATENCY_COUNT; latency++) {
 
-        } else {
+            prof_get_latency(latency, &stats);
 
-            goto error;
+            proto_output_chunk_P(latency ? str_fmt_stats_sep : str_fmt_stats,
+                (PGM_P)pgm_read_word(&proto_latency_names[latency]),
+                stats.count ? stats.min : 0, stats.max, prof_stats_mean(&stats));
 
         }
 
+        proto_output_end();
+
+        return;
+
+    }
+
+    if (strcmp_P(argv[1], str_reset) == 0) {
+
+        prof_reset();
         proto_ok();
 
         return;
 
     }
 
-    error:
+    for (prof_latency_t latency = 0; latency < PROF_LATENCY_COUNT; latency++) {
 
-        proto_error();
+        if (strcmp_P(argv[1], (PGM_P)pgm_read_word(&proto_latency_names[latency])) == 0) {
 
-}
+            prof_get_latency(latency, &stats);
+            proto_output_histogram(&stats);
 
-static void _log(uint8_t argc, char* argv[]) {
+            return;
+
+        }
+
+    }
 
-    // TODO Implement
     proto_error();
 
 }
 
+#endif
+
+#if ENABLE_SLEEP
+
+static const char str_power[] PROGMEM = "power";
+
+/**
+ * @brief Outputs the number of wake-ups and the estimated current
+ *
+ * Both refer to the last second, the current is given in µA.
+ */
+static void _power(uint8_t argc, char* argv[]) {
+
+    proto_output_begin();
+    proto_output_chunk_P(PSTR("wakeups: %u, current: %u"), event_get_wakeups(), event_get_current());
+    proto_output_end();
+
+}
+
+#endif
+
 // TODO Implement normal reset, not only factory?
 static void _reset(uint8_t argc, char* argv[]) {
 
-    if (argc == 2 && strncmp_P(argv[1], PSTR("factory"), sizeof("factory")) == 0) {
+    if (strcmp_P(argv[1], PSTR("factory")) == 0) {
 
         prefs_reset();
+
+        #if ENABLE_PUSH
+            push_rebase(0, CHANNELS - 1);
+        #endif
+
         proto_ok();
 
     } else {
@@ -247,45 +1525,144 @@ static void _reset(uint8_t argc, char* argv[]) {
 
 }
 
-const char str_ping[] PROGMEM = "ping";
-const char str_info[] PROGMEM = "info";
-const char str_memory[] PROGMEM = "memory";
-const char str_channel[] PROGMEM = "channel";
-const char str_log[] PROGMEM = "log";
-const char str_reset[] PROGMEM = "reset";
+static const char str_ping[] PROGMEM = "ping";
+static const char str_channel[] PROGMEM = "channel";
+static const char str_snapshot[] PROGMEM = "snapshot";
+static const char str_flow[] PROGMEM = "flow";
+static const char str_route[] PROGMEM = "route";
+static const char str_baud[] PROGMEM = "baud";
+static const char str_changes[] PROGMEM = "changes";
 
-typedef struct
+// Sorted by name, see proto_command_t
+static const proto_command_t proto_commands[] PROGMEM = {
+
+#if ENABLE_RS485
+    {str_address, 0, 1, _address},
+#endif
+    {str_baud, 0, 1, _baud},
+#if ENABLE_BINARY_PROTOCOL
+    {str_binary, 0, 0, _binary},
+#endif
+    {str_changes, 2, 2, _changes},
+    {str_channel, 2, 4, _channel},
+    {str_flow, 0, 1, _flow},
+    {str_info, 0, 0, _info},
+#if ENABLE_RS485
+    {str_latch, 0, 0, _latch},
+#endif
+#if ENABLE_PROFILING
+    {str_latency, 0, 1, _latency},
+#endif
+#if ENABLE_LOGGING
+    {str_log, 0, PROTO_ARGS_MAX - 1, _log},
+#endif
+#if ENABLE_MEMCHECK
+    {str_memory, 0, 1, _memory},
+#endif
+#if ENABLE_MODBUS
+    {str_modbus, 0, 0, _modbus},
+#endif
+    {str_ping, 0, 0, _ping},
+#if ENABLE_SLEEP
+    {str_power, 0, 0, _power},
+#endif
+#if ENABLE_PROFILING
+    {str_profile, 0, 1, _profile},
+#endif
+#if ENABLE_PUSH
+    {str_push, 1, 2, _push},
+#endif
+    {str_reset, 1, 1, _reset},
+    {str_route, 1, 2, _route},
+    {str_snapshot, 0, 1, _snapshot},
+#if ENABLE_STATS
+    {str_stats, 0, 1, _stats},
+#endif
+
+};
+
+#if !defined(__AVR__)
+
+static bool proto_check_table(const proto_command_t* table, uint8_t size)
 {
 
-    const char* command;
+    for (uint8_t i = 1; i < size; i++) {
 
-    // -1 for ignore
-    int8_t args;
+        if (strcmp((const char*)pgm_read_word(&(table[i - 1].command)), (const char*)pgm_read_word(&(table[i].command))) >= 0) {
 
-    proto_command_callback_t callback;
+            return false;
 
-} proto_command_t;
+        }
 
-static const proto_command_t proto_commands[] PROGMEM = {
+    }
 
-    {str_ping, 0, _ping},
-    {str_info, 0, _info},
-    {str_memory, 0, _memory},
-    {str_channel, -1, _channel},
-    {str_log, -1, _log},
-    {str_reset, -1, _reset},
+    return true;
 
-};
+}
+
+/**
+ * @brief Checks that all command tables are sorted as proto_dispatch() expects
+ *
+ * Switches only ever leave out entries, so the tables being sorted with all
+ * of them enabled implies that they are sorted for any other combination.
+ * This is available for host builds only, see tools/check.c.
+ *
+ * @return True if all tables are strictly ascending, false otherwise
+ */
+bool proto_check_tables()
+{
+
+    bool sorted = proto_check_table(proto_commands, sizeof(proto_commands) / sizeof(proto_command_t));
+    sorted &= proto_check_table(proto_channel_commands, sizeof(proto_channel_commands) / sizeof(proto_command_t));
+
+    #if ENABLE_PUSH
+
+        sorted &= proto_check_table(proto_push_commands, sizeof(proto_push_commands) / sizeof(proto_command_t));
+
+    #endif
 
+    return sorted;
+
+}
+
+#endif
+
+/**
+ * @brief Splits up the command buffer into tokens separated by spaces
+ *
+ * The separators are replaced in place by `\0`, and pointers to the tokens
+ * are stored in `argv`, which needs to have room for PROTO_ARGS_MAX entries.
+ *
+ * @return Number of tokens, or PROTO_ARGS_MAX + 1 if there are too many
+ */
 static uint8_t proto_tokenize_command(char *argv[]) {
 
     uint8_t argc = 0;
-    char *token = strtok(proto_command_buffer, " ");
+    char* str = proto_command_buffer;
+
+    while (*str) {
+
+        if (*str == ' ') {
+
+            *str++ = '\0';
+
+            continue;
+
+        }
+
+        if (argc == PROTO_ARGS_MAX) {
+
+            return PROTO_ARGS_MAX + 1;
+
+        }
+
+        argv[argc++] = str;
 
-    while (token != NULL) {
+        while (*str && *str != ' ') {
 
-        argv[argc++] = token;
-        token = strtok(NULL, " ");
+            str++;
+
+        }
 
     }
 
@@ -293,12 +1670,148 @@ static uint8_t proto_tokenize_command(char *argv[]) {
 
 }
 
+/**
+ * @brief Processes the command line within proto_command_buffer
+ *
+ * The command line might be preceded by an address (when operated on a bus)
+ * and a tag, in this order. Lines addressed to other units are ignored
+ * silently.
+ */
+static void proto_process_command() {
+
+    char *argv[PROTO_ARGS_MAX];
+    uint8_t argc = proto_tokenize_command(argv);
+    bool overflow = (argc > PROTO_ARGS_MAX);
+    char** args = argv;
+
+    proto_tag = NULL;
+    proto_silent = false;
+
+    #if ENABLE_RS485
+        uint8_t address = prefs_get()->address;
+
+        if (argc > 0 && args[0][0] == PROTO_INPUT_ADDRESS_PREFIX) {
+
+            uint32_t target;
+
+            if (!proto_parse_uint(args[0] + 1, PROTO_ADDRESS_MAX, &target)) {
+
+                return;
+
+            }
+
+            if (target == PROTO_ADDRESS_BROADCAST) {
+
+                proto_silent = true;
+
+            } else if (target != address) {
+
+                // Units without an address never process addressed lines
+                return;
+
+            }
+
+            args++;
+            argc--;
+
+        } else if (address != 0) {
+
+            // Only addressed lines are processed on a bus
+            return;
+
+        }
+    #endif
+
+    // Check for optional tag, which is echoed back in the response
+    if (argc > 0 && args[0][0] == PROTO_INPUT_TAG_PREFIX) {
+
+        proto_tag = args[0];
+        args++;
+        argc--;
+
+    }
+
+    if (argc == 0 || overflow) {
+
+        proto_error();
+
+        return;
+
+    }
+
+    log_output_P(LOG_MODULE_PROTO, LOG_LEVEL_DEBUG, "cmd: %s, args: %d", args[0], argc);
+
+    if (!proto_dispatch(proto_commands, sizeof(proto_commands) / sizeof(proto_command_t), 0, argc, args)) {
+
+        proto_error();
+
+    }
+
+}
+
+/**
+ * @brief Keeps track of the time left to confirm a new baud rate
+ *
+ * @note This is expected to be called from the timer ISR at 10 Hz.
+ *
+ * @see _baud()
+ */
+void proto_tick() {
+
+    if (proto_baud_countdown != 0 && --proto_baud_countdown == 0) {
+
+        proto_baud_expired = true;
+
+    }
+
+}
+
 void proto_handle() {
 
     static uint8_t index = 0;
+    static bool truncated = false;
     char c;
 
-    while (uart_getc_nowait(&c)) {
+    // Fall back if the host can't communicate using the new baud rate
+    if (proto_baud_expired) {
+
+        proto_baud_expired = false;
+        uart_set_baud(PROTO_PORT, proto_baud_previous);
+        index = 0;
+        truncated = false;
+
+        log_output_P(LOG_MODULE_PROTO, LOG_LEVEL_WARN, "baud not confirmed: %lu", proto_baud_previous);
+
+    }
+
+    #if ENABLE_BINARY_PROTOCOL
+        if (binary_is_enabled()) {
+
+            binary_handle();
+
+            // Input following the switch back to text mode is still buffered
+            if (!binary_is_enabled()) {
+
+                event_post();
+
+            }
+
+            return;
+
+        }
+    #endif
+
+    #if ENABLE_MODBUS
+        if (modbus_is_enabled()) {
+
+            modbus_handle();
+
+            return;
+
+        }
+    #endif
+
+    while (uart_getc_nowait(PROTO_PORT, &c)) {
 
         log_output_P(LOG_MODULE_PROTO, LOG_LEVEL_DEBUG, "rx: %c, idx: %d", c, index);
 
@@ -308,32 +1821,66 @@ void proto_handle() {
             proto_command_buffer[index] = '\0';
             index = 0;
 
-            char *argv[PROTO_COMMAND_BUFFER_SIZE];
-            uint8_t argc = proto_tokenize_command(argv);
+            if (truncated) {
 
-            log_output_P(LOG_MODULE_PROTO, LOG_LEVEL_DEBUG, "cmd: %s, args: %d", argv[0], argc);
+                truncated = false;
 
-            uint8_t j = sizeof(proto_commands) / sizeof(proto_command_t);
+                #if ENABLE_STATS
+                    if (proto_truncated < UINT16_MAX) {
 
-            // Iterate over all commands
-            for (uint8_t i = 0; i < j; i++) {
+                        proto_truncated++;
 
-                int8_t compare = strncmp_P(argv[0], (const char*)pgm_read_word(&(proto_commands[i].command)), PROTO_COMMAND_BUFFER_SIZE);
-                int8_t args = (int8_t)pgm_read_byte(&(proto_commands[i].args));
+                    }
+                #endif
 
-                // Check command and number of arguments
-                if (compare == 0 && ((argc - 1) == args || args == -1)) {
+                proto_tag = NULL;
+                proto_silent = false;
 
-                    proto_command_callback_t callback = (proto_command_callback_t)pgm_read_word(&(proto_commands[i].callback));
-                    callback(argc, argv);
+                #if ENABLE_RS485
+                    // The line might not have been addressed to this unit
+                    proto_silent = (prefs_get()->address != 0);
+                #endif
 
-                    return;
+                proto_error();
 
-                }
+                // Further input might already be buffered
+                event_post();
+
+                return;
 
             }
 
-            proto_error();
+            #if ENABLE_PROFILING
+                // Data received after the EOL has moved on the timestamp
+                if (uart_input_available(PROTO_PORT)) {
+
+                    proto_command_received = prof_cycles();
+
+                } else {
+
+                    proto_command_received = uart_get_rx_time(PROTO_PORT);
+
+                }
+
+                proto_command_pending = true;
+            #endif
+
+            #if ENABLE_MEMCHECK
+                mem_enter(MEM_CONTEXT_PROTO);
+            #endif
+
+            proto_process_command();
+
+            #if ENABLE_MEMCHECK
+                mem_leave(MEM_CONTEXT_PROTO);
+            #endif
+
+            #if ENABLE_PROFILING
+                proto_command_pending = false;
+            #endif
+
+            // Further input might already be buffered
+            event_post();
 
             return;
 
@@ -344,9 +1891,12 @@ void proto_handle() {
 
             proto_command_buffer[index++] = c;
 
+        } else {
+
+            truncated = true;
+
         }
 
     }
 
 }
-
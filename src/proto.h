@@ -20,6 +20,8 @@
 #ifndef _PROTO_H_
 #define _PROTO_H_
 
+#include <stdbool.h>
+
 /**
  * @brief Prefix for any output generated by this module
  *
@@ -28,6 +30,20 @@
  */
 #define PROTO_OUTPUT_PREFIX ">"
 
+/**
+ * @brief Response to commands that have been processed successfully
+ *
+ * This is output after {@link #PROTO_OUTPUT_PREFIX} and the tag, if any.
+ */
+#define PROTO_OUTPUT_OK "OK"
+
+/**
+ * @brief Response to commands that are unknown, malformed or have failed
+ *
+ * This is output after {@link #PROTO_OUTPUT_PREFIX} and the tag, if any.
+ */
+#define PROTO_OUTPUT_ERROR "ERR"
+
 /**
  * @brief EOL marker for any output generated by this module
  *
@@ -44,6 +60,45 @@
  */
 #define PROTO_INPUT_EOL '\r'
 
+/**
+ * @brief Prefix identifying an optional tag in front of a command
+ *
+ * A command can be preceded by a tag, e.g. `#42 ping`, which is then output
+ * in front of the response, i.e. `>#42 OK`.
+ */
+#define PROTO_INPUT_TAG_PREFIX '#'
+
+/**
+ * @brief Prefix identifying the address of a unit in front of a command
+ *
+ * When operated on a shared bus, i.e. with an address other than zero being
+ * set, only commands preceded by the address of the unit, e.g. `@5 ping`, or
+ * by the broadcast address are processed.
+ */
+#define PROTO_INPUT_ADDRESS_PREFIX '@'
+
+/**
+ * @brief Address that all units on a bus process commands for silently
+ */
+#define PROTO_ADDRESS_BROADCAST 0
+
+/**
+ * @brief Highest address that can be assigned to a unit
+ */
+#define PROTO_ADDRESS_MAX 247
+
+/**
+ * @brief Time for the host to confirm a new baud rate in multiples of 100 ms
+ *
+ * @see proto_tick()
+ */
+#define PROTO_BAUD_CONFIRM_TIMEOUT 20
+
+void proto_tick();
 void proto_handle();
 
+#if !defined(__AVR__)
+bool proto_check_tables();
+#endif
+
 #endif /* _PROTO_H_ */
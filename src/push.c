@@ -0,0 +1,315 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file push.c
+ * @brief Implementation of the header declared in push.h
+ *
+ * The interval is counted down by push_tick(), which is called from the timer
+ * ISR at 10 Hz and only flags a message as being due. The message itself is
+ * generated by push_handle() from within the main loop.
+ *
+ * When the UART is still busy transmitting other data once a message is due,
+ * it is deferred. Intervals elapsing in the meantime are merged into a single
+ * message, as the deltas are always calculated against the counts of the last
+ * message that has actually been output. Counts set explicitly in between are
+ * taken as the new reference instead, see push_rebase().
+ *
+ * @see push.h
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "binary.h"
+#include "config.h"
+#include "log.h"
+#include "prefs.h"
+#include "push.h"
+#include "scratch.h"
+#include "uart.h"
+
+#if ENABLE_PUSH
+
+/**
+ * @brief Port pushed counts are output on
+ *
+ * @see uart_set_route()
+ */
+#define PUSH_PORT uart_get_route(UART_STREAM_PUSH)
+
+/**
+ * @brief Maximum size of the output generated for a single channel
+ */
+#define PUSH_OUTPUT_CHUNK_SIZE 28
+
+/**
+ * @brief Interval between messages in multiples of 100 ms, zero if disabled
+ *
+ * @see push_set_interval()
+ */
+static uint16_t push_interval;
+
+/**
+ * @brief Number of ticks left until the next message is due
+ */
+static uint16_t push_countdown;
+
+/**
+ * @brief Flag indicating that a message is due
+ *
+ * @see push_tick()
+ * @see push_handle()
+ */
+static volatile bool push_pending;
+
+/**
+ * @brief Bitmap of subscribed channels
+ */
+static uint8_t push_channels[(CHANNELS + 7) / 8];
+
+/**
+ * @brief Counts of each channel at the time of the last message
+ */
+static uint32_t push_counts[CHANNELS];
+
+/**
+ * @brief Log level of the S0 module before messages were being pushed
+ *
+ * @see push_set_interval()
+ */
+static log_level_t push_log_level;
+
+/**
+ * @brief Sets the interval between messages
+ *
+ * The counts at the time of this call are used as reference for the deltas
+ * of the first message. While messages are being pushed the log messages of
+ * the S0 module for each impulse are suppressed, as they would defeat the
+ * purpose of pushing messages periodically. The log level of the S0 module
+ * is restored once pushing is disabled again.
+ *
+ * @param interval Interval in multiples of 100 ms, zero to disable
+ */
+void push_set_interval(uint16_t interval)
+{
+
+    uint16_t previous = push_get_interval();
+
+    for (uint8_t i = 0; i < CHANNELS; i++) {
+
+        push_counts[i] = prefs_get()->channels[i].count;
+
+    }
+
+    uint8_t sreg = SREG;
+    cli();
+
+    push_interval = interval;
+    push_countdown = interval;
+    push_pending = false;
+
+    SREG = sreg;
+
+    if (!previous && interval) {
+
+        push_log_level = log_get_level(LOG_MODULE_S0);
+
+        if (push_log_level > LOG_LEVEL_WARN) {
+
+            log_set_level(LOG_MODULE_S0, LOG_LEVEL_WARN);
+
+        }
+
+    } else if (previous && !interval) {
+
+        log_set_level(LOG_MODULE_S0, push_log_level);
+
+    }
+
+}
+
+uint16_t push_get_interval()
+{
+
+    uint8_t sreg = SREG;
+    cli();
+
+    uint16_t interval = push_interval;
+
+    SREG = sreg;
+
+    return interval;
+
+}
+
+/**
+ * @brief Takes the counts of a range of channels as reference for the deltas
+ *
+ * This needs to be called whenever counts are set explicitly, e.g. by `set
+ * count` or by restoring an image, as the difference to the previous count
+ * would be reported as impulses otherwise.
+ *
+ * @param first First channel of the range
+ * @param last Last channel of the range (inclusive)
+ */
+void push_rebase(uint8_t first, uint8_t last)
+{
+
+    for (uint8_t i = first; i <= last; i++) {
+
+        push_counts[i] = prefs_get()->channels[i].count;
+
+    }
+
+}
+
+/**
+ * @brief (Un)subscribes a channel
+ *
+ * Only subscribed channels are included in the messages.
+ */
+void push_subscribe(uint8_t channel, bool subscribed)
+{
+
+    if (subscribed) {
+
+        push_channels[channel / 8] |= _BV(channel % 8);
+
+    } else {
+
+        push_channels[channel / 8] &= ~_BV(channel % 8);
+
+    }
+
+}
+
+/**
+ * @brief Counts down the interval and flags a message as due
+ *
+ * @note This is expected to be called from the timer ISR at 10 Hz.
+ */
+void push_tick()
+{
+
+    if (push_interval == 0) {
+
+        return;
+
+    }
+
+    if (--push_countdown == 0) {
+
+        push_countdown = push_interval;
+        push_pending = true;
+
+    }
+
+}
+
+/**
+ * @brief Outputs a message if one is due and the UART is ready
+ */
+void push_handle()
+{
+
+    if (!push_pending || uart_output_busy(PUSH_PORT)) {
+
+        return;
+
+    }
+
+    #if ENABLE_RS485
+        // Messages would collide with other units on the bus
+        if (prefs_get()->address != 0) {
+
+            push_pending = false;
+
+            return;
+
+        }
+    #endif
+
+    #if ENABLE_BINARY_PROTOCOL
+        // Messages would be interleaved with frames
+        if (binary_is_enabled()) {
+
+            return;
+
+        }
+    #endif
+
+    #if ENABLE_MODBUS
+        // Messages would corrupt the frames
+        if (prefs_get()->modbus) {
+
+            push_pending = false;
+
+            return;
+
+        }
+    #endif
+
+    push_pending = false;
+
+    uart_puts_P(PUSH_PORT, PUSH_OUTPUT_PREFIX);
+
+    bool first = true;
+
+    for (uint8_t i = 0; i < CHANNELS; i++) {
+
+        if (!(push_channels[i / 8] & _BV(i % 8))) {
+
+            continue;
+
+        }
+
+        uint32_t count = prefs_get()->channels[i].count;
+
+        // Modulo 2^32, so counts wrapping around are accounted for
+        uint32_t delta = count - push_counts[i];
+
+        scratch_mark_t mark = scratch_mark();
+        char* str = scratch_alloc(PUSH_OUTPUT_CHUNK_SIZE);
+
+        if (str != NULL) {
+
+            snprintf_P(str, PUSH_OUTPUT_CHUNK_SIZE, first ? PSTR("%u %lu %lu") : PSTR(";%u %lu %lu"), i, count, delta);
+
+            uart_flush_output(PUSH_PORT);
+            uart_puts(PUSH_PORT, str);
+
+        }
+
+        scratch_release(mark);
+
+        push_counts[i] = count;
+        first = false;
+
+    }
+
+    uart_puts_P(PUSH_PORT, PUSH_OUTPUT_EOL);
+
+}
+
+#endif /* ENABLE_PUSH */
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file push.h
+ * @brief Periodic output of the counts of subscribed channels
+ *
+ * Instead of polling the S0-counter or parsing the log message output for
+ * each impulse, the counts of subscribed channels can be pushed periodically.
+ * Each message contains the count of each subscribed channel along with the
+ * number of impulses since the last message:
+ *
+ * \code
+ *  PUSH: 0 123 2;2 4567 0\r\n
+ * \endcode
+ *
+ * Each group consists of the channel, its count and the delta, groups are
+ * separated by `;`.
+ *
+ * @see push.c
+ */
+
+#ifndef _PUSH_H_
+#define _PUSH_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Prefix for any output generated by this module
+ */
+#define PUSH_OUTPUT_PREFIX "PUSH: "
+
+/**
+ * @brief EOL marker for any output generated by this module
+ */
+#define PUSH_OUTPUT_EOL "\r\n"
+
+void push_set_interval(uint16_t interval);
+uint16_t push_get_interval();
+void push_rebase(uint8_t first, uint8_t last);
+void push_subscribe(uint8_t channel, bool subscribed);
+void push_tick();
+void push_handle();
+
+#endif /* _PUSH_H_ */
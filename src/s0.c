@@ -18,13 +18,18 @@
  */
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
 
+#include "config.h"
+#include "event.h"
 #include "fifo.h"
 #include "log.h"
 #include "prefs.h"
+#include "prof.h"
 #include "s0.h"
 #include "timer.h"
 #include "io.h"
+#include "str.h"
 
 #define membersize(type, member) sizeof(((type *)0)->member)
 
@@ -66,6 +71,33 @@ static uint8_t s0_fifo_buffer[S0_FIFO_BUFFER_SIZE];
 
 static volatile uint8_t s0_output_counter = 0;
 
+/**
+ * @brief Number of impulses lost, because s0_fifo was full
+ *
+ * @see s0_get_dropped()
+ */
+static volatile uint16_t s0_dropped = 0;
+
+#if ENABLE_PROFILING
+
+/**
+ * @brief Timestamp of an impulse whose age has not been recorded yet
+ *
+ * Only one impulse at a time is tracked. Its age is recorded by s0_handle()
+ * once the next count has been saved, which samples the time impulses wait
+ * to be persisted.
+ *
+ * @see PROF_LATENCY_PULSE
+ */
+static volatile uint32_t s0_detected;
+
+/**
+ * @brief Flag indicating that s0_detected is valid
+ */
+static volatile bool s0_detected_valid;
+
+#endif
+
 void s0_init()
 {
 
@@ -86,7 +118,7 @@ void s0_init()
 
     fifo_init(&s0_fifo, s0_fifo_buffer, S0_FIFO_BUFFER_SIZE);
 
-    log_output_P(LOG_MODULE_S0, LOG_LEVEL_DEBUG, "initialized");
+    log_output_S(LOG_MODULE_S0, LOG_LEVEL_DEBUG, str_initialized);
 
 }
 
@@ -119,7 +151,22 @@ void s0_poll()
             if (impulses[i] != 0 && impulses[i] > prefs_get()->channels[i].min && impulses[i] < prefs_get()->channels[i].max) {
 
                 // Put channel into FIFO, so it will be handled asynchronously by s0_handle()
-                fifo_put(&s0_fifo, i);
+                if (!fifo_put(&s0_fifo, i) && s0_dropped < UINT16_MAX) {
+
+                    s0_dropped++;
+
+                }
+
+                event_post();
+
+                #if ENABLE_PROFILING
+                    if (!s0_detected_valid) {
+
+                        s0_detected = prof_cycles();
+                        s0_detected_valid = true;
+
+                    }
+                #endif
 
             }
 
@@ -157,6 +204,15 @@ void s0_handle()
         prefs_get()->channels[channel].count++;
         prefs_save_block(&(prefs_get()->channels[channel].count), membersize(channel_prefs_t, count));
 
+        #if ENABLE_PROFILING
+            if (s0_detected_valid) {
+
+                prof_record_latency(PROF_LATENCY_PULSE, s0_detected);
+                s0_detected_valid = false;
+
+            }
+        #endif
+
         s0_output_counter = S0_OUTPUT_LENGTH;
 
         log_output_P(LOG_MODULE_S0, LOG_LEVEL_INFO, "channel: %u, count: %lu", channel, prefs_get()->channels[channel].count);
@@ -165,3 +221,205 @@ void s0_handle()
 
 }
 
+#if ENABLE_SLEEP
+
+/**
+ * @brief Pin change masks of ports C and D currently in effect
+ *
+ * @see s0_watch()
+ */
+static uint8_t s0_watch_c;
+static uint8_t s0_watch_d;
+
+/**
+ * @brief Enables or disables pin change interrupts for all enabled channels
+ *
+ * Channels are located on ports C and D only, whose pin change interrupts
+ * are not used otherwise. The registers are only written once the channels
+ * to be watched change, e.g. when going to sleep or waking up, in which case
+ * pending interrupts are discarded. Calling this on every tick therefore
+ * neither costs register writes nor loses pin changes.
+ */
+static void s0_watch(bool enabled)
+{
+
+    uint8_t mask_c = 0;
+    uint8_t mask_d = 0;
+
+    for (uint8_t i = 0; enabled && i < CHANNELS; i++) {
+
+        if (!(prefs_get()->channels[i].enabled)) {
+
+            continue;
+
+        }
+
+        if (channels[i].port == &PINC) {
+
+            mask_c |= _BV(channels[i].pin);
+
+        } else if (channels[i].port == &PIND) {
+
+            mask_d |= _BV(channels[i].pin);
+
+        }
+
+    }
+
+    if (mask_c == s0_watch_c && mask_d == s0_watch_d) {
+
+        return;
+
+    }
+
+    s0_watch_c = mask_c;
+    s0_watch_d = mask_d;
+
+    PCIFR = _BV(PCIF1) | _BV(PCIF2);
+    PCMSK1 = mask_c;
+    PCMSK2 = mask_d;
+
+    if (enabled) {
+
+        PCICR |= _BV(PCIE1) | _BV(PCIE2);
+
+    } else {
+
+        PCICR &= ~(_BV(PCIE1) | _BV(PCIE2));
+
+    }
+
+}
+
+/**
+ * @brief Checks whether all enabled channels are idle
+ *
+ * Channels are idle when their signal is high and no impulse is being
+ * measured.
+ */
+static bool s0_idle()
+{
+
+    for (uint8_t i = 0; i < CHANNELS; i++) {
+
+        if (channels[i].port == NULL || !(prefs_get()->channels[i].enabled)) {
+
+            continue;
+
+        }
+
+        if (impulses[i] != 0 || !(*(channels[i].port) & _BV(channels[i].pin))) {
+
+            return false;
+
+        }
+
+    }
+
+    return true;
+
+}
+
+/**
+ * @brief Checks whether all channels are idle and watches them if so
+ *
+ * Impulses not yet handled and the output being active keep the channels
+ * busy, too, as s0_output() needs to be called at 100 Hz then. Once this
+ * returns true, s0_poll() doesn't need to be called until the signal of any
+ * of the channels changes, which is signaled by timer_wake().
+ *
+ * The channels are only watched once they have been found idle, so ticks
+ * with a channel being busy leave the pin change interrupts alone. The
+ * signals are checked once more after the interrupts have been enabled, so
+ * changes in between are not missed.
+ *
+ * @note This is expected to be called from the timer ISR.
+ *
+ * @return True if all channels are idle, false otherwise
+ */
+bool s0_sleep()
+{
+
+    if (s0_fifo.count != 0 || s0_output_counter != 0 || (PORT(S0_OUTPUT) & _BV(BIT(S0_OUTPUT))) || !s0_idle()) {
+
+        s0_watch(false);
+
+        return false;
+
+    }
+
+    s0_watch(true);
+
+    if (!s0_idle()) {
+
+        s0_watch(false);
+
+        return false;
+
+    }
+
+    return true;
+
+}
+
+/**
+ * @brief Stops watching the channels and speeds up the timer again
+ */
+static void s0_pin_change()
+{
+
+    s0_watch(false);
+    timer_wake();
+
+}
+
+ISR(PCINT1_vect)
+{
+
+    s0_pin_change();
+
+}
+
+ISR(PCINT2_vect)
+{
+
+    s0_pin_change();
+
+}
+
+#endif
+
+/**
+ * @brief Returns the number of impulses lost since reset
+ *
+ * @note This saturates at UINT16_MAX.
+ */
+uint16_t s0_get_dropped()
+{
+
+    uint8_t sreg = SREG;
+    cli();
+
+    uint16_t dropped = s0_dropped;
+
+    SREG = sreg;
+
+    return dropped;
+
+}
+
+#if ENABLE_STATS
+
+/**
+ * @brief Returns the highest fill level of the FIFO since reset
+ *
+ * @see S0_FIFO_BUFFER_SIZE
+ */
+uint8_t s0_get_fifo_high()
+{
+
+    return s0_fifo.high;
+
+}
+
+#endif
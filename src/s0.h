@@ -20,10 +20,16 @@
 #ifndef _S0_H_
 #define _S0_H_
 
+#include <stdbool.h>
+#include <stdint.h>
+
 void s0_init();
 void s0_poll();
+bool s0_sleep();
 void s0_handle();
 void s0_output();
+uint16_t s0_get_dropped();
+uint8_t s0_get_fifo_high();
 
 #endif /* _S0_H_ */
 
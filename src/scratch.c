@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file scratch.c
+ * @brief Implementation of the header declared in scratch.h
+ *
+ * The arena is managed like a stack: scratch_alloc() simply moves the top
+ * upwards and scratch_release() moves it back down to a previous mark.
+ *
+ * @see scratch.h
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "scratch.h"
+
+/**
+ * @brief The arena itself
+ */
+static uint8_t scratch_arena[SCRATCH_SIZE];
+
+/**
+ * @brief Offset of the first unused byte within scratch_arena
+ */
+static uint8_t scratch_top;
+
+/**
+ * @brief Highest value of scratch_top since reset
+ */
+static uint8_t scratch_high;
+
+/**
+ * @brief Number of allocations that could not be satisfied
+ */
+static uint16_t scratch_overuse;
+
+scratch_mark_t scratch_mark()
+{
+
+    return scratch_top;
+
+}
+
+/**
+ * @brief Allocates a buffer from the arena
+ *
+ * @param size Size of the buffer in bytes
+ *
+ * @return Pointer to the buffer, NULL if the arena is exhausted, which is
+ * counted as overuse
+ */
+void* scratch_alloc(uint8_t size)
+{
+
+    if (size > SCRATCH_SIZE - scratch_top) {
+
+        if (scratch_overuse < UINT16_MAX) {
+
+            scratch_overuse++;
+
+        }
+
+        return NULL;
+
+    }
+
+    void* buffer = &scratch_arena[scratch_top];
+
+    scratch_top += size;
+
+    if (scratch_top > scratch_high) {
+
+        scratch_high = scratch_top;
+
+    }
+
+    return buffer;
+
+}
+
+/**
+ * @brief Frees everything allocated after the given mark has been taken
+ */
+void scratch_release(scratch_mark_t mark)
+{
+
+    scratch_top = mark;
+
+}
+
+/**
+ * @brief Returns the highest number of bytes allocated at once since reset
+ */
+uint8_t scratch_get_high()
+{
+
+    return scratch_high;
+
+}
+
+/**
+ * @brief Returns the number of allocations that could not be satisfied
+ */
+uint16_t scratch_get_overuse()
+{
+
+    return scratch_overuse;
+
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file scratch.h
+ * @brief Shared arena for temporary buffers
+ *
+ * Output paths (protocol, log messages, pushed counts) need buffers to format
+ * their output in. Instead of putting these onto the stack, where they pile
+ * up whenever these paths are nested, they are allocated from a single static
+ * arena in a stack-like manner:
+ *
+ * \code
+ *  scratch_mark_t mark = scratch_mark();
+ *  char* str = scratch_alloc(size);
+ *  ...
+ *  scratch_release(mark);
+ * \endcode
+ *
+ * Releasing a mark frees everything allocated after it had been taken, so
+ * allocations must be released in reverse order.
+ *
+ * @warning This must not be used from within ISRs.
+ *
+ * @see scratch.c
+ */
+
+#ifndef _SCRATCH_H_
+#define _SCRATCH_H_
+
+#include <stdint.h>
+
+/**
+ * @brief Size of the arena in bytes
+ *
+ * This is sized for the largest single buffer, a log message (80 bytes), as
+ * none of the output paths allocate while holding a buffer of another one.
+ * The high-water mark measured by `dispatch -l` across all commands is 80
+ * bytes (see `doc/HOST.md`). Should allocations ever nest, the output
+ * concerned is dropped rather than overflowing, which is reported as overuse
+ * by the `memory` command.
+ */
+#define SCRATCH_SIZE 80
+
+/**
+ * @brief Position within the arena, as returned by scratch_mark()
+ */
+typedef uint8_t scratch_mark_t;
+
+scratch_mark_t scratch_mark();
+void* scratch_alloc(uint8_t size);
+void scratch_release(scratch_mark_t mark);
+uint8_t scratch_get_high();
+uint16_t scratch_get_overuse();
+
+#endif /* _SCRATCH_H_ */
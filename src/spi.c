@@ -0,0 +1,356 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file spi.c
+ * @brief Implementation of the header declared in spi.h
+ *
+ * Two images are kept: The active one, which is output by the ISRs, and the
+ * inactive one, which is prepared by spi_handle() from within the main loop.
+ * Once the inactive image has been prepared, it is flagged as pending. The
+ * images are swapped at the beginning of the next transfer, i.e. when SS is
+ * pulled low, so a transfer always returns a consistent image.
+ *
+ * The inactive image is only ever written to while it is not pending, so the
+ * ISRs and the main loop never access the same image concurrently. If the
+ * counts change again before the host has started a transfer, the pending
+ * flag is withdrawn while the image is being prepared again.
+ *
+ * @see spi.h
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/crc16.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "config.h"
+#include "io.h"
+#include "log.h"
+#include "prefs.h"
+#include "s0.h"
+#include "spi.h"
+#include "str.h"
+
+#if ENABLE_SPI
+
+/**
+ * @brief Pin signaling the host that a new image is available
+ */
+#define SPI_READY PORTD, 4
+
+/**
+ * @brief Slave select pin, which is monitored by a pin change interrupt
+ */
+#define SPI_SS PORTB, 2
+
+/**
+ * @brief Data output pin of the slave
+ */
+#define SPI_MISO PORTB, 4
+
+/**
+ * @brief Buffers holding the images
+ *
+ * @see spi_active
+ */
+static spi_image_t spi_images[2];
+
+/**
+ * @brief Index of the image within spi_images that is currently output
+ */
+static volatile uint8_t spi_active;
+
+/**
+ * @brief Flag indicating that the inactive image is ready to be swapped in
+ */
+static volatile bool spi_pending;
+
+/**
+ * @brief Index of the next byte of the active image to be output
+ *
+ * The image exceeds 255 bytes from 32 channels on, hence the width.
+ */
+static volatile uint16_t spi_index;
+
+/**
+ * @brief Impulses per channel within each of the last intervals
+ *
+ * This is kept separately from the images, as it is only advanced once per
+ * interval, whereas images are prepared whenever the counts change.
+ */
+static uint8_t spi_history[SPI_HISTORY_SIZE][CHANNELS];
+
+/**
+ * @brief Number of intervals that have been recorded so far, saturating
+ */
+static uint8_t spi_history_count;
+
+/**
+ * @brief Counts of each channel at the beginning of the current interval
+ */
+static uint32_t spi_history_counts[CHANNELS];
+
+/**
+ * @brief Flag indicating that the current interval has elapsed
+ *
+ * @see spi_tick()
+ */
+static volatile bool spi_interval_elapsed;
+
+/**
+ * @brief Sequence number the inactive image has been prepared for
+ */
+static uint32_t spi_sequence;
+
+/**
+ * @brief Initializes the SPI hardware in slave mode
+ *
+ * @note This needs to be called after prefs_init(), as the counts at this
+ * point in time are the reference for the first interval of the history.
+ */
+void spi_init()
+{
+
+    for (uint8_t i = 0; i < CHANNELS; i++) {
+
+        spi_history_counts[i] = prefs_get()->channels[i].count;
+
+    }
+
+    // MISO is the only output in slave mode
+    DDR(SPI_MISO) |= _BV(BIT(SPI_MISO));
+
+    PORT(SPI_READY) &= ~_BV(BIT(SPI_READY));
+    DDR(SPI_READY) |= _BV(BIT(SPI_READY));
+
+    // Enable SPI in slave mode (mode 0, MSB first) with interrupt
+    SPCR = _BV(SPE) | _BV(SPIE);
+
+    // Enable pin change interrupt for SS
+    PCMSK0 |= _BV(PCINT2);
+    PCICR |= _BV(PCIE0);
+
+    // Provide an image right away
+    spi_sequence = prefs_get_sequence() - 1;
+    spi_handle();
+
+    log_output_S(LOG_MODULE_SPI, LOG_LEVEL_DEBUG, str_initialized);
+
+}
+
+/**
+ * @brief Starts a new transfer whenever SS is pulled low
+ *
+ * A pending image is swapped in at this point and the first byte is put into
+ * the data register, so it is output with the first clock cycles.
+ */
+ISR(PCINT0_vect)
+{
+
+    if (PIN(SPI_SS) & _BV(BIT(SPI_SS))) {
+
+        return;
+
+    }
+
+    if (spi_pending) {
+
+        spi_active ^= 1;
+        spi_pending = false;
+
+        PORT(SPI_READY) &= ~_BV(BIT(SPI_READY));
+
+    }
+
+    SPDR = ((uint8_t*)&spi_images[spi_active])[0];
+    spi_index = 1;
+
+}
+
+/**
+ * @brief Puts the next byte of the image into the data register
+ *
+ * Once the whole image has been output, zeros are output.
+ */
+ISR(SPI_STC_vect)
+{
+
+    uint16_t index = spi_index;
+
+    if (index < sizeof(spi_image_t)) {
+
+        SPDR = ((uint8_t*)&spi_images[spi_active])[index];
+        spi_index = index + 1;
+
+    } else {
+
+        SPDR = 0;
+
+    }
+
+}
+
+/**
+ * @brief Flags the current interval of the history as elapsed
+ *
+ * @note This is expected to be called from the timer ISR at 1 Hz.
+ */
+void spi_tick()
+{
+
+    spi_interval_elapsed = true;
+
+}
+
+/**
+ * @brief Advances the history by one interval
+ */
+static void spi_history_advance()
+{
+
+    for (uint8_t i = SPI_HISTORY_SIZE - 1; i > 0; i--) {
+
+        for (uint8_t ch = 0; ch < CHANNELS; ch++) {
+
+            spi_history[i][ch] = spi_history[i - 1][ch];
+
+        }
+
+    }
+
+    for (uint8_t ch = 0; ch < CHANNELS; ch++) {
+
+        uint32_t count = prefs_get()->channels[ch].count;
+        uint32_t delta = count - spi_history_counts[ch];
+
+        spi_history[0][ch] = delta > UINT8_MAX ? UINT8_MAX : delta;
+        spi_history_counts[ch] = count;
+
+    }
+
+    if (spi_history_count < SPI_HISTORY_SIZE) {
+
+        spi_history_count++;
+
+    }
+
+}
+
+/**
+ * @brief Prepares a new image whenever counts change or an interval elapses
+ *
+ * This is expected to be called from within the main loop.
+ */
+void spi_handle()
+{
+
+    uint32_t sequence = prefs_get_sequence();
+    bool elapsed = spi_interval_elapsed;
+
+    if (sequence == spi_sequence && !elapsed) {
+
+        return;
+
+    }
+
+    if (elapsed) {
+
+        spi_interval_elapsed = false;
+        spi_history_advance();
+
+    }
+
+    // Withdraw pending image, so it can be prepared again
+    uint8_t sreg = SREG;
+    cli();
+
+    spi_pending = false;
+    PORT(SPI_READY) &= ~_BV(BIT(SPI_READY));
+
+    SREG = sreg;
+
+    spi_image_t* image = &spi_images[spi_active ^ 1];
+
+    image->version = SPI_IMAGE_VERSION;
+    image->status = 0;
+    image->channels = CHANNELS;
+    memset(image->enabled, 0, sizeof(image->enabled));
+    image->sequence = sequence;
+
+    if (spi_history_count == SPI_HISTORY_SIZE) {
+
+        image->status |= SPI_STATUS_HISTORY_VALID;
+
+    }
+
+    if (s0_get_dropped() != 0) {
+
+        image->status |= SPI_STATUS_S0_OVERRUN;
+
+    }
+
+    for (uint8_t ch = 0; ch < CHANNELS; ch++) {
+
+        channel_prefs_t* channel = &(prefs_get()->channels[ch]);
+
+        if (channel->enabled) {
+
+            image->enabled[ch / 8] |= _BV(ch % 8);
+
+        }
+
+        image->counts[ch] = channel->count;
+
+        for (uint8_t i = 0; i < SPI_HISTORY_SIZE; i++) {
+
+            image->history[i][ch] = spi_history[i][ch];
+
+        }
+
+    }
+
+    uint16_t crc = 0xFFFF;
+    const uint8_t* data = (const uint8_t*)image;
+
+    for (uint16_t i = 0; i < offsetof(spi_image_t, crc); i++) {
+
+        crc = _crc_xmodem_update(crc, data[i]);
+
+    }
+
+    image->crc = crc;
+
+    spi_sequence = sequence;
+
+    sreg = SREG;
+    cli();
+
+    spi_pending = true;
+    PORT(SPI_READY) |= _BV(BIT(SPI_READY));
+
+    SREG = sreg;
+
+}
+
+#endif /* ENABLE_SPI */
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file spi.h
+ * @brief SPI slave interface providing an image of the complete state
+ *
+ * This module allows a host on the same board to read out the state of all
+ * channels at once via SPI, which is considerably faster than polling each
+ * channel via UART. The S0-counter operates as SPI slave (mode 0, MSB first).
+ * Each transfer, i.e. each time the host pulls SS low, starts at the
+ * beginning of the image (spi_image_t), which the host simply clocks out.
+ * Data sent by the host is ignored.
+ *
+ * The image is double buffered: While the host is reading one image, the
+ * next one is prepared. Once a new image is available, the data ready pin
+ * ({@link #SPI_READY}) is driven high. It is driven low again as soon as the
+ * host starts a transfer, which will return the new image.
+ *
+ * For details refer to `doc/SPI.md`.
+ *
+ * @see spi.c
+ */
+
+#ifndef _SPI_H_
+#define _SPI_H_
+
+#include <stdint.h>
+
+#include "prefs.h"
+
+/**
+ * @brief Version of the layout of the image
+ *
+ * This is contained within each image and needs to be incremented whenever
+ * spi_image_t changes.
+ */
+#define SPI_IMAGE_VERSION 1
+
+/**
+ * @brief Number of intervals contained within the history of each image
+ */
+#define SPI_HISTORY_SIZE 4
+
+/**
+ * @brief Flag within spi_image_t::status indicating a complete history
+ *
+ * This is not set until SPI_HISTORY_SIZE intervals have elapsed after reset.
+ */
+#define SPI_STATUS_HISTORY_VALID (1 << 0)
+
+/**
+ * @brief Flag within spi_image_t::status indicating that data has been lost
+ *
+ * This is set when impulses could not be processed in time, i.e. counts might
+ * be too low.
+ */
+#define SPI_STATUS_S0_OVERRUN (1 << 1)
+
+/**
+ * @brief Layout of the image that is read out by the host
+ *
+ * Multi-byte values are little endian.
+ */
+typedef struct {
+
+    // Layout of the image, see SPI_IMAGE_VERSION
+    uint8_t version;
+
+    // Combination of SPI_STATUS_* flags
+    uint8_t status;
+
+    // Number of channels, i.e. CHANNELS
+    uint8_t channels;
+
+    // Bitmap of enabled channels, channel N is bit N % 8 of byte N / 8
+    uint8_t enabled[(CHANNELS + 7) / 8];
+
+    // Sequence number of the counts, see prefs_get_sequence()
+    uint32_t sequence;
+
+    // Count of each channel
+    uint32_t counts[CHANNELS];
+
+    // Impulses per channel within each of the last intervals, newest first
+    uint8_t history[SPI_HISTORY_SIZE][CHANNELS];
+
+    // CRC-16/CCITT-FALSE over all of the preceding bytes
+    uint16_t crc;
+
+} __attribute__((packed)) spi_image_t;
+
+void spi_init();
+void spi_tick();
+void spi_handle();
+
+#endif /* _SPI_H_ */
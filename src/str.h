@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file str.h
+ * @brief Log messages in program space shared across modules
+ *
+ * The linker does not merge literals placed into `.progmem`, so a literal
+ * used in multiple places occupies flash each time. The log messages output
+ * by more than one module are therefore defined only once within str.c and
+ * referenced by their symbol.
+ *
+ * This is a small refactoring rather than a pool saving flash: There are only
+ * two such messages, and by estimate they rather cost a few bytes than save
+ * any, which has not been measured using avr-size. Merging all of the strings in program space is still
+ * an open item (see TODO). Strings used more than once within a single module
+ * are defined as static variables of that module, e.g. the keywords of
+ * proto.c.
+ *
+ * Strings are output as log messages by log_output_S(), whereas
+ * log_output_P() keeps placing literals used only once right at the call.
+ *
+ * @see str.c
+ */
+
+#ifndef _STR_H_
+#define _STR_H_
+
+#include <avr/pgmspace.h>
+
+// Log messages
+extern const char str_initialized[] PROGMEM;
+extern const char str_crc_mismatch[] PROGMEM;
+
+#endif /* _STR_H_ */
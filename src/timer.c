@@ -17,12 +17,75 @@
  * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
  */
 
+/**
+ * @file timer.c
+ * @brief Timer driving all of the periodic work
+ *
+ * Timer0 is run in CTC mode and interrupts once per millisecond. S0 channels
+ * are polled on each tick, whereas slower periodic work is scheduled by
+ * deadlines in milliseconds (timer_now), which are checked on each tick.
+ *
+ * With `ENABLE_SLEEP` the timer is slowed down to a tick every
+ * {@link #TIMER_SLOW_MS} milliseconds while all of the S0 channels are idle,
+ * see s0_sleep(). The channels are watched by pin change interrupts instead,
+ * which call timer_wake() to switch back to 1 ms ticks right away, so the
+ * first sample of an impulse is taken no later than without slowing down.
+ * Deadlines that have passed while slowed down are caught up with in a row.
+ *
+ * @see timer.h
+ */
+
 #include <avr/io.h>
 #include <avr/interrupt.h>
 
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "event.h"
 #include "log.h"
+#include "mem.h"
+#include "modbus.h"
+#include "prof.h"
+#include "proto.h"
+#include "push.h"
 #include "s0.h"
+#include "spi.h"
+#include "str.h"
 #include "timer.h"
+#include "uart.h"
+
+#if ENABLE_SLEEP
+
+/**
+ * @brief Period of the timer in milliseconds while all channels are idle
+ *
+ * The timer is prescaled by 1024 then, so this must not exceed 32 ms at 8 MHz.
+ */
+#define TIMER_SLOW_MS 32
+
+#if F_CPU / 1000 * TIMER_SLOW_MS / 1024 > 256
+    #error "TIMER_SLOW_MS is too long for F_CPU"
+#endif
+
+/**
+ * @brief Flag indicating that the timer has been slowed down
+ */
+static volatile bool timer_slow;
+
+#endif
+
+/**
+ * @brief Current time in milliseconds, wrapping around
+ */
+static uint16_t timer_now;
+
+/**
+ * @brief Deadlines of the periodic work, see timer_dispatch()
+ */
+static uint16_t timer_deadline_100hz = 10;
+static uint16_t timer_deadline_10hz = 100;
+static uint16_t timer_deadline_1hz = 1000;
 
 void timer_init()
 {
@@ -32,7 +95,7 @@ void timer_init()
     OCR0A = F_CPU / 64 / 1000;
     TIMSK0 = _BV(OCIE0A);
 
-    log_output_P(LOG_MODULE_TIMER, LOG_LEVEL_DEBUG, "initialized");
+    log_output_S(LOG_MODULE_TIMER, LOG_LEVEL_DEBUG, str_initialized);
 
 }
 
@@ -41,6 +104,10 @@ static inline void timer_1khz()
 
     s0_poll();
 
+    #if ENABLE_MODBUS
+        uart_tick();
+    #endif
+
 }
 
 static inline void timer_100hz()
@@ -48,55 +115,220 @@ static inline void timer_100hz()
 
     s0_output();
 
-}
+    #if ENABLE_MEMCHECK
+        mem_tick();
+    #endif
 
+}
 
 static inline void timer_10hz()
 {
 
-}
+    proto_tick();
+
+    #if ENABLE_PUSH
+        push_tick();
+    #endif
 
+}
 
 static inline void timer_1hz()
 {
 
+    #if ENABLE_PROFILING
+        prof_tick();
+    #endif
+
+    #if ENABLE_SPI
+        spi_tick();
+    #endif
+
+    #if ENABLE_SLEEP
+        event_tick();
+    #endif
+
 }
 
-ISR(TIMER0_COMPA_vect)
+/**
+ * @brief Checks whether a deadline has passed and advances it if so
+ *
+ * @param deadline Deadline to check
+ * @param period Period of the work in milliseconds
+ *
+ * @return True if the work is due, false otherwise
+ */
+static inline bool timer_due(uint16_t* deadline, uint16_t period)
 {
 
-    static uint8_t prescaler1;
-    static uint8_t prescaler2;
-    static uint8_t prescaler3;
+    if ((int16_t)(timer_now - *deadline) < 0) {
 
-    timer_1khz();
+        return false;
 
-    if (++prescaler1 != 10) {
+    }
 
-        return;
+    *deadline += period;
+
+    return true;
+
+}
+
+/**
+ * @brief Advances the time and runs the periodic work that is due
+ *
+ * The main loop is woken up afterwards, as each piece of work might leave
+ * something to be handled.
+ *
+ * @param ms Milliseconds elapsed since the last call
+ */
+static inline void timer_dispatch(uint8_t ms)
+{
+
+    bool due = false;
+
+    timer_now += ms;
+
+    while (timer_due(&timer_deadline_100hz, 10)) {
+
+        timer_100hz();
+        due = true;
+
+    }
+
+    while (timer_due(&timer_deadline_10hz, 100)) {
+
+        timer_10hz();
+        due = true;
+
+    }
+
+    while (timer_due(&timer_deadline_1hz, 1000)) {
+
+        timer_1hz();
+        due = true;
 
     }
 
-    prescaler1 = 0;
-    timer_100hz();
+    if (due) {
+
+        event_post();
+
+    }
+
+}
+
+#if ENABLE_SLEEP
+
+/**
+ * @brief Slows the timer down while all channels are idle
+ *
+ * Modbus needs the 1 ms ticks to detect the end of frames, so the timer is
+ * never slowed down while it is enabled.
+ */
+static inline void timer_select()
+{
+
+    bool slow;
 
-    if (++prescaler2 != 10) {
+    #if ENABLE_MODBUS
+        if (modbus_is_enabled()) {
+
+            slow = false;
+
+        } else {
+
+            slow = s0_sleep();
+
+        }
+    #else
+        slow = s0_sleep();
+    #endif
+
+    if (slow == timer_slow) {
 
         return;
 
     }
 
-    prescaler2 = 0;
-    timer_10hz();
+    timer_slow = slow;
+
+    TCNT0 = 0;
+
+    if (slow) {
 
-    if (++prescaler3 != 10) {
+        TCCR0B = _BV(CS02) | _BV(CS00);
+        OCR0A = F_CPU / 1000 * TIMER_SLOW_MS / 1024 - 1;
+
+    } else {
+
+        TCCR0B = _BV(CS01) | _BV(CS00);
+        OCR0A = F_CPU / 64 / 1000;
+
+    }
+
+}
+
+/**
+ * @brief Switches back to 1 ms ticks once an S0 channel becomes active
+ *
+ * The time elapsed since the last tick is accounted for, so deadlines are
+ * kept. Full milliseconds are added to timer_now right away, while the
+ * fraction of the current millisecond is carried over into the counter, so
+ * the next tick happens once the current millisecond is complete.
+ *
+ * @note This is expected to be called from the pin change ISRs of the S0
+ * channels.
+ */
+void timer_wake()
+{
+
+    if (!timer_slow) {
 
         return;
 
     }
 
-    prescaler3 = 0;
-    timer_1hz();
+    uint32_t cycles = (uint32_t)TCNT0 * 1024;
+
+    timer_now += cycles / (F_CPU / 1000);
+
+    timer_slow = false;
+
+    TCCR0B = _BV(CS01) | _BV(CS00);
+    OCR0A = F_CPU / 64 / 1000;
+    TCNT0 = cycles % (F_CPU / 1000) / 64;
+    TIFR0 = _BV(OCF0A);
 
 }
 
+#endif
+
+ISR(TIMER0_COMPA_vect)
+{
+
+    PROF_ENTER();
+
+    #if ENABLE_MEMCHECK
+        mem_sample(true);
+    #endif
+
+    #if ENABLE_SLEEP
+        if (timer_slow) {
+
+            timer_dispatch(TIMER_SLOW_MS);
+
+        } else {
+
+            timer_1khz();
+            timer_dispatch(1);
+
+        }
+
+        timer_select();
+    #else
+        timer_1khz();
+        timer_dispatch(1);
+    #endif
+
+    PROF_EXIT(PROF_ISR_TIMER);
+
+}
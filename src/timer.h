@@ -21,6 +21,7 @@
 #define _TIMER_H_
 
 void timer_init();
+void timer_wake();
 
 #endif /* _TIMER_H_ */
 
@@ -23,7 +23,8 @@
  *
  * This implements the functionality declared in uart.h. As the module works
  * in an asynchronous fashion there are buffers holding the data, which are
- * managed as FIFOs.
+ * managed as FIFOs. Each port has its own set of buffers and state, which is
+ * kept in {@link #uart_ports}.
  *
  * It is based upon [1] with some minor adaptations.
  *
@@ -35,17 +36,225 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <util/delay.h>
 
 #include <stdbool.h>
 #include <stdio.h>
 
+#include "config.h"
+#include "event.h"
 #include "fifo.h"
+#include "io.h"
+#include "prof.h"
 #include "uart.h"
 
 #define UART_RX_OVERRUN_SYMBOL '~'
 #define UART_TX_OVERRUN_SYMBOL '+'
 
-static bool tx_overrun;
+/**
+ * @brief Interrupt vectors of the USARTs
+ *
+ * MCUs with a single USART name their vectors differently from those with
+ * multiple USARTs.
+ */
+#if defined(USART0_RX_vect)
+    #define UART0_RX_vect USART0_RX_vect
+    #define UART0_UDRE_vect USART0_UDRE_vect
+    #define UART0_TX_vect USART0_TX_vect
+#else
+    #define UART0_RX_vect USART_RX_vect
+    #define UART0_UDRE_vect USART_UDRE_vect
+    #define UART0_TX_vect USART_TX_vect
+#endif
+
+/**
+ * @brief Access to the registers of the USART belonging to a port
+ *
+ * The registers of all USARTs share the same layout, so the bit names of
+ * USART0 are used for all of them. When called with a constant port, e.g.
+ * from within an ISR, the selection is resolved at compile time.
+ */
+#if UART_PORTS > 1
+    #define UCSRA(port) (*((port) ? &UCSR1A : &UCSR0A))
+    #define UCSRB(port) (*((port) ? &UCSR1B : &UCSR0B))
+    #define UCSRC(port) (*((port) ? &UCSR1C : &UCSR0C))
+    #define UBRRH(port) (*((port) ? &UBRR1H : &UBRR0H))
+    #define UBRRL(port) (*((port) ? &UBRR1L : &UBRR0L))
+    #define UDR(port) (*((port) ? &UDR1 : &UDR0))
+#else
+    #define UCSRA(port) UCSR0A
+    #define UCSRB(port) UCSR0B
+    #define UCSRC(port) UCSR0C
+    #define UBRRH(port) UBRR0H
+    #define UBRRL(port) UBRR0L
+    #define UDR(port) UDR0
+#endif
+
+/**
+ * @brief State of a single port
+ *
+ * @see uart_ports
+ */
+typedef struct {
+
+    /**
+     * @brief FIFO organizational data of incoming buffer
+     *
+     * @see uart_buffer_in
+     */
+    fifo_t fifo_in;
+
+    /**
+     * @brief FIFO organizational data of outgoing buffer
+     *
+     * @see uart_buffer_out
+     */
+    fifo_t fifo_out;
+
+    /**
+     * @brief Flag indicating that data to be transmitted has been lost
+     */
+    bool tx_overrun;
+
+    /**
+     * @brief Flag indicating whether software flow control is enabled
+     *
+     * @see uart_set_flow_control()
+     */
+    bool flow_control;
+
+    /**
+     * @brief Flag indicating whether XOFF has been sent without XON following
+     */
+    volatile bool flow_stopped;
+
+    /**
+     * @brief Flow control character still to be transmitted, zero if none
+     *
+     * This takes precedence over everything else within the transmission
+     * buffer.
+     */
+    volatile uint8_t flow_symbol;
+
+    /**
+     * @brief Number of ticks since the last byte has been received
+     *
+     * @see uart_tick()
+     * @see uart_get_rx_idle()
+     */
+    volatile uint8_t rx_idle;
+
+    /**
+     * @brief Baud rate currently in use
+     *
+     * @see uart_set_baud()
+     */
+    uint32_t baud;
+
+    #if ENABLE_PROFILING
+        /**
+         * @brief Timestamp of the last byte received
+         *
+         * @see uart_get_rx_time()
+         */
+        uint32_t rx_time;
+    #endif
+
+    #if ENABLE_STATS
+        /**
+         * @brief Counters of noteworthy events
+         *
+         * @see uart_get_stats()
+         */
+        uart_stats_t stats;
+    #endif
+
+} uart_port_t;
+
+/**
+ * @brief State of all available ports
+ */
+static uart_port_t uart_ports[UART_PORTS];
+
+/**
+ * @brief Port each of the streams is routed to
+ *
+ * @see uart_set_route()
+ */
+static uint8_t uart_routes[UART_STREAM_COUNT] = {
+
+    UART_PORT_DEFAULT,
+    UART_PORT_STREAMING,
+    UART_PORT_STREAMING,
+
+};
+
+#if ENABLE_RS485
+
+/**
+ * @brief Pin controlling the driver enable input of a RS-485 transceiver
+ *
+ * The driver is enabled before the first byte is transmitted and disabled
+ * again from within ISR(UART0_TX_vect), i.e. right after the stop bit of the
+ * last byte has been shifted out, so that the bus is released as early as
+ * possible without truncating the response.
+ *
+ * @note Only the first port can be operated on a RS-485 bus.
+ */
+#define UART_RS485_DE PORTD, 3
+
+/**
+ * @brief Flag indicating that the first port is operated on a shared bus
+ *
+ * @see uart_set_bus()
+ */
+static bool uart_bus;
+
+#endif
+
+/**
+ * @brief Checks whether data lost on a port is to be marked by a symbol
+ *
+ * On a bus the symbols would be unsolicited output colliding with other
+ * units, so lost data is only accounted for in uart_port_t::stats there.
+ *
+ * @see UART_RX_OVERRUN_SYMBOL
+ * @see UART_TX_OVERRUN_SYMBOL
+ */
+static inline bool uart_overrun_symbols(uint8_t port)
+{
+
+    #if ENABLE_RS485
+        if (port == 0 && uart_bus) {
+
+            return false;
+
+        }
+    #endif
+
+    return true;
+
+}
+
+/**
+ * @brief Enables the transmission of buffered data
+ *
+ * For the first port this also enables the RS-485 driver, if applicable.
+ */
+static inline void uart_tx_enable(uint8_t port)
+{
+
+    #if ENABLE_RS485
+        if (port == 0) {
+
+            PORT(UART_RS485_DE) |= _BV(BIT(UART_RS485_DE));
+
+        }
+    #endif
+
+    UCSRB(port) |= _BV(UDRIE0);
+
+}
 
 /**
  * @brief The baud rate used for the serial communication
@@ -61,48 +270,30 @@ static bool tx_overrun;
 #include <util/setbaud.h>
 
 /**
- * @brief Buffer used for incoming data
+ * @brief Buffers used for incoming data
  *
- * This is the actual buffer used for data coming in via UART. It is managed
- * as a FIFO (uart_fifo_in).
+ * These are the actual buffers used for data coming in via UART. They are
+ * managed as FIFOs (uart_port_t::fifo_in).
  *
  * @see UART_BUFFER_SIZE_IN
- * @see uart_buffer_in
- * @see uart_fifo_in
- */
-static uint8_t uart_buffer_in[UART_BUFFER_SIZE_IN];
-
-/**
- * @brief FIFO organizational data of incoming buffer
- *
- * @see uart_buffer_in
  */
-fifo_t uart_fifo_in;
+static uint8_t uart_buffer_in[UART_PORTS][UART_BUFFER_SIZE_IN];
 
 /**
- * @brief Buffer used for outgoing data
+ * @brief Buffers used for outgoing data
  *
- * This is the actual buffer used for data that should be transmitted via UART.
- * It is managed as a FIFO (uart_fifo_out).
+ * These are the actual buffers used for data that should be transmitted via
+ * UART. They are managed as FIFOs (uart_port_t::fifo_out).
  *
  * @see UART_BUFFER_SIZE_OUT
- * @see uart_buffer_out
- * @see uart_fifo_out
- */
-static uint8_t uart_buffer_out[UART_BUFFER_SIZE_OUT];
-
-/**
- * @brief FIFO organizational data of outgoing buffer
- *
- * @see uart_fifo_out
  */
-fifo_t uart_fifo_out;
+static uint8_t uart_buffer_out[UART_PORTS][UART_BUFFER_SIZE_OUT];
 
 /**
  * @brief Initializes the UART hardware
  *
- * This functions initializes the UART hardware. It needs to be called once
- * **before** any other functions of this module can be used.
+ * This functions initializes the UART hardware of all ports. It needs to be
+ * called once **before** any other functions of this module can be used.
  */
 void uart_init()
 {
@@ -111,30 +302,41 @@ void uart_init()
     uint8_t sreg = SREG;
     cli();
 
-    // Setup UART registers
-    UBRR0H = UBRRH_VALUE;
-    UBRR0L = UBRRL_VALUE;
+    for (uint8_t port = 0; port < UART_PORTS; port++) {
 
-    #if (USE_2X)
-        UCSR0A |= _BV(U2X0);
-    #endif
+        // Setup UART registers
+        UBRRH(port) = UBRRH_VALUE;
+        UBRRL(port) = UBRRL_VALUE;
+
+        #if (USE_2X)
+            UCSRA(port) |= _BV(U2X0);
+        #endif
+
+        UCSRB(port) = _BV(RXCIE0) | _BV(RXEN0) | _BV(TXEN0);
+        UCSRC(port) = _BV(UCSZ01) | _BV(UCSZ00);
 
-    UCSR0B = _BV(RXCIE0) | _BV(RXEN0) | _BV(TXEN0);
-    UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);
+        // Flush receive buffer
+        do {
 
-    // Flush receive buffer
-    do {
+            (void)UDR(port);
 
-        (void)UDR0;
+        } while (UCSRA(port) & _BV(RXC0));
 
-    } while (UCSR0A & _BV(RXC0));
+        // Reset transmit flag
+        UCSRA(port) |= _BV(TXC0);
 
-    // Reset transmit flag
-    UCSR0A |= _BV(TXC0);
+        uart_ports[port].baud = UART_BAUD;
 
-    // Initialize FIFOs for RX and TX
-    fifo_init(&uart_fifo_in, uart_buffer_in, UART_BUFFER_SIZE_IN);
-    fifo_init(&uart_fifo_out, uart_buffer_out, UART_BUFFER_SIZE_OUT);
+        // Initialize FIFOs for RX and TX
+        fifo_init(&uart_ports[port].fifo_in, uart_buffer_in[port], UART_BUFFER_SIZE_IN);
+        fifo_init(&uart_ports[port].fifo_out, uart_buffer_out[port], UART_BUFFER_SIZE_OUT);
+
+    }
+
+    #if ENABLE_RS485
+        PORT(UART_RS485_DE) &= ~_BV(BIT(UART_RS485_DE));
+        DDR(UART_RS485_DE) |= _BV(BIT(UART_RS485_DE));
+    #endif
 
     // Restore interrupt status
     SREG = sreg;
@@ -144,79 +346,245 @@ void uart_init()
 /**
  * @brief Processes incoming data from UART
  *
- * This ISR processes all of the data coming in via UART. It simply puts the
- * received data into the appropriate buffer (uart_fifo_in).
+ * This puts the received data into the appropriate buffer
+ * (uart_port_t::fifo_in). It is shared by the ISRs of all ports, and expected
+ * to be inlined with a constant port.
  *
- * @note As the return value of {@link fifo_put()} is ignored, data might
- * be lost once the appropriate FIFO is full.
+ * @note As the buffer is limited in size, data might be lost once the
+ * appropriate FIFO is full. This is accounted for in uart_port_t::stats.
  *
  * @see fifo_put()
- * @see uart_fifo_in
  */
-ISR(USART_RX_vect)
+static inline __attribute__((always_inline)) void uart_rx_isr(uint8_t port)
 {
 
-  bool rx_overrun = UCSR0A & _BV(DOR0);
-  bool fifo_overrun = !fifo_put(&uart_fifo_in, UDR0);
+    uart_port_t* p = &uart_ports[port];
+
+    bool rx_overrun = UCSRA(port) & _BV(DOR0);
+    bool fifo_overrun = !fifo_put(&p->fifo_in, UDR(port));
+
+    p->rx_idle = 0;
+
+    event_post();
+
+    #if ENABLE_PROFILING
+        p->rx_time = prof_cycles();
+    #endif
+
+    #if ENABLE_STATS
+        p->stats.rx++;
+
+        if (rx_overrun) {
+
+            p->stats.rx_overrun++;
+
+        }
+
+        if (fifo_overrun) {
+
+            p->stats.rx_dropped++;
+
+        }
+    #endif
+
+    if ((rx_overrun || fifo_overrun) && uart_overrun_symbols(port)) {
+
+        uart_putc(port, UART_RX_OVERRUN_SYMBOL);
+
+    }
+
+    // Ask host to pause once the buffer is filling up
+    if (p->flow_control && !p->flow_stopped && p->fifo_in.count >= UART_FLOW_XOFF_LEVEL) {
+
+        p->flow_stopped = true;
+        p->flow_symbol = UART_XOFF;
 
-  if (rx_overrun || fifo_overrun) {
+        #if ENABLE_STATS
+            p->stats.xoff++;
+        #endif
 
-      uart_putc(UART_RX_OVERRUN_SYMBOL);
+        uart_tx_enable(port);
 
-  }
+    }
 
 }
 
 /**
  * @brief Transmits data via UART
  *
- * This ISR processes all of the data within the outgoing buffer
- * (uart_fifo_out) and transmits it via UART. It also checks whether there is
- * actually something to be transmitted and disables itself if this is not the
- * case.
+ * This processes all of the data within the outgoing buffer
+ * (uart_port_t::fifo_out) and transmits it via UART. It also checks whether
+ * there is actually something to be transmitted and disables the interrupt
+ * if this is not the case. It is shared by the ISRs of all ports, and
+ * expected to be inlined with a constant port.
  *
- * @see uart_fifo_out
  * @see fifo_get_nowait()
  */
-ISR(USART_UDRE_vect)
+static inline __attribute__((always_inline)) void uart_udre_isr(uint8_t port)
 {
 
-    if (tx_overrun) {
+    uart_port_t* p = &uart_ports[port];
+
+    if (p->flow_symbol) {
+
+        UDR(port) = p->flow_symbol;
+        p->flow_symbol = 0;
 
-      UDR0 = UART_TX_OVERRUN_SYMBOL;
-      tx_overrun = false;
+    } else if (p->tx_overrun) {
+
+        UDR(port) = UART_TX_OVERRUN_SYMBOL;
+        p->tx_overrun = false;
 
     } else {
 
-      if (uart_fifo_out.count > 0) {
+        if (p->fifo_out.count > 0) {
+
+            uint8_t data;
+
+            fifo_get_nowait(&p->fifo_out, &data);
+            UDR(port) = data;
+
+            #if ENABLE_STATS
+                p->stats.tx++;
+            #endif
+
+        } else {
+
+            UCSRB(port) &= ~_BV(UDRIE0);
+
+            // Handlers waiting for the output to be drained can proceed now
+            event_post();
+
+            #if ENABLE_RS485
+                // Release the bus once the last byte has been shifted out
+                if (port == 0) {
+
+                    UCSRA(port) |= _BV(TXC0);
+                    UCSRB(port) |= _BV(TXCIE0);
+
+                }
+            #endif
+
+        }
+
+    }
+
+}
+
+ISR(UART0_RX_vect)
+{
+
+    PROF_ENTER();
+
+    uart_rx_isr(0);
+
+    PROF_EXIT(PROF_ISR_UART_RX);
+
+}
+
+ISR(UART0_UDRE_vect)
+{
+
+    PROF_ENTER();
+
+    uart_udre_isr(0);
+
+    PROF_EXIT(PROF_ISR_UART_UDRE);
+
+}
+
+#if UART_PORTS > 1
+
+ISR(USART1_RX_vect)
+{
+
+    PROF_ENTER();
+
+    uart_rx_isr(1);
+
+    PROF_EXIT(PROF_ISR_UART1_RX);
+
+}
+
+ISR(USART1_UDRE_vect)
+{
+
+    PROF_ENTER();
+
+    uart_udre_isr(1);
+
+    PROF_EXIT(PROF_ISR_UART1_UDRE);
+
+}
+
+#endif
 
-        uint8_t data;
+#if ENABLE_RS485
 
-        fifo_get_nowait(&uart_fifo_out, &data);
-        UDR0 = data;
+/**
+ * @brief Disables the RS-485 driver once the transmission is complete
+ *
+ * This is triggered after the stop bit of the last byte has been shifted out.
+ * If there is new data to be transmitted in the meantime, the driver is left
+ * enabled.
+ *
+ * @see UART_RS485_DE
+ */
+ISR(UART0_TX_vect)
+{
 
-      } else {
+    UCSRB(0) &= ~_BV(TXCIE0);
 
-        UCSR0B &= ~_BV(UDRIE0);
+    if (!(UCSRB(0) & _BV(UDRIE0))) {
 
-      }
+        PORT(UART_RS485_DE) &= ~_BV(BIT(UART_RS485_DE));
 
     }
 
 }
 
+/**
+ * @brief Sets whether the first port is operated on a shared bus
+ *
+ * While on a bus, data lost on this port is no longer marked by
+ * {@link #UART_RX_OVERRUN_SYMBOL} and {@link #UART_TX_OVERRUN_SYMBOL}, but
+ * only accounted for in the stats.
+ *
+ * @param enabled True if the unit has been assigned an address on a bus
+ */
+void uart_set_bus(bool enabled)
+{
+
+    uint8_t sreg = SREG;
+    cli();
+
+    uart_bus = enabled;
+
+    if (enabled) {
+
+        uart_ports[0].tx_overrun = false;
+
+    }
+
+    SREG = sreg;
+
+}
+
+#endif
+
 /**
  * @brief Transmits a single character
  *
- * This function puts the given character into the transmission FIFO. It
- * returns a boolean value, which indicates whether the character could
- * actually be put into the FIFO, or whether the buffer is already full, in
- * which case the return value would be false and the character won't be
- * transmitted at all.
+ * This function puts the given character into the transmission FIFO of the
+ * given port. It returns a boolean value, which indicates whether the
+ * character could actually be put into the FIFO, or whether the buffer is
+ * already full, in which case the return value would be false and the
+ * character won't be transmitted at all.
  *
  * This function enables the UART data register empty interrupt to make sure
  * that the data within the buffer will be processed by the appropriate ISR.
  *
+ * @param port Port to transmit the character on
  * @param c Character to transmit
  *
  * @return True if character was put into transmission FIFO, false otherwise
@@ -226,23 +594,32 @@ ISR(USART_UDRE_vect)
  *
  * @note uart_flush() can be used for synchronization.
  *
- * @see uart_fifo_out
- * @see ISR(USART_UDR0)
+ * @see uart_port_t::fifo_out
+ * @see uart_udre_isr()
  */
-bool uart_putc(char c)
+bool uart_putc(uint8_t port, char c)
 {
 
     // Put data into FIFO
-    bool result = fifo_put(&uart_fifo_out, c);
+    bool result = fifo_put(&uart_ports[port].fifo_out, c);
 
     if (!result) {
 
-      tx_overrun = true;
+        uint8_t sreg = SREG;
+        cli();
+
+        uart_ports[port].tx_overrun = uart_overrun_symbols(port);
+
+        #if ENABLE_STATS
+            uart_ports[port].stats.tx_dropped++;
+        #endif
+
+        SREG = sreg;
 
     }
 
     // Re-enable interrupt, so data will be picked up
-    UCSR0B |= _BV(UDRIE0);
+    uart_tx_enable(port);
 
     return result;
 
@@ -251,11 +628,12 @@ bool uart_putc(char c)
 /**
  * @brief Retrieves next byte received by the UART hardware - if available
  *
- * This retrieves the next byte from the incoming buffer and puts it at the
- * location pointed to by the parameter `character` and returns true. If there
- * is nothing left in the buffer to be retrieved, the function simply returns
- * false.
+ * This retrieves the next byte from the incoming buffer of the given port and
+ * puts it at the location pointed to by the parameter `character` and returns
+ * true. If there is nothing left in the buffer to be retrieved, the function
+ * simply returns false.
  *
+ * @param port Port to retrieve the character from
  * @param character Pointer to location where retrieved character will be put
  *
  * @return Indicates whether something was retrieved from the buffer
@@ -263,36 +641,57 @@ bool uart_putc(char c)
  * @warning Make sure to check the return value, which indicates whether or not
  * something has been retrieved.
  *
- * @see uart_fifo_in
+ * @see uart_port_t::fifo_in
  * @see fifo_get_nowait()
  */
-bool uart_getc_nowait(char* c)
+bool uart_getc_nowait(uint8_t port, char* c)
 {
 
-    return fifo_get_nowait(&uart_fifo_in, (uint8_t*)c);
+    uart_port_t* p = &uart_ports[port];
+
+    bool result = fifo_get_nowait(&p->fifo_in, (uint8_t*)c);
+
+    // Ask host to resume once the buffer has been drained sufficiently
+    if (p->flow_stopped && p->fifo_in.count <= UART_FLOW_XON_LEVEL) {
+
+        uint8_t sreg = SREG;
+        cli();
+
+        p->flow_stopped = false;
+        p->flow_symbol = UART_XON;
+        uart_tx_enable(port);
+
+        SREG = sreg;
+
+    }
+
+    return result;
 
 }
 
 /**
  * @brief Retrieves next byte received by the UART hardware or wait for it
  *
- * This retrieves the next byte from the incoming buffer and busy waits when
- * no data is currently available.
+ * This retrieves the next byte from the incoming buffer of the given port and
+ * busy waits when no data is currently available.
  *
- * Internally it makes use of fifo_get_wait()
+ * Internally it makes use of uart_getc_nowait()
  *
  * @return The character retrieved from the buffer
  *
  * @warning By using this function carelessly you can effectively stop program
  * execution. Consider using uart_getc_nowait().
  *
- * @see uart_fifo_in
- * @see fifo_get_wait
+ * @see uart_getc_nowait()
  */
-char uart_getc_wait()
+char uart_getc_wait(uint8_t port)
 {
 
-    return fifo_get_wait(&uart_fifo_in);
+    char c;
+
+    while (!uart_getc_nowait(port, &c));
+
+    return c;
 
 }
 
@@ -303,16 +702,17 @@ char uart_getc_wait()
  * terminated. Internally it makes use of uart_putc(), so each character will
  * be processed individually.
  *
+ * @param port Port to transmit the string on
  * @param s Pointer to string to transmit
  *
  * @see uart_putc()
  */
-void uart_puts(const char* str)
+void uart_puts(uint8_t port, const char* str)
 {
 
     while (*str) {
 
-        uart_putc(*str++);
+        uart_putc(port, *str++);
 
     }
 
@@ -326,6 +726,7 @@ void uart_puts(const char* str)
  * pgm_read_byte() to retrieve the data and uart_putc(), so each character will
  * be processed individually.
  *
+ * @param port Port to transmit the string on
  * @param s Pointer to string stored in program memory to transmit
  *
  * uart_puts_P() can be used to put strings into program space quite easily.
@@ -334,14 +735,14 @@ void uart_puts(const char* str)
  * @see uart_putc()
  * @see pgm_read_byte()
  */
-void uart_puts_p(PGM_P str)
+void uart_puts_p(uint8_t port, PGM_P str)
 {
 
     char c;
 
     while ((c = pgm_read_byte(str++)) != '\0') {
 
-        uart_putc(c);
+        uart_putc(port, c);
 
     }
 
@@ -350,11 +751,11 @@ void uart_puts_p(PGM_P str)
 /**
  * @brief Waits for the transmit buffer to be flushed completely
  *
- * This busy waits until the whole transmission buffer has been output. This
- * can be used to synchronize the transmission every now and then to make sure
- * no data is being lost.
+ * This busy waits until the whole transmission buffer of the given port has
+ * been output. This can be used to synchronize the transmission every now and
+ * then to make sure no data is being lost.
  *
- * @see ISR(USART_UDRE_vect)
+ * @see uart_udre_isr()
  *
  * @todo Think about returning immediately in case interrupts are disabled to
  * prevent deadlock situations?
@@ -362,12 +763,338 @@ void uart_puts_p(PGM_P str)
  * @todo Consider to flush the buffer implicitly every now and then and get rid
  * of this function?
  */
-void uart_flush_output()
+void uart_flush_output(uint8_t port)
 {
 
-    while (UCSR0B & _BV(UDRIE0));
+    while (UCSRB(port) & _BV(UDRIE0));
 
 }
 
-#undef BAUD
+/**
+ * @brief Checks whether there is still data left to be transmitted
+ *
+ * Contrary to uart_flush_output() this returns immediately, so callers can
+ * defer output that is not urgent instead of waiting.
+ *
+ * @return True if the transmission buffer is not yet empty, false otherwise
+ *
+ * @see uart_flush_output()
+ */
+bool uart_output_busy(uint8_t port)
+{
 
+    return UCSRB(port) & _BV(UDRIE0);
+
+}
+
+/**
+ * @brief Enables or disables software flow control (XON/XOFF) for a port
+ *
+ * Once enabled, XOFF is sent whenever the fill level of the receive buffer
+ * reaches {@link #UART_FLOW_XOFF_LEVEL}, and XON is sent once it has been
+ * drained to {@link #UART_FLOW_XON_LEVEL}. This allows the host to send
+ * multiple commands at once without having to wait for each response.
+ *
+ * @note Disabling it while the host is paused sends XON immediately.
+ *
+ * @param port Port to enable or disable flow control for
+ * @param enabled True to enable flow control, false to disable it
+ */
+void uart_set_flow_control(uint8_t port, bool enabled)
+{
+
+    uart_port_t* p = &uart_ports[port];
+
+    uint8_t sreg = SREG;
+    cli();
+
+    p->flow_control = enabled;
+
+    if (!enabled && p->flow_stopped) {
+
+        p->flow_stopped = false;
+        p->flow_symbol = UART_XON;
+        uart_tx_enable(port);
+
+    }
+
+    SREG = sreg;
+
+}
+
+bool uart_get_flow_control(uint8_t port)
+{
+
+    return uart_ports[port].flow_control;
+
+}
+
+#if ENABLE_STATS
+
+/**
+ * @brief Retrieves a consistent copy of the event counters of a port
+ *
+ * @param port Port to retrieve the counters for
+ * @param stats Pointer to location where the counters will be copied to
+ *
+ * @see uart_stats_t
+ */
+void uart_get_stats(uint8_t port, uart_stats_t* stats)
+{
+
+    uint8_t sreg = SREG;
+    cli();
+
+    *stats = uart_ports[port].stats;
+    stats->rx_high = uart_ports[port].fifo_in.high;
+    stats->tx_high = uart_ports[port].fifo_out.high;
+
+    SREG = sreg;
+
+}
+
+#endif
+
+/**
+ * @brief Keeps track of the time since the last byte has been received
+ *
+ * @note This is expected to be called from the timer ISR at 1 kHz.
+ *
+ * @see uart_get_rx_idle()
+ */
+void uart_tick()
+{
+
+    for (uint8_t port = 0; port < UART_PORTS; port++) {
+
+        if (uart_ports[port].rx_idle < UINT8_MAX) {
+
+            uart_ports[port].rx_idle++;
+
+            // Protocols waiting for silence on the line need to check again
+            event_post();
+
+        }
+
+    }
+
+}
+
+/**
+ * @brief Returns the time since the last byte has been received on a port
+ *
+ * This allows for protocols that delimit their frames by silence on the line.
+ *
+ * @return Number of ticks (1 ms each) since the last byte, saturating
+ *
+ * @see uart_tick()
+ */
+uint8_t uart_get_rx_idle(uint8_t port)
+{
+
+    return uart_ports[port].rx_idle;
+
+}
+
+/**
+ * @brief Checks whether there is received data left to be retrieved
+ */
+bool uart_input_available(uint8_t port)
+{
+
+    return uart_ports[port].fifo_in.count != 0;
+
+}
+
+#if ENABLE_PROFILING
+
+/**
+ * @brief Returns the timestamp of the last byte received on a port
+ *
+ * @return Timestamp as returned by prof_cycles()
+ */
+uint32_t uart_get_rx_time(uint8_t port)
+{
+
+    uint8_t sreg = SREG;
+    cli();
+
+    uint32_t time = uart_ports[port].rx_time;
+
+    SREG = sreg;
+
+    return time;
+
+}
+
+#endif
+
+/**
+ * @brief Routes a stream to the given port
+ *
+ * All further output of the stream will go to the given port. For the
+ * protocol stream this also determines the port commands are read from.
+ *
+ * @note Invalid ports are ignored.
+ *
+ * @see uart_stream_t
+ */
+void uart_set_route(uart_stream_t stream, uint8_t port)
+{
+
+    if (port < UART_PORTS) {
+
+        uart_routes[stream] = port;
+
+    }
+
+}
+
+/**
+ * @brief Returns the port a stream is routed to
+ *
+ * @see uart_set_route()
+ */
+uint8_t uart_get_route(uart_stream_t stream)
+{
+
+    return uart_routes[stream];
+
+}
+
+/**
+ * @brief Calculates the prescaler for the given baud rate
+ *
+ * The double speed mode is always used, so that rates up to an eighth of the
+ * CPU clock can be generated, e.g. 250k, 500k and 1M baud exactly at 8 MHz.
+ *
+ * @return False if the rate can't be generated within
+ * {@link #UART_BAUD_TOLERANCE}, true otherwise
+ */
+static bool uart_baud_prescaler(uint32_t baud, uint16_t* ubrr)
+{
+
+    if (baud == 0 || baud > F_CPU / 8) {
+
+        return false;
+
+    }
+
+    // Round to nearest prescaler
+    uint32_t value = (F_CPU + 4 * baud) / (8 * baud) - 1;
+
+    if (value > 0xFFF) {
+
+        return false;
+
+    }
+
+    uint32_t actual = F_CPU / (8 * (value + 1));
+    uint32_t deviation = actual > baud ? actual - baud : baud - actual;
+
+    if (deviation * 100 > baud * UART_BAUD_TOLERANCE) {
+
+        return false;
+
+    }
+
+    *ubrr = value;
+
+    return true;
+
+}
+
+/**
+ * @brief Checks whether the given baud rate can be used
+ *
+ * @see uart_set_baud()
+ */
+bool uart_baud_valid(uint32_t baud)
+{
+
+    uint16_t ubrr;
+
+    return uart_baud_prescaler(baud, &ubrr);
+
+}
+
+/**
+ * @brief Changes the baud rate of a port at runtime
+ *
+ * Contrary to {@link #UART_BAUD}, which is evaluated at compile time, the
+ * prescaler is calculated at runtime here.
+ *
+ * Data that is still to be transmitted is output using the previous rate
+ * before switching, whereas data that has been received but not yet
+ * retrieved is discarded, as it might have been garbled by the switch.
+ *
+ * @param port Port to change the baud rate for
+ * @param baud Baud rate to switch to
+ *
+ * @return False if the rate can't be used (the previous one is kept in this
+ * case), true otherwise
+ *
+ * @see uart_baud_valid()
+ */
+bool uart_set_baud(uint8_t port, uint32_t baud)
+{
+
+    uint16_t ubrr;
+
+    if (!uart_baud_prescaler(baud, &ubrr)) {
+
+        return false;
+
+    }
+
+    uart_port_t* p = &uart_ports[port];
+
+    // Wait for the last byte to be shifted out, which takes up to 10 bits
+    uart_flush_output(port);
+
+    for (uint32_t us = 10000000 / p->baud + 1; us > 0; us--) {
+
+        _delay_us(1);
+
+    }
+
+    uint8_t sreg = SREG;
+    cli();
+
+    UBRRH(port) = ubrr >> 8;
+    UBRRL(port) = ubrr & 0xFF;
+    UCSRA(port) |= _BV(U2X0);
+
+    p->baud = baud;
+
+    // Discard everything received at the previous rate
+    #if ENABLE_STATS
+        uint8_t high = p->fifo_in.high;
+        fifo_init(&p->fifo_in, uart_buffer_in[port], UART_BUFFER_SIZE_IN);
+        p->fifo_in.high = high;
+    #else
+        fifo_init(&p->fifo_in, uart_buffer_in[port], UART_BUFFER_SIZE_IN);
+    #endif
+
+    if (p->flow_stopped) {
+
+        p->flow_stopped = false;
+        p->flow_symbol = UART_XON;
+        uart_tx_enable(port);
+
+    }
+
+    SREG = sreg;
+
+    return true;
+
+}
+
+uint32_t uart_get_baud(uint8_t port)
+{
+
+    return uart_ports[port].baud;
+
+}
+
+#undef BAUD
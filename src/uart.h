@@ -27,6 +27,13 @@
  * buffered and the functions do not block the actual processing. Some means to
  * synchronize are provided, too, in order to make sure no data is being lost.
  *
+ * MCUs with more than one USART, e.g. the ATmega1284P, provide multiple ports,
+ * each of which has buffers of its own. All of the functions expect the port
+ * to operate on as their first argument. Which port the output of a
+ * particular module goes to is determined by the routing of
+ * {@link #uart_stream_t streams}, so that e.g. log messages can be kept away
+ * from the port the protocol is operated on.
+ *
  * @see uart.c
  */
 
@@ -53,26 +60,152 @@
 #define UART_BAUD 38400
 
 /**
- * @brief Defines the size of uart_buffer_in
+ * @brief Maximum deviation of a baud rate that is accepted, in percent
+ *
+ * Baud rates that can't be generated within this tolerance from the CPU clock
+ * are rejected by uart_set_baud().
+ */
+#define UART_BAUD_TOLERANCE 2
+
+/**
+ * @brief Number of available ports
+ *
+ * This depends on the number of USARTs provided by the MCU. At most two of
+ * them are supported.
+ */
+#if defined(UDR1)
+    #define UART_PORTS 2
+#else
+    #define UART_PORTS 1
+#endif
+
+/**
+ * @brief Port streams are routed to by default, unless stated otherwise
+ *
+ * @see uart_set_route()
+ */
+#define UART_PORT_DEFAULT 0
+
+/**
+ * @brief Port streams with lots of output (logs, pushed counts) are routed to
+ *
+ * This defaults to the second port, if available, so that these don't add
+ * latency to the responses of the protocol.
+ *
+ * @see uart_set_route()
+ */
+#define UART_PORT_STREAMING (UART_PORTS - 1)
+
+/**
+ * @brief Defines the size of uart_buffer_in (for each port)
  *
  * @see uart_buffer_in
  */
-#define UART_BUFFER_SIZE_IN 32
+#define UART_BUFFER_SIZE_IN 64
 
 /**
- * @brief Defines the size of uart_buffer_out
+ * @brief Defines the size of uart_buffer_out (for each port)
  *
  * @see uart_buffer_out
  */
 #define UART_BUFFER_SIZE_OUT 128
 
+/**
+ * @brief Fill level of uart_buffer_in at which XOFF is sent
+ *
+ * This should leave enough room for the data the host might still send
+ * before reacting to XOFF.
+ *
+ * @see uart_set_flow_control()
+ */
+#define UART_FLOW_XOFF_LEVEL (UART_BUFFER_SIZE_IN * 3 / 4)
+
+/**
+ * @brief Fill level of uart_buffer_in at which XON is sent again
+ *
+ * @see uart_set_flow_control()
+ */
+#define UART_FLOW_XON_LEVEL (UART_BUFFER_SIZE_IN / 4)
+
+/**
+ * @brief Character used to ask the host to resume transmission
+ */
+#define UART_XON 0x11
+
+/**
+ * @brief Character used to ask the host to pause transmission
+ */
+#define UART_XOFF 0x13
+
+/**
+ * @brief Counters for events on the UART, which are of interest for the host
+ *
+ * @see uart_get_stats()
+ */
+typedef struct {
+
+    // Number of bytes lost, because the hardware buffer was overrun
+    uint16_t rx_overrun;
+
+    // Number of bytes lost, because the receive buffer was full
+    uint16_t rx_dropped;
+
+    // Number of bytes lost, because the transmission buffer was full
+    uint16_t tx_dropped;
+
+    // Number of times XOFF has been sent
+    uint16_t xoff;
+
+    // Highest fill level of the receive buffer
+    uint8_t rx_high;
+
+    // Highest fill level of the transmission buffer
+    uint8_t tx_high;
+
+    // Number of bytes received
+    uint32_t rx;
+
+    // Number of bytes transmitted
+    uint32_t tx;
+
+} uart_stats_t;
+
+/**
+ * @brief Enumeration of streams that can be routed to a port individually
+ *
+ * @see uart_set_route()
+ */
+typedef enum {
+
+    UART_STREAM_PROTO = 0,
+    UART_STREAM_LOG,
+    UART_STREAM_PUSH,
+
+    UART_STREAM_COUNT
+
+} uart_stream_t;
+
 void uart_init();
-bool uart_putc(char c);
-char uart_getc_wait();
-bool uart_getc_nowait(char* c);
-void uart_puts(const char* str);
-void uart_puts_p(PGM_P str);
-void uart_flush_output();
+bool uart_putc(uint8_t port, char c);
+char uart_getc_wait(uint8_t port);
+bool uart_getc_nowait(uint8_t port, char* c);
+void uart_puts(uint8_t port, const char* str);
+void uart_puts_p(uint8_t port, PGM_P str);
+void uart_flush_output(uint8_t port);
+bool uart_output_busy(uint8_t port);
+void uart_set_flow_control(uint8_t port, bool enabled);
+bool uart_get_flow_control(uint8_t port);
+void uart_set_bus(bool enabled);
+void uart_get_stats(uint8_t port, uart_stats_t* stats);
+void uart_tick();
+bool uart_baud_valid(uint32_t baud);
+bool uart_set_baud(uint8_t port, uint32_t baud);
+uint32_t uart_get_baud(uint8_t port);
+uint8_t uart_get_rx_idle(uint8_t port);
+bool uart_input_available(uint8_t port);
+uint32_t uart_get_rx_time(uint8_t port);
+void uart_set_route(uart_stream_t stream, uint8_t port);
+uint8_t uart_get_route(uart_stream_t stream);
 
 /**
  * @brief Macro used to automatically put a string constant into program memory
@@ -83,7 +216,7 @@ void uart_flush_output();
  * @see PSTR()
  * @see uart_puts_p()
  */
-#define uart_puts_P(str) uart_puts_p(PSTR(str))
+#define uart_puts_P(port, str) uart_puts_p(port, PSTR(str))
 
 #endif /* _UART_H_ */
 
@@ -0,0 +1,668 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file bench.c
+ * @brief Cycle-accurate benchmark of the firmware running on simavr
+ *
+ * This runs the actual firmware image on simavr with a FRAM attached to the
+ * TWI, feeds in changes of the input pins from a script and finally sends a
+ * single command via UART. Meanwhile the cycles spent within probed functions
+ * and ISRs are measured.
+ *
+ * A probe is entered once the program counter reaches its address and left
+ * once the stack pointer rises above its value at the entry, i.e. once the
+ * return address has been popped. Cycles spent within nested ISRs are not
+ * accounted to the interrupted function. Cycles needed to respond to an
+ * interrupt before reaching the ISR itself are not accounted for at all.
+ *
+ * Results are output to stdout as lines of `METRIC VALUE` in cycles:
+ *
+ * - `NAME_max` and `NAME_mean` for each probe
+ * - `NAME_busy` for function probes, i.e. the mean of all calls that took
+ *   longer than the shortest one. For s0_handle() these are the calls that
+ *   actually processed an impulse.
+ * - `command`, i.e. the cycles from the EOL of the command being put on the
+ *   line until the last byte of the response has been written to the UART.
+ *   This includes the time needed to receive the EOL itself.
+ *
+ * Probes whose name starts with `__` are tracked, so their cycles are not
+ * accounted to others, but not output.
+ *
+ * The script has the same format as the one of the host simulation (see
+ * `doc/HOST.md`), e.g. `1500 C0 0`.
+ *
+ * This is expected to be invoked by `tools/bench.sh`, which resolves the
+ * addresses of the probes.
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_irq.h"
+#include "avr_ioport.h"
+#include "avr_twi.h"
+#include "avr_uart.h"
+
+/**
+ * @brief Maximum number of probes
+ */
+#define BENCH_PROBES_MAX 32
+
+/**
+ * @brief Maximum nesting of probes, e.g. an ISR interrupting a function
+ */
+#define BENCH_DEPTH_MAX 8
+
+/**
+ * @brief Size of the simulated FRAM, needs to be a power of two
+ */
+#define BENCH_FRAM_SIZE 0x2000
+
+/**
+ * @brief I2C address of the FRAM, including the R/W bit
+ */
+#define BENCH_FRAM_ADDR 0xA0
+
+/**
+ * @brief Time to let the firmware settle after the script, in milliseconds
+ */
+#define BENCH_SETTLE_MS 500
+
+/**
+ * @brief Baud rate of the UART, i.e. UART_BAUD of the firmware
+ */
+#define BENCH_BAUD 38400
+
+/**
+ * @brief Time without output after which a response is considered complete
+ */
+#define BENCH_QUIET_MS 50
+
+/**
+ * @brief A probed function or ISR along with its statistics
+ */
+typedef struct {
+
+    const char* name;
+    uint32_t addr;
+    bool isr;
+
+    uint64_t calls;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+
+    // Calls that took longer than the shortest one so far
+    uint64_t busy_calls;
+    uint64_t busy_sum;
+
+} bench_probe_t;
+
+/**
+ * @brief A probe that has been entered, but not yet left
+ */
+typedef struct {
+
+    bench_probe_t* probe;
+    uint16_t sp;
+    avr_cycle_count_t start;
+
+    // Cycles spent within nested ISRs
+    avr_cycle_count_t nested;
+
+} bench_frame_t;
+
+/**
+ * @brief State of the simulated FRAM
+ */
+typedef struct {
+
+    avr_irq_t* irq;
+
+    uint8_t data[BENCH_FRAM_SIZE];
+
+    // Current address and number of address bytes received so far
+    uint16_t addr;
+    uint8_t addr_bytes;
+
+    // Address the FRAM has been selected with, zero if not selected
+    uint8_t selected;
+
+} bench_fram_t;
+
+static bench_probe_t bench_probes[BENCH_PROBES_MAX];
+static uint8_t bench_probe_count;
+
+static bench_frame_t bench_frames[BENCH_DEPTH_MAX];
+static uint8_t bench_depth;
+
+static bench_fram_t bench_fram;
+
+/**
+ * @brief Cycle the last byte has been output by the UART at
+ */
+static avr_cycle_count_t bench_output_cycle;
+
+/**
+ * @brief Number of bytes output by the UART
+ */
+static uint64_t bench_output_count;
+
+static const char* bench_fram_names[2] = {
+
+    [TWI_IRQ_INPUT] = "8>fram.out",
+    [TWI_IRQ_OUTPUT] = "32<fram.in",
+
+};
+
+static void bench_fail(const char* msg, const char* arg)
+{
+
+    fprintf(stderr, "bench: %s%s%s\n", msg, arg ? ": " : "", arg ? arg : "");
+    exit(EXIT_FAILURE);
+
+}
+
+/**
+ * @brief Handles messages sent by the TWI to the FRAM
+ *
+ * The first two bytes written after being selected are the address (most
+ * significant byte first), any further bytes are data. Reads continue at the
+ * current address, so a repeated start keeps the address.
+ */
+static void bench_fram_hook(avr_irq_t* irq, uint32_t value, void* param)
+{
+
+    bench_fram_t* fram = param;
+    avr_twi_msg_irq_t msg;
+
+    msg.u.v = value;
+
+    if (msg.u.twi.msg & TWI_COND_STOP) {
+
+        fram->selected = 0;
+
+    }
+
+    if (msg.u.twi.msg & TWI_COND_START) {
+
+        fram->selected = 0;
+
+        if ((msg.u.twi.addr & ~1) == BENCH_FRAM_ADDR) {
+
+            fram->selected = msg.u.twi.addr;
+
+            if (!(msg.u.twi.addr & 1)) {
+
+                fram->addr_bytes = 0;
+
+            }
+
+            avr_raise_irq(fram->irq + TWI_IRQ_INPUT, avr_twi_irq_msg(TWI_COND_ACK, fram->selected, 1));
+
+        }
+
+    }
+
+    if (!fram->selected) {
+
+        return;
+
+    }
+
+    if (msg.u.twi.msg & TWI_COND_WRITE) {
+
+        avr_raise_irq(fram->irq + TWI_IRQ_INPUT, avr_twi_irq_msg(TWI_COND_ACK, fram->selected, 1));
+
+        if (fram->addr_bytes < 2) {
+
+            fram->addr = (fram->addr << 8) | msg.u.twi.data;
+            fram->addr_bytes++;
+
+        } else {
+
+            fram->data[fram->addr++ & (BENCH_FRAM_SIZE - 1)] = msg.u.twi.data;
+
+        }
+
+    }
+
+    if (msg.u.twi.msg & TWI_COND_READ) {
+
+        uint8_t data = fram->data[fram->addr++ & (BENCH_FRAM_SIZE - 1)];
+
+        avr_raise_irq(fram->irq + TWI_IRQ_INPUT, avr_twi_irq_msg(TWI_COND_READ, fram->selected, data));
+
+    }
+
+}
+
+static void bench_fram_attach(avr_t* avr)
+{
+
+    bench_fram.irq = avr_alloc_irq(&avr->irq_pool, 0, 2, bench_fram_names);
+
+    avr_irq_register_notify(bench_fram.irq + TWI_IRQ_OUTPUT, bench_fram_hook, &bench_fram);
+
+    avr_connect_irq(bench_fram.irq + TWI_IRQ_INPUT, avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_INPUT));
+    avr_connect_irq(avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_OUTPUT), bench_fram.irq + TWI_IRQ_OUTPUT);
+
+}
+
+static void bench_uart_hook(avr_irq_t* irq, uint32_t value, void* param)
+{
+
+    avr_t* avr = param;
+
+    bench_output_cycle = avr->cycle;
+    bench_output_count++;
+
+}
+
+static void bench_uart_attach(avr_t* avr)
+{
+
+    // Output is only counted, it would clutter the results otherwise
+    uint32_t flags = 0;
+
+    avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+    flags &= ~AVR_UART_FLAG_STDIO;
+    avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+
+    avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUTPUT), bench_uart_hook, avr);
+
+}
+
+/**
+ * @brief Adds a probe given as `NAME=ADDRESS`
+ */
+static void bench_probe_add(char* arg, bool isr)
+{
+
+    char* sep = strchr(arg, '=');
+
+    if (!sep || bench_probe_count == BENCH_PROBES_MAX) {
+
+        bench_fail("invalid probe", arg);
+
+    }
+
+    *sep = '\0';
+
+    bench_probe_t* probe = &bench_probes[bench_probe_count++];
+
+    probe->name = arg;
+    probe->addr = strtoul(sep + 1, NULL, 16);
+    probe->isr = isr;
+    probe->min = UINT64_MAX;
+
+}
+
+static uint16_t bench_sp(avr_t* avr)
+{
+
+    return avr->data[R_SPL] | (avr->data[R_SPH] << 8);
+
+}
+
+static void bench_probe_leave(avr_t* avr)
+{
+
+    bench_frame_t* frame = &bench_frames[--bench_depth];
+    bench_probe_t* probe = frame->probe;
+
+    avr_cycle_count_t total = avr->cycle - frame->start;
+    uint64_t cycles = total - frame->nested;
+
+    if (probe->isr && bench_depth > 0) {
+
+        bench_frames[bench_depth - 1].nested += total;
+
+    }
+
+    if (cycles > probe->min && probe->calls > 0) {
+
+        probe->busy_calls++;
+        probe->busy_sum += cycles;
+
+    }
+
+    if (cycles < probe->min) {
+
+        probe->min = cycles;
+
+    }
+
+    if (cycles > probe->max) {
+
+        probe->max = cycles;
+
+    }
+
+    probe->calls++;
+    probe->sum += cycles;
+
+}
+
+/**
+ * @brief Executes a single instruction and updates the probes accordingly
+ */
+static void bench_step(avr_t* avr)
+{
+
+    int state = avr_run(avr);
+
+    if (state == cpu_Done || state == cpu_Crashed) {
+
+        bench_fail("firmware has stopped", NULL);
+
+    }
+
+    uint16_t sp = bench_sp(avr);
+
+    while (bench_depth > 0 && sp > bench_frames[bench_depth - 1].sp) {
+
+        bench_probe_leave(avr);
+
+    }
+
+    for (uint8_t i = 0; i < bench_probe_count; i++) {
+
+        if (avr->pc != bench_probes[i].addr) {
+
+            continue;
+
+        }
+
+        if (bench_depth == BENCH_DEPTH_MAX) {
+
+            bench_fail("probes nested too deeply", bench_probes[i].name);
+
+        }
+
+        bench_frame_t* frame = &bench_frames[bench_depth++];
+
+        frame->probe = &bench_probes[i];
+        frame->sp = sp;
+        frame->start = avr->cycle;
+        frame->nested = 0;
+
+        break;
+
+    }
+
+}
+
+static void bench_run_until(avr_t* avr, avr_cycle_count_t cycle)
+{
+
+    while (avr->cycle < cycle) {
+
+        bench_step(avr);
+
+    }
+
+}
+
+/**
+ * @brief Applies the changes of the input pins given by a script
+ */
+static void bench_script(avr_t* avr, const char* path)
+{
+
+    FILE* script = fopen(path, "r");
+
+    if (!script) {
+
+        bench_fail("unable to open script", path);
+
+    }
+
+    char line[128];
+    unsigned long last = 0;
+
+    while (fgets(line, sizeof(line), script)) {
+
+        unsigned long time;
+        char port;
+        unsigned bit;
+        unsigned level;
+
+        if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0') {
+
+            continue;
+
+        }
+
+        if (sscanf(line, "%lu %c%u %u", &time, &port, &bit, &level) != 4 || port < 'B' || port > 'D' || bit > 7 || level > 1 || time < last) {
+
+            bench_fail("invalid script line", line);
+
+        }
+
+        bench_run_until(avr, (avr_cycle_count_t)time * (avr->frequency / 1000));
+        avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(port), bit), level);
+
+        last = time;
+
+    }
+
+    fclose(script);
+
+}
+
+/**
+ * @brief Returns the number of cycles needed to transfer a single byte
+ *
+ * This assumes 8N1 framing at {@link #BENCH_BAUD}.
+ */
+static avr_cycle_count_t bench_byte_cycles(avr_t* avr)
+{
+
+    return 10 * avr->frequency / BENCH_BAUD;
+
+}
+
+/**
+ * @brief Sends a command and returns the cycles until its response is done
+ */
+static avr_cycle_count_t bench_command(avr_t* avr, const char* command)
+{
+
+    avr_irq_t* input = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_INPUT);
+    avr_cycle_count_t quiet = (avr_cycle_count_t)BENCH_QUIET_MS * (avr->frequency / 1000);
+
+    for (const char* c = command; *c; c++) {
+
+        avr_raise_irq(input, (uint8_t)*c);
+
+    }
+
+    // Let the command be received, so the EOL is not delayed by it
+    bench_run_until(avr, avr->cycle + (strlen(command) + 2) * bench_byte_cycles(avr));
+
+    avr_cycle_count_t start = avr->cycle;
+
+    avr_raise_irq(input, '\r');
+
+    uint64_t count = bench_output_count;
+
+    while (bench_output_count == count || avr->cycle < bench_output_cycle + quiet) {
+
+        if (avr->cycle > start + 100 * quiet) {
+
+            bench_fail("no response to command", command);
+
+        }
+
+        bench_step(avr);
+
+    }
+
+    return bench_output_cycle - start;
+
+}
+
+static void bench_usage()
+{
+
+    fprintf(stderr, "usage: bench [-m MCU] [-F HZ] [-p SCRIPT] [-c COMMAND] [-f NAME=ADDR]... [-i NAME=ADDR]... ELF\n");
+    exit(EXIT_FAILURE);
+
+}
+
+int main(int argc, char* argv[])
+{
+
+    const char* mcu = "atmega328p";
+    unsigned long frequency = 8000000;
+    const char* script = NULL;
+    const char* command = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:F:p:c:f:i:")) != -1) {
+
+        switch (opt) {
+
+            case 'm':
+                mcu = optarg;
+                break;
+
+            case 'F':
+                frequency = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'p':
+                script = optarg;
+                break;
+
+            case 'c':
+                command = optarg;
+                break;
+
+            case 'f':
+                bench_probe_add(optarg, false);
+                break;
+
+            case 'i':
+                bench_probe_add(optarg, true);
+                break;
+
+            default:
+                bench_usage();
+
+        }
+
+    }
+
+    if (optind != argc - 1) {
+
+        bench_usage();
+
+    }
+
+    elf_firmware_t firmware;
+
+    memset(&firmware, 0, sizeof(firmware));
+
+    if (elf_read_firmware(argv[optind], &firmware) != 0) {
+
+        bench_fail("unable to read firmware", argv[optind]);
+
+    }
+
+    // The image doesn't carry this information itself
+    snprintf(firmware.mmcu, sizeof(firmware.mmcu), "%s", mcu);
+    firmware.frequency = frequency;
+
+    avr_t* avr = avr_make_mcu_by_name(firmware.mmcu);
+
+    if (!avr) {
+
+        bench_fail("unknown MCU", mcu);
+
+    }
+
+    avr_init(avr);
+    avr_load_firmware(avr, &firmware);
+
+    bench_fram_attach(avr);
+    bench_uart_attach(avr);
+
+    // All pins are high initially, just like with the pull-ups enabled
+    for (char port = 'B'; port <= 'D'; port++) {
+
+        for (uint8_t bit = 0; bit < 8; bit++) {
+
+            avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(port), bit), 1);
+
+        }
+
+    }
+
+    if (script) {
+
+        bench_script(avr, script);
+
+    }
+
+    bench_run_until(avr, avr->cycle + (avr_cycle_count_t)BENCH_SETTLE_MS * (frequency / 1000));
+
+    avr_cycle_count_t command_cycles = command ? bench_command(avr, command) : 0;
+
+    for (uint8_t i = 0; i < bench_probe_count; i++) {
+
+        bench_probe_t* probe = &bench_probes[i];
+
+        fprintf(stderr, "bench: %s called %" PRIu64 " times\n", probe->name, probe->calls);
+
+        if (strncmp(probe->name, "__", 2) == 0 || probe->calls == 0) {
+
+            continue;
+
+        }
+
+        printf("%s_max %" PRIu64 "\n", probe->name, probe->max);
+        printf("%s_mean %" PRIu64 "\n", probe->name, probe->sum / probe->calls);
+
+        if (!probe->isr && probe->busy_calls > 0) {
+
+            printf("%s_busy %" PRIu64 "\n", probe->name, probe->busy_sum / probe->busy_calls);
+
+        }
+
+    }
+
+    if (command) {
+
+        printf("command %" PRIu64 "\n", (uint64_t)command_cycles);
+
+    }
+
+    return EXIT_SUCCESS;
+
+}
@@ -0,0 +1,147 @@
+#!/bin/sh
+#
+# Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+#
+# This file is part of S0-counter.
+#
+# S0-counter is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# S0-counter is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+#
+#
+# Benchmarks the firmware cycle-accurately on simavr, see tools/bench.c.
+#
+# The firmware is built into bin/bench/ with the functions being probed kept
+# out of line, so their cycles can be attributed. The results are written to
+# bin/bench/results, along with the flash and RAM used, and appended to
+# bin/bench/history tagged with the current revision.
+#
+# If a baseline exists (tools/bench.baseline by default), the results are
+# compared against it and this fails if any metric has increased by more than
+# BENCH_THRESHOLD percent. Invoked with `baseline` the current results are
+# recorded as the new baseline instead.
+#
+# This is expected to be invoked via `make bench` or `make bench-baseline`
+# from the root directory.
+
+set -e
+
+mode=$1
+
+MCU=${MCU:-atmega328p}
+F_CPU=${F_CPU:-8000000}
+TARGET=${TARGET:-s0-counter}
+SIZE=${SIZE:-avr-size}
+NM=${NM:-avr-nm}
+
+BENCH=${BENCH:-bin/bench/bench}
+BENCH_BASELINE=${BENCH_BASELINE:-tools/bench.baseline}
+BENCH_THRESHOLD=${BENCH_THRESHOLD:-5}
+BENCH_SCRIPT=${BENCH_SCRIPT:-tools/bench.pulses}
+BENCH_COMMAND=${BENCH_COMMAND:-channel 0 info}
+
+# Vector of TIMER0_COMPA on the ATmega328P
+TIMER_VECTOR=${TIMER_VECTOR:-__vector_14}
+
+# Functions being probed, these must not be inlined
+FUNCTIONS="s0_handle prefs_save"
+
+dir=bin/bench
+elf=$dir/fw/$TARGET.elf
+results=$dir/results
+
+mkdir -p "$dir/fw"
+
+make -s BINDIR="$dir/fw" DEPDIR="$dir/fw" OPTFLAGS="-Os -fno-inline-functions-called-once -fno-inline-small-functions" "$elf" >/dev/null
+
+section() {
+
+    $SIZE -A "$1" | awk -v name="$2" '$1 == name { size = $2 } END { print size + 0 }'
+
+}
+
+symbol() {
+
+    $NM "$elf" | awk -v name="$1" '$3 == name { print $1 }'
+
+}
+
+set -- -m "$MCU" -F "$F_CPU" -p "$BENCH_SCRIPT" -c "$BENCH_COMMAND"
+
+for name in $FUNCTIONS; do
+
+    addr=$(symbol "$name")
+
+    if [ -z "$addr" ]; then
+
+        echo "bench: $name has been inlined, not measured" >&2
+        continue
+
+    fi
+
+    set -- "$@" -f "$name=$addr"
+
+done
+
+# All ISRs are probed, so their cycles are not accounted to the functions
+for vector in $($NM "$elf" | awk '$3 ~ /^__vector_[0-9]+$/ { print $3 }'); do
+
+    name=$vector
+    [ "$vector" != "$TIMER_VECTOR" ] || name=timer_isr
+
+    set -- "$@" -i "$name=$(symbol "$vector")"
+
+done
+
+"$BENCH" "$@" "$elf" > "$results"
+
+text=$(section "$elf" .text)
+data=$(section "$elf" .data)
+bss=$(section "$elf" .bss)
+noinit=$(section "$elf" .noinit)
+
+echo "flash $((text + data))" >> "$results"
+echo "ram $((data + bss + noinit))" >> "$results"
+
+rev=$(git describe --always --dirty 2>/dev/null || echo unknown)
+awk -v rev="$rev" '{ print rev, $0 }' "$results" >> "$dir/history"
+
+if [ "$mode" = "baseline" ]; then
+
+    cp "$results" "$BENCH_BASELINE"
+    echo "bench: baseline recorded in $BENCH_BASELINE"
+    exit 0
+
+fi
+
+if [ ! -f "$BENCH_BASELINE" ]; then
+
+    cat "$results"
+    echo "bench: no baseline, run \`make bench-baseline\` to record one"
+    exit 0
+
+fi
+
+awk -v threshold="$BENCH_THRESHOLD" '
+
+    NR == FNR { base[$1] = $2; next }
+
+    {
+        change = ($1 in base) && base[$1] > 0 ? ($2 - base[$1]) * 100 / base[$1] : 0
+        flag = change > threshold ? "  REGRESSED" : ""
+        printf "%-20s %10s %10u %+7.1f%%%s\n", $1, ($1 in base) ? base[$1] : "-", $2, change, flag
+        if (flag != "") failed = 1
+    }
+
+    END { exit failed }
+
+' "$BENCH_BASELINE" "$results"
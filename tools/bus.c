@@ -0,0 +1,564 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file bus.c
+ * @brief Virtual RS-485 bus polling multiple instances of the simulation
+ *
+ * Each unit is an instance of the host simulation built with `ENABLE_RS485`,
+ * with its stdin and stdout attached to pipes and a FRAM of its own. Before
+ * the units are put onto the bus, each of them is assigned an address via its
+ * own pipe, just like units would be configured before being mounted.
+ *
+ * On the bus every request is written to all of the units, whereas the output
+ * of all units is merged, as on a shared half-duplex line. Only the addressed
+ * unit is supposed to respond, so output of any other unit is counted as a
+ * collision. Broadcasts (`@0`) must not be answered by any unit at all.
+ *
+ * A poll cycle either consists of `@N changes EPOCH SEQUENCE` for each unit,
+ * passing on the epoch and sequence number of its previous response, or with
+ * `-l` of a broadcast `latch` followed by `@N snapshot latched` for each unit.
+ *
+ * The simulation transmits instantly, so the time on the wire is derived from
+ * the number of bytes actually transferred at the given baud rate (10 bits per
+ * byte). The turnaround, i.e. the time from the end of a request until the
+ * end of its response, is measured on the host. It doesn't include the
+ * processing time of the MCU, which can only be measured on the unit itself.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "proto.h"
+
+/**
+ * @brief Maximum number of units on the bus
+ */
+#define BUS_UNITS_MAX 64
+
+/**
+ * @brief Maximum length of a line of output
+ */
+#define BUS_LINE_MAX 512
+
+/**
+ * @brief Time a unit has to respond within in milliseconds
+ */
+#define BUS_TIMEOUT 1000
+
+/**
+ * @brief Simulation used unless given otherwise
+ */
+#define BUS_SIM_DEFAULT "bin/rs485/host/s0-counter"
+
+typedef struct {
+
+    pid_t pid;
+    int in;
+    int out;
+
+    char fram[64];
+
+    // Partial line of output read so far
+    char line[BUS_LINE_MAX];
+    size_t len;
+
+    // Epoch and sequence number of the last response to `changes`
+    unsigned long epoch;
+    unsigned long sequence;
+
+} bus_unit_t;
+
+static bus_unit_t bus_units[BUS_UNITS_MAX];
+static uint8_t bus_unit_count = 32;
+
+static const char* bus_sim = BUS_SIM_DEFAULT;
+
+/**
+ * @brief Bytes transferred and time spent on the bus
+ */
+typedef struct {
+
+    unsigned long requests;
+    unsigned long request_bytes;
+    unsigned long responses;
+    unsigned long response_bytes;
+    unsigned long errors;
+    unsigned long collisions;
+
+    // Sum of the turnarounds measured on the host in microseconds
+    uint64_t turnaround;
+
+} bus_stats_t;
+
+static bus_stats_t bus_stats;
+
+static void bus_fail(const char* msg, const char* arg)
+{
+
+    fprintf(stderr, "bus: %s%s%s\n", msg, arg ? ": " : "", arg ? arg : "");
+    exit(EXIT_FAILURE);
+
+}
+
+static uint64_t bus_now_us()
+{
+
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+
+}
+
+static void bus_spawn(bus_unit_t* unit, const char* dir, uint8_t address, const char* speed, const char* script)
+{
+
+    int in[2];
+    int out[2];
+
+    if (pipe(in) != 0 || pipe(out) != 0) {
+
+        bus_fail("unable to create pipes", NULL);
+
+    }
+
+    snprintf(unit->fram, sizeof(unit->fram), "%s/unit%u.fram", dir, address);
+
+    unit->pid = fork();
+
+    if (unit->pid == 0) {
+
+        // The statistics output on termination are of no interest
+        int null = open("/dev/null", O_WRONLY);
+
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        close(null);
+        close(in[0]);
+        close(in[1]);
+        close(out[0]);
+        close(out[1]);
+
+        if (script) {
+
+            execl(bus_sim, bus_sim, "-i", "-s", speed, "-f", unit->fram, "-p", script, (char*)NULL);
+
+        } else {
+
+            execl(bus_sim, bus_sim, "-i", "-s", speed, "-f", unit->fram, (char*)NULL);
+
+        }
+
+        perror(bus_sim);
+        _exit(EXIT_FAILURE);
+
+    }
+
+    close(in[0]);
+    close(out[1]);
+
+    unit->in = in[1];
+    unit->out = out[0];
+    unit->len = 0;
+
+}
+
+/**
+ * @brief Reads the output of all units until the given unit has responded
+ *
+ * Output of any other unit is counted as a collision, as would be the case on
+ * an actual bus. Lines of the given unit that are not responses are counted
+ * as well, as they would collide with the responses of other units.
+ *
+ * @param expected Unit expected to respond, NULL to only drain the output
+ * @param response Buffer for the response, needs to hold BUS_LINE_MAX bytes
+ * @param timeout Time to wait for in milliseconds
+ *
+ * @return Length of the response including the EOL, zero if there is none
+ */
+static size_t bus_receive(bus_unit_t* expected, char* response, int timeout)
+{
+
+    struct pollfd fds[BUS_UNITS_MAX];
+    uint64_t deadline = bus_now_us() + (uint64_t)timeout * 1000;
+
+    for (uint8_t i = 0; i < bus_unit_count; i++) {
+
+        fds[i].fd = bus_units[i].out;
+        fds[i].events = POLLIN;
+
+    }
+
+    for (;;) {
+
+        uint64_t now = bus_now_us();
+
+        if (now >= deadline) {
+
+            return 0;
+
+        }
+
+        int ready = poll(fds, bus_unit_count, (deadline - now + 999) / 1000);
+
+        if (ready < 0 && errno != EINTR) {
+
+            bus_fail("unable to poll units", NULL);
+
+        }
+
+        for (uint8_t i = 0; i < bus_unit_count && ready > 0; i++) {
+
+            if (!(fds[i].revents & (POLLIN | POLLHUP))) {
+
+                continue;
+
+            }
+
+            bus_unit_t* unit = &bus_units[i];
+            char c;
+
+            if (read(unit->out, &c, 1) != 1) {
+
+                bus_fail("unit has terminated", unit->fram);
+
+            }
+
+            if (unit != expected) {
+
+                bus_stats.collisions++;
+
+                continue;
+
+            }
+
+            if (unit->len < BUS_LINE_MAX - 1) {
+
+                unit->line[unit->len++] = c;
+
+            }
+
+            if (c != '\n') {
+
+                continue;
+
+            }
+
+            size_t len = unit->len;
+
+            unit->line[len] = '\0';
+            unit->len = 0;
+
+            if (strncmp(unit->line, PROTO_OUTPUT_PREFIX, strlen(PROTO_OUTPUT_PREFIX)) != 0) {
+
+                bus_stats.collisions += len;
+
+                continue;
+
+            }
+
+            memcpy(response, unit->line, len + 1);
+
+            return len;
+
+        }
+
+    }
+
+}
+
+/**
+ * @brief Puts a request onto the bus and waits for the response, if any
+ *
+ * @param unit Unit addressed, NULL for a broadcast
+ * @param response Buffer for the response, needs to hold BUS_LINE_MAX bytes
+ *
+ * @return Length of the response including the EOL
+ */
+static size_t bus_request(bus_unit_t* unit, const char* request, char* response)
+{
+
+    size_t len = strlen(request);
+
+    for (uint8_t i = 0; i < bus_unit_count; i++) {
+
+        if (write(bus_units[i].in, request, len) != (ssize_t)len) {
+
+            bus_fail("unable to write to unit", bus_units[i].fram);
+
+        }
+
+    }
+
+    bus_stats.requests++;
+    bus_stats.request_bytes += len;
+
+    if (unit == NULL) {
+
+        return 0;
+
+    }
+
+    uint64_t start = bus_now_us();
+    size_t received = bus_receive(unit, response, BUS_TIMEOUT);
+
+    if (received == 0) {
+
+        bus_fail("no response to", request);
+
+    }
+
+    bus_stats.turnaround += bus_now_us() - start;
+    bus_stats.responses++;
+    bus_stats.response_bytes += received;
+
+    if (strncmp(response + strlen(PROTO_OUTPUT_PREFIX), PROTO_OUTPUT_ERROR, strlen(PROTO_OUTPUT_ERROR)) == 0) {
+
+        bus_stats.errors++;
+
+    }
+
+    return received;
+
+}
+
+/**
+ * @brief Assigns addresses to all units via their own pipes
+ */
+static void bus_setup()
+{
+
+    char request[32];
+    char response[BUS_LINE_MAX];
+
+    for (uint8_t i = 0; i < bus_unit_count; i++) {
+
+        bus_unit_t* unit = &bus_units[i];
+        int len = snprintf(request, sizeof(request), "address %u\r", i + 1);
+
+        if (write(unit->in, request, len) != len) {
+
+            bus_fail("unable to write to unit", unit->fram);
+
+        }
+
+        // Other units are quiet, so nothing is counted as a collision
+        if (bus_receive(unit, response, BUS_TIMEOUT) == 0 || strcmp(response, PROTO_OUTPUT_PREFIX PROTO_OUTPUT_OK PROTO_OUTPUT_EOL) != 0) {
+
+            bus_fail("unable to set address", unit->fram);
+
+        }
+
+    }
+
+    memset(&bus_stats, 0, sizeof(bus_stats));
+
+}
+
+static void bus_cycle(bool latched)
+{
+
+    char request[64];
+    char response[BUS_LINE_MAX];
+
+    if (latched) {
+
+        bus_request(NULL, "@0 latch\r", NULL);
+
+    }
+
+    for (uint8_t i = 0; i < bus_unit_count; i++) {
+
+        bus_unit_t* unit = &bus_units[i];
+
+        if (latched) {
+
+            snprintf(request, sizeof(request), "@%u snapshot latched\r", i + 1);
+            bus_request(unit, request, response);
+
+            continue;
+
+        }
+
+        snprintf(request, sizeof(request), "@%u changes %lu %lu\r", i + 1, unit->epoch, unit->sequence);
+        bus_request(unit, request, response);
+
+        sscanf(response, PROTO_OUTPUT_PREFIX "%lu %lu", &(unit->epoch), &(unit->sequence));
+
+    }
+
+}
+
+static void bus_report(const char* name, const bus_stats_t* stats, unsigned cycles, unsigned long baud)
+{
+
+    double wire = (stats->request_bytes + stats->response_bytes) * 10.0 * 1000 / baud / cycles;
+    double turnaround = stats->turnaround / 1000.0 / cycles;
+
+    printf("%-10s %8.1f %9.1f %9.1f %9.2f %9.2f %9.2f %6lu %6lu\n", name,
+        (double)stats->request_bytes / stats->requests,
+        stats->responses ? (double)stats->response_bytes / stats->responses : 0,
+        (double)(stats->request_bytes + stats->response_bytes) / cycles,
+        wire, turnaround, wire + turnaround, stats->errors, stats->collisions);
+
+}
+
+static void bus_usage()
+{
+
+    fprintf(stderr,
+        "usage: bus [-n UNITS] [-b BAUD] [-c CYCLES] [-l] [-S SIM] [-s SPEED] [-p SCRIPT]\n"
+        "\n"
+        "  -n UNITS   number of units on the bus (default 32)\n"
+        "  -b BAUD    baud rate the time on the wire is derived from (default 38400)\n"
+        "  -c CYCLES  number of poll cycles (default 100)\n"
+        "  -l         poll with a broadcast latch and snapshot latched\n"
+        "  -S SIM     simulation built with ENABLE_RS485 (default " BUS_SIM_DEFAULT ")\n"
+        "  -s SPEED   speed of the simulation (default 0)\n"
+        "  -p SCRIPT  pulses fed into each unit\n");
+
+    exit(EXIT_FAILURE);
+
+}
+
+int main(int argc, char* argv[])
+{
+
+    unsigned long baud = 38400;
+    unsigned cycles = 100;
+    bool latched = false;
+    const char* speed = "0";
+    const char* script = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:b:c:lS:s:p:")) != -1) {
+
+        switch (opt) {
+
+            case 'n':
+                bus_unit_count = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'b':
+                baud = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'c':
+                cycles = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'l':
+                latched = true;
+                break;
+
+            case 'S':
+                bus_sim = optarg;
+                break;
+
+            case 's':
+                speed = optarg;
+                break;
+
+            case 'p':
+                script = optarg;
+                break;
+
+            default:
+                bus_usage();
+
+        }
+
+    }
+
+    if (optind != argc || bus_unit_count == 0 || bus_unit_count > BUS_UNITS_MAX || baud == 0 || cycles < 2) {
+
+        bus_usage();
+
+    }
+
+    char dir[] = "/tmp/bus-XXXXXX";
+
+    if (mkdtemp(dir) == NULL) {
+
+        bus_fail("unable to create directory", dir);
+
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    for (uint8_t i = 0; i < bus_unit_count; i++) {
+
+        bus_spawn(&bus_units[i], dir, i + 1, speed, script);
+
+    }
+
+    bus_setup();
+
+    // The first cycle returns all channels of each unit for `changes`
+    bus_cycle(latched);
+
+    bus_stats_t first = bus_stats;
+
+    memset(&bus_stats, 0, sizeof(bus_stats));
+
+    for (unsigned i = 1; i < cycles; i++) {
+
+        bus_cycle(latched);
+
+    }
+
+    // Output arriving late is still counted as a collision
+    bus_receive(NULL, NULL, 100);
+
+    printf("%u units, %lu baud, %s\n\n", bus_unit_count, baud, latched ? "latch + snapshot latched" : "changes");
+    printf("%-10s %8s %9s %9s %9s %9s %9s %6s %6s\n", "cycle", "req B", "resp B", "B/cycle", "wire ms", "host ms", "total ms", "errors", "coll");
+    bus_report("first", &first, 1, baud);
+    bus_report("following", &bus_stats, cycles - 1, baud);
+
+    for (uint8_t i = 0; i < bus_unit_count; i++) {
+
+        kill(bus_units[i].pid, SIGTERM);
+        close(bus_units[i].in);
+        waitpid(bus_units[i].pid, NULL, 0);
+        close(bus_units[i].out);
+        unlink(bus_units[i].fram);
+
+    }
+
+    rmdir(dir);
+
+    return (first.errors || first.collisions || bus_stats.errors || bus_stats.collisions) ? EXIT_FAILURE : EXIT_SUCCESS;
+
+}
@@ -0,0 +1,1223 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file check.c
+ * @brief Regression tests of the protocols and the preferences
+ *
+ * Like the dispatch benchmark (see tools/dispatch.c), this is linked against
+ * the firmware modules of the host build, but not against the simulation
+ * itself. Input is handed over to the UART directly and proto_handle() is
+ * invoked until it has been consumed, while output is collected through a
+ * pipe. Nothing depends on the wall clock, so results are deterministic.
+ *
+ * Frames are built and verified by implementations of COBS and both of the
+ * CRCs of their own, rather than by those of the firmware, so that mistakes
+ * within the latter don't cancel out.
+ *
+ * Modbus is only covered when built with ENABLE_MODBUS, which `make check`
+ * takes care of. The exit status is non-zero if any of the checks failed.
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <avr/io.h>
+
+#include "binary.h"
+#include "config.h"
+#include "modbus.h"
+#include "prefs.h"
+#include "proto.h"
+#include "push.h"
+#include "s0.h"
+#include "sim.h"
+#include "uart.h"
+#include "version.h"
+
+/**
+ * @brief Size of the buffer output is collected in
+ */
+#define CHECK_OUTPUT_SIZE 512
+
+/**
+ * @brief Checks a condition, recording a failure along with its line
+ */
+#define CHECK(condition) check_assert((condition), #condition, __LINE__)
+
+/**
+ * @brief Checks that a text command is answered with exactly the given output
+ */
+#define CHECK_COMMAND(command, expected) CHECK(strcmp(check_command(command), expected) == 0)
+
+volatile uint8_t sim_io[SIM_IO_SIZE];
+
+/**
+ * @brief Number of checks that have failed so far
+ */
+static unsigned check_failures;
+
+/**
+ * @brief File descriptor of the FRAM file, see check_fram_write()
+ */
+static int check_fram_fd;
+
+/**
+ * @brief Offset of the preferences in use within the FRAM file
+ *
+ * @see check_fram_locate()
+ */
+static size_t check_fram_offset;
+
+/**
+ * @brief Read side of the pipe the output of the UART is attached to
+ */
+static int check_output_fd;
+
+/**
+ * @brief Output collected by check_output()
+ */
+static char check_output_buffer[CHECK_OUTPUT_SIZE];
+
+/**
+ * @brief Simulated time, which doesn't advance
+ */
+uint32_t sim_get_time()
+{
+
+    return 0;
+
+}
+
+/**
+ * @brief Invoked by the UART without any input left, nothing to do
+ */
+void sim_idle()
+{
+
+}
+
+void sim_sleep()
+{
+
+}
+
+static void check_assert(bool ok, const char* condition, int line)
+{
+
+    if (!ok) {
+
+        fprintf(stderr, "check.c:%d: %s\n", line, condition);
+        check_failures++;
+
+    }
+
+}
+
+/**
+ * @brief CRC-16/CCITT-FALSE as used by the binary protocol
+ */
+static uint16_t check_crc_ccitt(const uint8_t* data, size_t len)
+{
+
+    uint16_t crc = 0xFFFF;
+
+    while (len--) {
+
+        crc ^= (uint16_t)*data++ << 8;
+
+        for (uint8_t i = 0; i < 8; i++) {
+
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+
+        }
+
+    }
+
+    return crc;
+
+}
+
+/**
+ * @brief CRC-16/MODBUS, transmitted low byte first
+ */
+static uint16_t check_crc_modbus(const uint8_t* data, size_t len)
+{
+
+    uint16_t crc = 0xFFFF;
+
+    while (len--) {
+
+        crc ^= *data++;
+
+        for (uint8_t i = 0; i < 8; i++) {
+
+            crc = (crc & 0x0001) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+
+        }
+
+    }
+
+    return crc;
+
+}
+
+/**
+ * @brief Hands over input to the UART and lets proto_handle() consume it
+ */
+static void check_input(const uint8_t* data, size_t len)
+{
+
+    for (size_t i = 0; i < len; i++) {
+
+        sim_uart_receive(data[i]);
+
+    }
+
+    do {
+
+        proto_handle();
+
+    } while (uart_input_available(UART_PORT_DEFAULT));
+
+}
+
+/**
+ * @brief Returns all of the output since the last invocation
+ *
+ * @return Length of the output, which is NUL terminated, too
+ */
+static size_t check_output()
+{
+
+    ssize_t len = read(check_output_fd, check_output_buffer, sizeof(check_output_buffer) - 1);
+
+    if (len < 0) {
+
+        len = 0;
+
+    }
+
+    check_output_buffer[len] = '\0';
+
+    return len;
+
+}
+
+/**
+ * @brief Runs a text command and returns its output
+ */
+static const char* check_command(const char* command)
+{
+
+    check_input((const uint8_t*)command, strlen(command));
+    check_input((const uint8_t*)"\r", 1);
+
+    check_output();
+
+    return check_output_buffer;
+
+}
+
+/**
+ * @brief Simulates a reset of the unit as far as the preferences are concerned
+ */
+static void check_reboot()
+{
+
+    prefs_init();
+
+}
+
+/**
+ * @brief Writes to the image of the preferences in use, bypassing the firmware
+ */
+static void check_fram_write(size_t offset, const void* data, size_t len)
+{
+
+    if (pwrite(check_fram_fd, data, len, check_fram_offset + offset) != (ssize_t)len) {
+
+        perror("check: fram");
+        exit(EXIT_FAILURE);
+
+    }
+
+}
+
+/**
+ * @brief Determines where the preferences in use are located in the FRAM file
+ *
+ * The FRAM section also contains the staging area of restores, and the order
+ * of its variables is up to the compiler. The preferences are reset within an
+ * erased FRAM, so they are the only image with a valid header afterwards.
+ */
+static void check_fram_locate()
+{
+
+    uint8_t erased[2 * sizeof(prefs_t)];
+    prefs_t image;
+
+    memset(erased, 0xFF, sizeof(erased));
+    check_fram_write(0, erased, sizeof(erased));
+
+    prefs_reset();
+
+    for (check_fram_offset = 0; check_fram_offset <= sizeof(prefs_t); check_fram_offset++) {
+
+        if (pread(check_fram_fd, &image, sizeof(image), check_fram_offset) == sizeof(image)
+            && image.version == VERSION && image.length == sizeof(prefs_t)) {
+
+            return;
+
+        }
+
+    }
+
+    fprintf(stderr, "check: preferences not found within FRAM\n");
+    exit(EXIT_FAILURE);
+
+}
+
+/**
+ * @brief Feeds a single valid impulse into channel 0 and lets it be saved
+ */
+static void check_pulse()
+{
+
+    PINC &= ~_BV(0);
+
+    for (uint8_t i = 0; i < 30; i++) {
+
+        s0_poll();
+
+    }
+
+    PINC |= _BV(0);
+
+    s0_poll();
+    s0_handle();
+
+}
+
+#if ENABLE_PUSH
+
+/**
+ * @brief Lets a message be due and checks its output
+ */
+static void check_push_message(const char* expected)
+{
+
+    push_tick();
+    push_handle();
+
+    check_output();
+    CHECK(strcmp(check_output_buffer, expected) == 0);
+
+}
+
+/**
+ * @brief Checks the deltas of pushed messages
+ *
+ * Deltas are counted modulo 2^32, whereas counts set explicitly must not be
+ * reported as impulses, whether they are raised or lowered.
+ */
+static void check_push()
+{
+
+    CHECK_COMMAND("channel 0 set enabled true", ">OK\r\n");
+    CHECK_COMMAND("channel 0 set count 4294967295", ">OK\r\n");
+    CHECK_COMMAND("push subscribe 0", ">OK\r\n");
+    CHECK_COMMAND("push interval 1", ">OK\r\n");
+    check_push_message("PUSH: 0 4294967295 0\r\n");
+
+    check_pulse();
+    check_push_message("PUSH: 0 0 1\r\n");
+
+    CHECK_COMMAND("channel 0 set count 10", ">OK\r\n");
+    check_pulse();
+    check_push_message("PUSH: 0 11 1\r\n");
+
+    CHECK_COMMAND("channel 0 set count 5", ">OK\r\n");
+    check_push_message("PUSH: 0 5 0\r\n");
+
+    CHECK_COMMAND("push interval 0", ">OK\r\n");
+    CHECK_COMMAND("push unsubscribe 0", ">OK\r\n");
+
+}
+
+#endif
+
+#if ENABLE_RS485
+
+/**
+ * @brief Returns the count of channel 0 within the response to `snapshot`
+ */
+static unsigned long check_snapshot_count(const char* command)
+{
+
+    unsigned long count = ULONG_MAX;
+
+    sscanf(check_command(command), ">%*u %*u %*u %lu", &count);
+
+    return count;
+
+}
+
+/**
+ * @brief Checks the filtering of addressed lines and latching by broadcasts
+ */
+static void check_bus()
+{
+
+    // Units without an address never respond in place of another unit
+    CHECK_COMMAND("@5 ping", "");
+    CHECK_COMMAND("@0 ping", "");
+    CHECK_COMMAND("ping", ">OK\r\n");
+
+    CHECK_COMMAND("address 5", ">OK\r\n");
+    CHECK_COMMAND("ping", "");
+    CHECK_COMMAND("@4 ping", "");
+    CHECK_COMMAND("@248 ping", "");
+    CHECK_COMMAND("@5 #42 ping", ">#42 OK\r\n");
+    CHECK_COMMAND("@5 pong", ">ERR\r\n");
+
+    CHECK_COMMAND("@5 channel 0 set count 100", ">OK\r\n");
+
+    // Broadcasts are processed without a response
+    CHECK_COMMAND("@0 latch", "");
+    check_pulse();
+    check_output();
+    CHECK(check_snapshot_count("@5 snapshot latched") == 100);
+    CHECK(check_snapshot_count("@5 snapshot") == 101);
+
+    CHECK_COMMAND("@0 channel 0 set count 7", "");
+    CHECK(check_snapshot_count("@5 snapshot") == 7);
+    CHECK(check_snapshot_count("@5 snapshot latched") == 100);
+
+    // The address persists across a reset
+    check_reboot();
+    CHECK_COMMAND("ping", "");
+    CHECK_COMMAND("@5 address", ">address: 5\r\n");
+
+    CHECK_COMMAND("@5 address 0", ">OK\r\n");
+    CHECK_COMMAND("ping", ">OK\r\n");
+
+}
+
+#endif
+
+#if ENABLE_SLEEP
+
+/**
+ * @brief Checks that busy channels leave the pin change interrupts alone
+ *
+ * Writing PCIFR discards pending pin changes, so it must only be written when
+ * the channels start or stop being watched, not on every tick in between.
+ */
+static void check_sleep()
+{
+
+    CHECK_COMMAND("channel 0 set enabled true", ">OK\r\n");
+
+    // Lets the output of previous impulses expire
+    for (uint8_t i = 0; i < UINT8_MAX; i++) {
+
+        s0_output();
+
+    }
+
+    CHECK(s0_sleep());
+    CHECK(PCICR & _BV(PCIE1));
+
+    PINC &= ~_BV(0);
+    CHECK(!s0_sleep());
+    CHECK(!(PCICR & _BV(PCIE1)));
+
+    PCIFR = 0;
+
+    for (uint8_t i = 0; i < 30; i++) {
+
+        s0_poll();
+        CHECK(!s0_sleep());
+
+    }
+
+    CHECK(PCIFR == 0 && !(PCICR & _BV(PCIE1)));
+
+    PINC |= _BV(0);
+    s0_poll();
+    CHECK(!s0_sleep());
+    CHECK(PCIFR == 0);
+
+    s0_handle();
+
+    for (uint8_t i = 0; i < UINT8_MAX; i++) {
+
+        s0_output();
+
+    }
+
+    CHECK(s0_sleep());
+    CHECK(PCICR & _BV(PCIE1));
+
+}
+
+#endif
+
+#if ENABLE_BINARY_PROTOCOL
+
+/**
+ * @brief Sends a request of the binary protocol, appending its CRC
+ *
+ * @param corrupt Whether to corrupt the CRC, so the frame must be ignored
+ */
+static void check_binary_send(const uint8_t* request, uint8_t len, bool corrupt)
+{
+
+    uint8_t data[UINT8_MAX];
+    uint8_t frame[UINT8_MAX + 2];
+    uint8_t code = 0;
+    size_t index = 1;
+
+    memcpy(data, request, len);
+
+    uint16_t crc = check_crc_ccitt(data, len) ^ (corrupt ? 0x0100 : 0);
+    data[len++] = crc & 0xFF;
+    data[len++] = crc >> 8;
+
+    // COBS, requests are well below the maximum block length of 254 bytes
+    for (uint8_t i = 0; i < len; i++) {
+
+        if (data[i] == 0) {
+
+            frame[code] = index - code;
+            code = index++;
+
+        } else {
+
+            frame[index++] = data[i];
+
+        }
+
+    }
+
+    frame[code] = index - code;
+    frame[index++] = BINARY_FRAME_DELIMITER;
+
+    check_input(frame, index);
+
+}
+
+/**
+ * @brief Decodes the response to a request of the binary protocol
+ *
+ * The response needs to be a single frame with a valid CRC, which echoes the
+ * command and id of the request.
+ *
+ * @return Length of the payload following the status, negative on error
+ */
+static int check_binary_receive(const uint8_t* request, uint8_t* status, uint8_t* payload)
+{
+
+    size_t len = check_output();
+    uint8_t data[CHECK_OUTPUT_SIZE];
+    size_t index = 0;
+    size_t i = 0;
+
+    if (len < 2 || check_output_buffer[len - 1] != BINARY_FRAME_DELIMITER) {
+
+        return -1;
+
+    }
+
+    len--;
+
+    while (i < len) {
+
+        uint8_t code = check_output_buffer[i++];
+
+        if (code == 0 || i + code - 1 > len) {
+
+            return -1;
+
+        }
+
+        for (uint8_t j = 1; j < code; j++) {
+
+            data[index++] = check_output_buffer[i++];
+
+        }
+
+        if (code != 0xFF && i < len) {
+
+            data[index++] = 0;
+
+        }
+
+    }
+
+    if (index < 5 || check_crc_ccitt(data, index - 2) != (data[index - 2] | (data[index - 1] << 8))) {
+
+        return -1;
+
+    }
+
+    if (data[0] != request[0] || data[1] != request[1]) {
+
+        return -1;
+
+    }
+
+    *status = data[2];
+    memcpy(payload, &data[3], index - 5);
+
+    return index - 5;
+
+}
+
+/**
+ * @brief Sends a request and checks the status and length of its response
+ */
+static bool check_binary(const uint8_t* request, uint8_t len, uint8_t status, uint8_t* payload, int expected)
+{
+
+    uint8_t actual;
+
+    check_binary_send(request, len, false);
+
+    return check_binary_receive(request, &actual, payload) == expected && actual == status;
+
+}
+
+/**
+ * @brief Checks COBS and CRC of the binary protocol
+ */
+static void check_binary_framing()
+{
+
+    uint8_t payload[CHECK_OUTPUT_SIZE];
+
+    CHECK_COMMAND("binary", PROTO_OUTPUT_PREFIX PROTO_OUTPUT_OK PROTO_OUTPUT_EOL);
+    CHECK(binary_is_enabled());
+
+    uint8_t ping[] = { BINARY_CMD_PING, 1 };
+    CHECK(check_binary(ping, sizeof(ping), BINARY_STATUS_OK, payload, 0));
+
+    // Ids of zero are encoded within the COBS overhead
+    uint8_t info[] = { BINARY_CMD_INFO, 0 };
+    CHECK(check_binary(info, sizeof(info), BINARY_STATUS_OK, payload, 2));
+    CHECK(payload[0] == VERSION && payload[1] == CHANNELS);
+
+    // Counts consisting mostly of zero bytes
+    uint8_t count_set[] = { BINARY_CMD_COUNT_SET, 2, 1, 0x00, 0x00, 0x01, 0x00 };
+    CHECK(check_binary(count_set, sizeof(count_set), BINARY_STATUS_OK, payload, 0));
+    CHECK(prefs_get()->channels[1].count == 0x10000);
+
+    uint8_t channel_get[] = { BINARY_CMD_CHANNEL_GET, 3, 1 };
+    CHECK(check_binary(channel_get, sizeof(channel_get), BINARY_STATUS_OK, payload, 7));
+    CHECK(payload[3] == 0x00 && payload[4] == 0x00 && payload[5] == 0x01 && payload[6] == 0x00);
+
+    // Frames with a wrong CRC are dropped silently
+    uint8_t count_reset[] = { BINARY_CMD_COUNT_SET, 4, 1, 0, 0, 0, 0 };
+    check_binary_send(count_reset, sizeof(count_reset), true);
+    CHECK(check_output() == 0);
+    CHECK(prefs_get()->channels[1].count == 0x10000);
+
+    // So are truncated blocks, while the following frame is processed
+    uint8_t truncated[] = { 0x05, BINARY_CMD_PING, 5, BINARY_FRAME_DELIMITER };
+    check_input(truncated, sizeof(truncated));
+    CHECK(check_output() == 0);
+    CHECK(check_binary(ping, sizeof(ping), BINARY_STATUS_OK, payload, 0));
+
+    // Frames exceeding the buffer are discarded as a whole
+    uint8_t oversized[BINARY_FRAME_MAX_SIZE + 1] = { BINARY_CMD_PING, 6 };
+    check_binary_send(oversized, sizeof(oversized), false);
+    CHECK(check_output() == 0);
+
+    uint8_t unknown[] = { 0x7F, 7 };
+    CHECK(check_binary(unknown, sizeof(unknown), BINARY_STATUS_UNKNOWN_COMMAND, payload, 0));
+
+    uint8_t invalid[] = { BINARY_CMD_CHANNEL_GET, 8, CHANNELS };
+    CHECK(check_binary(invalid, sizeof(invalid), BINARY_STATUS_INVALID_ARGUMENT, payload, 0));
+
+    uint8_t text[] = { BINARY_CMD_TEXT, 9 };
+    CHECK(check_binary(text, sizeof(text), BINARY_STATUS_OK, payload, 0));
+    CHECK(!binary_is_enabled());
+
+    CHECK_COMMAND("ping", PROTO_OUTPUT_PREFIX PROTO_OUTPUT_OK PROTO_OUTPUT_EOL);
+
+}
+
+/**
+ * @brief Writes an image in chunks, feeding an impulse before each of them
+ */
+static void check_restore_write(const prefs_t* image, uint8_t id)
+{
+
+    uint8_t payload[CHECK_OUTPUT_SIZE];
+
+    for (uint16_t offset = 0; offset < sizeof(prefs_t); offset += BINARY_FRAM_CHUNK_SIZE) {
+
+        uint8_t size = (sizeof(prefs_t) - offset < BINARY_FRAM_CHUNK_SIZE) ? sizeof(prefs_t) - offset : BINARY_FRAM_CHUNK_SIZE;
+        uint8_t write[4 + BINARY_FRAM_CHUNK_SIZE] = { BINARY_CMD_FRAM_WRITE, id, offset & 0xFF, offset >> 8 };
+
+        memcpy(&write[4], (const uint8_t*)image + offset, size);
+
+        check_pulse();
+        CHECK(check_binary(write, 4 + size, BINARY_STATUS_OK, payload, 0));
+
+    }
+
+}
+
+/**
+ * @brief Checks restoring an image while impulses keep being counted
+ *
+ * Counts saved while the image is being written must neither corrupt it nor
+ * be lost if the image is rejected.
+ */
+static void check_restore()
+{
+
+    uint8_t payload[CHECK_OUTPUT_SIZE];
+    prefs_t image;
+
+    prefs_reset();
+
+    memcpy(&image, prefs_get(), sizeof(prefs_t));
+
+    for (uint8_t i = 0; i < CHANNELS; i++) {
+
+        image.channels[i].count = 5000 + i;
+
+    }
+
+    uint16_t crc = check_crc_ccitt((const uint8_t*)&image, sizeof(image));
+    uint32_t epoch = prefs_get_epoch();
+
+    CHECK_COMMAND("binary", PROTO_OUTPUT_PREFIX PROTO_OUTPUT_OK PROTO_OUTPUT_EOL);
+
+    // A commit with the wrong CRC leaves the counts in use alone
+    check_restore_write(&image, 1);
+
+    uint32_t count = prefs_get()->channels[0].count;
+    CHECK(count != 0);
+
+    uint8_t reject[] = { BINARY_CMD_FRAM_COMMIT, 2, sizeof(prefs_t) & 0xFF, sizeof(prefs_t) >> 8, ~crc & 0xFF, ~crc >> 8 };
+    CHECK(check_binary(reject, sizeof(reject), BINARY_STATUS_INVALID_ARGUMENT, payload, 0));
+    CHECK(prefs_get()->channels[0].count == count && prefs_get()->channels[1].count == 0);
+
+    check_reboot();
+    CHECK(prefs_get()->channels[0].count == count);
+
+    epoch = prefs_get_epoch();
+
+    // The image in use is read back while the staged one is pending
+    check_restore_write(&image, 3);
+
+    uint8_t read[] = { BINARY_CMD_FRAM_READ, 4, offsetof(prefs_t, channels) + sizeof(channel_prefs_t), 0, sizeof(channel_prefs_t) };
+    CHECK(check_binary(read, sizeof(read), BINARY_STATUS_OK, payload, sizeof(channel_prefs_t)));
+    CHECK(((channel_prefs_t*)payload)->count == 0);
+
+    // A length differing from the one within the image is rejected, too
+    uint16_t partial = check_crc_ccitt((const uint8_t*)&image, sizeof(image) - 1);
+    uint8_t truncated[] = { BINARY_CMD_FRAM_COMMIT, 7, (sizeof(prefs_t) - 1) & 0xFF, (sizeof(prefs_t) - 1) >> 8, partial & 0xFF, partial >> 8 };
+    CHECK(check_binary(truncated, sizeof(truncated), BINARY_STATUS_INVALID_ARGUMENT, payload, 0));
+    CHECK(prefs_get()->channels[1].count == 0);
+
+    uint8_t commit[] = { BINARY_CMD_FRAM_COMMIT, 5, sizeof(prefs_t) & 0xFF, sizeof(prefs_t) >> 8, crc & 0xFF, crc >> 8 };
+    CHECK(check_binary(commit, sizeof(commit), BINARY_STATUS_OK, payload, 0));
+
+    for (uint8_t i = 0; i < CHANNELS; i++) {
+
+        CHECK(prefs_get()->channels[i].count == 5000 + i);
+
+    }
+
+    CHECK(prefs_get_epoch() == epoch);
+
+    uint8_t text[] = { BINARY_CMD_TEXT, 6 };
+    CHECK(check_binary(text, sizeof(text), BINARY_STATUS_OK, payload, 0));
+
+    // Impulses following the commit are counted on top of the image
+    check_pulse();
+    check_reboot();
+    CHECK(prefs_get()->channels[0].count == 5001);
+    CHECK(prefs_get()->channels[1].count == 5001);
+
+}
+
+#endif
+
+#if ENABLE_MODBUS
+
+/**
+ * @brief Sends a Modbus request followed by silence terminating the frame
+ *
+ * @param corrupt Whether to corrupt the CRC, so the frame must be ignored
+ */
+static void check_modbus_send(const uint8_t* request, uint8_t len, bool corrupt)
+{
+
+    uint8_t frame[UINT8_MAX];
+
+    memcpy(frame, request, len);
+
+    uint16_t crc = check_crc_modbus(frame, len) ^ (corrupt ? 0x0100 : 0);
+    frame[len++] = crc & 0xFF;
+    frame[len++] = crc >> 8;
+
+    check_input(frame, len);
+
+    for (uint8_t i = 0; i < MODBUS_T35_TICKS; i++) {
+
+        uart_tick();
+
+    }
+
+    proto_handle();
+
+}
+
+/**
+ * @brief Sends a Modbus request and compares the response without its CRC
+ */
+static bool check_modbus(const uint8_t* request, uint8_t len, const uint8_t* expected, uint8_t expected_len)
+{
+
+    check_modbus_send(request, len, false);
+
+    size_t actual = check_output();
+    const uint8_t* response = (const uint8_t*)check_output_buffer;
+
+    if (actual != expected_len + 2u || check_crc_modbus(response, actual) != 0) {
+
+        return false;
+
+    }
+
+    return memcmp(response, expected, expected_len) == 0;
+
+}
+
+/**
+ * @brief Checks the CRC and function codes of Modbus RTU
+ */
+static void check_modbus_functions()
+{
+
+    prefs_get()->channels[0] = (channel_prefs_t){ true, 25, 35, 0x12345678 };
+    prefs_save();
+
+    CHECK_COMMAND("modbus", PROTO_OUTPUT_PREFIX PROTO_OUTPUT_OK PROTO_OUTPUT_EOL);
+    CHECK(modbus_is_enabled());
+
+    uint8_t read_input[] = { MODBUS_DEFAULT_ADDRESS, 0x04, 0x00, 0x00, 0x00, 0x02 };
+    uint8_t counts[] = { MODBUS_DEFAULT_ADDRESS, 0x04, 4, 0x12, 0x34, 0x56, 0x78 };
+    CHECK(check_modbus(read_input, sizeof(read_input), counts, sizeof(counts)));
+
+    uint8_t read_holding[] = { MODBUS_DEFAULT_ADDRESS, 0x03, 0x00, 0x00, 0x00, 0x03 };
+    uint8_t settings[] = { MODBUS_DEFAULT_ADDRESS, 0x03, 6, 0, 1, 0, 25, 0, 35 };
+    CHECK(check_modbus(read_holding, sizeof(read_holding), settings, sizeof(settings)));
+
+    // Minimum of channel 1, persisted
+    uint8_t write_single[] = { MODBUS_DEFAULT_ADDRESS, 0x06, 0x00, 0x04, 0x00, 22 };
+    CHECK(check_modbus(write_single, sizeof(write_single), write_single, sizeof(write_single)));
+    CHECK(prefs_get()->channels[1].min == 22);
+
+    // All settings of channel 1 and the first of channel 2
+    uint8_t write_multiple[] = { MODBUS_DEFAULT_ADDRESS, 0x10, 0x00, 0x03, 0x00, 0x04, 8, 0, 1, 0, 20, 0, 40, 0, 0 };
+    uint8_t written[] = { MODBUS_DEFAULT_ADDRESS, 0x10, 0x00, 0x03, 0x00, 0x04 };
+    CHECK(check_modbus(write_multiple, sizeof(write_multiple), written, sizeof(written)));
+
+    check_reboot();
+    CHECK(prefs_get()->channels[1].min == 20 && prefs_get()->channels[1].max == 40);
+    CHECK(!prefs_get()->channels[2].enabled);
+
+    uint8_t illegal_function[] = { MODBUS_DEFAULT_ADDRESS, 0x05, 0x00, 0x00, 0xFF, 0x00 };
+    uint8_t illegal_function_ex[] = { MODBUS_DEFAULT_ADDRESS, 0x85, 0x01 };
+    CHECK(check_modbus(illegal_function, sizeof(illegal_function), illegal_function_ex, sizeof(illegal_function_ex)));
+
+    uint8_t illegal_address[] = { MODBUS_DEFAULT_ADDRESS, 0x03, 0x00, CHANNELS * MODBUS_HOLDING_PER_CHANNEL, 0x00, 0x01 };
+    uint8_t illegal_address_ex[] = { MODBUS_DEFAULT_ADDRESS, 0x83, 0x02 };
+    CHECK(check_modbus(illegal_address, sizeof(illegal_address), illegal_address_ex, sizeof(illegal_address_ex)));
+
+    uint8_t illegal_value[] = { MODBUS_DEFAULT_ADDRESS, 0x06, 0x00, 0x00, 0x00, 0x02 };
+    uint8_t illegal_value_ex[] = { MODBUS_DEFAULT_ADDRESS, 0x86, 0x03 };
+    CHECK(check_modbus(illegal_value, sizeof(illegal_value), illegal_value_ex, sizeof(illegal_value_ex)));
+
+    // Frames with a wrong CRC or addressed to other units are ignored
+    uint8_t corrupted[] = { MODBUS_DEFAULT_ADDRESS, 0x06, 0x00, 0x01, 0x00, 30 };
+    check_modbus_send(corrupted, sizeof(corrupted), true);
+    CHECK(check_output() == 0 && prefs_get()->channels[0].min == 25);
+
+    uint8_t other[] = { MODBUS_DEFAULT_ADDRESS + 1, 0x06, 0x00, 0x01, 0x00, 30 };
+    check_modbus_send(other, sizeof(other), false);
+    CHECK(check_output() == 0 && prefs_get()->channels[0].min == 25);
+
+    // Broadcasts are applied without a response
+    uint8_t broadcast[] = { 0, 0x06, 0x00, 0x01, 0x00, 30 };
+    check_modbus_send(broadcast, sizeof(broadcast), false);
+    CHECK(check_output() == 0 && prefs_get()->channels[0].min == 30);
+
+    uint8_t text[] = { MODBUS_DEFAULT_ADDRESS, 0x06, MODBUS_REG_MODE >> 8, MODBUS_REG_MODE & 0xFF, 0x00, 0x00 };
+    CHECK(check_modbus(text, sizeof(text), text, sizeof(text)));
+    CHECK(!modbus_is_enabled());
+
+    CHECK_COMMAND("ping", PROTO_OUTPUT_PREFIX PROTO_OUTPUT_OK PROTO_OUTPUT_EOL);
+
+    check_reboot();
+    CHECK(!modbus_is_enabled());
+
+}
+
+#endif
+
+/**
+ * @brief Checks that the command tables are sorted for this configuration
+ *
+ * This complements tools/tables.c, which checks them with all switches
+ * enabled, and makes sure the tables actually dispatch as expected.
+ */
+static void check_command_tables()
+{
+
+    CHECK(proto_check_tables());
+    CHECK_COMMAND("ping", ">OK\r\n");
+    CHECK_COMMAND("channel 0 set enabled true", ">OK\r\n");
+    CHECK_COMMAND("channel 0 get enabled", ">ERR\r\n");
+    CHECK_COMMAND("pong", ">ERR\r\n");
+
+}
+
+/**
+ * @brief Checks that preferences of an unknown version are reset
+ */
+static void check_prefs_reset()
+{
+
+    prefs_t image;
+
+    memset(&image, 0xFF, sizeof(image));
+    image.version = VERSION + 1;
+    image.length = sizeof(prefs_t);
+    check_fram_write(0, &image, sizeof(image));
+
+    check_reboot();
+
+    for (uint8_t i = 0; i < CHANNELS; i++) {
+
+        CHECK(prefs_get()->channels[i].count == 0 && prefs_get()->channels[i].min == 25);
+
+    }
+
+    CHECK(prefs_get()->baud == UART_BAUD);
+
+}
+
+/**
+ * @brief Checks that preferences saved by a previous firmware are upgraded
+ *
+ * The oldest layout supported consists of the header and the channels. Any
+ * members appended since are expected to get their defaults, regardless of
+ * what is found beyond the end of the image in FRAM.
+ */
+static void check_prefs_upgrade()
+{
+
+    prefs_t image;
+
+    memset(&image, 0xFF, sizeof(image));
+    check_fram_write(0, &image, sizeof(image));
+
+    image.version = VERSION;
+    image.length = offsetof(prefs_t, address);
+
+    for (uint8_t i = 0; i < CHANNELS; i++) {
+
+        image.channels[i] = (channel_prefs_t){ i % 2, 20 + i, 40 + i, 1000 * i };
+
+    }
+
+    check_fram_write(0, &image, image.length);
+
+    check_reboot();
+
+    for (uint8_t i = 0; i < CHANNELS; i++) {
+
+        CHECK(memcmp(&prefs_get()->channels[i], &image.channels[i], sizeof(channel_prefs_t)) == 0);
+
+    }
+
+    CHECK(prefs_get()->length == sizeof(prefs_t));
+    CHECK(prefs_get()->address == 0);
+    CHECK(!prefs_get()->modbus);
+    CHECK(prefs_get()->baud == UART_BAUD);
+    CHECK(prefs_get_epoch() == 1);
+
+    // The upgraded image is persisted, so it loads as is
+    check_reboot();
+    CHECK(prefs_get()->length == sizeof(prefs_t));
+    CHECK(prefs_get()->channels[CHANNELS - 1].count == 1000 * (CHANNELS - 1));
+    CHECK(prefs_get()->baud == UART_BAUD);
+    CHECK(prefs_get_epoch() == 2);
+
+}
+
+/**
+ * @brief Checks setting a range of channels with a single command
+ */
+static void check_range_set()
+{
+
+    prefs_reset();
+
+    CHECK_COMMAND("channel 0-2 set min 20", PROTO_OUTPUT_PREFIX PROTO_OUTPUT_OK PROTO_OUTPUT_EOL);
+    CHECK_COMMAND("channel 1-2 set count 4294967295", PROTO_OUTPUT_PREFIX PROTO_OUTPUT_OK PROTO_OUTPUT_EOL);
+    CHECK_COMMAND("channel 3-3 set enabled false", PROTO_OUTPUT_PREFIX PROTO_OUTPUT_OK PROTO_OUTPUT_EOL);
+
+    CHECK_COMMAND("channel 2-1 set min 1", PROTO_OUTPUT_PREFIX PROTO_OUTPUT_ERROR PROTO_OUTPUT_EOL);
+    CHECK_COMMAND("channel 0-8 set min 1", PROTO_OUTPUT_PREFIX PROTO_OUTPUT_ERROR PROTO_OUTPUT_EOL);
+    CHECK_COMMAND("channel 0-1 set min 256", PROTO_OUTPUT_PREFIX PROTO_OUTPUT_ERROR PROTO_OUTPUT_EOL);
+    CHECK_COMMAND("channel 0-1 info", PROTO_OUTPUT_PREFIX PROTO_OUTPUT_ERROR PROTO_OUTPUT_EOL);
+
+    // Only the channels within the range are written, and persistently so
+    check_reboot();
+
+    for (uint8_t i = 0; i < CHANNELS; i++) {
+
+        channel_prefs_t* channel = &(prefs_get()->channels[i]);
+
+        CHECK(channel->min == (i <= 2 ? 20 : 25));
+        CHECK(channel->max == 35);
+        CHECK(channel->count == ((i == 1 || i == 2) ? UINT32_MAX : 0));
+        CHECK(channel->enabled == (i != 3));
+
+    }
+
+    CHECK_COMMAND("channel 2 info", PROTO_OUTPUT_PREFIX "enabled: true, min: 20, max: 35, count: 4294967295" PROTO_OUTPUT_EOL);
+
+}
+
+/**
+ * @brief Returns the number of channels listed by the output of `changes`
+ */
+static unsigned check_changes_listed()
+{
+
+    unsigned listed = 0;
+
+    for (const char* c = check_output_buffer; *c; c++) {
+
+        listed += (*c == ';');
+
+    }
+
+    return listed;
+
+}
+
+/**
+ * @brief Checks the channels reported by `changes` across saves and resets
+ */
+static void check_changes()
+{
+
+    unsigned long epoch;
+    unsigned long sequence;
+    unsigned long next;
+    char command[48];
+    char expected[48];
+
+    CHECK(sscanf(check_command("changes 0 0"), PROTO_OUTPUT_PREFIX "%lu %lu", &epoch, &sequence) == 2);
+    CHECK(epoch == prefs_get_epoch());
+    CHECK(check_changes_listed() == CHANNELS);
+
+    // Nothing has changed since
+    snprintf(command, sizeof(command), "changes %lu %lu", epoch, sequence);
+    snprintf(expected, sizeof(expected), PROTO_OUTPUT_PREFIX "%lu %lu" PROTO_OUTPUT_EOL, epoch, sequence);
+    CHECK_COMMAND(command, expected);
+
+    // Only the channels having changed are listed
+    CHECK_COMMAND("channel 4-5 set max 50", PROTO_OUTPUT_PREFIX PROTO_OUTPUT_OK PROTO_OUTPUT_EOL);
+    CHECK(sscanf(check_command(command), PROTO_OUTPUT_PREFIX "%*u %lu", &next) == 1);
+    CHECK(next > sequence);
+    CHECK(check_changes_listed() == 2);
+    CHECK(strstr(check_output_buffer, ";4 1 25 50 ") != NULL);
+    CHECK(strstr(check_output_buffer, ";5 1 25 50 ") != NULL);
+
+    // Sequences from the future or from another epoch list everything
+    snprintf(command, sizeof(command), "changes %lu %lu", epoch, next + 1);
+    check_command(command);
+    CHECK(check_changes_listed() == CHANNELS);
+
+    snprintf(command, sizeof(command), "changes %lu %lu", epoch + 1, next);
+    check_command(command);
+    CHECK(check_changes_listed() == CHANNELS);
+
+    // Sequences start over after a reset, but the epoch tells them apart
+    check_reboot();
+    CHECK(prefs_get_epoch() == epoch + 1);
+
+    snprintf(command, sizeof(command), "changes %lu %lu", epoch, next);
+    check_command(command);
+    CHECK(check_changes_listed() == CHANNELS);
+
+    CHECK_COMMAND("changes 0", PROTO_OUTPUT_PREFIX PROTO_OUTPUT_ERROR PROTO_OUTPUT_EOL);
+    CHECK_COMMAND("changes x 0", PROTO_OUTPUT_PREFIX PROTO_OUTPUT_ERROR PROTO_OUTPUT_EOL);
+
+}
+
+/**
+ * @brief Checks that confirmed baud rates are persisted for the default port
+ *
+ * Rates negotiated on another port must not be applied to the default port
+ * after the next reset, which is only covered with more than one port.
+ */
+static void check_baud()
+{
+
+    CHECK_COMMAND("baud 250000", PROTO_OUTPUT_PREFIX PROTO_OUTPUT_OK PROTO_OUTPUT_EOL);
+    CHECK_COMMAND("baud confirm", PROTO_OUTPUT_PREFIX PROTO_OUTPUT_OK PROTO_OUTPUT_EOL);
+    CHECK_COMMAND("baud confirm", PROTO_OUTPUT_PREFIX PROTO_OUTPUT_ERROR PROTO_OUTPUT_EOL);
+
+    check_reboot();
+    CHECK(prefs_get()->baud == 250000);
+
+    #if UART_PORTS > 1
+        uart_set_route(UART_STREAM_PROTO, 1);
+
+        CHECK_COMMAND("baud 500000", PROTO_OUTPUT_PREFIX PROTO_OUTPUT_OK PROTO_OUTPUT_EOL);
+        CHECK_COMMAND("baud confirm", PROTO_OUTPUT_PREFIX PROTO_OUTPUT_OK PROTO_OUTPUT_EOL);
+
+        uart_set_route(UART_STREAM_PROTO, UART_PORT_DEFAULT);
+
+        check_reboot();
+        CHECK(prefs_get()->baud == 250000);
+    #endif
+
+    char command[16];
+
+    snprintf(command, sizeof(command), "baud %lu", (unsigned long)UART_BAUD);
+    CHECK_COMMAND(command, PROTO_OUTPUT_PREFIX PROTO_OUTPUT_OK PROTO_OUTPUT_EOL);
+    CHECK_COMMAND("baud confirm", PROTO_OUTPUT_PREFIX PROTO_OUTPUT_OK PROTO_OUTPUT_EOL);
+    CHECK(prefs_get()->baud == UART_BAUD);
+
+}
+
+/**
+ * @brief Runs a single test and outputs its result
+ */
+static void check_run(const char* name, void (*test)())
+{
+
+    unsigned failures = check_failures;
+
+    test();
+
+    printf("%-24s %s\n", name, (check_failures == failures) ? "ok" : "FAILED");
+
+}
+
+int main(int argc, char* argv[])
+{
+
+    char path[] = "/tmp/check-XXXXXX";
+    int pipefd[2];
+
+    check_fram_fd = mkstemp(path);
+
+    if (check_fram_fd < 0 || !sim_fram_open(path)) {
+
+        perror("check: fram");
+        exit(EXIT_FAILURE);
+
+    }
+
+    unlink(path);
+
+    if (pipe2(pipefd, O_NONBLOCK) != 0) {
+
+        perror("check: pipe");
+        exit(EXIT_FAILURE);
+
+    }
+
+    check_output_fd = pipefd[0];
+
+    uart_init();
+    sim_uart_attach(pipefd[1]);
+
+    // Inputs are pulled up
+    PINB = 0xFF;
+    PINC = 0xFF;
+    PIND = 0xFF;
+
+    s0_init();
+    check_fram_locate();
+
+    // The upgrade expects the preferences not to have been loaded before
+    check_run("prefs reset", check_prefs_reset);
+    check_run("prefs upgrade", check_prefs_upgrade);
+    check_run("command tables", check_command_tables);
+    check_run("range set", check_range_set);
+    check_run("changes", check_changes);
+    check_run("baud", check_baud);
+
+    #if ENABLE_PUSH
+        check_run("push", check_push);
+    #endif
+
+    #if ENABLE_RS485
+        check_run("bus", check_bus);
+    #endif
+
+    #if ENABLE_SLEEP
+        check_run("sleep", check_sleep);
+    #endif
+
+    #if ENABLE_BINARY_PROTOCOL
+        check_run("binary framing", check_binary_framing);
+        check_run("restore", check_restore);
+    #endif
+
+    #if ENABLE_MODBUS
+        check_run("modbus functions", check_modbus_functions);
+    #endif
+
+    if (check_failures != 0) {
+
+        printf("\n%u check(s) failed\n", check_failures);
+
+        return EXIT_FAILURE;
+
+    }
+
+    return EXIT_SUCCESS;
+
+}
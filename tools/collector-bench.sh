@@ -0,0 +1,82 @@
+#!/bin/sh
+#
+# Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+#
+# This file is part of S0-counter.
+#
+# S0-counter is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# S0-counter is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+#
+#
+# Benchmarks the collector against simulated units. Each unit is a host
+# simulation replaying the same synthetic pulse train on a pty of its own,
+# sped up by SPEED. The collector ingests all of them for DURATION seconds
+# and outputs the number of events ingested per second. Afterwards queries
+# are benchmarked with `collector bench`.
+#
+# This is expected to be invoked via `make collector-bench` from the root
+# directory.
+
+set -e
+
+UNITS=${UNITS:-8}
+SPEED=${SPEED:-20}
+RATE=${RATE:-20}
+DURATION=${DURATION:-10}
+
+HOST_BINDIR=${HOST_BINDIR:-bin/host}
+TARGET=${TARGET:-s0-counter}
+
+dir=bin/collector-bench
+pids=
+
+cleanup() {
+
+    [ -z "$pids" ] || kill $pids 2>/dev/null || true
+
+}
+
+trap cleanup EXIT
+
+rm -rf "$dir"
+mkdir -p "$dir"
+
+# Pulses of RATE per second on each of the channels, for a whole hour
+"$HOST_BINDIR/replay" gen -r "$RATE" -d 3600 > "$dir/trace"
+
+links=
+
+for i in $(seq "$UNITS"); do
+
+    "$HOST_BINDIR/$TARGET" -s "$SPEED" -f "$dir/unit$i.fram" -p "$dir/trace" 2> "$dir/unit$i.log" &
+    pids="$pids $!"
+
+    # Wait for the pty to be announced
+    while ! grep -q 'uart on' "$dir/unit$i.log"; do
+
+        sleep 0.1
+
+    done
+
+    links="$links unit$i=$(sed -n 's/^sim: uart on //p' "$dir/unit$i.log")"
+
+done
+
+"$HOST_BINDIR/collector" run -D "$dir/data" -i 1 $links &
+collector=$!
+
+sleep "$DURATION"
+kill -INT "$collector"
+wait "$collector"
+
+"$HOST_BINDIR/collector" bench -D "$dir/data"
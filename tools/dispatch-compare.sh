@@ -0,0 +1,97 @@
+#!/bin/sh
+#
+# Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+#
+# This file is part of S0-counter.
+#
+# S0-counter is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# S0-counter is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+#
+# Compares the command dispatcher of two git revisions, BASE and REVISION, or
+# of BASE and the working tree if REVISION is not given. The firmware modules
+# of each revision are checked out into a temporary worktree and built along
+# with the simulation (host/) and the benchmark (tools/dispatch.c) of the
+# working tree, so that only the firmware differs. Both benchmarks are then run
+# alternately for ROUNDS rounds, with any arguments being passed on to them.
+#
+# This is expected to be invoked via `make dispatch-compare BASE=...` from the
+# root directory.
+
+set -e
+
+BASE=${BASE:?BASE needs to be set to a git revision}
+REVISION=${REVISION:-}
+ROUNDS=${ROUNDS:-3}
+HOST_BINDIR=${HOST_BINDIR:-bin/host}
+FEATURES=${FEATURES:-}
+
+dir=bin/dispatch-compare
+
+cleanup() {
+
+    for tree in "$dir"/*/; do
+
+        [ -d "$tree" ] && git worktree remove --force "$tree" 2>/dev/null || true
+
+    done
+
+}
+
+trap cleanup EXIT
+
+# Builds the benchmark against the firmware modules of the given revision
+build() {
+
+    tree=$dir/$2
+
+    git worktree add --detach "$tree" "$1" >/dev/null
+    cp -R host/. "$tree/host/"
+    cp tools/dispatch.c "$tree/tools/dispatch.c"
+
+    # Links the firmware modules the same way as the Makefile of the working
+    # tree does, which the revision might predate
+    cat > "$tree/dispatch.mk" <<'EOF'
+$(HOST_BINDIR)/dispatch-compare: tools/dispatch.c $(filter-out %/main.o %/sim/sim.o,$(HOST_OBJECTS))
+	$(HOST_CC) $(HOST_CFLAGS) -o $@ $^
+EOF
+
+    make -s -C "$tree" -f Makefile -f dispatch.mk FEATURES="$FEATURES" bin/host/dispatch-compare >/dev/null
+    cp "$tree/bin/host/dispatch-compare" "$dir/dispatch-$2"
+
+}
+
+cleanup
+rm -rf "$dir"
+mkdir -p "$dir"
+
+build "$BASE" base
+
+if [ -n "$REVISION" ]; then
+
+    build "$REVISION" revision
+
+else
+
+    REVISION="working tree"
+    cp "$HOST_BINDIR/dispatch" "$dir/dispatch-revision"
+
+fi
+
+for round in $(seq "$ROUNDS"); do
+
+    echo "# round $round: $BASE"
+    "$dir/dispatch-base" "$@"
+    echo "# round $round: $REVISION"
+    "$dir/dispatch-revision" "$@"
+
+done
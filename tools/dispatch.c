@@ -0,0 +1,301 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file dispatch.c
+ * @brief Benchmark of the command dispatcher of the text protocol
+ *
+ * This is linked against the firmware modules of the host build (see
+ * `doc/HOST.md`), but not against the simulation itself: Commands are handed
+ * over to the UART directly and proto_handle() is invoked once per command,
+ * so neither the pty nor the simulated time are involved. Output is dropped.
+ *
+ * Each command of the mix is run a number of times, and the time needed by
+ * proto_handle() is measured for each run. This covers tokenizing, looking up
+ * the command and its sub-commands, parsing the arguments and the command
+ * itself, including its (dropped) output. Commands not available within the
+ * configuration built are answered with an error, which still measures the
+ * lookup.
+ *
+ * Results are given in nanoseconds of the host, so they are only meaningful
+ * relative to each other, e.g. before and after changing the dispatcher (see
+ * tools/dispatch-compare.sh).
+ *
+ * Afterwards the high-water mark of the scratch arena (see scratch.h) is
+ * output. Unlike the stack, the arena is laid out the same on the host as on
+ * the MCU, so this is meaningful for sizing SCRATCH_SIZE. With `-l` all log
+ * messages are formatted, as if logging was enabled at the highest level, so
+ * messages logged while a command is being processed are accounted for.
+ */
+
+#define _GNU_SOURCE
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <avr/io.h>
+
+#include "log.h"
+#include "prefs.h"
+#include "proto.h"
+#include "scratch.h"
+#include "sim.h"
+#include "uart.h"
+
+/**
+ * @brief Commands being measured by default
+ *
+ * This covers commands at the beginning and the end of the command table,
+ * sub-commands, arguments being parsed and a command that doesn't exist.
+ */
+static const char* const dispatch_mix[] = {
+
+    "address",
+    "baud",
+    "changes 0 0",
+    "channel 0 info",
+    "channel 0-2 set min 25",
+    "flow",
+    "info",
+    "ping",
+    "power",
+    "push interval",
+    "route log",
+    "stats",
+    "unknown",
+
+};
+
+volatile uint8_t sim_io[SIM_IO_SIZE];
+
+/**
+ * @brief Simulated time, which doesn't advance
+ */
+uint32_t sim_get_time()
+{
+
+    return 0;
+
+}
+
+/**
+ * @brief Invoked by the UART without any input left, nothing to do
+ */
+void sim_idle()
+{
+
+}
+
+void sim_sleep()
+{
+
+}
+
+static uint64_t dispatch_now_ns()
+{
+
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+
+}
+
+static int dispatch_compare(const void* a, const void* b)
+{
+
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+
+    return (x > y) - (x < y);
+
+}
+
+/**
+ * @brief Runs a single command and returns the time needed in nanoseconds
+ */
+static uint32_t dispatch_run(const char* command)
+{
+
+    for (const char* c = command; *c; c++) {
+
+        sim_uart_receive(*c);
+
+    }
+
+    sim_uart_receive('\r');
+
+    uint64_t start = dispatch_now_ns();
+
+    proto_handle();
+
+    return dispatch_now_ns() - start;
+
+}
+
+static void dispatch_usage()
+{
+
+    fprintf(stderr,
+        "Usage: dispatch [-l] [-n N] [COMMAND]...\n"
+        "\n"
+        "  -l    format all log messages at the highest level\n"
+        "  -n N  number of runs of each command (default: 100000)\n");
+
+    exit(EXIT_FAILURE);
+
+}
+
+int main(int argc, char* argv[])
+{
+
+    unsigned long runs = 100000;
+    bool logging = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "ln:")) != -1) {
+
+        switch (opt) {
+
+            case 'l':
+                logging = true;
+                break;
+
+            case 'n':
+                runs = strtoul(optarg, NULL, 10);
+                break;
+
+            default:
+                dispatch_usage();
+
+        }
+
+    }
+
+    if (runs == 0) {
+
+        dispatch_usage();
+
+    }
+
+    const char* const* commands = dispatch_mix;
+    size_t count = sizeof(dispatch_mix) / sizeof(dispatch_mix[0]);
+
+    if (optind < argc) {
+
+        commands = (const char* const*)&argv[optind];
+        count = argc - optind;
+
+    }
+
+    char path[] = "/tmp/dispatch-XXXXXX";
+    int fd = mkstemp(path);
+
+    if (fd < 0 || !sim_fram_open(path)) {
+
+        perror("dispatch: fram");
+        exit(EXIT_FAILURE);
+
+    }
+
+    close(fd);
+    unlink(path);
+
+    uart_init();
+
+    if (logging) {
+
+        for (log_module_t module = 0; module < LOG_MODULE_COUNT; module++) {
+
+            log_set_level(module, LOG_LEVEL_ALL);
+
+        }
+
+        log_enable();
+
+    }
+
+    prefs_init();
+
+    uint32_t* samples = malloc(runs * sizeof(uint32_t));
+
+    if (!samples) {
+
+        perror("dispatch");
+        exit(EXIT_FAILURE);
+
+    }
+
+    printf("%-24s %10s %10s %10s %10s\n", "command", "per second", "mean ns", "p99 ns", "max ns");
+
+    uint64_t total = 0;
+    uint32_t worst = 0;
+
+    for (size_t i = 0; i < count; i++) {
+
+        uint64_t sum = 0;
+
+        // Warm up caches and branch predictors
+        for (unsigned j = 0; j < 100; j++) {
+
+            dispatch_run(commands[i]);
+
+        }
+
+        for (unsigned long j = 0; j < runs; j++) {
+
+            samples[j] = dispatch_run(commands[i]);
+            sum += samples[j];
+
+        }
+
+        qsort(samples, runs, sizeof(uint32_t), dispatch_compare);
+
+        uint32_t p99 = samples[(runs - 1) * 99 / 100];
+
+        printf("%-24s %10.0f %10.0f %10u %10u\n", commands[i], runs * 1e9 / sum,
+            (double)sum / runs, p99, samples[runs - 1]);
+
+        total += sum;
+
+        if (p99 > worst) {
+
+            worst = p99;
+
+        }
+
+    }
+
+    printf("%-24s %10.0f %10.0f %10u\n", "total", count * runs * 1e9 / total,
+        (double)total / (count * runs), worst);
+
+    printf("\nscratch: %u/%u bytes, overuse: %u\n", scratch_get_high(), SCRATCH_SIZE, scratch_get_overuse());
+
+    free(samples);
+
+    return EXIT_SUCCESS;
+
+}
@@ -0,0 +1,1255 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file fram.c
+ * @brief Dumps, restores and decodes the FRAM image of a unit
+ *
+ * The image is transferred via the binary protocol (see
+ * `doc/BINARY_PROTOCOL.md`), which is entered with the `binary` command of the
+ * text protocol and left again once done. It is split into chunks of
+ * {@link #FRAM_CHUNK_SIZE} bytes, each of which is a request of its own
+ * protected by the CRC of its frame. Multiple requests are kept in flight, so
+ * the link is kept busy in both directions. Requests not being responded to
+ * within the timeout are sent again.
+ *
+ * The size of the image is not known in advance: Reading stops at the first
+ * chunk returned short. Counts might change while the image is being read, so
+ * it is read until two consecutive passes are identical.
+ *
+ * Restoring writes all of the chunks starting at a given offset, so an
+ * interrupted restore can be resumed, and is finished by a commit carrying
+ * the length and CRC of the whole image. The unit stages the chunks apart
+ * from the image in use and verifies them against it before loading them.
+ *
+ * Decoding interprets the image using the layout of prefs_t. The layout is
+ * chosen by the ELF file of the firmware the image belongs to, i.e. the AVR
+ * (the default) or the host simulation, and the symbols within its FRAM
+ * section tell which range of the image belongs to which variable.
+ */
+
+#define _GNU_SOURCE
+
+#include <elf.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fram_layout.h"
+#include "prefs.h"
+
+/**
+ * @brief Number of bytes of the image per request
+ *
+ * This corresponds to BINARY_FRAM_CHUNK_SIZE of the firmware.
+ */
+#define FRAM_CHUNK_SIZE 16
+
+/**
+ * @brief Maximum size of an image
+ */
+#define FRAM_IMAGE_MAX 4096
+
+/**
+ * @brief Maximum size of a decoded frame, i.e. BINARY_FRAME_MAX_SIZE
+ */
+#define FRAM_FRAME_MAX 24
+
+/**
+ * @brief Maximum number of encoded bytes of requests in flight
+ *
+ * This needs to stay below the size of the receive buffer of the unit
+ * (UART_BUFFER_SIZE_IN), as flow control is disabled in binary mode.
+ */
+#define FRAM_WINDOW 48
+
+/**
+ * @brief Number of times a request is sent again before giving up
+ */
+#define FRAM_RETRIES 5
+
+/**
+ * @brief Maximum number of read passes until two of them need to match
+ */
+#define FRAM_PASSES 5
+
+/**
+ * @brief Commands of the binary protocol, see binary_cmd_t
+ */
+#define FRAM_CMD_TEXT 0x06
+#define FRAM_CMD_READ 0x07
+#define FRAM_CMD_WRITE 0x08
+#define FRAM_CMD_COMMIT 0x09
+
+/**
+ * @brief Status codes of the binary protocol, see binary_status_t
+ */
+#define FRAM_STATUS_OK 0x00
+#define FRAM_STATUS_INVALID_ARGUMENT 0x02
+
+/**
+ * @brief Maximum number of jobs, i.e. one per chunk of the largest image
+ */
+#define FRAM_JOBS_MAX (FRAM_IMAGE_MAX / FRAM_CHUNK_SIZE + 1)
+
+/**
+ * @brief States of a job
+ */
+typedef enum {
+
+    FRAM_JOB_PENDING = 0,
+    FRAM_JOB_FLIGHT,
+    FRAM_JOB_DONE,
+
+} fram_job_state_t;
+
+/**
+ * @brief A single request along with its state
+ *
+ * The payload is derived from the command: Reads and writes cover `len` bytes
+ * of fram_image starting at `offset`, commits cover all of it.
+ */
+typedef struct {
+
+    uint8_t cmd;
+    uint16_t offset;
+    uint8_t len;
+
+    fram_job_state_t state;
+    unsigned retries;
+    uint8_t id;
+    size_t encoded;
+    uint64_t sent;
+
+} fram_job_t;
+
+/**
+ * @brief Layout of the host simulation, which is the one of this tool
+ */
+static const fram_layout_t fram_layout_host = {
+
+    "host",
+    sizeof(prefs_t),
+    offsetof(prefs_t, length), sizeof(size_t),
+    offsetof(prefs_t, channels), sizeof(channel_prefs_t),
+    offsetof(channel_prefs_t, enabled),
+    offsetof(channel_prefs_t, min),
+    offsetof(channel_prefs_t, max),
+    offsetof(channel_prefs_t, count),
+    offsetof(prefs_t, address),
+    offsetof(prefs_t, modbus),
+    offsetof(prefs_t, baud),
+    offsetof(prefs_t, epoch),
+
+};
+
+/**
+ * @brief Image being dumped or restored
+ */
+static uint8_t fram_image[FRAM_IMAGE_MAX];
+
+/**
+ * @brief Size of fram_image, as far as known
+ */
+static size_t fram_size;
+
+static fram_job_t fram_jobs[FRAM_JOBS_MAX];
+static size_t fram_job_count;
+
+/**
+ * @brief Jobs in flight indexed by the id of their request
+ */
+static fram_job_t* fram_flights[256];
+
+/**
+ * @brief Id of the next request
+ */
+static uint8_t fram_id;
+
+static uint64_t fram_timeout = 500000;
+
+/**
+ * @brief Device of a unit that has been switched to the binary protocol
+ *
+ * @see fram_fail()
+ */
+static int fram_device = -1;
+
+static bool fram_run_single(int fd, uint8_t cmd);
+
+/**
+ * @brief Outputs an error and exits, switching the unit back to text first
+ */
+static void fram_fail(const char* msg, const char* arg)
+{
+
+    fprintf(stderr, "fram: %s%s%s\n", msg, arg ? ": " : "", arg ? arg : "");
+
+    if (fram_device >= 0) {
+
+        int fd = fram_device;
+
+        fram_device = -1;
+        fram_run_single(fd, FRAM_CMD_TEXT);
+
+    }
+
+    exit(EXIT_FAILURE);
+
+}
+
+static uint64_t fram_now_us()
+{
+
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+
+}
+
+/**
+ * @brief CRC-16/CCITT-FALSE as used by the binary protocol
+ *
+ * @param crc CRC so far, 0xFFFF initially
+ */
+static uint16_t fram_crc(uint16_t crc, const uint8_t* data, size_t len)
+{
+
+    while (len--) {
+
+        crc ^= (uint16_t)*data++ << 8;
+
+        for (uint8_t i = 0; i < 8; i++) {
+
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+
+        }
+
+    }
+
+    return crc;
+
+}
+
+/**
+ * @brief Opens the device, configuring it as raw serial line if applicable
+ */
+static int fram_open(const char* path, unsigned long baud)
+{
+
+    int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+    if (fd < 0) {
+
+        fram_fail("unable to open device", path);
+
+    }
+
+    struct termios tio;
+
+    if (tcgetattr(fd, &tio) == 0) {
+
+        cfmakeraw(&tio);
+
+        if (cfsetspeed(&tio, baud) != 0) {
+
+            fram_fail("unsupported baud rate", NULL);
+
+        }
+
+        tcsetattr(fd, TCSANOW, &tio);
+        tcflush(fd, TCIOFLUSH);
+
+    }
+
+    return fd;
+
+}
+
+static void fram_write_all(int fd, const void* data, size_t len)
+{
+
+    while (len > 0) {
+
+        ssize_t result = write(fd, data, len);
+
+        if (result < 0) {
+
+            struct pollfd pfd = { fd, POLLOUT, 0 };
+
+            poll(&pfd, 1, 100);
+
+            continue;
+
+        }
+
+        data = (const uint8_t*)data + result;
+        len -= result;
+
+    }
+
+}
+
+/**
+ * @brief Switches the unit over to the binary protocol
+ *
+ * A unit that doesn't respond might still be in binary mode, e.g. after an
+ * earlier run has been interrupted, so this is not considered an error. The
+ * frame delimiter sent afterwards discards whatever the unit has received.
+ */
+static void fram_binary(int fd)
+{
+
+    const char command[] = "\rbinary\r";
+    char line[64];
+    size_t len = 0;
+
+    fram_write_all(fd, command, sizeof(command) - 1);
+
+    uint64_t end = fram_now_us() + fram_timeout;
+
+    while (fram_now_us() < end) {
+
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        char c;
+
+        if (poll(&pfd, 1, 10) <= 0 || read(fd, &c, 1) != 1) {
+
+            continue;
+
+        }
+
+        if (c != '\r' && c != '\n') {
+
+            if (len < sizeof(line) - 1) {
+
+                line[len++] = c;
+
+            }
+
+            continue;
+
+        }
+
+        line[len] = '\0';
+        len = 0;
+
+        if (strcmp(line, ">OK") == 0) {
+
+            // Skip the LF of the response
+            usleep(10000);
+            tcflush(fd, TCIFLUSH);
+
+            break;
+
+        }
+
+    }
+
+    const uint8_t delimiter = 0;
+
+    fram_write_all(fd, &delimiter, 1);
+
+    fram_device = fd;
+
+}
+
+/**
+ * @brief Assembles, encodes and sends the request of a job
+ */
+static void fram_send(int fd, fram_job_t* job)
+{
+
+    uint8_t frame[FRAM_FRAME_MAX];
+    size_t len = 0;
+
+    job->id = fram_id++;
+
+    frame[len++] = job->cmd;
+    frame[len++] = job->id;
+
+    switch (job->cmd) {
+
+        case FRAM_CMD_READ:
+            frame[len++] = job->offset & 0xFF;
+            frame[len++] = job->offset >> 8;
+            frame[len++] = job->len;
+            break;
+
+        case FRAM_CMD_WRITE:
+            frame[len++] = job->offset & 0xFF;
+            frame[len++] = job->offset >> 8;
+            memcpy(&frame[len], &fram_image[job->offset], job->len);
+            len += job->len;
+            break;
+
+        case FRAM_CMD_COMMIT: {
+
+            uint16_t crc = fram_crc(0xFFFF, fram_image, fram_size);
+
+            frame[len++] = fram_size & 0xFF;
+            frame[len++] = fram_size >> 8;
+            frame[len++] = crc & 0xFF;
+            frame[len++] = crc >> 8;
+            break;
+
+        }
+
+    }
+
+    uint16_t crc = fram_crc(0xFFFF, frame, len);
+
+    frame[len++] = crc & 0xFF;
+    frame[len++] = crc >> 8;
+
+    // COBS, frames are well below the maximum block length of 254 bytes
+    uint8_t encoded[FRAM_FRAME_MAX + 2];
+    size_t code = 0;
+    size_t out = 1;
+
+    for (size_t i = 0; i < len; i++) {
+
+        if (frame[i] == 0) {
+
+            encoded[code] = out - code;
+            code = out++;
+
+        } else {
+
+            encoded[out++] = frame[i];
+
+        }
+
+    }
+
+    encoded[code] = out - code;
+    encoded[out++] = 0;
+
+    fram_write_all(fd, encoded, out);
+
+    job->state = FRAM_JOB_FLIGHT;
+    job->encoded = out;
+    job->sent = fram_now_us();
+
+    fram_flights[job->id] = job;
+
+}
+
+/**
+ * @brief Handles a decoded frame with a valid CRC
+ */
+static void fram_receive(const uint8_t* frame, size_t len)
+{
+
+    fram_job_t* job = fram_flights[frame[1]];
+
+    // Responses to requests that have been sent again in the meantime
+    if (job == NULL || job->state != FRAM_JOB_FLIGHT || job->cmd != frame[0]) {
+
+        return;
+
+    }
+
+    fram_flights[frame[1]] = NULL;
+
+    const uint8_t* payload = &frame[3];
+    uint8_t status = frame[2];
+
+    len -= 3;
+
+    if (job->cmd == FRAM_CMD_READ) {
+
+        // A short response marks the end of the image, chunks beyond it are
+        // either returned empty or rejected
+        if (status == FRAM_STATUS_OK && len <= job->len) {
+
+            memcpy(&fram_image[job->offset], payload, len);
+
+            if (len < job->len && job->offset + len < fram_size) {
+
+                fram_size = job->offset + len;
+
+            }
+
+        } else if (status == FRAM_STATUS_INVALID_ARGUMENT) {
+
+            if (job->offset < fram_size) {
+
+                fram_size = job->offset;
+
+            }
+
+        } else {
+
+            fram_fail("unexpected response to read", NULL);
+
+        }
+
+    } else if (status != FRAM_STATUS_OK) {
+
+        fram_fail(job->cmd == FRAM_CMD_COMMIT ? "image rejected by unit" : "request rejected by unit", NULL);
+
+    }
+
+    job->state = FRAM_JOB_DONE;
+
+}
+
+/**
+ * @brief Appends a decoded byte to the frame, flagging it if too long
+ */
+static void fram_append(uint8_t* frame, size_t* index, bool* invalid, uint8_t c)
+{
+
+    if (*index < FRAM_FRAME_MAX) {
+
+        frame[(*index)++] = c;
+
+    } else {
+
+        *invalid = true;
+
+    }
+
+}
+
+/**
+ * @brief Decodes incoming data and handles complete frames
+ *
+ * This decodes COBS the same way binary_handle() does.
+ */
+static void fram_input(const uint8_t* data, size_t len)
+{
+
+    static uint8_t frame[FRAM_FRAME_MAX];
+    static size_t index;
+    static uint8_t remaining;
+    static uint8_t code;
+    static bool invalid;
+
+    for (size_t i = 0; i < len; i++) {
+
+        if (data[i] == 0) {
+
+            if (!invalid && remaining == 0 && index >= 3 + 2) {
+
+                uint16_t crc = frame[index - 2] | (frame[index - 1] << 8);
+
+                if (crc == fram_crc(0xFFFF, frame, index - 2)) {
+
+                    fram_receive(frame, index - 2);
+
+                }
+
+            }
+
+            index = 0;
+            remaining = 0;
+            code = 0;
+            invalid = false;
+
+        } else if (remaining == 0) {
+
+            // Blocks shorter than 254 bytes imply a zero byte in between
+            if (code != 0 && code != 0xFF) {
+
+                fram_append(frame, &index, &invalid, 0);
+
+            }
+
+            code = data[i];
+            remaining = code - 1;
+
+        } else {
+
+            fram_append(frame, &index, &invalid, data[i]);
+            remaining--;
+
+        }
+
+    }
+
+}
+
+/**
+ * @brief Runs the given jobs until all of them are done
+ *
+ * Reads of chunks beyond the end of the image, as soon as it is known, are
+ * done without being sent.
+ *
+ * @return True if all of the jobs are done, false if the unit has stopped
+ * responding
+ */
+static bool fram_run(int fd, fram_job_t* jobs, size_t count)
+{
+
+    while (true) {
+
+        uint64_t now = fram_now_us();
+        size_t window = 0;
+        bool done = true;
+
+        for (size_t i = 0; i < count; i++) {
+
+            fram_job_t* job = &jobs[i];
+
+            if (job->cmd == FRAM_CMD_READ && job->offset >= fram_size) {
+
+                job->state = FRAM_JOB_DONE;
+
+            }
+
+            if (job->state == FRAM_JOB_FLIGHT && now - job->sent > fram_timeout) {
+
+                if (++job->retries > FRAM_RETRIES) {
+
+                    return false;
+
+                }
+
+                fram_flights[job->id] = NULL;
+                job->state = FRAM_JOB_PENDING;
+
+            }
+
+            if (job->state == FRAM_JOB_FLIGHT) {
+
+                window += job->encoded;
+
+            }
+
+            if (job->state != FRAM_JOB_DONE) {
+
+                done = false;
+
+            }
+
+        }
+
+        if (done) {
+
+            return true;
+
+        }
+
+        for (size_t i = 0; i < count; i++) {
+
+            fram_job_t* job = &jobs[i];
+
+            // Worst case of header, CRC, COBS overhead and data to be written
+            size_t encoded = 10 + (job->cmd == FRAM_CMD_WRITE ? job->len : 0);
+
+            if (job->state != FRAM_JOB_PENDING) {
+
+                continue;
+
+            }
+
+            if (window > 0 && window + encoded > FRAM_WINDOW) {
+
+                break;
+
+            }
+
+            fram_send(fd, job);
+            window += job->encoded;
+
+        }
+
+        struct pollfd pfd = { fd, POLLIN, 0 };
+
+        if (poll(&pfd, 1, 10) > 0) {
+
+            uint8_t buffer[256];
+            ssize_t result = read(fd, buffer, sizeof(buffer));
+
+            if (result > 0) {
+
+                fram_input(buffer, result);
+
+            }
+
+        }
+
+    }
+
+}
+
+/**
+ * @brief Runs a single job with the given command
+ */
+static bool fram_run_single(int fd, uint8_t cmd)
+{
+
+    fram_job_t job = { .cmd = cmd };
+
+    return fram_run(fd, &job, 1);
+
+}
+
+/**
+ * @brief Sets up jobs for chunks of fram_image starting at the given offset
+ */
+static void fram_jobs_setup(uint8_t cmd, size_t offset, size_t end)
+{
+
+    fram_job_count = 0;
+
+    for (; offset < end; offset += FRAM_CHUNK_SIZE) {
+
+        fram_job_t* job = &fram_jobs[fram_job_count++];
+
+        memset(job, 0, sizeof(*job));
+
+        job->cmd = cmd;
+        job->offset = offset;
+        job->len = (end - offset < FRAM_CHUNK_SIZE) ? end - offset : FRAM_CHUNK_SIZE;
+
+    }
+
+}
+
+/**
+ * @brief Returns the offset of the first chunk that has not been done
+ */
+static size_t fram_jobs_resume()
+{
+
+    for (size_t i = 0; i < fram_job_count; i++) {
+
+        if (fram_jobs[i].state != FRAM_JOB_DONE) {
+
+            return fram_jobs[i].offset;
+
+        }
+
+    }
+
+    return fram_size;
+
+}
+
+/**
+ * @brief Reads the image until two consecutive passes are identical
+ */
+static void fram_dump(int fd, const char* path)
+{
+
+    static uint8_t previous[FRAM_IMAGE_MAX];
+    size_t previous_size = 0;
+    uint64_t start = fram_now_us();
+
+    for (unsigned pass = 1; pass <= FRAM_PASSES; pass++) {
+
+        fram_size = FRAM_IMAGE_MAX;
+        fram_jobs_setup(FRAM_CMD_READ, 0, FRAM_IMAGE_MAX);
+
+        if (!fram_run(fd, fram_jobs, fram_job_count)) {
+
+            fram_fail("no response from unit", NULL);
+
+        }
+
+        if (pass > 1 && fram_size == previous_size && memcmp(fram_image, previous, fram_size) == 0) {
+
+            FILE* file = fopen(path, "wb");
+
+            if (file == NULL || fwrite(fram_image, 1, fram_size, file) != fram_size || fclose(file) != 0) {
+
+                fram_fail("unable to write image", path);
+
+            }
+
+            fprintf(stderr, "fram: read %zu bytes in %u passes within %.0f ms\n", fram_size, pass, (fram_now_us() - start) / 1000.0);
+
+            return;
+
+        }
+
+        memcpy(previous, fram_image, fram_size);
+        previous_size = fram_size;
+
+    }
+
+    fram_fail("image keeps changing while being read", NULL);
+
+}
+
+/**
+ * @brief Writes the image starting at the given offset and commits it
+ */
+static void fram_restore(int fd, const char* path, size_t offset)
+{
+
+    FILE* file = fopen(path, "rb");
+
+    if (file == NULL) {
+
+        fram_fail("unable to open image", path);
+
+    }
+
+    fram_size = fread(fram_image, 1, sizeof(fram_image), file);
+
+    if (fram_size == 0 || fram_size > UINT16_MAX || !feof(file) || offset >= fram_size) {
+
+        fram_fail("invalid image or offset", path);
+
+    }
+
+    fclose(file);
+
+    uint64_t start = fram_now_us();
+
+    fram_jobs_setup(FRAM_CMD_WRITE, offset, fram_size);
+
+    if (!fram_run(fd, fram_jobs, fram_job_count)) {
+
+        char resume[64];
+
+        snprintf(resume, sizeof(resume), "resume with -o %zu", fram_jobs_resume());
+        fram_fail("no response from unit", resume);
+
+    }
+
+    if (!fram_run_single(fd, FRAM_CMD_COMMIT)) {
+
+        fram_fail("no response from unit to commit", NULL);
+
+    }
+
+    fprintf(stderr, "fram: wrote %zu bytes and committed within %.0f ms\n", fram_size - offset, (fram_now_us() - start) / 1000.0);
+
+}
+
+/**
+ * @brief A variable within the FRAM section of an ELF file
+ */
+typedef struct {
+
+    char name[64];
+    size_t offset;
+    size_t size;
+
+} fram_symbol_t;
+
+/**
+ * @brief Maximum number of variables within the FRAM section
+ */
+#define FRAM_SYMBOLS_MAX 32
+
+/**
+ * @brief Reads the symbols within the FRAM section of an ELF file
+ *
+ * The section is called `.fram` on the AVR and `fram` on the host. Offsets
+ * are relative to the start of the section, i.e. addresses within the image.
+ *
+ * @return Number of symbols found, the layout is chosen by the architecture
+ */
+static size_t fram_symbols(const char* path, fram_symbol_t* symbols, const fram_layout_t** layout)
+{
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+
+    if (fd < 0 || fstat(fd, &st) != 0) {
+
+        fram_fail("unable to open ELF file", path);
+
+    }
+
+    const uint8_t* elf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    close(fd);
+
+    if (elf == MAP_FAILED || st.st_size < (off_t)sizeof(Elf64_Ehdr) || memcmp(elf, ELFMAG, SELFMAG) != 0 || elf[EI_DATA] != ELFDATA2LSB) {
+
+        fram_fail("not a little endian ELF file", path);
+
+    }
+
+    // Both classes are converted to 64 bit, which holds all of the values
+    bool is64 = elf[EI_CLASS] == ELFCLASS64;
+    Elf64_Ehdr ehdr;
+
+    if (is64) {
+
+        ehdr = *(const Elf64_Ehdr*)elf;
+
+    } else {
+
+        const Elf32_Ehdr* e = (const Elf32_Ehdr*)elf;
+
+        ehdr.e_machine = e->e_machine;
+        ehdr.e_shoff = e->e_shoff;
+        ehdr.e_shnum = e->e_shnum;
+        ehdr.e_shstrndx = e->e_shstrndx;
+
+    }
+
+    Elf64_Shdr shdrs[ehdr.e_shnum];
+
+    for (size_t i = 0; i < ehdr.e_shnum; i++) {
+
+        if (is64) {
+
+            shdrs[i] = ((const Elf64_Shdr*)(elf + ehdr.e_shoff))[i];
+
+        } else {
+
+            const Elf32_Shdr* s = &((const Elf32_Shdr*)(elf + ehdr.e_shoff))[i];
+
+            shdrs[i].sh_name = s->sh_name;
+            shdrs[i].sh_type = s->sh_type;
+            shdrs[i].sh_addr = s->sh_addr;
+            shdrs[i].sh_offset = s->sh_offset;
+            shdrs[i].sh_size = s->sh_size;
+            shdrs[i].sh_link = s->sh_link;
+
+        }
+
+    }
+
+    const char* shstrtab = (const char*)elf + shdrs[ehdr.e_shstrndx].sh_offset;
+    size_t fram = 0;
+
+    for (size_t i = 1; i < ehdr.e_shnum; i++) {
+
+        const char* name = shstrtab + shdrs[i].sh_name;
+
+        if (strcmp(name, ".fram") == 0 || strcmp(name, "fram") == 0) {
+
+            fram = i;
+
+        }
+
+    }
+
+    if (fram == 0) {
+
+        fram_fail("no FRAM section", path);
+
+    }
+
+    *layout = ehdr.e_machine == EM_AVR ? &fram_layout_avr : &fram_layout_host;
+
+    size_t count = 0;
+
+    for (size_t i = 1; i < ehdr.e_shnum; i++) {
+
+        if (shdrs[i].sh_type != SHT_SYMTAB) {
+
+            continue;
+
+        }
+
+        const char* strtab = (const char*)elf + shdrs[shdrs[i].sh_link].sh_offset;
+        size_t entsize = is64 ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym);
+
+        for (size_t j = 0; j < shdrs[i].sh_size / entsize; j++) {
+
+            const uint8_t* sym = elf + shdrs[i].sh_offset + j * entsize;
+            Elf64_Sym s;
+
+            if (is64) {
+
+                s = *(const Elf64_Sym*)sym;
+
+            } else {
+
+                const Elf32_Sym* s32 = (const Elf32_Sym*)sym;
+
+                s.st_name = s32->st_name;
+                s.st_info = s32->st_info;
+                s.st_shndx = s32->st_shndx;
+                s.st_value = s32->st_value;
+                s.st_size = s32->st_size;
+
+            }
+
+            if (s.st_shndx != fram || ELF64_ST_TYPE(s.st_info) != STT_OBJECT || count == FRAM_SYMBOLS_MAX) {
+
+                continue;
+
+            }
+
+            snprintf(symbols[count].name, sizeof(symbols[count].name), "%s", strtab + s.st_name);
+            symbols[count].offset = s.st_value - shdrs[fram].sh_addr;
+            symbols[count].size = s.st_size;
+            count++;
+
+        }
+
+    }
+
+    return count;
+
+}
+
+/**
+ * @brief Returns a little endian value of the given size from the image
+ */
+static uint64_t fram_get(const uint8_t* image, size_t offset, size_t size)
+{
+
+    uint64_t value = 0;
+
+    while (size--) {
+
+        value = (value << 8) | image[offset + size];
+
+    }
+
+    return value;
+
+}
+
+/**
+ * @brief Outputs the preferences contained within the image
+ *
+ * Members beyond the image or the length stored within it are missing, e.g.
+ * when the image has been written by an older firmware.
+ */
+static void fram_decode(const uint8_t* image, size_t size, const fram_layout_t* layout)
+{
+
+    printf("layout: %s, %zu bytes\n", layout->name, layout->size);
+
+    if (size < layout->channels + CHANNELS * layout->channel_size) {
+
+        fram_fail("image too short for layout", layout->name);
+
+    }
+
+    size_t length = fram_get(image, layout->length, layout->length_size);
+
+    printf("version: %u\n", image[0]);
+    printf("length: %zu\n", length);
+
+    if (image[0] != VERSION || length != layout->size) {
+
+        printf("warning: expected version %u and length %zu\n", VERSION, layout->size);
+
+    }
+
+    if (length < size) {
+
+        size = length;
+
+    }
+
+    for (uint8_t i = 0; i < CHANNELS; i++) {
+
+        const uint8_t* channel = &image[layout->channels + i * layout->channel_size];
+
+        printf("channel %u: enabled: %s, min: %u, max: %u, count: %lu\n", i,
+            channel[layout->enabled] ? "true" : "false",
+            channel[layout->min], channel[layout->max],
+            (unsigned long)fram_get(channel, layout->count, 4));
+
+    }
+
+    if (layout->address < size) {
+
+        printf("address: %u\n", image[layout->address]);
+
+    }
+
+    if (layout->modbus < size) {
+
+        printf("modbus: %s\n", image[layout->modbus] ? "true" : "false");
+
+    }
+
+    if (layout->baud + 4 <= size) {
+
+        printf("baud: %lu\n", (unsigned long)fram_get(image, layout->baud, 4));
+
+    }
+
+    if (layout->epoch + 4 <= size) {
+
+        printf("epoch: %lu\n", (unsigned long)fram_get(image, layout->epoch, 4));
+
+    }
+
+}
+
+static void fram_usage()
+{
+
+    fprintf(stderr,
+        "Usage: fram dump [-b BAUD] [-t MS] DEVICE IMAGE\n"
+        "       fram restore [-b BAUD] [-t MS] [-o OFFSET] DEVICE IMAGE\n"
+        "       fram decode [-e ELF] IMAGE\n"
+        "\n"
+        "  -b BAUD    baud rate of serial devices (default: 38400)\n"
+        "  -t MS      time after which requests are sent again (default: 500)\n"
+        "  -o OFFSET  offset to resume an interrupted restore at (default: 0)\n"
+        "  -e ELF     firmware the image belongs to (default: AVR layout)\n");
+
+    exit(EXIT_FAILURE);
+
+}
+
+int main(int argc, char* argv[])
+{
+
+    unsigned long baud = 38400;
+    size_t offset = 0;
+    const char* elf = NULL;
+    int opt;
+
+    if (argc < 2) {
+
+        fram_usage();
+
+    }
+
+    const char* mode = argv[1];
+
+    optind = 2;
+
+    while ((opt = getopt(argc, argv, "b:t:o:e:")) != -1) {
+
+        switch (opt) {
+
+            case 'b':
+                baud = strtoul(optarg, NULL, 10);
+                break;
+
+            case 't':
+                fram_timeout = strtoull(optarg, NULL, 10) * 1000;
+                break;
+
+            case 'o':
+                offset = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'e':
+                elf = optarg;
+                break;
+
+            default:
+                fram_usage();
+
+        }
+
+    }
+
+    if ((strcmp(mode, "dump") == 0 || strcmp(mode, "restore") == 0) && optind == argc - 2) {
+
+        int fd = fram_open(argv[optind], baud);
+
+        fram_binary(fd);
+
+        if (strcmp(mode, "dump") == 0) {
+
+            fram_dump(fd, argv[optind + 1]);
+
+        } else {
+
+            fram_restore(fd, argv[optind + 1], offset);
+
+        }
+
+        fram_device = -1;
+
+        if (!fram_run_single(fd, FRAM_CMD_TEXT)) {
+
+            fram_fail("unable to switch back to the text protocol", NULL);
+
+        }
+
+        return EXIT_SUCCESS;
+
+    }
+
+    if (strcmp(mode, "decode") == 0 && optind == argc - 1) {
+
+        FILE* file = fopen(argv[optind], "rb");
+
+        if (file == NULL) {
+
+            fram_fail("unable to open image", argv[optind]);
+
+        }
+
+        fram_size = fread(fram_image, 1, sizeof(fram_image), file);
+        fclose(file);
+
+        const fram_layout_t* layout = &fram_layout_avr;
+
+        if (elf == NULL) {
+
+            fram_decode(fram_image, fram_size, layout);
+
+            return EXIT_SUCCESS;
+
+        }
+
+        fram_symbol_t symbols[FRAM_SYMBOLS_MAX];
+        size_t count = fram_symbols(elf, symbols, &layout);
+
+        for (size_t i = 0; i < count; i++) {
+
+            printf("%s: offset: %zu, size: %zu\n", symbols[i].name, symbols[i].offset, symbols[i].size);
+
+            // Other variables, e.g. the staging area of restores, aren't decoded
+            if (strcmp(symbols[i].name, "prefs_fram") == 0) {
+
+                if (symbols[i].offset + symbols[i].size > fram_size) {
+
+                    fram_fail("image too short for symbol", symbols[i].name);
+
+                }
+
+                if (symbols[i].size != layout->size) {
+
+                    fram_fail("size of prefs_t differs from layout", layout->name);
+
+                }
+
+                fram_decode(&fram_image[symbols[i].offset], symbols[i].size, layout);
+
+            }
+
+        }
+
+        return EXIT_SUCCESS;
+
+    }
+
+    fram_usage();
+
+}
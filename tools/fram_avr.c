@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file fram_avr.c
+ * @brief Layout of prefs_t on the AVR, derived from prefs.h
+ *
+ * The AVR has a 16 bit size_t and aligns nothing, so prefs.h is compiled
+ * once more with size_t replaced and structures packed. This keeps the layout
+ * in sync with prefs_t whenever a member is appended, rather than relying on
+ * a copy of its offsets. This is a translation unit of its own, as prefs.h
+ * can only be included once.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "fram_layout.h"
+
+#define size_t uint16_t
+#pragma pack(push, 1)
+
+#include "prefs.h"
+
+#pragma pack(pop)
+#undef size_t
+
+_Static_assert(sizeof(bool) == 1, "bool needs to be a single byte as on the AVR");
+
+const fram_layout_t fram_layout_avr = {
+
+    "avr",
+    sizeof(prefs_t),
+    offsetof(prefs_t, length), sizeof(((prefs_t*)0)->length),
+    offsetof(prefs_t, channels), sizeof(channel_prefs_t),
+    offsetof(channel_prefs_t, enabled),
+    offsetof(channel_prefs_t, min),
+    offsetof(channel_prefs_t, max),
+    offsetof(channel_prefs_t, count),
+    offsetof(prefs_t, address),
+    offsetof(prefs_t, modbus),
+    offsetof(prefs_t, baud),
+    offsetof(prefs_t, epoch),
+
+};
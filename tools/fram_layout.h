@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file fram_layout.h
+ * @brief Layouts of prefs_t as used by tools/fram.c
+ *
+ * The layout of the host is the one the tool is compiled with. The layout of
+ * the AVR is derived from prefs.h by fram_avr.c, see there.
+ */
+
+#ifndef _FRAM_LAYOUT_H_
+#define _FRAM_LAYOUT_H_
+
+#include <stddef.h>
+
+/**
+ * @brief Layout of prefs_t on a particular platform
+ *
+ * Offsets of the members of each channel are relative to the channel.
+ */
+typedef struct {
+
+    const char* name;
+    size_t size;
+    size_t length;
+    size_t length_size;
+    size_t channels;
+    size_t channel_size;
+    size_t enabled;
+    size_t min;
+    size_t max;
+    size_t count;
+    size_t address;
+    size_t modbus;
+    size_t baud;
+    size_t epoch;
+
+} fram_layout_t;
+
+extern const fram_layout_t fram_layout_avr;
+
+#endif /* _FRAM_LAYOUT_H_ */
@@ -0,0 +1,573 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file load.c
+ * @brief Load generator measuring the throughput and latency of commands
+ *
+ * This connects to the UART of a unit, either a real serial device or the pty
+ * of the host simulation, and sends a weighted random mix of commands. Each
+ * command is tagged with a sequence number (see `doc/UART_PROTOCOL.md`), so
+ * responses can be matched even with multiple commands in flight. Anything
+ * not being a response, e.g. log messages, is ignored.
+ *
+ * Commands are either sent closed-loop, i.e. keeping a fixed number of
+ * commands in flight, or open-loop at a fixed rate regardless of responses.
+ * The latter reveals what happens once the unit can't keep up anymore.
+ *
+ * Latencies are measured from writing the EOL of a command until the EOL of
+ * its response has been read. Commands without a response within the timeout
+ * are considered lost.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "proto.h"
+
+/**
+ * @brief Maximum number of commands within a mix
+ */
+#define LOAD_COMMANDS_MAX 16
+
+/**
+ * @brief Maximum number of commands in flight, needs to be a power of two
+ */
+#define LOAD_FLIGHT_MAX 256
+
+/**
+ * @brief Maximum length of a line of output
+ */
+#define LOAD_LINE_MAX 256
+
+/**
+ * @brief A command of the mix along with its statistics
+ */
+typedef struct {
+
+    const char* command;
+    unsigned weight;
+
+    unsigned long sent;
+    unsigned long errors;
+    unsigned long lost;
+
+    // Latencies of all responses in microseconds
+    uint32_t* latencies;
+    size_t count;
+
+} load_command_t;
+
+/**
+ * @brief A command that has been sent, but not yet been responded to
+ */
+typedef struct {
+
+    load_command_t* command;
+    uint32_t sequence;
+    uint64_t sent;
+    bool valid;
+
+} load_flight_t;
+
+/**
+ * @brief Mix used unless given otherwise
+ *
+ * Only commands available within the host build are used, so that the mix
+ * is answered without errors by the simulation, too.
+ */
+static const char* const load_mix_default[] = {
+
+    "4:ping",
+    "4:channel 0 info",
+    "1:channel 1 set min 25",
+    "1:stats",
+
+};
+
+static load_command_t load_commands[LOAD_COMMANDS_MAX];
+static uint8_t load_command_count;
+static unsigned load_weights;
+
+static load_flight_t load_flights[LOAD_FLIGHT_MAX];
+static unsigned load_in_flight;
+
+/**
+ * @brief Sequence number of the next command, used as its tag
+ */
+static uint32_t load_sequence;
+
+static void load_fail(const char* msg, const char* arg)
+{
+
+    fprintf(stderr, "load: %s%s%s\n", msg, arg ? ": " : "", arg ? arg : "");
+    exit(EXIT_FAILURE);
+
+}
+
+static uint64_t load_now_us()
+{
+
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+
+}
+
+/**
+ * @brief Adds a command to the mix given as `WEIGHT:COMMAND`
+ */
+static void load_command_add(const char* arg)
+{
+
+    char* command;
+    unsigned long weight = strtoul(arg, &command, 10);
+
+    if (*command != ':' || weight == 0 || load_command_count == LOAD_COMMANDS_MAX) {
+
+        load_fail("invalid command", arg);
+
+    }
+
+    load_commands[load_command_count++] = (load_command_t){ .command = command + 1, .weight = weight };
+    load_weights += weight;
+
+}
+
+static load_command_t* load_command_pick()
+{
+
+    unsigned pick = rand() % load_weights;
+
+    for (uint8_t i = 0; i < load_command_count; i++) {
+
+        if (pick < load_commands[i].weight) {
+
+            return &load_commands[i];
+
+        }
+
+        pick -= load_commands[i].weight;
+
+    }
+
+    return &load_commands[0];
+
+}
+
+static void load_record(load_command_t* command, uint32_t latency)
+{
+
+    if (command->count % 1024 == 0) {
+
+        command->latencies = realloc(command->latencies, (command->count + 1024) * sizeof(uint32_t));
+
+        if (!command->latencies) {
+
+            load_fail("out of memory", NULL);
+
+        }
+
+    }
+
+    command->latencies[command->count++] = latency;
+
+}
+
+/**
+ * @brief Opens the device, configuring it as raw serial line if applicable
+ */
+static int load_open(const char* path, unsigned long baud)
+{
+
+    int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+    if (fd < 0) {
+
+        load_fail("unable to open device", path);
+
+    }
+
+    struct termios tio;
+
+    if (tcgetattr(fd, &tio) == 0) {
+
+        cfmakeraw(&tio);
+
+        if (cfsetspeed(&tio, baud) != 0) {
+
+            load_fail("unsupported baud rate", NULL);
+
+        }
+
+        tcsetattr(fd, TCSANOW, &tio);
+        tcflush(fd, TCIOFLUSH);
+
+    }
+
+    return fd;
+
+}
+
+static void load_send(int fd)
+{
+
+    load_command_t* command = load_command_pick();
+    load_flight_t* flight = &load_flights[load_sequence % LOAD_FLIGHT_MAX];
+    char line[LOAD_LINE_MAX];
+    int len = snprintf(line, sizeof(line), "#%u %s\r", load_sequence, command->command);
+
+    // The slot of a command this old is reused, it is considered lost
+    if (flight->valid) {
+
+        flight->command->lost++;
+        load_in_flight--;
+
+    }
+
+    for (int written = 0; written < len; ) {
+
+        ssize_t result = write(fd, line + written, len - written);
+
+        if (result < 0 && errno != EAGAIN && errno != EINTR) {
+
+            load_fail("unable to write", strerror(errno));
+
+        }
+
+        if (result > 0) {
+
+            written += result;
+
+        }
+
+    }
+
+    flight->command = command;
+    flight->sequence = load_sequence;
+    flight->sent = load_now_us();
+    flight->valid = true;
+
+    command->sent++;
+    load_in_flight++;
+    load_sequence++;
+
+}
+
+/**
+ * @brief Matches a line of output against the commands in flight
+ */
+static void load_receive(const char* line, uint64_t now)
+{
+
+    unsigned long tag;
+    int offset;
+
+    if (sscanf(line, PROTO_OUTPUT_PREFIX "#%lu %n", &tag, &offset) != 1) {
+
+        return;
+
+    }
+
+    load_flight_t* flight = &load_flights[tag % LOAD_FLIGHT_MAX];
+
+    // Responses to commands already considered lost are ignored
+    if (!flight->valid || flight->sequence != tag) {
+
+        return;
+
+    }
+
+    if (strcmp(line + offset, PROTO_OUTPUT_ERROR) == 0) {
+
+        flight->command->errors++;
+
+    } else {
+
+        load_record(flight->command, now - flight->sent);
+
+    }
+
+    flight->valid = false;
+    load_in_flight--;
+
+}
+
+/**
+ * @brief Considers commands lost that have not been responded to in time
+ */
+static void load_expire(uint64_t now, uint64_t timeout)
+{
+
+    for (unsigned i = 0; i < LOAD_FLIGHT_MAX; i++) {
+
+        load_flight_t* flight = &load_flights[i];
+
+        if (flight->valid && now - flight->sent > timeout) {
+
+            flight->command->lost++;
+            flight->valid = false;
+            load_in_flight--;
+
+        }
+
+    }
+
+}
+
+static int load_compare(const void* a, const void* b)
+{
+
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+
+    return (x > y) - (x < y);
+
+}
+
+static double load_percentile(const load_command_t* command, unsigned percent)
+{
+
+    if (command->count == 0) {
+
+        return 0;
+
+    }
+
+    size_t index = (command->count * percent + 99) / 100;
+
+    return command->latencies[index > 0 ? index - 1 : 0] / 1000.0;
+
+}
+
+static void load_report_line(const char* name, const load_command_t* command)
+{
+
+    printf("| %-24s | %6lu | %6zu | %6lu | %6lu | %8.2f | %8.2f | %8.2f |\n", name,
+        command->sent, command->count, command->errors, command->lost,
+        load_percentile(command, 50), load_percentile(command, 99), load_percentile(command, 100));
+
+}
+
+static void load_report(double elapsed)
+{
+
+    load_command_t total = { 0 };
+
+    printf("| %-24s | %6s | %6s | %6s | %6s | %8s | %8s | %8s |\n", "Command", "Sent", "OK", "Errors", "Lost", "p50 ms", "p99 ms", "max ms");
+    printf("|--------------------------|--------|--------|--------|--------|----------|----------|----------|\n");
+
+    for (uint8_t i = 0; i < load_command_count; i++) {
+
+        load_command_t* command = &load_commands[i];
+
+        qsort(command->latencies, command->count, sizeof(uint32_t), load_compare);
+        load_report_line(command->command, command);
+
+        total.sent += command->sent;
+        total.errors += command->errors;
+        total.lost += command->lost;
+
+        for (size_t j = 0; j < command->count; j++) {
+
+            load_record(&total, command->latencies[j]);
+
+        }
+
+    }
+
+    qsort(total.latencies, total.count, sizeof(uint32_t), load_compare);
+    load_report_line("Total", &total);
+
+    printf("\nthroughput %.1f responses/s over %.1f s\n", (total.count + total.errors) / elapsed, elapsed);
+
+}
+
+static void load_usage()
+{
+
+    fprintf(stderr,
+        "Usage: load [-b BAUD] [-r RATE | -n N] [-d S] [-t MS] [-s SEED] [-c WEIGHT:COMMAND]... DEVICE\n"
+        "\n"
+        "  -b BAUD            baud rate of serial devices (default: 38400)\n"
+        "  -r RATE            send commands open-loop at the given rate per second\n"
+        "  -n N               keep N commands in flight (default: 1)\n"
+        "  -d S               duration of the run (default: 10)\n"
+        "  -t MS              time after which commands are lost (default: 1000)\n"
+        "  -s SEED            seed of the random numbers (default: 1)\n"
+        "  -c WEIGHT:COMMAND  command of the mix along with its weight\n");
+
+    exit(EXIT_FAILURE);
+
+}
+
+int main(int argc, char* argv[])
+{
+
+    unsigned long baud = 38400;
+    double rate = 0;
+    unsigned window = 1;
+    double duration = 10;
+    uint64_t timeout = 1000000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:r:n:d:t:s:c:")) != -1) {
+
+        switch (opt) {
+
+            case 'b':
+                baud = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'r':
+                rate = atof(optarg);
+                break;
+
+            case 'n':
+                window = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'd':
+                duration = atof(optarg);
+                break;
+
+            case 't':
+                timeout = strtoull(optarg, NULL, 10) * 1000;
+                break;
+
+            case 's':
+                srand(strtoul(optarg, NULL, 10));
+                break;
+
+            case 'c':
+                load_command_add(optarg);
+                break;
+
+            default:
+                load_usage();
+
+        }
+
+    }
+
+    if (optind != argc - 1 || window == 0 || window > LOAD_FLIGHT_MAX || rate < 0 || duration <= 0) {
+
+        load_usage();
+
+    }
+
+    if (load_command_count == 0) {
+
+        for (uint8_t i = 0; i < sizeof(load_mix_default) / sizeof(load_mix_default[0]); i++) {
+
+            load_command_add(load_mix_default[i]);
+
+        }
+
+    }
+
+    int fd = load_open(argv[optind], baud);
+
+    char line[LOAD_LINE_MAX];
+    size_t len = 0;
+
+    uint64_t start = load_now_us();
+    uint64_t end = start + duration * 1000000;
+    uint64_t next = start;
+    uint64_t now = start;
+
+    // Keep going after the last command until all responses are in
+    while (now < end || (load_in_flight > 0 && now < end + timeout)) {
+
+        if (now < end) {
+
+            if (rate > 0) {
+
+                while (next <= now) {
+
+                    load_send(fd);
+                    next += 1000000 / rate;
+
+                }
+
+            } else {
+
+                while (load_in_flight < window) {
+
+                    load_send(fd);
+
+                }
+
+            }
+
+        }
+
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        int wait = rate > 0 && next > now ? (next - now + 999) / 1000 : 10;
+
+        if (poll(&pfd, 1, wait) > 0) {
+
+            char buffer[LOAD_LINE_MAX];
+            ssize_t result = read(fd, buffer, sizeof(buffer));
+
+            now = load_now_us();
+
+            for (ssize_t i = 0; i < result; i++) {
+
+                if (buffer[i] == '\n' || buffer[i] == '\r') {
+
+                    line[len] = '\0';
+                    load_receive(line, now);
+                    len = 0;
+
+                } else if (len < sizeof(line) - 1) {
+
+                    line[len++] = buffer[i];
+
+                }
+
+            }
+
+        }
+
+        now = load_now_us();
+        load_expire(now, timeout);
+
+    }
+
+    load_report((now - start) / 1e6);
+
+    return EXIT_SUCCESS;
+
+}
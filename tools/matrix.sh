@@ -0,0 +1,94 @@
+#!/bin/sh
+#
+# Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+#
+# This file is part of S0-counter.
+#
+# S0-counter is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# S0-counter is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+#
+# Builds the firmware for the main combinations of the switches within
+# src/config.h and outputs a table of the flash and RAM used by each of them,
+# along with an estimate of the time spent in the startup code before main().
+#
+# The estimate accounts for copying .data (9 cycles per byte), clearing .bss
+# (5 cycles per byte) and, if ENABLE_MEMCHECK is set, painting the unused SRAM
+# (6 cycles per byte). Everything else done before main() takes constant time.
+#
+# This is expected to be invoked via `make matrix` from the root directory.
+
+set -e
+
+MCU=${MCU:-atmega328p}
+F_CPU=${F_CPU:-8000000}
+TARGET=${TARGET:-s0-counter}
+SIZE=${SIZE:-avr-size}
+NM=${NM:-avr-nm}
+
+# Size of the SRAM of the ATmega328P
+RAM_SIZE=${RAM_SIZE:-2048}
+
+# Diagnostics only, everything needed in production stays enabled
+LEAN="-DENABLE_MEMCHECK=0 -DENABLE_LOGGING=0 -DENABLE_STATS=0 -DENABLE_PROFILING=0"
+
+# Name and switches of each combination, separated by a colon
+CONFIGS="
+default:
+full:-DENABLE_PROFILING=1
+no-memcheck:-DENABLE_MEMCHECK=0
+no-logging:-DENABLE_LOGGING=0
+no-stats:-DENABLE_STATS=0
+no-sleep:-DENABLE_SLEEP=0
+lean:$LEAN
+minimal:$LEAN -DENABLE_BINARY_PROTOCOL=0 -DENABLE_PUSH=0
+"
+
+section() {
+
+    $SIZE -A "$1" | awk -v name="$2" '$1 == name { size = $2 } END { print size + 0 }'
+
+}
+
+printf '| %-12s | %6s | %6s | %8s |\n' "Config" "Flash" "RAM" "Boot"
+printf '|--------------|--------|--------|----------|\n'
+
+echo "$CONFIGS" | while IFS=: read -r name features; do
+
+    [ -n "$name" ] || continue
+
+    dir=bin/matrix/$name
+    mkdir -p "$dir"
+
+    make -s BINDIR="$dir" DEPDIR="$dir" FEATURES="$features" "$dir/$TARGET.elf" >/dev/null
+
+    elf=$dir/$TARGET.elf
+    text=$(section "$elf" .text)
+    data=$(section "$elf" .data)
+    bss=$(section "$elf" .bss)
+    noinit=$(section "$elf" .noinit)
+
+    flash=$((text + data))
+    ram=$((data + bss + noinit))
+    cycles=$((data * 9 + bss * 5))
+
+    if $NM "$elf" | grep -q ' mem_init$'; then
+
+        cycles=$((cycles + (RAM_SIZE - ram) * 6))
+
+    fi
+
+    boot=$((cycles * 1000000 / F_CPU))
+
+    printf '| %-12s | %6u | %6u | %5u us |\n' "$name" "$flash" "$ram" "$boot"
+
+done
@@ -0,0 +1,796 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file replay.c
+ * @brief Replays pulse trains through the host simulation
+ *
+ * Traces are scripts of the host simulation (see `doc/HOST.md`), which carry
+ * the pulses that have actually been emitted by the meter as comments:
+ *
+ *     # pulse C0 1500.000 1530.000
+ *
+ * These give the pin along with the beginning and end of the pulse in
+ * milliseconds. Traces captured from real meters need to be labeled this way
+ * in order to be evaluated, synthetic traces are labeled by the generator.
+ *
+ * The generator models the signal of each channel continuously and samples it
+ * once per millisecond, just like s0_poll() does. Pulses can have their width
+ * and spacing jittered, contacts can bounce after each edge, and the rate can
+ * be ramped linearly over the duration of the trace.
+ *
+ * Each impulse the firmware reports (via the log output of the S0 module) is
+ * matched against the pulses of its channel: It needs to be reported within
+ * {@link #REPLAY_WINDOW} milliseconds after the end of a pulse. Pulses not
+ * being reported are missed, reports without a matching pulse are false
+ * positives.
+ *
+ * The capacity is determined by bisecting the rate of synthetic traces until
+ * the highest rate without any missed pulses or false positives is found.
+ */
+
+#define _GNU_SOURCE
+
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/**
+ * @brief Number of channels connected to a pin, see s0.c
+ */
+#define REPLAY_CHANNELS 3
+
+/**
+ * @brief Time within which a pulse needs to be reported after its end
+ */
+#define REPLAY_WINDOW 10
+
+/**
+ * @brief Time before the first pulse, so the firmware can start up
+ */
+#define REPLAY_LEAD 1000
+
+/**
+ * @brief Time after the last pulse, so the firmware can report it
+ */
+#define REPLAY_TRAIL 1000
+
+/**
+ * @brief Minimum gap between two pulses, they would merge otherwise
+ */
+#define REPLAY_GAP 0.5
+
+/**
+ * @brief Number of iterations when bisecting the capacity
+ */
+#define REPLAY_BISECTIONS 10
+
+/**
+ * @brief Default path of the host simulation
+ */
+#define REPLAY_SIM_DEFAULT "bin/host/s0-counter"
+
+/**
+ * @brief Maximum number of commands sent before replaying
+ */
+#define REPLAY_COMMANDS_MAX 16
+
+/**
+ * @brief Pins of the channels, indexed by channel
+ */
+static const char* const replay_pins[REPLAY_CHANNELS] = {
+
+    "C0",
+    "C1",
+    "D2",
+
+};
+
+/**
+ * @brief A single pulse emitted by a meter, times in milliseconds
+ */
+typedef struct {
+
+    uint8_t channel;
+    double start;
+    double end;
+
+} replay_pulse_t;
+
+/**
+ * @brief Parameters of synthetic traces
+ */
+typedef struct {
+
+    // Number of channels driven, starting at channel 0
+    uint8_t channels;
+
+    // Pulses per second and channel at the beginning and end of the trace
+    double rate;
+    double rate_end;
+
+    // Width of pulses in milliseconds
+    double width;
+
+    // Maximum deviation of width and spacing in milliseconds
+    double jitter;
+
+    // Time contacts bounce after each edge in milliseconds
+    double bounce;
+
+    // Duration of the trace in milliseconds
+    uint32_t duration;
+
+    unsigned seed;
+
+} replay_gen_t;
+
+/**
+ * @brief Outcome of a replay per channel
+ */
+typedef struct {
+
+    unsigned long pulses;
+    unsigned long detected;
+    unsigned long missed;
+    unsigned long false_positives;
+
+} replay_result_t;
+
+/**
+ * @brief Pulses of the trace being replayed, sorted by their end
+ */
+static replay_pulse_t* replay_pulses;
+static size_t replay_pulse_count;
+
+static const char* replay_sim = REPLAY_SIM_DEFAULT;
+
+static const char* replay_commands[REPLAY_COMMANDS_MAX];
+static uint8_t replay_command_count;
+
+static void replay_fail(const char* msg, const char* arg)
+{
+
+    fprintf(stderr, "replay: %s%s%s\n", msg, arg ? ": " : "", arg ? arg : "");
+    exit(EXIT_FAILURE);
+
+}
+
+/**
+ * @brief Returns a uniformly distributed random number within [-1, 1]
+ */
+static double replay_random()
+{
+
+    return 2.0 * rand() / RAND_MAX - 1.0;
+
+}
+
+static void replay_pulse_add(uint8_t channel, double start, double end)
+{
+
+    if (replay_pulse_count % 1024 == 0) {
+
+        replay_pulses = realloc(replay_pulses, (replay_pulse_count + 1024) * sizeof(replay_pulse_t));
+
+        if (!replay_pulses) {
+
+            replay_fail("out of memory", NULL);
+
+        }
+
+    }
+
+    replay_pulses[replay_pulse_count++] = (replay_pulse_t){ channel, start, end };
+
+}
+
+static int replay_pulse_compare(const void* a, const void* b)
+{
+
+    double d = ((const replay_pulse_t*)a)->end - ((const replay_pulse_t*)b)->end;
+
+    return (d > 0) - (d < 0);
+
+}
+
+/**
+ * @brief Generates the pulses of a synthetic trace
+ *
+ * Pulses of each channel start at a random phase, so channels don't switch
+ * simultaneously.
+ */
+static void replay_gen_pulses(const replay_gen_t* gen)
+{
+
+    replay_pulse_count = 0;
+
+    for (uint8_t ch = 0; ch < gen->channels; ch++) {
+
+        double t = REPLAY_LEAD + (replay_random() + 1) / 2 * 1000 / gen->rate;
+        double last_end = 0;
+
+        while (true) {
+
+            double rate = gen->rate + (gen->rate_end - gen->rate) * t / gen->duration;
+            double width = fmax(gen->width + gen->jitter * replay_random(), 1);
+
+            t = fmax(t, last_end + REPLAY_GAP);
+
+            if (t + width + REPLAY_TRAIL > gen->duration) {
+
+                break;
+
+            }
+
+            replay_pulse_add(ch, t, t + width);
+            last_end = t + width;
+
+            t += 1000 / rate + gen->jitter * replay_random();
+
+        }
+
+    }
+
+    qsort(replay_pulses, replay_pulse_count, sizeof(replay_pulse_t), replay_pulse_compare);
+
+}
+
+/**
+ * @brief Returns the level of a channel sampled at the given time
+ *
+ * @param pulse Pulse of the channel ending last before or at time, if any
+ * @param next Next pulse of the channel, if any
+ */
+static bool replay_gen_level(const replay_gen_t* gen, const replay_pulse_t* pulse, const replay_pulse_t* next, double time)
+{
+
+    if (next && time >= next->start) {
+
+        return time < next->start + gen->bounce ? rand() & 1 : false;
+
+    }
+
+    if (pulse && time < pulse->end + gen->bounce) {
+
+        return rand() & 1;
+
+    }
+
+    return true;
+
+}
+
+/**
+ * @brief Writes a synthetic trace, labeled with its pulses
+ */
+static void replay_gen_write(const replay_gen_t* gen, FILE* out)
+{
+
+    srand(gen->seed);
+
+    replay_gen_pulses(gen);
+
+    fprintf(out, "# channels %u, rate %g-%g/s, width %g ms, jitter %g ms, bounce %g ms, seed %u\n",
+        gen->channels, gen->rate, gen->rate_end, gen->width, gen->jitter, gen->bounce, gen->seed);
+
+    // Index of the next pulse of each channel within replay_pulses
+    size_t next[REPLAY_CHANNELS];
+    size_t last[REPLAY_CHANNELS];
+    bool level[REPLAY_CHANNELS];
+    size_t labeled = 0;
+
+    for (uint8_t ch = 0; ch < REPLAY_CHANNELS; ch++) {
+
+        next[ch] = 0;
+        last[ch] = SIZE_MAX;
+        level[ch] = true;
+
+        while (next[ch] < replay_pulse_count && replay_pulses[next[ch]].channel != ch) {
+
+            next[ch]++;
+
+        }
+
+    }
+
+    for (uint32_t time = 0; time < gen->duration; time++) {
+
+        for (uint8_t ch = 0; ch < gen->channels; ch++) {
+
+            const replay_pulse_t* pulse = next[ch] < replay_pulse_count ? &replay_pulses[next[ch]] : NULL;
+
+            // Move on once the current pulse is over, including its bounce
+            if (pulse && time >= pulse->end) {
+
+                last[ch] = next[ch];
+
+                do {
+
+                    next[ch]++;
+
+                } while (next[ch] < replay_pulse_count && replay_pulses[next[ch]].channel != ch);
+
+                pulse = next[ch] < replay_pulse_count ? &replay_pulses[next[ch]] : NULL;
+
+            }
+
+            const replay_pulse_t* previous = last[ch] != SIZE_MAX ? &replay_pulses[last[ch]] : NULL;
+            bool sample = replay_gen_level(gen, previous, pulse, time);
+
+            if (sample != level[ch]) {
+
+                fprintf(out, "%u %s %u\n", time, replay_pins[ch], sample);
+                level[ch] = sample;
+
+            }
+
+        }
+
+        while (labeled < replay_pulse_count && replay_pulses[labeled].end <= time) {
+
+            const replay_pulse_t* pulse = &replay_pulses[labeled++];
+
+            fprintf(out, "# pulse %s %.3f %.3f\n", replay_pins[pulse->channel], pulse->start, pulse->end);
+
+        }
+
+    }
+
+}
+
+/**
+ * @brief Loads the pulses a trace is labeled with
+ *
+ * @return Time of the last change of the input pins
+ */
+static uint32_t replay_load(const char* path)
+{
+
+    FILE* trace = fopen(path, "r");
+
+    if (!trace) {
+
+        replay_fail("unable to open trace", path);
+
+    }
+
+    char line[128];
+    unsigned long last = 0;
+
+    replay_pulse_count = 0;
+
+    while (fgets(line, sizeof(line), trace)) {
+
+        char pin[3];
+        double start;
+        double end;
+        unsigned long time;
+
+        if (sscanf(line, "# pulse %2s %lf %lf", pin, &start, &end) == 3) {
+
+            uint8_t ch = 0;
+
+            while (ch < REPLAY_CHANNELS && strcmp(pin, replay_pins[ch]) != 0) {
+
+                ch++;
+
+            }
+
+            if (ch == REPLAY_CHANNELS) {
+
+                replay_fail("pin not connected to any channel", line);
+
+            }
+
+            replay_pulse_add(ch, start, end);
+
+        } else if (sscanf(line, "%lu", &time) == 1) {
+
+            last = time;
+
+        }
+
+    }
+
+    fclose(trace);
+
+    qsort(replay_pulses, replay_pulse_count, sizeof(replay_pulse_t), replay_pulse_compare);
+
+    return last;
+
+}
+
+/**
+ * @brief Runs the simulation on the given trace and evaluates its output
+ *
+ * @return True if no pulse has been missed and no false positive occurred
+ */
+static bool replay_run(const char* trace, uint32_t end, replay_result_t results[REPLAY_CHANNELS])
+{
+
+    char fram[] = "/tmp/replay-XXXXXX";
+    int fd = mkstemp(fram);
+
+    if (fd < 0) {
+
+        replay_fail("unable to create FRAM", fram);
+
+    }
+
+    close(fd);
+
+    int in[2];
+    int out[2];
+
+    if (pipe(in) != 0 || pipe(out) != 0) {
+
+        replay_fail("unable to create pipes", NULL);
+
+    }
+
+    // Commands are queued up before the simulation starts, so they are
+    // processed before the first pulse
+    for (uint8_t i = 0; i < replay_command_count; i++) {
+
+        dprintf(in[1], "%s\r", replay_commands[i]);
+
+    }
+
+    close(in[1]);
+
+    char duration[16];
+
+    snprintf(duration, sizeof(duration), "%u", end);
+
+    pid_t pid = fork();
+
+    if (pid == 0) {
+
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        close(in[0]);
+        close(out[0]);
+        close(out[1]);
+
+        execl(replay_sim, replay_sim, "-i", "-T", "-s", "0", "-t", duration, "-p", trace, "-f", fram, (char*)NULL);
+
+        perror(replay_sim);
+        _exit(EXIT_FAILURE);
+
+    }
+
+    close(in[0]);
+    close(out[1]);
+
+    // Index of the next pulse of each channel to be matched
+    size_t cursor[REPLAY_CHANNELS] = { 0 };
+
+    memset(results, 0, REPLAY_CHANNELS * sizeof(replay_result_t));
+
+    for (size_t i = 0; i < replay_pulse_count; i++) {
+
+        results[replay_pulses[i].channel].pulses++;
+
+    }
+
+    FILE* output = fdopen(out[0], "r");
+    char line[256];
+
+    while (fgets(line, sizeof(line), output)) {
+
+        unsigned long time;
+        unsigned ch;
+
+        if (sscanf(line, "%lu LOG: S0: channel: %u", &time, &ch) != 2 || ch >= REPLAY_CHANNELS) {
+
+            continue;
+
+        }
+
+        results[ch].detected++;
+
+        // Skip pulses that should have been reported by now
+        while (cursor[ch] < replay_pulse_count && (replay_pulses[cursor[ch]].channel != ch || replay_pulses[cursor[ch]].end + REPLAY_WINDOW < time)) {
+
+            cursor[ch]++;
+
+        }
+
+        if (cursor[ch] < replay_pulse_count && replay_pulses[cursor[ch]].end <= time + 1) {
+
+            cursor[ch]++;
+
+        } else {
+
+            results[ch].false_positives++;
+
+        }
+
+    }
+
+    fclose(output);
+
+    int status;
+
+    waitpid(pid, &status, 0);
+    unlink(fram);
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+
+        replay_fail("simulation failed", replay_sim);
+
+    }
+
+    bool lossless = true;
+
+    for (uint8_t ch = 0; ch < REPLAY_CHANNELS; ch++) {
+
+        unsigned long matched = results[ch].detected - results[ch].false_positives;
+
+        results[ch].missed = results[ch].pulses - matched;
+
+        if (results[ch].missed || results[ch].false_positives) {
+
+            lossless = false;
+
+        }
+
+    }
+
+    return lossless;
+
+}
+
+static void replay_report(const replay_result_t results[REPLAY_CHANNELS])
+{
+
+    replay_result_t total = { 0 };
+
+    printf("| Channel | Pulses | Detected | Missed | False |\n");
+    printf("|---------|--------|----------|--------|-------|\n");
+
+    for (uint8_t ch = 0; ch < REPLAY_CHANNELS; ch++) {
+
+        const replay_result_t* r = &results[ch];
+
+        printf("| %-7u | %6lu | %8lu | %6lu | %5lu |\n", ch, r->pulses, r->detected, r->missed, r->false_positives);
+
+        total.pulses += r->pulses;
+        total.detected += r->detected;
+        total.missed += r->missed;
+        total.false_positives += r->false_positives;
+
+    }
+
+    printf("| %-7s | %6lu | %8lu | %6lu | %5lu |\n", "Total", total.pulses, total.detected, total.missed, total.false_positives);
+
+}
+
+/**
+ * @brief Writes a synthetic trace to a temporary file and replays it
+ */
+static bool replay_gen_run(const replay_gen_t* gen, replay_result_t results[REPLAY_CHANNELS])
+{
+
+    char path[] = "/tmp/replay-XXXXXX";
+    int fd = mkstemp(path);
+    FILE* trace = fd >= 0 ? fdopen(fd, "w") : NULL;
+
+    if (!trace) {
+
+        replay_fail("unable to create trace", path);
+
+    }
+
+    replay_gen_write(gen, trace);
+    fclose(trace);
+
+    bool lossless = replay_run(path, gen->duration, results);
+
+    unlink(path);
+
+    return lossless;
+
+}
+
+/**
+ * @brief Determines the highest rate that is replayed without any loss
+ *
+ * The rate per channel is bisected between zero and the rate at which pulses
+ * would touch each other.
+ */
+static void replay_capacity(replay_gen_t* gen)
+{
+
+    replay_result_t results[REPLAY_CHANNELS];
+    double low = 0;
+    double high = 1000 / (gen->width + REPLAY_GAP);
+
+    for (uint8_t i = 0; i < REPLAY_BISECTIONS; i++) {
+
+        gen->rate = gen->rate_end = (low + high) / 2;
+
+        bool lossless = replay_gen_run(gen, results);
+
+        fprintf(stderr, "replay: %.2f/s per channel %s\n", gen->rate, lossless ? "lossless" : "lossy");
+
+        if (lossless) {
+
+            low = gen->rate;
+
+        } else {
+
+            high = gen->rate;
+
+        }
+
+    }
+
+    printf("capacity %.2f pulses/s (%.2f/s on each of %u channels)\n", low * gen->channels, low, gen->channels);
+
+}
+
+static void replay_usage()
+{
+
+    fprintf(stderr,
+        "Usage: replay gen [OPTIONS]\n"
+        "       replay run [-S SIM] [-x COMMAND]... TRACE\n"
+        "       replay capacity [-S SIM] [-x COMMAND]... [OPTIONS]\n"
+        "\n"
+        "  -c N        number of channels driven (default: %u)\n"
+        "  -r RATE     pulses per second and channel (default: 1)\n"
+        "  -R RATE     rate at the end of the trace, ramped linearly\n"
+        "  -w MS       width of pulses (default: 30)\n"
+        "  -j MS       maximum deviation of width and spacing (default: 0)\n"
+        "  -b MS       time contacts bounce after each edge (default: 0)\n"
+        "  -d S        duration of the trace (default: 60)\n"
+        "  -s SEED     seed of the random numbers (default: 1)\n"
+        "  -S SIM      host simulation (default: %s)\n"
+        "  -x COMMAND  command sent before replaying, e.g. to set min/max\n",
+        REPLAY_CHANNELS, REPLAY_SIM_DEFAULT);
+
+    exit(EXIT_FAILURE);
+
+}
+
+int main(int argc, char* argv[])
+{
+
+    replay_gen_t gen = { REPLAY_CHANNELS, 1, -1, 30, 0, 0, 60000, 1 };
+    int opt;
+
+    if (argc < 2) {
+
+        replay_usage();
+
+    }
+
+    const char* mode = argv[1];
+
+    optind = 2;
+
+    while ((opt = getopt(argc, argv, "c:r:R:w:j:b:d:s:S:x:")) != -1) {
+
+        switch (opt) {
+
+            case 'c':
+                gen.channels = atoi(optarg);
+                break;
+
+            case 'r':
+                gen.rate = atof(optarg);
+                break;
+
+            case 'R':
+                gen.rate_end = atof(optarg);
+                break;
+
+            case 'w':
+                gen.width = atof(optarg);
+                break;
+
+            case 'j':
+                gen.jitter = atof(optarg);
+                break;
+
+            case 'b':
+                gen.bounce = atof(optarg);
+                break;
+
+            case 'd':
+                gen.duration = atof(optarg) * 1000;
+                break;
+
+            case 's':
+                gen.seed = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'S':
+                replay_sim = optarg;
+                break;
+
+            case 'x':
+                if (replay_command_count == REPLAY_COMMANDS_MAX) {
+
+                    replay_fail("too many commands", optarg);
+
+                }
+
+                replay_commands[replay_command_count++] = optarg;
+                break;
+
+            default:
+                replay_usage();
+
+        }
+
+    }
+
+    if (gen.rate_end < 0) {
+
+        gen.rate_end = gen.rate;
+
+    }
+
+    if (gen.channels < 1 || gen.channels > REPLAY_CHANNELS || gen.rate <= 0 || gen.rate_end <= 0 || gen.width <= 0 || gen.duration <= REPLAY_LEAD + REPLAY_TRAIL) {
+
+        replay_usage();
+
+    }
+
+    if (strcmp(mode, "gen") == 0 && optind == argc) {
+
+        replay_gen_write(&gen, stdout);
+
+        return EXIT_SUCCESS;
+
+    }
+
+    if (strcmp(mode, "run") == 0 && optind == argc - 1) {
+
+        replay_result_t results[REPLAY_CHANNELS];
+        uint32_t last = replay_load(argv[optind]);
+        bool lossless = replay_run(argv[optind], last + REPLAY_TRAIL, results);
+
+        replay_report(results);
+
+        return lossless ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    }
+
+    if (strcmp(mode, "capacity") == 0 && optind == argc) {
+
+        replay_capacity(&gen);
+
+        return EXIT_SUCCESS;
+
+    }
+
+    replay_usage();
+
+}
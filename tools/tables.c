@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2017 Karol Babioch <karol@babioch.de>
+ *
+ * This file is part of S0-counter.
+ *
+ * S0-counter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * S0-counter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with S0-counter. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file tables.c
+ * @brief Checks the order of the command tables with every switch enabled
+ *
+ * The command tables of the text protocol are bisected, so they need to be
+ * sorted for every combination of the switches within src/config.h. Switches
+ * only leave out entries, so it is sufficient to check the tables with all of
+ * them enabled. Some of these switches (e.g. `ENABLE_MEMCHECK`) can't be built
+ * for the host, so this is linked against proto.c alone, with any symbol it
+ * refers to left unresolved. None of them are used by proto_check_tables().
+ *
+ * This is expected to be invoked via `make check`.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "proto.h"
+
+int main()
+{
+
+    if (!proto_check_tables()) {
+
+        fprintf(stderr, "command tables: not sorted\n");
+
+        return EXIT_FAILURE;
+
+    }
+
+    printf("command tables: ok\n");
+
+    return EXIT_SUCCESS;
+
+}